@@ -0,0 +1,104 @@
+#include "affinity.h"
+
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "logging.h"
+
+namespace pico {
+
+std::vector<int> parseCpuList(const std::string& str) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) { end = str.size(); }
+        std::string item = str.substr(pos, end - pos);
+        pos = end + 1;
+
+        int first = 0, last = 0;
+        char tail = 0;
+        if (sscanf(item.c_str(), "%d-%d%c", &first, &last, &tail) == 2) {}
+        else if (sscanf(item.c_str(), "%d%c", &first, &tail) == 1) {
+            last = first;
+        }
+        else {
+            continue;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) { continue; }
+        for (int i = first; i <= last; ++i) { cpus.push_back(i); }
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+std::vector<int> getAllowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set)) { return cpus; }
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &set)) { cpus.push_back(i); }
+    }
+    return cpus;
+}
+
+std::vector<int> getNumaNodeCpus(int node) {
+    std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string line;
+    if (node < 0 || !std::getline(ifs, line)) { return std::vector<int>(); }
+    return parseCpuList(line);
+}
+
+bool setThreadAffinity(pid_t tid, const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) { CPU_SET(cpu, &set); }
+    if (sched_setaffinity(tid, sizeof(set), &set)) {
+        LOG_ERROR("sched_setaffinity tid %d error %d", tid, errno);
+        return false;
+    }
+    return true;
+}
+
+ThreadPlacementGuard::ThreadPlacementGuard(const std::vector<int>& cpus, int numa_node) {
+    if (!cpus.empty() && sched_getaffinity(0, sizeof(m_oldCpus), &m_oldCpus) == 0) {
+        m_cpusSet = setThreadAffinity(0, cpus);
+    }
+    if (numa_node < 0) { return; }
+    if (numa_node >= (int)sizeof(m_oldNodes) * 8) {
+        LOG_ERROR("numa node %d out of range", numa_node);
+        return;
+    }
+    memset(m_oldNodes, 0, sizeof(m_oldNodes));
+    if (syscall(SYS_get_mempolicy, &m_oldMode, m_oldNodes, sizeof(m_oldNodes) * 8, nullptr, 0)) {
+        LOG_ERROR("get_mempolicy error %d", errno);
+        return;
+    }
+    unsigned long nodes[sizeof(m_oldNodes) / sizeof(m_oldNodes[0])];
+    memset(nodes, 0, sizeof(nodes));
+    nodes[numa_node / (sizeof(unsigned long) * 8)] |= 1ul << (numa_node % (sizeof(unsigned long) * 8));
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, sizeof(nodes) * 8)) {
+        LOG_ERROR("set_mempolicy node %d error %d", numa_node, errno);
+        return;
+    }
+    m_policySet = true;
+}
+
+ThreadPlacementGuard::~ThreadPlacementGuard() {
+    if (m_policySet) {
+        unsigned long* nodes = m_oldMode == MPOL_DEFAULT ? nullptr : m_oldNodes;
+        syscall(SYS_set_mempolicy, m_oldMode, nodes, sizeof(m_oldNodes) * 8);
+    }
+    if (m_cpusSet) { sched_setaffinity(0, sizeof(m_oldCpus), &m_oldCpus); }
+}
+
+}   // namespace pico
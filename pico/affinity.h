@@ -0,0 +1,62 @@
+#ifndef __PICO_AFFINITY_H__
+#define __PICO_AFFINITY_H__
+
+#include <sched.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace pico {
+
+/**
+ * @brief 解析"0-3,8,10-11"格式的CPU或NUMA节点列表
+ * @return 升序去重后的编号, 格式错误的部分被忽略
+ */
+std::vector<int> parseCpuList(const std::string& str);
+
+/**
+ * @brief 当前线程允许运行的CPU
+ */
+std::vector<int> getAllowedCpus();
+
+/**
+ * @brief NUMA节点上的CPU, 节点不存在时返回空
+ */
+std::vector<int> getNumaNodeCpus(int node);
+
+/**
+ * @brief 设置线程的CPU亲和性
+ * @param[in] tid 线程id, 0表示当前线程
+ */
+bool setThreadAffinity(pid_t tid, const std::vector<int>& cpus);
+
+/**
+ * @brief 在作用域内修改当前线程的CPU亲和性和NUMA内存策略, 析构时恢复
+ * @details 新线程继承创建者的亲和性和内存策略, 作用域内创建的调度线程连同其线程栈,
+ *          以及之后在这些线程上分配的协程栈和缓冲区都优先使用指定节点的内存.
+ *          内存策略为MPOL_PREFERRED, 节点内存不足时仍可以从其他节点分配
+ */
+class ThreadPlacementGuard : Noncopyable
+{
+public:
+    /**
+     * @param[in] cpus 允许运行的CPU, 为空时不修改亲和性
+     * @param[in] numa_node 内存优先分配的节点, 小于0时不修改内存策略
+     */
+    ThreadPlacementGuard(const std::vector<int>& cpus, int numa_node = -1);
+    ~ThreadPlacementGuard();
+
+private:
+    bool m_cpusSet = false;
+    cpu_set_t m_oldCpus;
+    bool m_policySet = false;
+    int m_oldMode = 0;
+    unsigned long m_oldNodes[16];
+};
+
+}   // namespace pico
+
+#endif
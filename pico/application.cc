@@ -267,7 +267,9 @@ void Application::run_in_fiber() {
         IOManager* worker = IOManager::GetThis();
         IOManager* acceptor = IOManager::GetThis();
 
+        WorkerGroup::Ptr worker_group;
         if (!server_conf.worker.empty()) {
+            worker_group = pico::WorkerMgr::getInstance()->getGroup(server_conf.worker);
             worker = pico::WorkerMgr::getInstance()->get(server_conf.worker).get();
             if (!worker) {
                 LOG_ERROR("invalid worker: %s", server_conf.worker.c_str());
@@ -284,6 +286,10 @@ void Application::run_in_fiber() {
 
         if (server_conf.type == "http") {
             HttpServer::Ptr server(new HttpServer(server_conf.keep_alive, worker, acceptor));
+            server->setWorkerGroup(worker_group);
+            server->setReuseportListeners(server_conf.reuseport_listeners);
+            server->setSocketOptions(server_conf.tcp);
+            server->setAdmissionOptions(server_conf.admission);
             if (!server_conf.name.empty()) {
                 server->setName(server_conf.name);
             }
@@ -295,6 +301,7 @@ void Application::run_in_fiber() {
                 exit(-1);
             }
             server->setType(server_conf.type);
+            server->setSharedStack(server_conf.shared_stack);
             if (server_conf.ssl) {
                 if (!server->loadCertificate(server_conf.cert_file, server_conf.key_file)) {
                     LOG_ERROR("load certficate failed");
@@ -328,7 +335,12 @@ void Application::run_in_fiber() {
         }
         else if (server_conf.type == "ws") {
             WsServer::Ptr server(new WsServer(worker, acceptor));
+            server->setWorkerGroup(worker_group);
+            server->setReuseportListeners(server_conf.reuseport_listeners);
+            server->setSocketOptions(server_conf.tcp);
+            server->setAdmissionOptions(server_conf.admission);
             server->setType(server_conf.type);
+            server->setSharedStack(server_conf.shared_stack);
             if (!server_conf.name.empty()) {
                 server->setName(server_conf.name);
             }
@@ -0,0 +1,59 @@
+#include "channel.h"
+
+#include <algorithm>
+
+namespace pico {
+
+void ChannelSelector::lockAll(const std::vector<ChannelBase*>& channels) {
+    for (auto channel : channels) { channel->m_mutex.lock(); }
+}
+
+void ChannelSelector::unlockAll(const std::vector<ChannelBase*>& channels) {
+    for (auto it = channels.rbegin(); it != channels.rend(); ++it) { (*it)->m_mutex.unlock(); }
+}
+
+int ChannelSelector::select(uint64_t timeout_ms) {
+    if (m_cases.empty()) { return -1; }
+    // 按地址顺序加锁, 与同时select相同通道的其他协程不会死锁
+    std::vector<ChannelBase*> channels;
+    channels.reserve(m_cases.size());
+    for (auto& c : m_cases) { channels.push_back(c->channel()); }
+    std::sort(channels.begin(), channels.end());
+    channels.erase(std::unique(channels.begin(), channels.end()), channels.end());
+
+    static thread_local size_t s_round = 0;
+    size_t count = m_cases.size();
+    size_t start = s_round++ % count;
+
+    FiberWaiter::Ptr wakeup;
+    lockAll(channels);
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = (start + i) % count;
+        if (m_cases[index]->tryComplete(wakeup)) {
+            unlockAll(channels);
+            if (wakeup) { wakeup->wake(); }
+            return index;
+        }
+    }
+    if (timeout_ms == 0) {
+        unlockAll(channels);
+        return -1;
+    }
+    // 持有全部通道锁时对端无法完成任何分支, 登记完成后才可能被唤醒
+    FiberWaiter::Ptr waiter = std::make_shared<FiberWaiter>(timeout_ms);
+    for (auto& c : m_cases) { c->enqueue(waiter); }
+    unlockAll(channels);
+
+    waiter->park();
+
+    int fired = -1;
+    lockAll(channels);
+    for (size_t i = 0; i < count; ++i) {
+        if (m_cases[i]->dequeue()) { fired = i; }
+    }
+    unlockAll(channels);
+    if (fired >= 0) { m_cases[fired]->finish(); }
+    return fired;
+}
+
+}   // namespace pico
@@ -0,0 +1,418 @@
+#ifndef __PICO_CHANNEL_H__
+#define __PICO_CHANNEL_H__
+
+#include <deque>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace pico {
+
+class ChannelSelector;
+
+/**
+ * @brief 通道基类, 供ChannelSelector按地址顺序对多个通道加锁
+ */
+class ChannelBase : Noncopyable
+{
+    friend class ChannelSelector;
+
+public:
+    virtual ~ChannelBase() {}
+
+protected:
+    Spinlock m_mutex;
+};
+
+/**
+ * @brief select中的一个分支, 除finish外都在持有所属通道锁时调用
+ */
+class ChannelCase : Noncopyable
+{
+public:
+    virtual ~ChannelCase() {}
+
+    virtual ChannelBase* channel() = 0;
+
+    /**
+     * @brief 能立即完成时完成操作
+     * @param[out] wakeup 被交接的对端, 释放锁之后由调用方wake
+     */
+    virtual bool tryComplete(FiberWaiter::Ptr& wakeup) = 0;
+
+    /**
+     * @brief 以waiter登记到通道的等待队列
+     */
+    virtual void enqueue(const FiberWaiter::Ptr& waiter) = 0;
+
+    /**
+     * @brief 从等待队列摘除
+     * @return 该分支是否被对端完成
+     */
+    virtual bool dequeue() = 0;
+
+    /**
+     * @brief 被对端完成后在当前协程中收尾, 不持有锁
+     */
+    virtual void finish() = 0;
+};
+
+/**
+ * @brief 协程间传递数据的通道
+ * @details 容量为0时发送方与接收方直接交接; 容量为kUnbounded时发送永不阻塞.
+ *          阻塞的发送方与接收方只挂起当前协程(见FiberWaiter), 对端完成交接后通过Scheduler唤醒.
+ *          超时或通道关闭时待发送的值被丢弃. T需要可默认构造和移动赋值
+ */
+template<class T>
+class Channel : public ChannelBase
+{
+    friend class ChannelSelector;
+
+public:
+    typedef std::shared_ptr<Channel> Ptr;
+    static const size_t kUnbounded = (size_t)-1;
+
+    explicit Channel(size_t capacity = 0)
+        : m_capacity(capacity) {}
+
+    /**
+     * @brief 发送, 缓冲区满且没有接收方时挂起
+     * @return 通道已关闭返回false
+     */
+    bool send(T value) { return sendFor(std::move(value), ~0ull); }
+
+    /**
+     * @return 发送成功返回true, 超时或通道已关闭返回false
+     */
+    bool sendFor(T value, uint64_t timeout_ms) {
+        FiberWaiter::Ptr wakeup;
+        bool ok = false;
+        std::shared_ptr<Waiting> waiting;
+        {
+            Spinlock::Lock lock(m_mutex);
+            if (!sendLocked(value, ok, wakeup)) {
+                if (timeout_ms == 0) { return false; }
+                waiting = enqueue(m_sendq, std::make_shared<FiberWaiter>(timeout_ms));
+                waiting->value = std::move(value);
+            }
+        }
+        if (!waiting) {
+            if (wakeup) { wakeup->wake(); }
+            return ok;
+        }
+        return waitFor(m_sendq, waiting);
+    }
+
+    bool trySend(T value) { return sendFor(std::move(value), 0); }
+
+    /**
+     * @brief 接收, 通道为空时挂起
+     * @return 通道已关闭且缓冲区为空时返回false
+     */
+    bool recv(T& value) { return recvFor(value, ~0ull); }
+
+    /**
+     * @return 收到数据返回true, 超时或通道已关闭且缓冲区为空时返回false
+     */
+    bool recvFor(T& value, uint64_t timeout_ms) {
+        FiberWaiter::Ptr wakeup;
+        bool ok = false;
+        std::shared_ptr<Waiting> waiting;
+        {
+            Spinlock::Lock lock(m_mutex);
+            if (!recvLocked(value, ok, wakeup)) {
+                if (timeout_ms == 0) { return false; }
+                waiting = enqueue(m_recvq, std::make_shared<FiberWaiter>(timeout_ms));
+            }
+        }
+        if (!waiting) {
+            if (wakeup) { wakeup->wake(); }
+            return ok;
+        }
+        if (!waitFor(m_recvq, waiting)) { return false; }
+        value = std::move(waiting->value);
+        return true;
+    }
+
+    bool tryRecv(T& value) { return recvFor(value, 0); }
+
+    /**
+     * @brief 关闭通道, 唤醒所有阻塞的发送方和接收方, 缓冲区中的数据仍可以接收
+     */
+    void close() {
+        std::vector<FiberWaiter::Ptr> wakeups;
+        {
+            Spinlock::Lock lock(m_mutex);
+            if (m_closed) { return; }
+            m_closed = true;
+            while (std::shared_ptr<Waiting> waiting = popWaiting(m_recvq)) {
+                wakeups.push_back(waiting->waiter);
+            }
+            while (std::shared_ptr<Waiting> waiting = popWaiting(m_sendq)) {
+                wakeups.push_back(waiting->waiter);
+            }
+        }
+        for (auto& waiter : wakeups) { waiter->wake(); }
+    }
+
+    bool isClosed() {
+        Spinlock::Lock lock(m_mutex);
+        return m_closed;
+    }
+
+    size_t size() {
+        Spinlock::Lock lock(m_mutex);
+        return m_buffer.size();
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+private:
+    /**
+     * @brief 等待队列中的发送方或接收方
+     */
+    struct Waiting
+    {
+        FiberWaiter::Ptr waiter;
+        /// 发送方待发送的值, 或交给接收方的值
+        T value;
+        /// 被对端完成时为true, 因通道关闭被唤醒时为false
+        bool ok = false;
+        bool fired = false;
+        bool linked = false;
+        typename std::list<std::shared_ptr<Waiting>>::iterator it;
+    };
+    typedef std::list<std::shared_ptr<Waiting>> WaitQueue;
+
+    class RecvCase : public ChannelCase
+    {
+    public:
+        RecvCase(Channel& channel, T& value, bool* ok)
+            : m_channel(channel)
+            , m_value(value)
+            , m_ok(ok) {}
+
+        ChannelBase* channel() override { return &m_channel; }
+
+        bool tryComplete(FiberWaiter::Ptr& wakeup) override {
+            bool ok = false;
+            if (!m_channel.recvLocked(m_value, ok, wakeup)) { return false; }
+            if (m_ok) { *m_ok = ok; }
+            return true;
+        }
+
+        void enqueue(const FiberWaiter::Ptr& waiter) override {
+            m_waiting = m_channel.enqueue(m_channel.m_recvq, waiter);
+        }
+
+        bool dequeue() override { return m_channel.dequeue(m_channel.m_recvq, m_waiting); }
+
+        void finish() override {
+            if (m_waiting->ok) { m_value = std::move(m_waiting->value); }
+            if (m_ok) { *m_ok = m_waiting->ok; }
+        }
+
+    private:
+        Channel& m_channel;
+        T& m_value;
+        bool* m_ok;
+        std::shared_ptr<Waiting> m_waiting;
+    };
+
+    class SendCase : public ChannelCase
+    {
+    public:
+        SendCase(Channel& channel, T&& value, bool* ok)
+            : m_channel(channel)
+            , m_value(std::move(value))
+            , m_ok(ok) {}
+
+        ChannelBase* channel() override { return &m_channel; }
+
+        bool tryComplete(FiberWaiter::Ptr& wakeup) override {
+            bool ok = false;
+            if (!m_channel.sendLocked(m_value, ok, wakeup)) { return false; }
+            if (m_ok) { *m_ok = ok; }
+            return true;
+        }
+
+        void enqueue(const FiberWaiter::Ptr& waiter) override {
+            m_waiting = m_channel.enqueue(m_channel.m_sendq, waiter);
+            m_waiting->value = std::move(m_value);
+        }
+
+        bool dequeue() override {
+            if (m_channel.dequeue(m_channel.m_sendq, m_waiting)) { return true; }
+            // 没有发送出去, 收回待发送的值以便再次select
+            m_value = std::move(m_waiting->value);
+            return false;
+        }
+
+        void finish() override {
+            if (m_ok) { *m_ok = m_waiting->ok; }
+        }
+
+    private:
+        Channel& m_channel;
+        T m_value;
+        bool* m_ok;
+        std::shared_ptr<Waiting> m_waiting;
+    };
+
+    /**
+     * @brief 持有m_mutex时尝试发送
+     * @return 能立即完成(包括通道已关闭)时返回true, ok表示是否发送成功
+     */
+    bool sendLocked(T& value, bool& ok, FiberWaiter::Ptr& wakeup) {
+        ok = false;
+        if (m_closed) { return true; }
+        if (std::shared_ptr<Waiting> receiver = popWaiting(m_recvq)) {
+            receiver->value = std::move(value);
+            receiver->ok = true;
+            wakeup = receiver->waiter;
+            ok = true;
+            return true;
+        }
+        if (m_buffer.size() < m_capacity) {
+            m_buffer.push_back(std::move(value));
+            ok = true;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 持有m_mutex时尝试接收
+     * @return 能立即完成(包括通道已关闭且为空)时返回true, ok表示是否收到数据
+     */
+    bool recvLocked(T& value, bool& ok, FiberWaiter::Ptr& wakeup) {
+        ok = false;
+        if (!m_buffer.empty()) {
+            value = std::move(m_buffer.front());
+            m_buffer.pop_front();
+            // 缓冲区腾出位置, 阻塞最久的发送方写入队尾
+            if (std::shared_ptr<Waiting> sender = popWaiting(m_sendq)) {
+                m_buffer.push_back(std::move(sender->value));
+                sender->ok = true;
+                wakeup = sender->waiter;
+            }
+            ok = true;
+            return true;
+        }
+        if (std::shared_ptr<Waiting> sender = popWaiting(m_sendq)) {
+            value = std::move(sender->value);
+            sender->ok = true;
+            wakeup = sender->waiter;
+            ok = true;
+            return true;
+        }
+        return m_closed;
+    }
+
+    /**
+     * @brief 持有m_mutex时取出第一个还能被唤醒的等待者, 已超时或已由其他分支完成的直接丢弃
+     */
+    std::shared_ptr<Waiting> popWaiting(WaitQueue& queue) {
+        while (!queue.empty()) {
+            std::shared_ptr<Waiting> waiting = queue.front();
+            queue.pop_front();
+            waiting->linked = false;
+            if (waiting->waiter->notify()) {
+                waiting->fired = true;
+                return waiting;
+            }
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<Waiting> enqueue(WaitQueue& queue, const FiberWaiter::Ptr& waiter) {
+        std::shared_ptr<Waiting> waiting = std::make_shared<Waiting>();
+        waiting->waiter = waiter;
+        waiting->it = queue.insert(queue.end(), waiting);
+        waiting->linked = true;
+        return waiting;
+    }
+
+    /**
+     * @brief 持有m_mutex时摘除等待者
+     * @return 是否被对端完成
+     */
+    bool dequeue(WaitQueue& queue, const std::shared_ptr<Waiting>& waiting) {
+        if (waiting->linked) {
+            queue.erase(waiting->it);
+            waiting->linked = false;
+        }
+        return waiting->fired;
+    }
+
+    /**
+     * @brief 挂起直到对端完成交接, 通道关闭或超时
+     */
+    bool waitFor(WaitQueue& queue, const std::shared_ptr<Waiting>& waiting) {
+        if (waiting->waiter->park()) { return waiting->ok; }
+        Spinlock::Lock lock(m_mutex);
+        dequeue(queue, waiting);
+        return false;
+    }
+
+private:
+    size_t m_capacity;
+    std::deque<T> m_buffer;
+    WaitQueue m_sendq;
+    WaitQueue m_recvq;
+    bool m_closed = false;
+};
+
+/**
+ * @brief 同时等待多个通道上的发送或接收, 类似go的select
+ * @details 多个分支同时就绪时从轮转的起点开始选择, 避免总是选中靠前的分支
+ */
+class ChannelSelector : Noncopyable
+{
+public:
+    /**
+     * @brief 添加接收分支
+     * @param[out] value 分支被选中且收到数据时写入
+     * @param[out] ok 不为空时写入是否收到数据, 通道已关闭时为false
+     * @return 分支序号
+     */
+    template<class T>
+    int recv(Channel<T>& channel, T& value, bool* ok = nullptr) {
+        m_cases.emplace_back(new typename Channel<T>::RecvCase(channel, value, ok));
+        return m_cases.size() - 1;
+    }
+
+    /**
+     * @brief 添加发送分支
+     * @param[out] ok 不为空时写入是否发送成功, 通道已关闭时为false
+     * @return 分支序号
+     */
+    template<class T>
+    int send(Channel<T>& channel, T value, bool* ok = nullptr) {
+        m_cases.emplace_back(new typename Channel<T>::SendCase(channel, std::move(value), ok));
+        return m_cases.size() - 1;
+    }
+
+    /**
+     * @brief 等待任意一个分支完成
+     * @param[in] timeout_ms 超时时间(毫秒), ~0ull表示一直等待, 0表示不等待
+     * @return 完成的分支序号, 超时或没有分支时返回-1
+     */
+    int select(uint64_t timeout_ms = ~0ull);
+
+    int trySelect() { return select(0); }
+
+private:
+    void lockAll(const std::vector<ChannelBase*>& channels);
+    void unlockAll(const std::vector<ChannelBase*>& channels);
+
+private:
+    std::vector<std::unique_ptr<ChannelCase>> m_cases;
+};
+
+}   // namespace pico
+
+#endif
@@ -0,0 +1,585 @@
+#include "dns.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "config.h"
+#include "hook.h"
+#include "logging.h"
+#include "util.h"
+
+namespace pico {
+
+static ConfigVar<std::vector<std::string>>::Ptr g_dns_nameservers = Config::Lookup(
+    "dns.nameservers", std::vector<std::string>(),
+    "dns nameservers as ip, ip:port or [ipv6]:port, empty for /etc/resolv.conf");
+
+static ConfigVar<std::vector<std::string>>::Ptr g_dns_search = Config::Lookup(
+    "dns.search", std::vector<std::string>(), "dns search domains, empty for /etc/resolv.conf");
+
+static ConfigVar<int32_t>::Ptr g_dns_ndots = Config::Lookup<int32_t>(
+    "dns.ndots", -1, "dots a name needs to be tried as absolute first, negative for /etc/resolv.conf");
+
+static ConfigVar<uint32_t>::Ptr g_dns_timeout =
+    Config::Lookup<uint32_t>("dns.timeout", 2000, "dns query timeout per attempt in ms");
+
+static ConfigVar<uint32_t>::Ptr g_dns_attempts =
+    Config::Lookup<uint32_t>("dns.attempts", 2, "dns query rounds over all nameservers");
+
+static ConfigVar<uint32_t>::Ptr g_dns_max_ttl =
+    Config::Lookup<uint32_t>("dns.max_ttl", 3600, "dns cache max ttl in seconds");
+
+static ConfigVar<uint32_t>::Ptr g_dns_negative_ttl =
+    Config::Lookup<uint32_t>("dns.negative_ttl", 30, "dns negative cache max ttl in seconds");
+
+static ConfigVar<uint32_t>::Ptr g_dns_cache_size =
+    Config::Lookup<uint32_t>("dns.cache_size", 10000, "dns cache max entries");
+
+static const uint16_t kTypeA = 1;
+static const uint16_t kTypeSOA = 6;
+static const uint16_t kTypeAAAA = 28;
+static const uint16_t kTypeOPT = 41;
+static const uint8_t kRcodeNoError = 0;
+static const uint8_t kRcodeNXDomain = 3;
+/// EDNS0通告的UDP应答大小, 避免截断
+static const uint16_t kUdpPayloadSize = 1232;
+
+static void PutUint16(std::string& out, uint16_t v) {
+    out.push_back((char)(v >> 8));
+    out.push_back((char)(v & 0xff));
+}
+
+static uint16_t GetUint16(const uint8_t* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t GetUint32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static bool BuildQuery(const std::string& name, uint16_t id, uint16_t qtype, std::string& out) {
+    PutUint16(out, id);
+    // RD
+    PutUint16(out, 0x0100);
+    PutUint16(out, 1);
+    PutUint16(out, 0);
+    PutUint16(out, 0);
+    PutUint16(out, 1);
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) { dot = name.size(); }
+        size_t len = dot - start;
+        if (len == 0 || len > 63) { return false; }
+        out.push_back((char)len);
+        out.append(name, start, len);
+        start = dot + 1;
+    }
+    out.push_back('\0');
+    PutUint16(out, qtype);
+    PutUint16(out, 1);
+    // OPT: 根域名, 类型, UDP大小, 扩展RCODE与标志, 数据长度
+    out.push_back('\0');
+    PutUint16(out, kTypeOPT);
+    PutUint16(out, kUdpPayloadSize);
+    PutUint16(out, 0);
+    PutUint16(out, 0);
+    PutUint16(out, 0);
+    return true;
+}
+
+static bool SkipName(const uint8_t* msg, size_t len, size_t& pos) {
+    while (pos < len) {
+        uint8_t c = msg[pos];
+        if (c == 0) {
+            ++pos;
+            return true;
+        }
+        if ((c & 0xc0) == 0xc0) {
+            pos += 2;
+            return pos <= len;
+        }
+        if (c & 0xc0) { return false; }
+        pos += 1 + c;
+    }
+    return false;
+}
+
+struct DnsReply
+{
+    uint8_t rcode = 0;
+    bool truncated = false;
+    std::vector<IPAddress::Ptr> addrs;
+    /// 应答中记录的最小TTL, 包括CNAME
+    uint32_t ttl = ~0u;
+    /// 授权段中SOA的否定缓存时间
+    uint32_t soa_ttl = ~0u;
+};
+
+static bool ParseReply(const uint8_t* msg, size_t len, uint16_t id, uint16_t qtype,
+                       DnsReply& reply) {
+    if (len < 12 || GetUint16(msg) != id || !(msg[2] & 0x80)) { return false; }
+    reply.truncated = msg[2] & 0x02;
+    reply.rcode = msg[3] & 0x0f;
+    uint16_t qdcount = GetUint16(msg + 4);
+    uint16_t ancount = GetUint16(msg + 6);
+    uint16_t nscount = GetUint16(msg + 8);
+    size_t pos = 12;
+    for (uint16_t i = 0; i < qdcount; ++i) {
+        if (!SkipName(msg, len, pos) || pos + 4 > len) { return false; }
+        pos += 4;
+    }
+    for (uint32_t i = 0; i < (uint32_t)ancount + nscount; ++i) {
+        if (!SkipName(msg, len, pos) || pos + 10 > len) { return false; }
+        uint16_t type = GetUint16(msg + pos);
+        uint32_t ttl = GetUint32(msg + pos + 4);
+        uint16_t rdlen = GetUint16(msg + pos + 8);
+        pos += 10;
+        if (pos + rdlen > len) { return false; }
+        const uint8_t* rdata = msg + pos;
+        pos += rdlen;
+        if (i >= ancount) {
+            if (type == kTypeSOA) {
+                // SOA的MINIMUM字段在rdata末尾, 否定缓存取其与记录TTL的较小值
+                uint32_t minimum = rdlen >= 4 ? GetUint32(rdata + rdlen - 4) : 0;
+                reply.soa_ttl = std::min(ttl, minimum);
+            }
+            continue;
+        }
+        if (type != qtype) {
+            // CNAME等中间记录, 链上任一记录过期都需要重新查询
+            reply.ttl = std::min(reply.ttl, ttl);
+            continue;
+        }
+        IPAddress::Ptr addr;
+        if (type == kTypeA && rdlen == 4) {
+            sockaddr_in sin;
+            memset(&sin, 0, sizeof(sin));
+            sin.sin_family = AF_INET;
+            memcpy(&sin.sin_addr, rdata, 4);
+            addr.reset(new IPv4Address(sin));
+        }
+        else if (type == kTypeAAAA && rdlen == 16) {
+            sockaddr_in6 sin6;
+            memset(&sin6, 0, sizeof(sin6));
+            sin6.sin6_family = AF_INET6;
+            memcpy(&sin6.sin6_addr, rdata, 16);
+            addr.reset(new IPv6Address(sin6));
+        }
+        if (addr) {
+            reply.addrs.push_back(addr);
+            reply.ttl = std::min(reply.ttl, ttl);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 向一个nameserver发送查询并等待应答
+ * @details socket与收发都经过hook, 在协程中等待时只挂起当前协程
+ */
+static bool Exchange(const IPAddress::Ptr& server, const std::string& query, uint16_t id,
+                     uint16_t qtype, DnsReply& reply) {
+    int fd = socket(server->getFamily(), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { return false; }
+    uint32_t timeout = g_dns_timeout->getValue();
+    timeval tv;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = timeout % 1000 * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    bool ok = false;
+    // 已连接的UDP套接字只接收该nameserver的应答, 端口不可达时立即返回错误
+    if (connect(fd, server->getAddr(), server->getAddrLen()) == 0 &&
+        send(fd, query.data(), query.size(), 0) == (ssize_t)query.size()) {
+        uint8_t buf[kUdpPayloadSize];
+        uint64_t deadline = getCurrentTime() + timeout;
+        while (!ok) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n < 0) { break; }
+            // 忽略id不符的迟到应答
+            ok = ParseReply(buf, n, id, qtype, reply);
+            if (!ok && getCurrentTime() >= deadline) { break; }
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+static uint16_t NextQueryId() {
+    static thread_local std::mt19937 s_rng(std::random_device{}());
+    return (uint16_t)s_rng();
+}
+
+static std::string NormalizeName(const std::string& host) {
+    std::string name = host;
+    if (!name.empty() && name.back() == '.') { name.pop_back(); }
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    return name;
+}
+
+static IPAddress::Ptr ParseNumeric(const std::string& host) {
+    sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    if (inet_pton(AF_INET, host.c_str(), &sin.sin_addr) == 1) {
+        sin.sin_family = AF_INET;
+        return IPAddress::Ptr(new IPv4Address(sin));
+    }
+    sockaddr_in6 sin6;
+    memset(&sin6, 0, sizeof(sin6));
+    if (inet_pton(AF_INET6, host.c_str(), &sin6.sin6_addr) == 1) {
+        sin6.sin6_family = AF_INET6;
+        return IPAddress::Ptr(new IPv6Address(sin6));
+    }
+    return nullptr;
+}
+
+/**
+ * @brief 解析nameserver, 格式为"ip", "ip:port"或"[ipv6]:port", 默认端口53
+ */
+static IPAddress::Ptr ParseServer(const std::string& server) {
+    std::string host = server;
+    std::string port;
+    if (!host.empty() && host[0] == '[') {
+        size_t end = host.find(']');
+        if (end == std::string::npos) { return nullptr; }
+        if (end + 1 < host.size()) {
+            if (host[end + 1] != ':') { return nullptr; }
+            port = host.substr(end + 2);
+        }
+        host = host.substr(1, end - 1);
+    }
+    else if (std::count(host.begin(), host.end(), ':') == 1) {
+        size_t colon = host.find(':');
+        port = host.substr(colon + 1);
+        host.resize(colon);
+    }
+    IPAddress::Ptr addr = ParseNumeric(host);
+    if (!addr) { return nullptr; }
+    unsigned long value = 53;
+    if (!port.empty()) {
+        char* end = nullptr;
+        value = strtoul(port.c_str(), &end, 10);
+        if (*end != '\0' || value == 0 || value > 0xffff) { return nullptr; }
+    }
+    addr->setPort(value);
+    return addr;
+}
+
+/**
+ * @brief 缓存中的地址是共享的, 返回给调用方的需要拷贝, 调用方会修改端口
+ */
+static void AppendCopies(const std::vector<IPAddress::Ptr>& from, int family,
+                         std::vector<IPAddress::Ptr>& to) {
+    for (auto& addr : from) {
+        if (family != AF_UNSPEC && addr->getFamily() != family) { continue; }
+        to.push_back(std::dynamic_pointer_cast<IPAddress>(
+            Address::Create(addr->getAddr(), addr->getAddrLen())));
+    }
+}
+
+DnsResolver::DnsResolver() {
+    loadResolvConf();
+    loadHosts();
+    loadNsswitch();
+}
+
+void DnsResolver::loadResolvConf() {
+    std::ifstream ifs("/etc/resolv.conf");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::istringstream iss(line);
+        std::string key, value;
+        if (!(iss >> key >> value)) { continue; }
+        if (key == "nameserver") { m_systemServers.push_back(value); }
+        else if (key == "search" || key == "domain") {
+            // 与libc相同, search和domain以最后出现的为准, domain只有一个域
+            m_systemSearch.clear();
+            do {
+                m_systemSearch.push_back(NormalizeName(value));
+            } while (key == "search" && iss >> value);
+        }
+        else if (key == "options") {
+            do {
+                if (value.compare(0, 6, "ndots:") == 0) {
+                    m_systemNdots = std::min(atoi(value.c_str() + 6), 15);
+                }
+            } while (iss >> value);
+        }
+    }
+    if (m_systemServers.empty()) { m_systemServers.push_back("127.0.0.1"); }
+}
+
+void DnsResolver::loadNsswitch() {
+    std::ifstream ifs("/etc/nsswitch.conf");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) { line.resize(comment); }
+        std::istringstream iss(line);
+        std::string key, source;
+        if (!(iss >> key) || key != "hosts:") { continue; }
+        while (iss >> source) {
+            // 跳过[NOTFOUND=return]等动作
+            if (source.find_first_of("[]=") != std::string::npos) { continue; }
+            if (source != "files" && source != "dns") { m_nssOther = true; }
+        }
+    }
+}
+
+std::vector<std::string> DnsResolver::searchNames(const std::string& name, bool absolute) const {
+    std::vector<std::string> names;
+    if (absolute) {
+        names.push_back(name);
+        return names;
+    }
+    std::vector<std::string> search = g_dns_search->getValue();
+    if (search.empty()) { search = m_systemSearch; }
+    int ndots = g_dns_ndots->getValue();
+    if (ndots < 0) { ndots = m_systemNdots; }
+    // 点数不少于ndots时先按绝对域名查询, 否则最后才查询
+    int dots = std::count(name.begin(), name.end(), '.');
+    if (dots >= ndots) { names.push_back(name); }
+    for (auto& domain : search) {
+        std::string suffix = NormalizeName(domain);
+        if (!suffix.empty()) { names.push_back(name + "." + suffix); }
+    }
+    if (dots < ndots) { names.push_back(name); }
+    return names;
+}
+
+void DnsResolver::loadHosts() {
+    std::ifstream ifs("/etc/hosts");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) { line.resize(comment); }
+        std::istringstream iss(line);
+        std::string ip, name;
+        if (!(iss >> ip)) { continue; }
+        IPAddress::Ptr addr = ParseNumeric(ip);
+        if (!addr) { continue; }
+        while (iss >> name) { m_hosts[NormalizeName(name)].push_back(addr); }
+    }
+}
+
+void DnsResolver::clear() {
+    RWMutex::WriteLock lock(m_mutex);
+    m_cache.clear();
+}
+
+int DnsResolver::resolve(const std::string& host, int family, std::vector<IPAddress::Ptr>& addrs) {
+    if (family != AF_UNSPEC && family != AF_INET && family != AF_INET6) { return EAI_FAMILY; }
+    bool absolute = !host.empty() && host.back() == '.';
+    std::string name = NormalizeName(host);
+    if (name.empty()) { return EAI_NONAME; }
+
+    IPAddress::Ptr numeric = ParseNumeric(name);
+    if (numeric) {
+        if (family != AF_UNSPEC && numeric->getFamily() != family) { return EAI_ADDRFAMILY; }
+        addrs.push_back(numeric);
+        return 0;
+    }
+
+    auto it = m_hosts.find(name);
+    if (it != m_hosts.end()) {
+        size_t count = addrs.size();
+        AppendCopies(it->second, family, addrs);
+        if (addrs.size() > count) { return 0; }
+    }
+
+    // 依次查询search生成的名称, 第一个有地址的为准
+    int rt = EAI_NONAME;
+    for (auto& candidate : searchNames(name, absolute)) {
+        int rt4 = EAI_NONAME;
+        int rt6 = EAI_NONAME;
+        if (family != AF_INET6) { rt4 = lookup(candidate, kTypeA, addrs); }
+        if (family != AF_INET) { rt6 = lookup(candidate, kTypeAAAA, addrs); }
+        if (rt4 == 0 || rt6 == 0) { return 0; }
+        // 临时失败优先于不存在, 调用方可以重试
+        if (rt4 == EAI_AGAIN || rt6 == EAI_AGAIN) { rt = EAI_AGAIN; }
+    }
+    return rt;
+}
+
+int DnsResolver::lookup(const std::string& name, uint16_t qtype,
+                        std::vector<IPAddress::Ptr>& addrs) {
+    std::string key = name + (qtype == kTypeA ? "|A" : "|AAAA");
+    uint64_t now = getCurrentTime();
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        auto it = m_cache.find(key);
+        if (it != m_cache.end() && it->second.expire > now) {
+            AppendCopies(it->second.addrs, AF_UNSPEC, addrs);
+            return it->second.error;
+        }
+    }
+
+    std::shared_ptr<Inflight> inflight;
+    bool owner = false;
+    {
+        RWMutex::WriteLock lock(m_mutex);
+        auto it = m_inflight.find(key);
+        if (it != m_inflight.end()) { inflight = it->second; }
+        else {
+            inflight = std::make_shared<Inflight>();
+            m_inflight[key] = inflight;
+            owner = true;
+        }
+    }
+    if (!owner) {
+        FiberMutex::Lock lock(inflight->mutex);
+        while (!inflight->done) { inflight->cond.wait(lock); }
+        AppendCopies(inflight->addrs, AF_UNSPEC, addrs);
+        return inflight->error;
+    }
+
+    CacheEntry entry;
+    uint32_t ttl = 0;
+    int rt = query(name, qtype, entry, ttl);
+    AppendCopies(entry.addrs, AF_UNSPEC, addrs);
+    {
+        RWMutex::WriteLock lock(m_mutex);
+        m_inflight.erase(key);
+        if (rt != EAI_AGAIN && ttl > 0) {
+            if (m_cache.size() >= g_dns_cache_size->getValue()) {
+                for (auto it = m_cache.begin(); it != m_cache.end();) {
+                    if (it->second.expire <= now) { it = m_cache.erase(it); }
+                    else { ++it; }
+                }
+                if (m_cache.size() >= g_dns_cache_size->getValue() && !m_cache.empty()) {
+                    m_cache.erase(m_cache.begin());
+                }
+            }
+            entry.expire = getCurrentTime() + (uint64_t)ttl * 1000;
+            m_cache[key] = entry;
+        }
+    }
+    FiberMutex::Lock lock(inflight->mutex);
+    inflight->done = true;
+    inflight->error = rt;
+    inflight->addrs.swap(entry.addrs);
+    inflight->cond.notifyAll();
+    return rt;
+}
+
+int DnsResolver::query(const std::string& name, uint16_t qtype, CacheEntry& entry,
+                       uint32_t& ttl) {
+    std::vector<std::string> servers = g_dns_nameservers->getValue();
+    if (servers.empty()) { servers = m_systemServers; }
+    uint32_t attempts = std::max(g_dns_attempts->getValue(), 1u);
+
+    for (uint32_t attempt = 0; attempt < attempts; ++attempt) {
+        for (auto& server : servers) {
+            IPAddress::Ptr addr = ParseServer(server);
+            if (!addr) {
+                LOG_ERROR("invalid dns nameserver %s", server.c_str());
+                continue;
+            }
+            uint16_t id = NextQueryId();
+            std::string packet;
+            if (!BuildQuery(name, id, qtype, packet)) { return EAI_NONAME; }
+            DnsReply reply;
+            if (!Exchange(addr, packet, id, qtype, reply)) { continue; }
+
+            if (reply.rcode == kRcodeNoError && !reply.addrs.empty()) {
+                entry.addrs.swap(reply.addrs);
+                ttl = std::min(reply.ttl, g_dns_max_ttl->getValue());
+                return 0;
+            }
+            // 截断的应答没有可用记录时换下一个nameserver
+            if (reply.truncated) { continue; }
+            if (reply.rcode == kRcodeNoError || reply.rcode == kRcodeNXDomain) {
+                entry.error = EAI_NONAME;
+                ttl = std::min(reply.soa_ttl, g_dns_negative_ttl->getValue());
+                return EAI_NONAME;
+            }
+            // SERVFAIL, REFUSED等换下一个nameserver
+        }
+    }
+    LOG_WARN("dns query %s type %u failed", name.c_str(), qtype);
+    return EAI_AGAIN;
+}
+
+int DnsResolver::getaddrinfo(const char* node, const char* service, const struct addrinfo* hints,
+                             struct addrinfo** res) {
+    int flags = hints ? hints->ai_flags : 0;
+    int family = hints ? hints->ai_family : AF_UNSPEC;
+    int socktype = hints ? hints->ai_socktype : 0;
+    int protocol = hints ? hints->ai_protocol : 0;
+    if (!node || (flags & (AI_CANONNAME | AI_NUMERICHOST | AI_V4MAPPED | AI_ALL)) ||
+        (family != AF_UNSPEC && family != AF_INET && family != AF_INET6) ||
+        (socktype == 0 && protocol != 0)) {
+        return getaddrinfo_f(node, service, hints, res);
+    }
+
+    uint16_t port = 0;
+    if (service && *service) {
+        char* end = nullptr;
+        unsigned long value = strtoul(service, &end, 10);
+        if (*end == '\0' && value <= 0xffff) { port = value; }
+        else if (flags & AI_NUMERICSERV) { return EAI_NONAME; }
+        else {
+            // 服务名只查本地的services数据库, 不会发出DNS查询
+            addrinfo service_hints;
+            memset(&service_hints, 0, sizeof(service_hints));
+            service_hints.ai_family = AF_INET;
+            service_hints.ai_socktype = socktype;
+            addrinfo* service_res = nullptr;
+            int rt = getaddrinfo_f(nullptr, service, &service_hints, &service_res);
+            if (rt != 0) { return rt; }
+            port = ntohs(((sockaddr_in*)service_res->ai_addr)->sin_port);
+            freeaddrinfo(service_res);
+        }
+    }
+
+    std::vector<IPAddress::Ptr> addrs;
+    int rt = resolve(node, family, addrs);
+    if (rt == EAI_NONAME && m_nssOther) {
+        // nsswitch中的其他来源(如myhostname, mdns)可能认识该名称, 交给libc
+        return getaddrinfo_f(node, service, hints, res);
+    }
+    if (rt != 0) { return rt; }
+
+    std::vector<std::pair<int, int>> types;
+    if (socktype) { types.push_back(std::make_pair(socktype, protocol)); }
+    else {
+        types.push_back(std::make_pair(SOCK_STREAM, IPPROTO_TCP));
+        types.push_back(std::make_pair(SOCK_DGRAM, IPPROTO_UDP));
+        if (!service) { types.push_back(std::make_pair(SOCK_RAW, 0)); }
+    }
+
+    addrinfo* head = nullptr;
+    addrinfo** tail = &head;
+    for (auto& addr : addrs) {
+        for (auto& type : types) {
+            // 与glibc相同, 地址与addrinfo在同一块内存中, freeaddrinfo逐个free即可释放
+            addrinfo* ai = (addrinfo*)calloc(1, sizeof(addrinfo) + sizeof(sockaddr_in6));
+            if (!ai) {
+                freeaddrinfo(head);
+                return EAI_MEMORY;
+            }
+            ai->ai_flags = flags;
+            ai->ai_family = addr->getFamily();
+            ai->ai_socktype = type.first;
+            ai->ai_protocol = type.second;
+            ai->ai_addrlen = addr->getAddrLen();
+            ai->ai_addr = (sockaddr*)(ai + 1);
+            memcpy(ai->ai_addr, addr->getAddr(), ai->ai_addrlen);
+            if (ai->ai_family == AF_INET) { ((sockaddr_in*)ai->ai_addr)->sin_port = htons(port); }
+            else { ((sockaddr_in6*)ai->ai_addr)->sin6_port = htons(port); }
+            *tail = ai;
+            tail = &ai->ai_next;
+        }
+    }
+    *res = head;
+    return 0;
+}
+
+}   // namespace pico
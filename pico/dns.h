@@ -0,0 +1,100 @@
+#ifndef __PICO_DNS_H__
+#define __PICO_DNS_H__
+
+#include <netdb.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "address.h"
+#include "mutex.h"
+#include "singleton.h"
+
+namespace pico {
+
+/**
+ * @brief DNS解析器
+ * @details 依次查找数字地址、/etc/hosts和缓存, 未命中时通过UDP向nameserver查询A/AAAA记录.
+ *          查询使用hook的socket, 在协程中只挂起当前协程; 结果按记录的TTL缓存,
+ *          NXDOMAIN和没有记录的应答按SOA的TTL做否定缓存, 同一名称的并发查询合并为一次.
+ *          不以'.'结尾的名称按resolv.conf的search/domain和ndots依次尝试, 与libc的顺序相同
+ */
+class DnsResolver : public Singleton<DnsResolver>
+{
+public:
+    DnsResolver();
+
+    /**
+     * @brief 解析主机名
+     * @param[in] family AF_INET, AF_INET6或AF_UNSPEC, AF_UNSPEC时IPv4地址在前
+     * @param[out] addrs 解析得到的地址, 端口为0
+     * @return 成功返回0, 否则返回EAI_*错误码
+     */
+    int resolve(const std::string& host, int family, std::vector<IPAddress::Ptr>& addrs);
+
+    /**
+     * @brief 与getaddrinfo相同的接口, 结果可以用freeaddrinfo释放
+     * @details 不支持的参数组合(没有node, AI_CANONNAME, AI_V4MAPPED等)交给原始的getaddrinfo;
+     *          nsswitch.conf的hosts中有files和dns之外的来源时, 不存在的名称也交给原始的getaddrinfo
+     */
+    int getaddrinfo(const char* node, const char* service, const struct addrinfo* hints,
+                    struct addrinfo** res);
+
+    /**
+     * @brief 清空缓存
+     */
+    void clear();
+
+private:
+    struct CacheEntry
+    {
+        std::vector<IPAddress::Ptr> addrs;
+        /// 过期时间(毫秒)
+        uint64_t expire = 0;
+        /// 否定缓存时为EAI_NONAME
+        int error = 0;
+    };
+
+    /**
+     * @brief 正在进行的查询, 同一名称的并发查询只发出一次
+     */
+    struct Inflight
+    {
+        FiberMutex mutex;
+        FiberCondition cond;
+        bool done = false;
+        int error = EAI_AGAIN;
+        std::vector<IPAddress::Ptr> addrs;
+    };
+
+    int lookup(const std::string& name, uint16_t qtype, std::vector<IPAddress::Ptr>& addrs);
+    int query(const std::string& name, uint16_t qtype, CacheEntry& entry, uint32_t& ttl);
+    void loadResolvConf();
+    void loadHosts();
+    void loadNsswitch();
+    /**
+     * @brief 按search和ndots生成依次查询的名称
+     * @param[in] absolute 名称是否以'.'结尾, 是时只查询名称本身
+     */
+    std::vector<std::string> searchNames(const std::string& name, bool absolute) const;
+
+private:
+    RWMutex m_mutex;
+    std::unordered_map<std::string, CacheEntry> m_cache;
+    std::unordered_map<std::string, std::shared_ptr<Inflight>> m_inflight;
+    /// /etc/hosts中的记录, 构造时加载
+    std::unordered_map<std::string, std::vector<IPAddress::Ptr>> m_hosts;
+    /// /etc/resolv.conf中的nameserver, 配置dns.nameservers为空时使用
+    std::vector<std::string> m_systemServers;
+    /// /etc/resolv.conf中的search或domain, 配置dns.search为空时使用
+    std::vector<std::string> m_systemSearch;
+    /// /etc/resolv.conf中的ndots, 配置dns.ndots小于0时使用
+    int m_systemNdots = 1;
+    /// nsswitch.conf的hosts中是否有files和dns之外的来源
+    bool m_nssOther = false;
+};
+
+}   // namespace pico
+
+#endif
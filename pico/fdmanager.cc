@@ -1,5 +1,6 @@
 #include "fdmanager.h"
 #include "hook.h"
+#include "iomanager.h"
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -17,6 +18,16 @@ FdCtx::FdCtx(int fd)
     init();
 }
 
+FdCtx::FdCtx(int fd, bool userNonBlock)
+    : m_fd(fd)
+    , m_isInit(true)
+    , m_isSocket(true)
+    , m_isSysNonBlock(true)
+    , m_isClosed(false)
+    , m_isUserNonBlock(userNonBlock)
+    , m_recvTimeout(UINT64_C(-1))
+    , m_sendTimeout(UINT64_C(-1)) {}
+
 FdCtx::~FdCtx() {}
 
 bool FdCtx::init() {
@@ -80,12 +91,25 @@ FdCtx::Ptr FdManager::getFdCtx(int fd, bool autoCreate) {
     if ((int)m_fdCtxs.size() <= fd) { m_fdCtxs.resize(fd * 1.5); }
     m_fdCtxs[fd] = fdCtx;
     wlock.unlock();
+    IOManager::ResetFd(fd);
+    return fdCtx;
+}
+
+FdCtx::Ptr FdManager::addSocket(int fd, bool userNonBlock) {
+    if (fd < 0) { return nullptr; }
+    FdCtx::Ptr fdCtx(new FdCtx(fd, userNonBlock));
+    {
+        MutexType::WriteLock wlock(m_mutex);
+        if ((int)m_fdCtxs.size() <= fd) { m_fdCtxs.resize(fd * 1.5); }
+        m_fdCtxs[fd] = fdCtx;
+    }
+    IOManager::ResetFd(fd);
     return fdCtx;
 }
 
 void FdManager::delFdCtx(int fd) {
     MutexType::WriteLock wlock(m_mutex);
-    if ((int)m_fdCtxs.size() < fd) { return; }
+    if ((int)m_fdCtxs.size() <= fd) { return; }
     m_fdCtxs[fd].reset();
 }
 
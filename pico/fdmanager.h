@@ -15,6 +15,11 @@ class FdCtx : public std::enable_shared_from_this<FdCtx>
 public:
     typedef std::shared_ptr<FdCtx> Ptr;
     explicit FdCtx(int fd);
+    /**
+     * @brief 以SOCK_NONBLOCK创建或接受的socket, 不再需要fstat和fcntl
+     * @param[in] userNonBlock 调用方自己是否要求非阻塞
+     */
+    FdCtx(int fd, bool userNonBlock);
     virtual ~FdCtx();
     bool init();
     bool isInit() const { return m_isInit; }
@@ -51,6 +56,10 @@ public:
 
     FdManager();
     FdCtx::Ptr getFdCtx(int fd, bool autoCreate = false);
+    /**
+     * @brief 登记一个内核中已经是非阻塞的socket, 覆盖该fd上残留的记录
+     */
+    FdCtx::Ptr addSocket(int fd, bool userNonBlock);
     void delFdCtx(int fd);
 
 private:
@@ -1,27 +1,318 @@
 #include "fiber.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include <algorithm>
+
+#include "config.h"
 #include "logging.h"
 #include "scheduler.h"
+#include "util.h"
 
 namespace pico {
 static std::atomic<uint64_t> s_fiber_id{0};
 static std::atomic<uint64_t> s_fiber_count{0};
+static std::atomic<size_t> s_fiber_local_slots{0};
 
 static thread_local Fiber* t_fiber = nullptr;
 static thread_local Fiber::Ptr t_threadFiber = nullptr;
 
-static uint32_t g_fiber_stack_size = 128 * 1024;
+static ConfigVar<uint32_t>::Ptr g_fiber_stack_size =
+    Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
+
+static ConfigVar<uint32_t>::Ptr g_fiber_stack_pool = Config::Lookup<uint32_t>(
+    "fiber.stack_pool", 64, "max cached fiber stacks per thread, 0 disables the pool");
+
+static ConfigVar<uint32_t>::Ptr g_fiber_shared_stack_size = Config::Lookup<uint32_t>(
+    "fiber.shared_stack_size", 1024 * 1024, "per-thread shared stack size for shared-stack fibers");
+
+static ConfigVar<std::string>::Ptr g_fiber_stack_allocator = Config::Lookup<std::string>(
+    "fiber.stack_allocator",
+    "auto",
+    "fiber stack allocator, mmap (guard-paged), malloc, or auto which uses mmap when the kernel "
+    "supports MADV_GUARD_INSTALL (linux 6.13+) and malloc otherwise; both cache stacks per thread");
 
-class MallocStackAllocator {
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+class StackAllocator {
 public:
+    virtual ~StackAllocator() {}
+
+    virtual void* alloc(size_t size) = 0;
+    virtual void dealloc(void* vp, size_t size) = 0;
+};
+
+/**
+ * @brief 释放的默认大小栈先缓存在当前线程, 缓存满后才交给Backend释放
+ * @details 两种分配方式共用同一套线程缓存, 协程频繁创建销毁时大部分栈在线程内复用;
+ *          Backend提供DefaultSize/Alloc/Dealloc
+ */
+template <class Backend>
+class PooledStackAllocator : public StackAllocator {
+public:
+    void* alloc(size_t size) override {
+        if (size == Backend::DefaultSize() && !t_pool_destroyed) {
+            Pool& pool = GetPool();
+            if (!pool.stacks.empty()) {
+                void* vp = pool.stacks.back();
+                pool.stacks.pop_back();
+                return vp;
+            }
+        }
+        return Backend::Alloc(size);
+    }
+
+    void dealloc(void* vp, size_t size) override {
+        // 线程退出时缓存已经析构, 直接归还
+        if (size == Backend::DefaultSize() && !t_pool_destroyed) {
+            Pool& pool = GetPool();
+            if (pool.stacks.size() < pool.capacity) {
+                pool.stacks.push_back(vp);
+                return;
+            }
+        }
+        Backend::Dealloc(vp, size);
+    }
+
+private:
+    struct Pool {
+        Pool()
+            : capacity(g_fiber_stack_pool->getValue()) {
+            stacks.reserve(capacity);
+        }
+
+        ~Pool() {
+            t_pool_destroyed = true;
+            for (auto vp : stacks) { Backend::Dealloc(vp, Backend::DefaultSize()); }
+        }
+
+        std::vector<void*> stacks;
+        size_t capacity;
+    };
+
+    static thread_local bool t_pool_destroyed;
+
+    static Pool& GetPool() {
+        static thread_local Pool s_pool;
+        return s_pool;
+    }
+};
+
+template <class Backend>
+thread_local bool PooledStackAllocator<Backend>::t_pool_destroyed = false;
+
+/**
+ * @brief malloc分配协程栈, 没有保护页
+ */
+struct MallocStacks {
+    static size_t DefaultSize() {
+        static size_t s_stack_size = g_fiber_stack_size->getValue();
+        return s_stack_size;
+    }
+
     static void* Alloc(size_t size) { return malloc(size); }
 
-    static void Dealloc(void* vp, size_t size) { return free(vp); }
+    static void Dealloc(void* vp, size_t size) { free(vp); }
+};
+
+/**
+ * @brief mmap分配协程栈, 栈的低地址端有一页保护页
+ * @details 栈溢出时立即触发SIGSEGV, 而不是静默地破坏相邻内存;
+ *          默认大小的栈按块批量映射, 保护页用MADV_GUARD_INSTALL安装, 不拆分内存映射,
+ *          协程数量不受vm.max_map_count限制. 内核不支持时(6.13之前)退化为mprotect,
+ *          每个栈多占两个映射, 协程数量约为vm.max_map_count的一半;
+ *          保护页无法安装时分配失败抛出std::bad_alloc, 不会交出没有保护页的栈.
+ *          线程缓存满后默认大小的栈归还到全局空闲链表并交还物理内存;
+ *          其他大小的栈单独映射和释放
+ */
+class MmapStacks {
+public:
+    static size_t DefaultSize() { return GetChunks().stack_size; }
+
+    static void* Alloc(size_t size) {
+        Chunks& chunks = GetChunks();
+        if (size != chunks.stack_size) { return Map(size); }
+        return chunks.alloc();
+    }
+
+    static void Dealloc(void* vp, size_t size) {
+        Chunks& chunks = GetChunks();
+        if (size != chunks.stack_size) { return Unmap(vp, size); }
+        chunks.dealloc(vp);
+    }
+
+    /**
+     * @brief 内核是否支持MADV_GUARD_INSTALL
+     */
+    static bool GuardInstallSupported() {
+        static bool s_supported = []() {
+            void* page = mmap(nullptr, PageSize(), PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (page == MAP_FAILED) { return false; }
+            bool rt = madvise(page, PageSize(), MADV_GUARD_INSTALL) == 0;
+            munmap(page, PageSize());
+            return rt;
+        }();
+        return s_supported;
+    }
+
+private:
+    /**
+     * @brief 批量映射的默认大小栈, 映射不会释放, 空闲的栈只交还物理内存
+     */
+    struct Chunks {
+        typedef Spinlock MutexType;
+        static const size_t kChunkBytes = 8 << 20;
+
+        Chunks()
+            : stack_size(g_fiber_stack_size->getValue()) {}
+
+        void* alloc() {
+            MutexType::Lock lock(mutex);
+            if (stacks.empty()) { grow(); }
+            void* vp = stacks.back();
+            stacks.pop_back();
+            return vp;
+        }
+
+        void dealloc(void* vp) {
+            madvise(vp, stack_size, MADV_FREE);
+            MutexType::Lock lock(mutex);
+            stacks.push_back(vp);
+        }
+
+        void grow() {
+            size_t len = MapSize(stack_size);
+            size_t count = std::max<size_t>(kChunkBytes / len, 1);
+            // 不计入提交内存, 相邻的块合并成一个大映射后不会使fork因为超出提交限制失败
+            char* base = (char*)mmap(nullptr, len * count, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (base == MAP_FAILED) {
+                LOG_ERROR("mmap fiber stacks failed, size=%lu, errno=%d", len * count, errno);
+                throw std::bad_alloc();
+            }
+            for (size_t i = count; i > 0; --i) {
+                char* guard = base + (i - 1) * len;
+                if (!Guard(guard)) {
+                    // 剩下的栈没有保护页, 溢出会破坏相邻的栈, 交还给内核; 从映射低端裁剪不会拆分映射
+                    munmap(base, i * len);
+                    break;
+                }
+                stacks.push_back(guard + PageSize());
+            }
+            if (stacks.empty()) { throw std::bad_alloc(); }
+        }
+
+        MutexType mutex;
+        const size_t stack_size;
+        std::vector<void*> stacks;
+    };
+
+    static Chunks& GetChunks() {
+        // 线程退出时还会归还栈, 不随进程退出析构
+        static Chunks* s_chunks = new Chunks;
+        return *s_chunks;
+    }
+
+    static size_t PageSize() {
+        static size_t s_page_size = sysconf(_SC_PAGESIZE);
+        return s_page_size;
+    }
+
+    static size_t MapSize(size_t size) {
+        size_t page = PageSize();
+        return (size + page - 1) / page * page + page;
+    }
+
+    /**
+     * @return 保护页安装失败返回false, 一般是mprotect拆分映射时超出了vm.max_map_count
+     */
+    static bool Guard(void* page) {
+        static std::atomic<bool> s_guard_install{true};
+        if (s_guard_install) {
+            if (!madvise(page, PageSize(), MADV_GUARD_INSTALL)) { return true; }
+            if (errno == EINVAL) { s_guard_install = false; }
+        }
+        if (mprotect(page, PageSize(), PROT_NONE)) {
+            LOG_ERROR("mprotect fiber stack guard failed, errno=%d", errno);
+            return false;
+        }
+        return true;
+    }
+
+    static void* Map(size_t size) {
+        size_t len = MapSize(size);
+        void* base =
+            mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            LOG_ERROR("mmap fiber stack failed, size=%lu, errno=%d", len, errno);
+            throw std::bad_alloc();
+        }
+        if (!Guard(base)) {
+            munmap(base, len);
+            throw std::bad_alloc();
+        }
+        return (char*)base + PageSize();
+    }
+
+    static void Unmap(void* vp, size_t size) { munmap((char*)vp - PageSize(), MapSize(size)); }
 };
 
-using StackAllocator = MallocStackAllocator;
+typedef PooledStackAllocator<MallocStacks> MallocStackAllocator;
+typedef PooledStackAllocator<MmapStacks> MmapStackAllocator;
+
+static StackAllocator* GetStackAllocator() {
+    static MallocStackAllocator s_malloc;
+    static MmapStackAllocator s_mmap;
+    static thread_local StackAllocator* t_allocator = nullptr;
+    if (!t_allocator) {
+        const std::string& name = g_fiber_stack_allocator->getValue();
+        bool use_mmap =
+            name == "mmap" || (name != "malloc" && MmapStacks::GuardInstallSupported());
+        t_allocator = use_mmap ? static_cast<StackAllocator*>(&s_mmap)
+                               : static_cast<StackAllocator*>(&s_malloc);
+    }
+    return t_allocator;
+}
+
+static uint32_t GetDefaultStackSize() {
+    static thread_local uint32_t t_stack_size = g_fiber_stack_size->getValue();
+    return t_stack_size;
+}
+
+#ifdef PICO_FIBER_ASM_CONTEXT
+/**
+ * @brief 线程共享栈, 同一时刻只有occupant的栈内容在上面
+ */
+struct SharedStack {
+    SharedStack()
+        : size(g_fiber_shared_stack_size->getValue())
+        , allocator(GetStackAllocator()) {
+        stack = (char*)allocator->alloc(size);
+        // 与make_fiber_context中的栈顶对齐方式一致
+        top = (char*)(((uintptr_t)stack + size) & ~(uintptr_t)15);
+    }
+
+    ~SharedStack() { allocator->dealloc(stack, size); }
+
+    size_t size;
+    StackAllocator* allocator;
+    char* stack;
+    char* top;
+    Fiber* occupant = nullptr;
+};
+
+static SharedStack& GetSharedStack() {
+    static thread_local SharedStack t_shared_stack;
+    return t_shared_stack;
+}
+#endif
 
 uint64_t Fiber::GetFiberId() {
     if (t_fiber) {
@@ -34,39 +325,44 @@ Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
+#ifndef PICO_FIBER_ASM_CONTEXT
     if (getcontext(&m_ctx)) {
         assert(false);
     }
+#endif
 
     ++s_fiber_count;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller, bool shared_stack)
     : m_id(++s_fiber_id), m_cb(cb) {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size;
-
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    if (getcontext(&m_ctx)) {
-        assert(false);
+#ifdef PICO_FIBER_ASM_CONTEXT
+    if (shared_stack) {
+        assert(!use_caller);
+        m_sharedStack = true;
+        m_stacksize = g_fiber_shared_stack_size->getValue();
+        return;
     }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
+#endif
+    m_stacksize = stacksize ? stacksize : GetDefaultStackSize();
 
-    if (!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
-    }
+    m_allocator = GetStackAllocator();
+    m_stack = m_allocator->alloc(m_stacksize);
+    makeContext(use_caller);
 }
 
 Fiber::~Fiber() {
     --s_fiber_count;
-    if (m_stack) {
+    if (m_sharedStack) {
+        assert(m_state == TERM || m_state == EXCEPT || m_state == INIT);
+#ifdef PICO_FIBER_ASM_CONTEXT
+        free(m_saved);
+#endif
+    } else if (m_stack) {
         assert(m_state == TERM || m_state == EXCEPT || m_state == INIT);
 
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        m_allocator->dealloc(m_stack, m_stacksize);
     } else {
         assert(!m_cb);
         assert(m_state == EXEC);
@@ -81,34 +377,119 @@ Fiber::~Fiber() {
 // 重置协程函数，并重置状态
 //  INIT，TERM, EXCEPT
 void Fiber::reset(std::function<void()> cb) {
-    assert(m_stack);
+    assert(m_stack || m_sharedStack);
     assert(m_state == TERM || m_state == EXCEPT || m_state == INIT);
     m_cb = cb;
+    m_locals.clear();
+    makeContext(false);
+    m_state = INIT;
+}
+
+void Fiber::makeContext(bool use_caller) {
+    void (*func)() = use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc;
+#ifdef PICO_FIBER_ASM_CONTEXT
+    if (m_sharedStack) {
+        // 共享栈协程在首次切入时才在共享栈上构造上下文
+        m_sp = nullptr;
+        return;
+    }
+    m_sp = make_fiber_context(m_stack, m_stacksize, func);
+#else
     if (getcontext(&m_ctx)) {
         assert(false);
     }
-
     m_ctx.uc_link = nullptr;
     m_ctx.uc_stack.ss_sp = m_stack;
     m_ctx.uc_stack.ss_size = m_stacksize;
 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = INIT;
+    makecontext(&m_ctx, func, 0);
+#endif
+}
+
+void Fiber::SwapContext(Fiber* from, Fiber* to) {
+#ifdef PICO_FIBER_ASM_CONTEXT
+    pico_swap_context(&from->m_sp, to->m_sp);
+#else
+    if (swapcontext(&from->m_ctx, &to->m_ctx)) {
+        assert(false);
+    }
+#endif
+}
+
+#ifdef PICO_FIBER_ASM_CONTEXT
+void Fiber::enterSharedStack() {
+    SharedStack& ss = GetSharedStack();
+    if (ss.occupant == this) {
+        return;
+    }
+    if (ss.occupant) {
+        ss.occupant->saveStack(ss.top);
+    }
+    ss.occupant = this;
+    if (!m_sp) {
+        m_thread = pico::getThreadId();
+        m_sp = make_fiber_context(ss.stack, ss.size, &Fiber::MainFunc);
+        return;
+    }
+    assert(m_thread == pico::getThreadId());
+    memcpy(ss.top - m_savedSize, m_saved, m_savedSize);
 }
 
+void Fiber::leaveSharedStack() {
+    if (m_state != TERM && m_state != EXCEPT) {
+        return;
+    }
+    // 协程已结束, 栈内容不再需要保存
+    SharedStack& ss = GetSharedStack();
+    if (ss.occupant == this) {
+        ss.occupant = nullptr;
+    }
+    free(m_saved);
+    m_saved = nullptr;
+    m_savedSize = 0;
+    m_savedCapacity = 0;
+    m_sp = nullptr;
+    m_thread = -1;
+}
+
+void Fiber::saveStack(char* top) {
+    size_t used = top - (char*)m_sp;
+    // 缓冲区大小跟随实际使用量, 栈变浅时收缩
+    if (used > m_savedCapacity || used < m_savedCapacity / 2) {
+        free(m_saved);
+        m_saved = (char*)malloc(used);
+        if (!m_saved) {
+            LOG_ERROR("save shared stack failed, size=%lu", used);
+            throw std::bad_alloc();
+        }
+        m_savedCapacity = used;
+    }
+    memcpy(m_saved, m_sp, used);
+    m_savedSize = used;
+}
+#endif
+
 void Fiber::call() {
     SetThis(this);
     m_state = EXEC;
-    if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        assert(false);
+#ifdef PICO_FIBER_ASM_CONTEXT
+    if (m_sharedStack) {
+        enterSharedStack();
+        SwapContext(t_threadFiber.get(), this);
+        leaveSharedStack();
+        return;
     }
+#endif
+    SwapContext(t_threadFiber.get(), this);
+}
+
+bool Fiber::isThreadMain() const {
+    return this == t_threadFiber.get();
 }
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
-    if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        assert(false);
-    }
+    SwapContext(this, t_threadFiber.get());
 }
 
 // 切换到当前协程执行
@@ -116,9 +497,15 @@ void Fiber::swapIn() {
     SetThis(this);
     assert(m_state != EXEC);
     m_state = EXEC;
-    if (swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-        assert(false);
+#ifdef PICO_FIBER_ASM_CONTEXT
+    if (m_sharedStack) {
+        enterSharedStack();
+        SwapContext(Scheduler::GetMainFiber(), this);
+        leaveSharedStack();
+        return;
     }
+#endif
+    SwapContext(Scheduler::GetMainFiber(), this);
 }
 
 // 切换到后台执行
@@ -126,15 +513,11 @@ void Fiber::swapOut() {
     Fiber* main_fiber = Scheduler::GetMainFiber();
     if (main_fiber) {
         SetThis(main_fiber);
-        if (swapcontext(&m_ctx, &main_fiber->m_ctx)) {
-            assert(false);
-        }
+        SwapContext(this, main_fiber);
     } else {
         // Fallback for call/back mode when no Scheduler main fiber exists.
         SetThis(t_threadFiber.get());
-        if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-            assert(false);
-        }
+        SwapContext(this, t_threadFiber.get());
     }
 }
 
@@ -169,6 +552,25 @@ void Fiber::yieldToHold() {
     cur->swapOut();
 }
 
+void Fiber::releaseLocals() {
+    // 先移出再析构, 析构函数中仍然可以挂起或访问其他FiberLocal
+    std::vector<std::shared_ptr<void>> locals;
+    locals.swap(m_locals);
+}
+
+size_t Fiber::AllocLocalSlot() {
+    return s_fiber_local_slots++;
+}
+
+std::shared_ptr<void>* Fiber::GetLocalSlot(size_t index, bool create) {
+    Fiber* cur = t_fiber ? t_fiber : GetThis().get();
+    if (cur->m_locals.size() <= index) {
+        if (!create) { return nullptr; }
+        cur->m_locals.resize(s_fiber_local_slots);
+    }
+    return &cur->m_locals[index];
+}
+
 // 总协程数
 uint64_t Fiber::TotalFibers() {
     return s_fiber_count;
@@ -180,6 +582,7 @@ void Fiber::MainFunc() {
     try {
         cur->m_cb();
         cur->m_cb = nullptr;
+        cur->releaseLocals();
         cur->m_state = TERM;
     } catch (std::exception& ex) {
         cur->m_state = EXCEPT;
@@ -201,6 +604,7 @@ void Fiber::CallerMainFunc() {
     try {
         cur->m_cb();
         cur->m_cb = nullptr;
+        cur->releaseLocals();
         cur->m_state = TERM;
     } catch (std::exception& ex) {
         cur->m_state = EXCEPT;
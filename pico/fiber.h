@@ -3,13 +3,18 @@
 
 #include <ucontext.h>
 
+#include <cassert>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <vector>
+
+#include "fiber_context.h"
+#include "noncopyable.h"
 
 namespace pico {
 class Scheduler;
-class Scheduler;
+class StackAllocator;
 
 /**
  * @brief 协程类
@@ -39,7 +44,17 @@ private:
     Fiber();
 
 public:
-    explicit Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    /**
+     * @brief 构造协程
+     * @param[in] shared_stack 是否运行在线程共享栈上
+     * @details 共享栈协程没有私有栈, 首次切入时绑定到当前线程的共享栈, 之后只能在该线程上执行;
+     *          切出时不拷贝, 直到同线程的其他共享栈协程需要使用共享栈时,
+     *          才把已使用的部分保存到按需分配的堆缓冲区中.
+     *          协程栈上的变量地址不能交给其他协程在本协程挂起期间访问;
+     *          仅手写上下文切换支持, 使用ucontext时退化为私有栈
+     */
+    explicit Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false,
+                   bool shared_stack = false);
     ~Fiber();
 
     void reset(std::function<void()> cb);
@@ -51,6 +66,23 @@ public:
     void back();
     uint64_t getId() const { return m_id; }
     State getState() const { return m_state; }
+    bool isSharedStack() const { return m_sharedStack; }
+    /**
+     * @brief 协程绑定的线程id, 未绑定时返回-1
+     * @details 共享栈协程首次执行时自动绑定; 绑定的协程每次调度都投递到该线程, 不会被窃取
+     */
+    int getBoundThread() const { return m_thread; }
+    /**
+     * @brief 把私有栈协程固定在线程上执行, 需要在首次调度之前调用
+     */
+    void bindThread(int thread) {
+        assert(!m_sharedStack);
+        m_thread = thread;
+    }
+    /**
+     * @brief 是否为线程的主协程, 主协程没有可以切回的上层, 不能挂起
+     */
+    bool isThreadMain() const;
 
 public:
     static void SetThis(Fiber* f);
@@ -62,13 +94,100 @@ public:
     static void CallerMainFunc();
     static uint64_t GetFiberId();
 
+    /**
+     * @brief 分配一个协程局部存储槽位, 槽位不回收, 供FiberLocal使用
+     */
+    static size_t AllocLocalSlot();
+    /**
+     * @brief 当前协程的第index个槽位, 不在协程中时使用线程的主协程
+     * @param[in] create 槽位数组不够长时是否扩展, 为false且不够长时返回nullptr
+     */
+    static std::shared_ptr<void>* GetLocalSlot(size_t index, bool create);
+
+private:
+    void makeContext(bool use_caller);
+    /**
+     * @brief 协程函数正常返回后在协程自己的上下文中释放局部变量, 异常时留到reset或析构
+     */
+    void releaseLocals();
+    static void SwapContext(Fiber* from, Fiber* to);
+#ifdef PICO_FIBER_ASM_CONTEXT
+    void enterSharedStack();
+    void leaveSharedStack();
+    void saveStack(char* top);
+#endif
+
 private:
     uint64_t m_id = 0;
     uint32_t m_stacksize = 0;
     State m_state = INIT;
+#ifdef PICO_FIBER_ASM_CONTEXT
+    void* m_sp = nullptr;
+#else
     ucontext_t m_ctx;
+#endif
     void* m_stack = nullptr;
+    StackAllocator* m_allocator = nullptr;
     std::function<void()> m_cb;
+    bool m_sharedStack = false;
+    int m_thread = -1;
+    /// 协程局部存储, 按FiberLocal分配的槽位下标访问, 协程函数返回时释放
+    std::vector<std::shared_ptr<void>> m_locals;
+#ifdef PICO_FIBER_ASM_CONTEXT
+    /// 共享栈协程被换出时保存的栈内容
+    char* m_saved = nullptr;
+    size_t m_savedSize = 0;
+    size_t m_savedCapacity = 0;
+#endif
+};
+
+/**
+ * @brief 协程局部变量, 每个协程持有一份独立的值, 随协程在线程间迁移
+ * @details 值保存在协程的槽位数组中, 访问只需一次下标查找; 协程函数返回或协程重置时释放,
+ *          调度器复用的协程不会把值带给下一个任务. 在线程的主协程和调度协程中访问时,
+ *          值的生命周期与线程相同. FiberLocal对象应长期存在(例如静态变量), 其槽位不回收
+ */
+template <class T>
+class FiberLocal : Noncopyable
+{
+public:
+    FiberLocal()
+        : m_index(Fiber::AllocLocalSlot()) {}
+
+    /**
+     * @brief 当前协程上的值, 没有设置时返回nullptr
+     */
+    T* get() const {
+        std::shared_ptr<void>* slot = Fiber::GetLocalSlot(m_index, false);
+        return slot ? static_cast<T*>(slot->get()) : nullptr;
+    }
+
+    /**
+     * @brief 当前协程上的值, 没有设置时默认构造
+     */
+    T& operator*() const {
+        std::shared_ptr<void>* slot = Fiber::GetLocalSlot(m_index, true);
+        if (!*slot) { *slot = std::make_shared<T>(); }
+        return *static_cast<T*>(slot->get());
+    }
+
+    T* operator->() const { return &**this; }
+
+    void set(T value) {
+        std::shared_ptr<void>* slot = Fiber::GetLocalSlot(m_index, true);
+        *slot = std::make_shared<T>(std::move(value));
+    }
+
+    /**
+     * @brief 释放当前协程上的值
+     */
+    void reset() {
+        std::shared_ptr<void>* slot = Fiber::GetLocalSlot(m_index, false);
+        if (slot) { slot->reset(); }
+    }
+
+private:
+    size_t m_index;
 };
 }; // namespace pico
 
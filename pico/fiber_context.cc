@@ -0,0 +1,116 @@
+#include "fiber_context.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef PICO_FIBER_ASM_CONTEXT
+
+#    if defined(__x86_64__)
+
+// System V AMD64: callee-saved rbx, rbp, r12-r15, 另外保存mxcsr和x87控制字
+// 栈布局(由低到高): mxcsr/fpucw(8) r15 r14 r13 r12 rbx rbp ret
+asm(R"(
+    .text
+    .globl pico_swap_context
+    .type pico_swap_context,@function
+    .align 16
+pico_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size pico_swap_context,.-pico_swap_context
+    .section .note.GNU-stack,"",%progbits
+    .text
+)");
+
+namespace pico {
+void* make_fiber_context(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)top;
+    // 伪造的返回地址, 使fn入口处的栈满足调用约定(rsp + 8 16字节对齐)
+    *--sp = 0;
+    *--sp = (uint64_t)fn;
+    // rbp rbx r12 r13 r14 r15
+    for (int i = 0; i < 6; ++i) { *--sp = 0; }
+    --sp;
+    uint32_t mxcsr = 0x1F80;
+    uint16_t fpucw = 0x037F;
+    memcpy(sp, &mxcsr, sizeof(mxcsr));
+    memcpy((char*)sp + 4, &fpucw, sizeof(fpucw));
+    return sp;
+}
+}   // namespace pico
+
+#    elif defined(__aarch64__)
+
+// AAPCS64: callee-saved x19-x29, lr(x30), d8-d15
+// 栈布局(由低到高): d8-d15(64) x19-x28(80) x29 x30(16), 共176字节
+asm(R"(
+    .text
+    .globl pico_swap_context
+    .type pico_swap_context,%function
+    .align 4
+pico_swap_context:
+    sub sp, sp, #176
+    stp d8, d9, [sp, #0]
+    stp d10, d11, [sp, #16]
+    stp d12, d13, [sp, #32]
+    stp d14, d15, [sp, #48]
+    stp x19, x20, [sp, #64]
+    stp x21, x22, [sp, #80]
+    stp x23, x24, [sp, #96]
+    stp x25, x26, [sp, #112]
+    stp x27, x28, [sp, #128]
+    stp x29, x30, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0]
+    ldp d10, d11, [sp, #16]
+    ldp d12, d13, [sp, #32]
+    ldp d14, d15, [sp, #48]
+    ldp x19, x20, [sp, #64]
+    ldp x21, x22, [sp, #80]
+    ldp x23, x24, [sp, #96]
+    ldp x25, x26, [sp, #112]
+    ldp x27, x28, [sp, #128]
+    ldp x29, x30, [sp, #144]
+    add sp, sp, #176
+    ret
+    .size pico_swap_context,.-pico_swap_context
+    .section .note.GNU-stack,"",%progbits
+    .text
+)");
+
+namespace pico {
+void* make_fiber_context(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 176);
+    memset(sp, 0, 176);
+    // x30(lr)作为ret的目标地址
+    sp[19] = (uint64_t)fn;
+    return sp;
+}
+}   // namespace pico
+
+#    endif
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __PICO_FIBER_CONTEXT_H__
+#define __PICO_FIBER_CONTEXT_H__
+
+#include <cstddef>
+
+// 默认在x86_64和aarch64上使用手写的上下文切换, 只保存callee-saved寄存器,
+// 不会像swapcontext那样每次切换都调用sigprocmask;
+// 定义PICO_FIBER_UCONTEXT可强制使用ucontext
+#if !defined(PICO_FIBER_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#    define PICO_FIBER_ASM_CONTEXT 1
+#endif
+
+#ifdef PICO_FIBER_ASM_CONTEXT
+
+extern "C" {
+/**
+ * @brief 保存当前寄存器到栈上, 将栈顶写入*from, 然后切换到to指向的栈并恢复寄存器
+ */
+void pico_swap_context(void** from, void* to);
+}
+
+namespace pico {
+/**
+ * @brief 在[stack, stack + size)上构造初始上下文, 首次切入时执行fn
+ * @return 保存的栈顶, 作为pico_swap_context的to参数
+ * @note fn不允许返回
+ */
+void* make_fiber_context(void* stack, size_t size, void (*fn)());
+}   // namespace pico
+
+#endif
+
+#endif
@@ -1,13 +1,20 @@
 #include "hook.h"
 
 #include <dlfcn.h>
+#include <limits.h>
 #include <stdarg.h>
 
+#include <algorithm>
 #include <iostream>
+#include <type_traits>
+#include <vector>
 
+#include "dns.h"
 #include "fdmanager.h"
 #include "iomanager.h"
 #include "logging.h"
+#include "uring.h"
+#include "util.h"
 
 namespace pico {
 static uint64_t g_tcp_connect_timeout = 5000;
@@ -15,24 +22,35 @@ static thread_local bool g_hook_enable = false;
 
 #define HOOK_FUN(XX) \
     XX(sleep)        \
+    XX(usleep)       \
+    XX(nanosleep)    \
+    XX(poll)         \
+    XX(select)       \
+    XX(epoll_wait)   \
     XX(socket)       \
     XX(connect)      \
     XX(accept)       \
+    XX(accept4)      \
     XX(read)         \
     XX(readv)        \
     XX(recv)         \
     XX(recvfrom)     \
     XX(recvmsg)      \
+    XX(recvmmsg)     \
+    XX(pread)        \
     XX(write)        \
     XX(writev)       \
     XX(send)         \
     XX(sendto)       \
     XX(sendmsg)      \
+    XX(sendmmsg)     \
+    XX(pwrite)       \
     XX(close)        \
     XX(fcntl)        \
     XX(ioctl)        \
     XX(setsockopt)   \
-    XX(getsockopt)
+    XX(getsockopt)   \
+    XX(getaddrinfo)
 
 
 void hook_init() {
@@ -66,10 +84,97 @@ struct timer_info {
     int cancelled = 0;
 };
 
+/**
+ * @brief 当前线程的errno
+ * @details 协程挂起后可能在其他线程恢复, 而__errno_location被声明为const函数,
+ *          编译器会把挂起前取得的errno地址沿用到挂起之后, 写到原线程的errno上.
+ *          挂起之后读写errno都通过volatile函数指针重新取得地址
+ */
+static int* (*volatile s_errno_location)() = &__errno_location;
 
-template <typename OriginFun, typename... Args>
+static int& current_errno() {
+    return *s_errno_location();
+}
+
+/**
+ * @brief 超时后标记timer_info并取消fd上该方向的等待
+ * @details do_io、do_uring_io和connect共用; timeout为~0或0时不限时, 返回nullptr
+ */
+static pico::Timer::Ptr add_timeout_timer(pico::IOManager* iom, int fd, uint32_t event,
+                                          uint64_t timeout,
+                                          const std::shared_ptr<timer_info>& tinfo) {
+    if (timeout == ~0ull || timeout == 0) {
+        return nullptr;
+    }
+    std::weak_ptr<timer_info> wp(tinfo);
+    return iom->addCondTimer(
+        timeout,
+        [fd, wp, iom, event]() {
+            std::shared_ptr<timer_info> t = wp.lock();
+            if (t == nullptr || t->cancelled) {
+                return;
+            }
+
+            t->cancelled = ETIMEDOUT;
+            iom->cancelEvent(fd, (pico::IOManager::Event)(event));
+        },
+        wp);
+}
+
+/**
+ * @brief 单次请求的长度, 超出部分由调用方像处理短读写一样继续
+ */
+static uint32_t uring_len(size_t len) {
+    return len > INT_MAX ? INT_MAX : len;
+}
+
+/**
+ * @brief io_uring后端下操作返回EAGAIN后把请求提交到ring, 代替注册事件、等待、再重试的过程
+ * @details 超时通过定时器取消请求实现; 请求被cancelEvent取消但没有超时时重新提交,
+ *          与epoll路径被唤醒后重试一致, fd已经被hook的close关闭时返回EBADF
+ */
+template <typename Prep>
+static ssize_t do_uring_io(pico::IOManager* iom, const pico::FdCtx::Ptr& ctx, int fd,
+                           uint32_t event, uint64_t timeout, const Prep& prep) {
+    std::shared_ptr<timer_info> tinfo(new timer_info);
+    pico::Timer::Ptr timer = add_timeout_timer(iom, fd, event, timeout, tinfo);
+
+    int res = 0;
+    while (true) {
+        io_uring_sqe sqe;
+        prep(sqe);
+        res = iom->submitRequest(fd, (pico::IOManager::Event)(event), sqe);
+        if ((res != -ECANCELED && res != -EINTR) || tinfo->cancelled) {
+            break;
+        }
+        if (pico::FdMgr::getInstance()->getFdCtx(fd) != ctx) {
+            res = -EBADF;
+            break;
+        }
+    }
+    if (timer) {
+        timer->cancel();
+    }
+    // 超时与完成同时发生时以完成为准, 数据已经读写, 不能再报告超时
+    if (res >= 0) {
+        return res;
+    }
+    current_errno() = (res == -ECANCELED && tinfo->cancelled) ? tinfo->cancelled : -res;
+    return -1;
+}
+
+
+/**
+ * @brief 没有对应io_uring操作的调用使用的Prep, do_io在io_uring后端下也按就绪等待再重试处理
+ */
+struct epoll_only
+{
+    void operator()(io_uring_sqe&) const {}
+};
+
+template <typename OriginFun, typename Prep, typename... Args>
 static ssize_t do_io(int fd, OriginFun origin_fun, const char* hook_fun, uint32_t event,
-                     int timeout_so, Args&&... args) {
+                     int timeout_so, const Prep& prep, Args&&... args) {
     if (!pico::is_hook_enable()) {
         return origin_fun(fd, std::forward<Args>(args)...);
     }
@@ -96,27 +201,16 @@ static ssize_t do_io(int fd, OriginFun origin_fun, const char* hook_fun, uint32_
 
 retry:
     ssize_t ret = origin_fun(fd, std::forward<Args>(args)...);
-    while (ret == -1 && errno == EINTR) {
+    while (ret == -1 && current_errno() == EINTR) {
         ret = origin_fun(fd, std::forward<Args>(args)...);
     }
-    if (ret == -1 && errno == EAGAIN) {
-        pico::Timer::Ptr timer;
-        std::weak_ptr<timer_info> wp(tinfo);
-
-        if (to != ~0ull && to != 0) {
-            timer = iom->addCondTimer(
-                to,
-                [fd, wp, iom, event]() {
-                    std::shared_ptr<timer_info> t = wp.lock();
-                    if (t == nullptr || t->cancelled) {
-                        return;
-                    }
-
-                    t->cancelled = ETIMEDOUT;
-                    iom->cancelEvent(fd, (pico::IOManager::Event)(event));
-                },
-                wp);
-        }
+    // 共享栈协程挂起后栈内容会被换出, 内核不能在挂起期间访问其栈上的数据, 只能等待就绪
+    if (ret == -1 && current_errno() == EAGAIN && iom->isUring() &&
+        !std::is_same<Prep, epoll_only>::value && !pico::Fiber::GetThis()->isSharedStack()) {
+        return do_uring_io(iom, ctx, fd, event, to, prep);
+    }
+    if (ret == -1 && current_errno() == EAGAIN) {
+        pico::Timer::Ptr timer = add_timeout_timer(iom, fd, event, to, tinfo);
 
         int rt = iom->addEvent(fd, (pico::IOManager::Event)(event));
 
@@ -132,7 +226,7 @@ retry:
                 timer->cancel();
             }
             if (tinfo->cancelled) {
-                errno = tinfo->cancelled;
+                current_errno() = tinfo->cancelled;
                 return -1;
             }
 
@@ -142,6 +236,151 @@ retry:
     return ret;
 }
 
+/**
+ * @brief 当前协程能够挂起等待时返回所在的IOManager
+ * @details 调度协程和线程主协程挂起后没有调度器恢复, 这时只能阻塞线程
+ */
+static pico::IOManager* parkable_iomanager() {
+    if (!pico::is_hook_enable()) {
+        return nullptr;
+    }
+    pico::IOManager* iom = pico::IOManager::GetThis();
+    if (!iom) {
+        return nullptr;
+    }
+    pico::Fiber::Ptr cur = pico::Fiber::GetThis();
+    if (cur.get() == pico::Scheduler::GetMainFiber() || cur->isThreadMain()) {
+        return nullptr;
+    }
+    return iom;
+}
+
+/**
+ * @brief 通过定时器挂起当前协程ms毫秒
+ */
+static void fiber_sleep(pico::IOManager* iom, uint64_t ms) {
+    iom->addTimer(ms,
+                  std::bind((void (pico::IOManager::*)(pico::Fiber::Ptr, int thread))&pico::IOManager::schedule,
+                            iom,
+                            pico::Fiber::GetThis(),
+                            -1));
+    pico::Fiber::yieldToHold();
+}
+
+/// 无法登记事件时重新检查的最长间隔(毫秒)
+static const uint64_t kPollRetryMaxMs = 16;
+
+/**
+ * @brief 把pollfd关注的事件登记到IOManager, 挂起直到任一fd就绪或超时, 再用poll取得revents
+ * @details 同一fd在多个pollfd中出现时合并登记. IOManager的每个方向只有一个等待位,
+ *          fd已被其他协程在同一方向上等待(如另一个协程阻塞在recv上)或登记失败时,
+ *          撤销已经完成的登记, 改为通过定时器挂起协程并重复非阻塞的poll, 间隔逐步加大
+ * @param[in] timeout 超时时间(毫秒), 小于0表示一直等待
+ */
+static int do_poll(pico::IOManager* iom, struct pollfd* fds, nfds_t nfds, int timeout) {
+    uint64_t deadline = timeout < 0 ? ~0ull : pico::getCurrentTime() + timeout;
+    uint64_t retry = 0;
+    while (true) {
+        int rt = poll_f(fds, nfds, 0);
+        if (rt != 0 || timeout == 0) {
+            return rt;
+        }
+        uint64_t wait = ~0ull;
+        if (deadline != ~0ull) {
+            uint64_t now = pico::getCurrentTime();
+            if (now >= deadline) {
+                return 0;
+            }
+            wait = deadline - now;
+        }
+
+        std::vector<std::pair<int, uint32_t>> interests;
+        interests.reserve(nfds);
+        for (nfds_t i = 0; i < nfds; ++i) {
+            if (fds[i].fd < 0) {
+                continue;
+            }
+            uint32_t event = 0;
+            if (fds[i].events & (POLLIN | POLLPRI | POLLRDHUP)) {
+                event |= pico::IOManager::READ;
+            }
+            if (fds[i].events & POLLOUT) {
+                event |= pico::IOManager::WRITE;
+            }
+            // 只关注错误和挂断时也按读等待, epoll总会报告这两类事件
+            interests.push_back(std::make_pair(fds[i].fd, event ? event : pico::IOManager::READ));
+        }
+        std::sort(interests.begin(), interests.end());
+
+        pico::FiberWaiter::Ptr waiter = std::make_shared<pico::FiberWaiter>(wait);
+        auto cb = [waiter]() {
+            if (waiter->notify()) {
+                waiter->wake();
+            }
+        };
+        std::vector<std::pair<int, pico::IOManager::Event>> added;
+        bool ok = true;
+        for (size_t i = 0; i < interests.size() && ok; ++i) {
+            int fd = interests[i].first;
+            uint32_t event = interests[i].second;
+            while (i + 1 < interests.size() && interests[i + 1].first == fd) {
+                event |= interests[++i].second;
+            }
+            // 创建FdCtx, 第三方库通过hook的close关闭时会清理登记
+            pico::FdMgr::getInstance()->getFdCtx(fd, true);
+            for (pico::IOManager::Event ev : {pico::IOManager::READ, pico::IOManager::WRITE}) {
+                if (!(event & ev)) {
+                    continue;
+                }
+                if (iom->addEvent(fd, ev, cb)) {
+                    ok = false;
+                    break;
+                }
+                added.push_back(std::make_pair(fd, ev));
+            }
+        }
+        if (!ok) {
+            for (auto& i : added) {
+                iom->delEvent(i.first, i.second);
+            }
+            // 撤销之前已经触发的登记会唤醒本协程, 先消费这次唤醒, 然后立即重新检查
+            if (!waiter->notify()) {
+                waiter->park();
+                continue;
+            }
+            retry = std::min(retry ? retry * 2 : 1, kPollRetryMaxMs);
+            fiber_sleep(iom, std::min(retry, wait));
+            continue;
+        }
+
+        waiter->park();
+        // 已经触发的事件在触发时被移除, delEvent返回false
+        for (auto& i : added) {
+            iom->delEvent(i.first, i.second);
+        }
+    }
+}
+
+/**
+ * @brief 普通文件总是就绪, epoll无法等待; io_uring后端下提交带偏移的读写, 挂起协程而不阻塞线程
+ * @details 请求不占用fd的等待位, 同一文件可以被多个协程同时读写
+ */
+template <typename OriginFun, typename Buf>
+static ssize_t do_file_io(int fd, OriginFun origin_fun, uint8_t opcode, Buf buf, size_t count,
+                          off_t offset) {
+    pico::IOManager* iom = parkable_iomanager();
+    if (!iom || !iom->isUring() || fd < 0 || pico::Fiber::GetThis()->isSharedStack()) {
+        return origin_fun(fd, buf, count, offset);
+    }
+    io_uring_sqe sqe;
+    pico::IOUring::Prep(sqe, opcode, fd, buf, uring_len(count), offset);
+    int res = iom->submitRequest(fd, pico::IOManager::NONE, sqe);
+    if (res < 0) {
+        current_errno() = -res;
+        return -1;
+    }
+    return res;
+}
 
 extern "C" {
 #define XX(name) name##_fun name##_f = nullptr;
@@ -149,27 +388,154 @@ HOOK_FUN(XX);
 #undef XX
 
 unsigned int sleep(unsigned int seconds) {
-    if (!pico::is_hook_enable()) {
-        return sleep_f(seconds);
-    }
-
-    pico::Fiber::Ptr fiber = pico::Fiber::GetThis();
-    pico::IOManager* io_manager = pico::IOManager::GetThis();
-    if (!fiber || !io_manager) {
+    pico::IOManager* iom = parkable_iomanager();
+    if (!iom) {
         // No IOManager in current thread, cannot park fiber via timer.
         return sleep_f(seconds);
     }
+    fiber_sleep(iom, (uint64_t)seconds * 1000);
+    return 0;
+}
 
-    io_manager->addTimer(seconds * 1000,
-                         std::bind((void (pico::IOManager::*)(pico::Fiber::Ptr, int thread))&pico::IOManager::schedule,
-                                   io_manager,
-                                   fiber,
-                                   -1));
-    pico::Fiber::yieldToHold();
+int usleep(useconds_t usec) {
+    pico::IOManager* iom = parkable_iomanager();
+    if (!iom || usec == 0) {
+        return usleep_f(usec);
+    }
+    // 定时器精度为毫秒, 向上取整保证至少睡眠请求的时长
+    fiber_sleep(iom, ((uint64_t)usec + 999) / 1000);
+    return 0;
+}
 
+int nanosleep(const struct timespec* req, struct timespec* rem) {
+    pico::IOManager* iom = parkable_iomanager();
+    if (!iom || !req) {
+        return nanosleep_f(req, rem);
+    }
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t ms = (uint64_t)req->tv_sec * 1000 + ((uint64_t)req->tv_nsec + 999999) / 1000000;
+    if (ms) {
+        fiber_sleep(iom, ms);
+    }
+    if (rem) {
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
+    }
     return 0;
 }
 
+int poll(struct pollfd* fds, nfds_t nfds, int timeout) {
+    pico::IOManager* iom = parkable_iomanager();
+    if (!iom || timeout == 0) {
+        return poll_f(fds, nfds, timeout);
+    }
+    return do_poll(iom, fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds,
+           struct timeval* timeout) {
+    pico::IOManager* iom = parkable_iomanager();
+    if (!iom || nfds < 0 || nfds > FD_SETSIZE ||
+        (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0)) {
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    int ms = -1;
+    if (timeout) {
+        uint64_t t = (uint64_t)timeout->tv_sec * 1000 + ((uint64_t)timeout->tv_usec + 999) / 1000;
+        ms = t > INT_MAX ? INT_MAX : (int)t;
+    }
+
+    std::vector<struct pollfd> pfds;
+    for (int fd = 0; fd < nfds; ++fd) {
+        short events = 0;
+        if (readfds && FD_ISSET(fd, readfds)) {
+            events |= POLLIN;
+        }
+        if (writefds && FD_ISSET(fd, writefds)) {
+            events |= POLLOUT;
+        }
+        if (exceptfds && FD_ISSET(fd, exceptfds)) {
+            events |= POLLPRI;
+        }
+        if (events) {
+            struct pollfd pfd = {fd, events, 0};
+            pfds.push_back(pfd);
+        }
+    }
+
+    uint64_t start = pico::getCurrentTime();
+    int rt = do_poll(iom, pfds.data(), pfds.size(), ms);
+    if (rt < 0) {
+        return rt;
+    }
+    for (auto& pfd : pfds) {
+        if (pfd.revents & POLLNVAL) {
+            current_errno() = EBADF;
+            return -1;
+        }
+    }
+    // 与内核相同, 可读包括挂断和错误, 可写包括错误, 返回值按集合中置位的总数计算
+    int count = 0;
+    for (auto& pfd : pfds) {
+        bool r = readfds && FD_ISSET(pfd.fd, readfds) && (pfd.revents & (POLLIN | POLLHUP | POLLERR));
+        bool w = writefds && FD_ISSET(pfd.fd, writefds) && (pfd.revents & (POLLOUT | POLLERR));
+        bool e = exceptfds && FD_ISSET(pfd.fd, exceptfds) && (pfd.revents & POLLPRI);
+        if (readfds && !r) {
+            FD_CLR(pfd.fd, readfds);
+        }
+        if (writefds && !w) {
+            FD_CLR(pfd.fd, writefds);
+        }
+        if (exceptfds && !e) {
+            FD_CLR(pfd.fd, exceptfds);
+        }
+        count += r + w + e;
+    }
+    // Linux的select会把剩余时间写回timeout
+    if (timeout) {
+        uint64_t elapsed = pico::getCurrentTime() - start;
+        uint64_t left = elapsed >= (uint64_t)ms ? 0 : ms - elapsed;
+        timeout->tv_sec = left / 1000;
+        timeout->tv_usec = left % 1000 * 1000;
+    }
+    return count;
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+    pico::IOManager* iom = parkable_iomanager();
+    if (!iom || timeout == 0) {
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+    // epoll fd本身可以被poll, 有事件就绪时可读
+    uint64_t deadline = timeout < 0 ? ~0ull : pico::getCurrentTime() + timeout;
+    while (true) {
+        int rt = epoll_wait_f(epfd, events, maxevents, 0);
+        if (rt != 0) {
+            return rt;
+        }
+        int wait = -1;
+        if (deadline != ~0ull) {
+            uint64_t now = pico::getCurrentTime();
+            if (now >= deadline) {
+                return 0;
+            }
+            wait = deadline - now;
+        }
+        struct pollfd pfd = {epfd, POLLIN, 0};
+        rt = do_poll(iom, &pfd, 1, wait);
+        if (rt <= 0) {
+            return rt;
+        }
+    }
+}
+
 int connect_with_timeout(int sockfd, const struct sockaddr* addr, socklen_t addrlen,
                          uint64_t timeout) {
     if (!pico::is_hook_enable()) {
@@ -190,6 +556,14 @@ int connect_with_timeout(int sockfd, const struct sockaddr* addr, socklen_t addr
         return connect_f(sockfd, addr, addrlen);
     }
 
+    pico::IOManager* iom = pico::IOManager::GetThis();
+    if (iom && iom->isUring() && !pico::Fiber::GetThis()->isSharedStack()) {
+        auto prep = [&](io_uring_sqe& sqe) {
+            pico::IOUring::Prep(sqe, IORING_OP_CONNECT, sockfd, addr, 0, addrlen);
+        };
+        return do_uring_io(iom, ctx, sockfd, pico::IOManager::WRITE, timeout, prep);
+    }
+
     int n = connect_f(sockfd, addr, addrlen);
     if (n == 0) {
         return 0;
@@ -197,24 +571,8 @@ int connect_with_timeout(int sockfd, const struct sockaddr* addr, socklen_t addr
         return n;
     }
 
-    pico::IOManager* iom = pico::IOManager::GetThis();
-    pico::Timer::Ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    if (timeout != (uint64_t)-1) {
-        timer = iom->addCondTimer(
-            timeout,
-            [winfo, sockfd, iom]() {
-                auto t = winfo.lock();
-                if (!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                iom->cancelEvent(sockfd, pico::IOManager::WRITE);
-            },
-            winfo);
-    }
+    pico::Timer::Ptr timer = add_timeout_timer(iom, sockfd, pico::IOManager::WRITE, timeout, tinfo);
 
     int rt = iom->addEvent(sockfd, pico::IOManager::WRITE);
     if (rt == 0) {
@@ -223,7 +581,7 @@ int connect_with_timeout(int sockfd, const struct sockaddr* addr, socklen_t addr
             timer->cancel();
         }
         if (tinfo->cancelled) {
-            errno = tinfo->cancelled;
+            current_errno() = tinfo->cancelled;
             return -1;
         }
     } else {
@@ -241,7 +599,7 @@ int connect_with_timeout(int sockfd, const struct sockaddr* addr, socklen_t addr
     if (!error) {
         return 0;
     } else {
-        errno = error;
+        current_errno() = error;
         return -1;
     }
 }
@@ -255,71 +613,176 @@ int socket(int domain, int type, int protocol) {
         return socket_f(domain, type, protocol);
     }
 
-    int fd = socket_f(domain, type, protocol);
+    // 创建时直接设为非阻塞, 省去FdCtx初始化中的fstat和两次fcntl
+    int fd = socket_f(domain, type | SOCK_NONBLOCK, protocol);
     if (fd == -1) {
         return fd;
     }
-    pico::FdMgr::getInstance()->getFdCtx(fd, true);
+    pico::FdMgr::getInstance()->addSocket(fd, type & SOCK_NONBLOCK);
     return fd;
 }
 
 int accept(int sockfd, struct sockaddr* addr, socklen_t* addrlen) {
-    int fd = do_io(sockfd, accept_f, "accept", pico::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    return accept4(sockfd, addr, addrlen, 0);
+}
+
+int accept4(int sockfd, struct sockaddr* addr, socklen_t* addrlen, int flags) {
+    if (!pico::is_hook_enable()) {
+        int fd = accept4_f(sockfd, addr, addrlen, flags);
+        if (fd >= 0) {
+            // 先丢弃同一fd号上一个使用者绕过hook关闭后残留的记录, 再按实际状态重建
+            pico::FdMgr::getInstance()->delFdCtx(fd);
+            pico::FdCtx::Ptr ctx = pico::FdMgr::getInstance()->getFdCtx(fd, true);
+            if (ctx) { ctx->setUserNonBlock(flags & SOCK_NONBLOCK); }
+        }
+        return fd;
+    }
+    // 接受的连接在内核中直接设为非阻塞, 用户是否要求非阻塞只记录在FdCtx中
+    int sys_flags = flags | SOCK_NONBLOCK;
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_ACCEPT, sockfd, addr, 0, (uint64_t)(uintptr_t)addrlen);
+        sqe.accept_flags = sys_flags;
+    };
+    int fd = do_io(sockfd, accept4_f, "accept4", pico::IOManager::READ, SO_RCVTIMEO, prep, addr,
+                   addrlen, sys_flags);
     if (fd >= 0) {
-        pico::FdMgr::getInstance()->getFdCtx(fd, true);
+        pico::FdMgr::getInstance()->addSocket(fd, flags & SOCK_NONBLOCK);
     }
     return fd;
 }
 
+// hook的fd都是socket, io_uring后端中read/write按recv/send提交, 向量和带地址的读写按msghdr提交
+
 ssize_t read(int fd, void* buf, size_t count) {
-    return do_io(fd, read_f, "read", pico::IOManager::READ, SO_RCVTIMEO, buf, count);
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_RECV, fd, buf, uring_len(count), 0);
+    };
+    return do_io(fd, read_f, "read", pico::IOManager::READ, SO_RCVTIMEO, prep, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
-    return do_io(fd, readv_f, "readv", pico::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = iovcnt;
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_RECVMSG, fd, &msg, 1, 0);
+    };
+    return do_io(fd, readv_f, "readv", pico::IOManager::READ, SO_RCVTIMEO, prep, iov, iovcnt);
 }
 
 ssize_t recv(int fd, void* buf, size_t len, int flags) {
-    return do_io(fd, recv_f, "recv", pico::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_RECV, fd, buf, uring_len(len), 0);
+        sqe.msg_flags = flags;
+    };
+    return do_io(fd, recv_f, "recv", pico::IOManager::READ, SO_RCVTIMEO, prep, buf, len, flags);
 }
 
 ssize_t recvfrom(int fd, void* buf, size_t len, int flags, struct sockaddr* src_addr,
                  socklen_t* addrlen) {
-    return do_io(fd,
-                 recvfrom_f,
-                 "recvfrom",
+    struct iovec iov = {buf, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = src_addr;
+    msg.msg_namelen = src_addr && addrlen ? *addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    bool uring = false;
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_RECVMSG, fd, &msg, 1, 0);
+        sqe.msg_flags = flags;
+        uring = true;
+    };
+    ssize_t n = do_io(fd,
+                      recvfrom_f,
+                      "recvfrom",
+                      pico::IOManager::READ,
+                      SO_RCVTIMEO,
+                      prep,
+                      buf,
+                      len,
+                      flags,
+                      src_addr,
+                      addrlen);
+    if (uring && n >= 0 && src_addr && addrlen) {
+        *addrlen = msg.msg_namelen;
+    }
+    return n;
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_RECVMSG, sockfd, msg, 1, 0);
+        sqe.msg_flags = flags;
+    };
+    return do_io(
+        sockfd, recvmsg_f, "recvmsg", pico::IOManager::READ, SO_RCVTIMEO, prep, msg, flags);
+}
+
+int recvmmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags,
+             struct timespec* timeout) {
+    return do_io(sockfd,
+                 recvmmsg_f,
+                 "recvmmsg",
                  pico::IOManager::READ,
                  SO_RCVTIMEO,
-                 buf,
-                 len,
+                 epoll_only(),
+                 msgvec,
+                 vlen,
                  flags,
-                 src_addr,
-                 addrlen);
+                 timeout);
 }
 
-ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmmsg", pico::IOManager::READ, SO_RCVTIMEO, msg, flags);
+ssize_t pread(int fd, void* buf, size_t count, off_t offset) {
+    return do_file_io(fd, pread_f, IORING_OP_READ, buf, count, offset);
 }
 
 ssize_t write(int fd, const void* buf, size_t count) {
-    return do_io(fd, write_f, "write", pico::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_SEND, fd, buf, uring_len(count), 0);
+    };
+    return do_io(fd, write_f, "write", pico::IOManager::WRITE, SO_SNDTIMEO, prep, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
-    return do_io(fd, write_f, "writev", pico::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = iovcnt;
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_SENDMSG, fd, &msg, 1, 0);
+    };
+    return do_io(fd, writev_f, "writev", pico::IOManager::WRITE, SO_SNDTIMEO, prep, iov, iovcnt);
 }
 
 ssize_t send(int fd, const void* buf, size_t len, int flags) {
-    return do_io(fd, send_f, "send", pico::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_SEND, fd, buf, uring_len(len), 0);
+        sqe.msg_flags = flags;
+    };
+    return do_io(fd, send_f, "send", pico::IOManager::WRITE, SO_SNDTIMEO, prep, buf, len, flags);
 }
 
 ssize_t sendto(int fd, const void* buf, size_t len, int flags, const struct sockaddr* dest_addr,
                socklen_t addrlen) {
+    struct iovec iov = {(void*)buf, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void*)dest_addr;
+    msg.msg_namelen = dest_addr ? addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_SENDMSG, fd, &msg, 1, 0);
+        sqe.msg_flags = flags;
+    };
     return do_io(fd,
                  sendto_f,
                  "sendto",
                  pico::IOManager::WRITE,
                  SO_SNDTIMEO,
+                 prep,
                  buf,
                  len,
                  flags,
@@ -328,7 +791,28 @@ ssize_t sendto(int fd, const void* buf, size_t len, int flags, const struct sock
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr* msg, int flags) {
-    return do_io(sockfd, sendmsg_f, "sendmsg", pico::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    auto prep = [&](io_uring_sqe& sqe) {
+        pico::IOUring::Prep(sqe, IORING_OP_SENDMSG, sockfd, msg, 1, 0);
+        sqe.msg_flags = flags;
+    };
+    return do_io(
+        sockfd, sendmsg_f, "sendmsg", pico::IOManager::WRITE, SO_SNDTIMEO, prep, msg, flags);
+}
+
+int sendmmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags) {
+    return do_io(sockfd,
+                 sendmmsg_f,
+                 "sendmmsg",
+                 pico::IOManager::WRITE,
+                 SO_SNDTIMEO,
+                 epoll_only(),
+                 msgvec,
+                 vlen,
+                 flags);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    return do_file_io(fd, pwrite_f, IORING_OP_WRITE, buf, count, offset);
 }
 
 int close(int fd) {
@@ -342,8 +826,9 @@ int close(int fd) {
         if (!iom) {
             return close_f(fd);
         }
-        iom->cancelAll(fd);
+        // 先移除FdCtx, 被取消的io_uring请求据此判断fd已关闭而不再重新提交
         pico::FdMgr::getInstance()->delFdCtx(fd);
+        iom->cancelAll(fd);
     }
     return close_f(fd);
 }
@@ -446,6 +931,15 @@ int getsockopt(int sockfd, int level, int optname, void* optval, socklen_t* optl
     return getsockopt_f(sockfd, level, optname, optval, optlen);
 }
 
+int getaddrinfo(const char* node, const char* service, const struct addrinfo* hints,
+                struct addrinfo** res) {
+    if (!pico::is_hook_enable()) {
+        return getaddrinfo_f(node, service, hints, res);
+    }
+    // 在协程中通过hook的UDP查询并缓存结果, 不阻塞调度线程
+    return pico::DnsResolver::getInstance()->getaddrinfo(node, service, hints, res);
+}
+
 int ioctl(int fd, unsigned long request, ...) {
     va_list va;
     va_start(va, request);
@@ -4,13 +4,18 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -23,6 +28,19 @@ extern "C" {
 // sleep
 typedef unsigned int (*sleep_fun)(unsigned int seconds);
 extern sleep_fun sleep_f;
+typedef int (*usleep_fun)(useconds_t usec);
+extern usleep_fun usleep_f;
+typedef int (*nanosleep_fun)(const struct timespec* req, struct timespec* rem);
+extern nanosleep_fun nanosleep_f;
+
+// poll
+typedef int (*poll_fun)(struct pollfd* fds, nfds_t nfds, int timeout);
+extern poll_fun poll_f;
+typedef int (*select_fun)(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds,
+                          struct timeval* timeout);
+extern select_fun select_f;
+typedef int (*epoll_wait_fun)(int epfd, struct epoll_event* events, int maxevents, int timeout);
+extern epoll_wait_fun epoll_wait_f;
 
 // socket
 typedef int (*socket_fun)(int domain, int type, int protocol);
@@ -31,6 +49,8 @@ typedef int (*connect_fun)(int sockfd, const struct sockaddr* addr, socklen_t ad
 extern connect_fun connect_f;
 typedef int (*accept_fun)(int sockfd, struct sockaddr* addr, socklen_t* addrlen);
 extern accept_fun accept_f;
+typedef int (*accept4_fun)(int sockfd, struct sockaddr* addr, socklen_t* addrlen, int flags);
+extern accept4_fun accept4_f;
 
 // read
 typedef ssize_t (*read_fun)(int fd, void* buf, size_t count);
@@ -44,6 +64,11 @@ typedef ssize_t (*recvfrom_fun)(int sockfd, void* buf, size_t len, int flags,
 extern recvfrom_fun recvfrom_f;
 typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr* msg, int flags);
 extern recvmsg_fun recvmsg_f;
+typedef int (*recvmmsg_fun)(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags,
+                            struct timespec* timeout);
+extern recvmmsg_fun recvmmsg_f;
+typedef ssize_t (*pread_fun)(int fd, void* buf, size_t count, off_t offset);
+extern pread_fun pread_f;
 
 // write
 typedef ssize_t (*write_fun)(int fd, const void* buf, size_t count);
@@ -57,6 +82,10 @@ typedef ssize_t (*sendto_fun)(int sockfd, const void* buf, size_t len, int flags
 extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int sockfd, const struct msghdr* msg, int flags);
 extern sendmsg_fun sendmsg_f;
+typedef int (*sendmmsg_fun)(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags);
+extern sendmmsg_fun sendmmsg_f;
+typedef ssize_t (*pwrite_fun)(int fd, const void* buf, size_t count, off_t offset);
+extern pwrite_fun pwrite_f;
 
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
@@ -73,6 +102,11 @@ extern setsockopt_fun setsockopt_f;
 typedef int (*getsockopt_fun)(int sockfd, int level, int optname, void* optval, socklen_t* optlen);
 extern getsockopt_fun getsockopt_f;
 
+// dns
+typedef int (*getaddrinfo_fun)(const char* node, const char* service, const struct addrinfo* hints,
+                               struct addrinfo** res);
+extern getaddrinfo_fun getaddrinfo_f;
+
 extern int connect_with_timeout(int sockfd, const struct sockaddr* addr, socklen_t addrlen,
                                 uint64_t timeout);
 }   // extern "C"
@@ -1,5 +1,9 @@
 #include "http.h"
 
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
 #include <iostream>
 #include <sstream>
 
@@ -7,10 +11,10 @@
 #include "pico/mustache.h"
 
 namespace pico {
-HttpMethod http_method_from_string(const std::string& method) {
-#define XX(num, name, string)                   \
-    if (strcmp(#string, method.c_str()) == 0) { \
-        return HttpMethod::name;                \
+HttpMethod http_method_from_string(const StringView& method) {
+#define XX(num, name, string)    \
+    if (method == #string) {     \
+        return HttpMethod::name; \
     }
     HTTP_METHOD_MAP(XX);
 #undef XX
@@ -40,17 +44,98 @@ const char* http_status_to_string(HttpStatus status) {
     }
 }
 
+/// 由定时器更新的秒数, 为0时没有服务器在运行
+static std::atomic<time_t> s_date_clock = {0};
+static std::atomic<int> s_date_clock_users = {0};
+
+StringView HttpDateClock::Now() {
+    static const char* const s_days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char* const s_months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                           "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    static thread_local time_t t_sec = 0;
+    static thread_local char t_buf[32];
+    static thread_local int t_len = 0;
+
+    time_t now = s_date_clock.load(std::memory_order_relaxed);
+    if (now == 0) { now = time(nullptr); }
+    if (now != t_sec) {
+        // 不使用strftime, 星期和月份的名字不受locale影响
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        t_len = snprintf(t_buf, sizeof(t_buf), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                         s_days[tm.tm_wday], tm.tm_mday, s_months[tm.tm_mon], tm.tm_year + 1900,
+                         tm.tm_hour, tm.tm_min, tm.tm_sec);
+        t_sec = now;
+    }
+    return StringView(t_buf, t_len);
+}
+
+void HttpDateClock::Tick() {
+    if (s_date_clock_users.load(std::memory_order_relaxed) > 0) {
+        s_date_clock.store(time(nullptr), std::memory_order_relaxed);
+    }
+}
+
+void HttpDateClock::Acquire() {
+    ++s_date_clock_users;
+    Tick();
+}
+
+void HttpDateClock::Release() {
+    if (--s_date_clock_users == 0) { s_date_clock.store(0, std::memory_order_relaxed); }
+}
+
+HttpHeaderBlock::HttpHeaderBlock(const HeaderList& headers, bool date)
+    : m_headers(headers), m_date(date) {
+    for (auto& i : m_headers) {
+        m_rendered += i.first;
+        m_rendered += ": ";
+        m_rendered += i.second;
+        m_rendered += "\r\n";
+    }
+}
+
+void HttpHeaderBlock::appendTo(
+    std::string& out, const std::map<std::string, std::string, CaseInsensitiveLess>& overrides) const {
+    if (m_date && overrides.find("Date") == overrides.end()) {
+        StringView date = HttpDateClock::Now();
+        out.append("Date: ", 6);
+        out.append(date.data(), date.size());
+        out.append("\r\n", 2);
+    }
+    bool overridden = false;
+    for (auto& i : m_headers) {
+        if (overrides.find(i.first) != overrides.end()) {
+            overridden = true;
+            break;
+        }
+    }
+    if (!overridden) {
+        out += m_rendered;
+        return;
+    }
+    for (auto& i : m_headers) {
+        if (overrides.find(i.first) != overrides.end()) { continue; }
+        out += i.first;
+        out.append(": ", 2);
+        out += i.second;
+        out.append("\r\n", 2);
+    }
+}
+
 HttpRequest::HttpRequest(const std::string& version, bool is_close)
-    : m_is_close(is_close), m_websocket(false), m_method(HttpMethod::GET), m_path("/"), m_version(version), m_parserParamFlag(0) {}
+    : m_is_close(is_close), m_websocket(false), m_method(HttpMethod::GET), m_parserParamFlag(0) {
+    m_view.setVersion(version);
+    m_view.setPath("/");
+}
 
 void HttpRequest::init() {
-    std::string conn = get_header("connection");
-    if (!conn.empty()) {
-        if (strcasecmp(conn.c_str(), "keep-alive") == 0) {
-            m_is_close = false;
-        } else {
-            m_is_close = true;
-        }
+    StringView conn;
+    if (m_view.getHeader(HttpRequestView::CONNECTION, &conn) && !conn.empty()) {
+        m_is_close = !conn.iequals("keep-alive");
+    } else {
+        // HTTP/1.1默认保持连接, 流水线请求依赖于此
+        m_is_close = m_view.version() != "HTTP/1.1";
     }
 }
 
@@ -83,7 +168,8 @@ void HttpRequest::initQueryParam() {
         ++pos;                                                                                     \
     } while (true);
 
-    PARSE_PARAM(m_query, m_params, '&', );
+    std::string query = m_view.query().to_string();
+    PARSE_PARAM(query, m_params, '&', );
     m_parserParamFlag |= 0x1;
 }
 
@@ -114,11 +200,11 @@ void HttpRequest::initCookies() {
 }
 
 std::string HttpRequest::get_header(const std::string& key, const std::string& def) {
-    auto it = m_headers.find(key);
-    if (it == m_headers.end()) {
+    StringView value;
+    if (!m_view.getHeader(key, &value)) {
         return def;
     }
-    return it->second;
+    return value.to_string();
 }
 
 std::string HttpRequest::get_param(const std::string& key, const std::string& def) {
@@ -153,7 +239,7 @@ std::string HttpRequest::get_token() {
 }
 
 void HttpRequest::set_header(const std::string& key, const std::string& value) {
-    m_headers[key] = value;
+    m_view.setHeader(key, value);
 }
 
 void HttpRequest::set_param(const std::string& key, const std::string& value) {
@@ -166,7 +252,7 @@ void HttpRequest::set_cookie(const std::string& key, const std::string& value) {
 
 void HttpRequest::set_token(const std::string& token) {
     if (token.empty()) {
-        m_headers.erase("Authorization");
+        m_view.delHeader("Authorization");
         return;
     }
     set_header("Authorization", "Bearer " + token);
@@ -189,7 +275,7 @@ tools::HttpSession::Ptr HttpRequest::get_session() {
 }
 
 void HttpRequest::del_header(const std::string& key) {
-    m_headers.erase(key);
+    m_view.delHeader(key);
 }
 
 void HttpRequest::del_param(const std::string& key) {
@@ -201,12 +287,12 @@ void HttpRequest::del_cookie(const std::string& key) {
 }
 
 bool HttpRequest::has_header(const std::string& key, std::string* value) {
-    auto it = m_headers.find(key);
-    if (it == m_headers.end()) {
+    StringView found;
+    if (!m_view.getHeader(key, &found)) {
         return false;
     }
     if (value != nullptr) {
-        *value = it->second;
+        *value = found.to_string();
     }
     return true;
 }
@@ -238,16 +324,19 @@ bool HttpRequest::has_cookie(const std::string& key, std::string* value) {
 
 std::string HttpRequest::to_string() const {
     std::stringstream ss;
-    ss << http_method_to_string(m_method) << " " << m_path << (m_query.empty() ? "" : "?")
-       << m_query << (m_fragment.empty() ? "" : "#") << m_fragment << " " << m_version << "\r\n";
+    StringView query = m_view.query();
+    StringView fragment = m_view.fragment();
+    ss << http_method_to_string(m_method) << " " << m_view.path() << (query.empty() ? "" : "?")
+       << query << (fragment.empty() ? "" : "#") << fragment << " " << m_view.version() << "\r\n";
     if (!m_websocket) {
         ss << "connection: " << (m_is_close ? "close" : "keep-alive") << "\r\n";
     }
-    for (auto& i : m_headers) {
-        if (!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
+    for (size_t i = 0; i < m_view.headerCount(); ++i) {
+        StringView name = m_view.headerName(i);
+        if (!m_websocket && name.iequals("connection")) {
             continue;
         }
-        ss << i.first << ": " << i.second << "\r\n";
+        ss << name << ": " << m_view.headerValue(i) << "\r\n";
     }
 
     if (!m_body.empty()) {
@@ -340,32 +429,96 @@ void HttpResponse::write(const Json::Value& json) {
     set_header("Content-Type", "application/json");
 }
 
-std::string HttpResponse::to_string() const {
-    std::stringstream ss;
-    ss << m_version << " " << (uint32_t)m_status << " "
-       << (m_reason.empty() ? http_status_to_string(m_status) : m_reason) << "\r\n";
+/**
+ * @brief 预先生成的HTTP/1.1状态行, 下标为状态码, 不在状态表中的为空
+ */
+static const std::string& http11_status_line(HttpStatus status) {
+    struct StatusLines
+    {
+        StatusLines() : lines(600) {
+#define XX(code, name, msg) lines[code] = "HTTP/1.1 " #code " " #msg "\r\n";
+            HTTP_STATUS_MAP(XX);
+#undef XX
+        }
+        std::vector<std::string> lines;
+    };
+    static const StatusLines s_status_lines;
+    static const std::string s_empty;
+    size_t code = (size_t)status;
+    return code < s_status_lines.lines.size() ? s_status_lines.lines[code] : s_empty;
+}
+
+static void append_uint(std::string& out, uint64_t value) {
+    char buf[20];
+    char* p = buf + sizeof(buf);
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    out.append(p, buf + sizeof(buf) - p);
+}
+
+#define APPEND_LITERAL(out, str) (out).append(str, sizeof(str) - 1)
+
+void HttpResponse::serialize_head(std::string& out) const {
+    const std::string* line = nullptr;
+    if (m_reason.empty() && m_version == "HTTP/1.1") {
+        line = &http11_status_line(m_status);
+    }
+    if (line && !line->empty()) {
+        out += *line;
+    } else {
+        out += m_version;
+        out += ' ';
+        append_uint(out, (uint32_t)m_status);
+        out += ' ';
+        out += m_reason.empty() ? http_status_to_string(m_status) : m_reason.c_str();
+        APPEND_LITERAL(out, "\r\n");
+    }
+    if (m_headerBlock) {
+        m_headerBlock->appendTo(out, m_headers);
+    }
     for (auto& i : m_headers) {
         if (!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
             continue;
         }
-        ss << i.first << ": " << i.second << "\r\n";
+        out += i.first;
+        APPEND_LITERAL(out, ": ");
+        out += i.second;
+        APPEND_LITERAL(out, "\r\n");
     }
     for (auto& i : m_cookies) {
-        ss << "Set-Cookie: " << i << "\r\n";
+        APPEND_LITERAL(out, "Set-Cookie: ");
+        out += i;
+        APPEND_LITERAL(out, "\r\n");
     }
     if (!m_websocket) {
-        ss << "connection: " << (m_is_close ? "close" : "keep-alive") << "\r\n";
-    }
-    if (!m_body.empty()) {
-        if (m_headers.find("content-length") == m_headers.end()) {
-            ss << "content-length: " << m_body.size() << "\r\n";
+        if (m_is_close) {
+            APPEND_LITERAL(out, "connection: close\r\n");
+        } else {
+            APPEND_LITERAL(out, "connection: keep-alive\r\n");
         }
-        ss << "\r\n"
-           << m_body;
-    } else {
-        ss << "\r\n";
     }
-    return ss.str();
+    // 保持连接时客户端只能依靠长度判断响应结束, 空响应体也要写出长度;
+    // 1xx/204/304不能带响应体
+    uint32_t code = (uint32_t)m_status;
+    bool framed = !m_body.empty() || (!m_is_close && code >= 200 && code != 204 && code != 304);
+    if (framed && m_headers.find("content-length") == m_headers.end()) {
+        APPEND_LITERAL(out, "content-length: ");
+        append_uint(out, m_body.size());
+        APPEND_LITERAL(out, "\r\n");
+    }
+    APPEND_LITERAL(out, "\r\n");
+}
+
+#undef APPEND_LITERAL
+
+std::string HttpResponse::to_string() const {
+    std::string str;
+    str.reserve(256 + m_body.size());
+    serialize_head(str);
+    str += m_body;
+    return str;
 }
 
 } // namespace pico
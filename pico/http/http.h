@@ -14,6 +14,7 @@
 // #include "pico/mustache.h"
 
 #include "../session.h"
+#include "http_view.h"
 
 namespace pico {
 
@@ -145,7 +146,7 @@ enum class HttpMethod
         INVALID_METHOD = -1
 };
 
-HttpMethod http_method_from_string(const std::string& method);
+HttpMethod http_method_from_string(const StringView& method);
 const char* http_method_to_string(HttpMethod method);
 
 const char* http_status_to_string(HttpStatus status);
@@ -157,6 +158,60 @@ struct CaseInsensitiveLess
     }
 };
 
+/**
+ * @brief 响应Date头使用的时钟
+ * @details 每个线程缓存格式化后的日期, 秒数变化后才重新格式化. 有服务器运行期间秒数由其
+ *          IOManager上每秒触发一次的定时器更新, 取时间不需要系统调用; 没有时直接调用time()
+ */
+class HttpDateClock
+{
+public:
+    /**
+     * @brief 当前时间的HTTP日期, 如"Sun, 06 Nov 1994 08:49:37 GMT"
+     * @return 指向线程缓存, 在本线程下次调用前有效
+     */
+    static StringView Now();
+    /**
+     * @brief 更新时钟, 由定时器每秒调用
+     */
+    static void Tick();
+    /**
+     * @brief 服务器启动时调用, 之后由其定时器驱动时钟, 停止时调用Release
+     */
+    static void Acquire();
+    static void Release();
+};
+
+/**
+ * @brief 预先渲染的固定响应头, 同一服务器的所有响应共用
+ * @details 响应自己设置了同名的头时以响应的为准, 此时逐个输出其余的头
+ */
+class HttpHeaderBlock
+{
+public:
+    typedef std::shared_ptr<const HttpHeaderBlock> Ptr;
+    typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+
+    /**
+     * @param[in] date 是否同时输出Date头
+     */
+    HttpHeaderBlock(const HeaderList& headers, bool date = true);
+
+    const HeaderList& getHeaders() const { return m_headers; }
+
+    /**
+     * @brief 把固定响应头追加到out
+     * @param[in] overrides 响应自己设置的头
+     */
+    void appendTo(std::string& out,
+                  const std::map<std::string, std::string, CaseInsensitiveLess>& overrides) const;
+
+private:
+    HeaderList m_headers;
+    std::string m_rendered;
+    bool m_date;
+};
+
 enum http_parser_type
 {
     HTTP_REQUEST,
@@ -172,11 +227,11 @@ public:
     HttpRequest(const std::string& version = "HTTP/1.1", bool is_close = true);
 
     // getter
-    std::string get_version() const { return m_version; }
+    std::string get_version() const { return m_view.version().to_string(); }
     HttpMethod get_method() const { return m_method; }
-    std::string get_path() const { return m_path; }
-    std::string get_query() const { return m_query; }
-    std::string get_fragment() const { return m_fragment; }
+    std::string get_path() const { return m_view.path().to_string(); }
+    std::string get_query() const { return m_view.query().to_string(); }
+    std::string get_fragment() const { return m_view.fragment().to_string(); }
     std::string get_body() const { return m_body; }
     std::string get_header(const std::string& key, const std::string& def = "");
     std::string get_param(const std::string& key, const std::string& def = "");
@@ -186,11 +241,11 @@ public:
     MapType get_params() const { return m_params; }
 
     // setter
-    void set_version(const std::string& version) { m_version = version; }
+    void set_version(const std::string& version) { m_view.setVersion(version); }
     void set_method(HttpMethod method) { m_method = method; }
-    void set_path(const std::string& path) { m_path = path; }
-    void set_query(const std::string& query) { m_query = query; }
-    void set_fragment(const std::string& fragment) { m_fragment = fragment; }
+    void set_path(const std::string& path) { m_view.setPath(path); }
+    void set_query(const std::string& query) { m_view.setQuery(query); }
+    void set_fragment(const std::string& fragment) { m_view.setFragment(fragment); }
     void set_body(const std::string& body) { m_body = body; }
     void set_header(const std::string& key, const std::string& value);
     void set_param(const std::string& key, const std::string& value);
@@ -223,6 +278,12 @@ public:
     bool is_websocket() const { return m_websocket; }
     void set_websocket(bool is_websocket) { m_websocket = is_websocket; }
 
+    /**
+     * @brief 请求行和请求头的视图, 字段指向请求自己保存的原始请求头, 读取时不复制
+     */
+    const HttpRequestView& view() const { return m_view; }
+    HttpRequestView& view() { return m_view; }
+
     std::string to_string() const;
 
     void init();
@@ -235,11 +296,7 @@ private:
     bool m_is_close;
     bool m_websocket;
     HttpMethod m_method;
-    std::string m_path;
-    std::string m_query;
-    std::string m_fragment;
-    std::string m_version;
-    MapType m_headers;
+    HttpRequestView m_view;
     MapType m_params;
     MapType m_cookies;
     std::string m_body;
@@ -260,6 +317,10 @@ public:
     std::string get_body() const { return m_body; }
     std::string get_header(const std::string& key, const std::string& def = "");
     std::string get_reason() const { return m_reason; }
+    /**
+     * @brief 响应体的引用, 发送时直接作为iovec使用, 避免复制
+     */
+    const std::string& get_body_ref() const { return m_body; }
 
     // setter
     void set_version(const std::string& version) { m_version = version; }
@@ -291,6 +352,16 @@ public:
                     const std::string& path = "", const std::string& domain = "",
                     bool secure = false);
 
+    /**
+     * @brief 设置共用的固定响应头, 输出在状态行之后
+     */
+    void set_header_block(HttpHeaderBlock::Ptr block) { m_headerBlock = block; }
+
+    /**
+     * @brief 把状态行和响应头(包括结尾的空行)追加到out, 不包括响应体
+     */
+    void serialize_head(std::string& out) const;
+
     std::string to_string() const;
 
 
@@ -303,6 +374,7 @@ private:
     bool m_is_close;
     bool m_websocket;
     std::string m_reason;
+    HttpHeaderBlock::Ptr m_headerBlock;
 
     std::vector<std::string> m_cookies;
 };
@@ -1,67 +1,169 @@
 #include "http_connection.h"
+
+#include <string.h>
+
+#include <algorithm>
+
 #include "../logging.h"
 
 #include "pico/config.h"
 #include "pico/util.h"
 
 namespace pico {
+/// 缓冲区首次分配的大小, 小请求不需要再扩大
+static const size_t kInitialBufferSize = 4 * 1024;
+/// 请求结束后缓冲区为空且超过该大小时释放, 避免个别大请求长期占用内存
+static const size_t kIdleBufferSize = 64 * 1024;
 
-
+/**
+ * @brief 查找请求头结束的空行, 行尾可以是\r\n或\n
+ * @param[in,out] from 开始查找的位置, 没有找到时更新为下次继续查找的位置
+ * @return 包括空行在内的请求头长度, 没有找到时返回0
+ */
+static size_t find_header_end(const char* data, size_t len, size_t& from) {
+    while (from < len) {
+        const char* nl = (const char*)memchr(data + from, '\n', len - from);
+        if (!nl) {
+            from = len;
+            return 0;
+        }
+        size_t pos = nl - data;
+        if (pos + 1 >= len) {
+            from = pos;
+            return 0;
+        }
+        if (data[pos + 1] == '\n') { return pos + 2; }
+        if (data[pos + 1] == '\r') {
+            if (pos + 2 >= len) {
+                from = pos;
+                return 0;
+            }
+            if (data[pos + 2] == '\n') { return pos + 3; }
+        }
+        from = pos + 1;
+    }
+    return 0;
+}
 
 HttpConnection::HttpConnection(Socket::Ptr sock, bool owner)
-    : SocketStream(sock, owner) {}
+    : SocketStream(sock, owner)
+    , m_parser(new HttpRequestParser()) {}
 
-HttpRequest::Ptr HttpConnection::recvRequest() {
-    HttpRequestParser::Ptr parser(new HttpRequestParser());
-    uint64_t buff_size = HttpRequestParser::getHttpRequestBufferSize();
-    std::shared_ptr<char> buff(new char[buff_size], std::default_delete<char[]>());
-    char* data = buff.get();
-    int offset = 0;
-    do {
-        int len = read(data + offset, buff_size - offset);
-        if (len <= 0) {
-            close();
-            return nullptr;
-        }
-        len += offset;
-        size_t nparsed = parser->parse(data, len);
-        offset = len - nparsed;
-        if (parser->hasError()) {
-            LOG_ERROR("parse http request error");
-            close();
-            return nullptr;
+int HttpConnection::fillBuffer() {
+    if (m_bufferPos > 0) {
+        // 流水线中已经处理的请求只移动了读位置, 在这里一次性丢弃
+        memmove(&m_buffer[0], &m_buffer[m_bufferPos], m_bufferLen - m_bufferPos);
+        m_bufferLen -= m_bufferPos;
+        m_bufferPos = 0;
+    }
+    if (m_bufferLen == m_buffer.size()) {
+        size_t limit = HttpRequestParser::getHttpRequestBufferSize();
+        if (m_bufferLen >= limit) {
+            LOG_ERROR("http request header exceeds %lu bytes", (unsigned long)limit);
+            return -1;
         }
-        if (parser->isFinished()) { break; }
-    } while (true);
-    uint64_t length = parser->getContentLength();
+        m_buffer.resize(std::min(std::max(m_buffer.size() * 2, kInitialBufferSize), limit));
+    }
+    int len = read(&m_buffer[m_bufferLen], m_buffer.size() - m_bufferLen);
+    if (len > 0) { m_bufferLen += len; }
+    return len;
+}
+
+void HttpConnection::consumeBuffer(size_t len) {
+    m_bufferPos += len;
+    if (m_bufferPos == m_bufferLen) {
+        m_bufferPos = 0;
+        m_bufferLen = 0;
+    }
+}
+
+HttpRequest::Ptr HttpConnection::recvRequest() {
+    m_parser->reset();
+    m_requestError = HttpStatus::OK;
+    // 解析器不能在字段中间断开后继续, 请求头完整后才交给解析器
+    size_t from = 0;
+    size_t header_len = 0;
+    while ((header_len = find_header_end(bufferData(), bufferedBytes(), from)) == 0) {
+        if (fillBuffer() <= 0) { return nullptr; }
+    }
+    // 只把请求头交给解析器, 请求复制的也只是这一段
+    int nparsed = m_parser->parse(&m_buffer[m_bufferPos], header_len);
+    if (nparsed != (int)header_len || m_parser->hasError() || !m_parser->isFinished()) {
+        LOG_ERROR("parse http request error");
+        m_requestError = HttpStatus::BAD_REQUEST;
+        return nullptr;
+    }
+    consumeBuffer(header_len);
+
+    HttpRequest::Ptr req = m_parser->getRequest();
+    if (m_parser->hasTooManyHeaders()) {
+        // 多出的请求头没有保存, 其中可能有决定请求体边界的Content-Length或Transfer-Encoding
+        LOG_ERROR("http request has more than %u header fields",
+                  HttpRequestParser::getHttpRequestMaxHeaders());
+        m_requestError = HttpStatus::REQUEST_HEADER_FIELDS_TOO_LARGE;
+        return nullptr;
+    }
+    uint64_t length = 0;
+    m_requestError = m_parser->checkBodyLength(length);
+    if (m_requestError != HttpStatus::OK) {
+        LOG_ERROR("reject http request with ambiguous or oversized body, status=%d",
+                  (int)m_requestError);
+        return nullptr;
+    }
     if (length > 0) {
         std::string body;
         body.resize(length);
-        int len = 0;
-        if ((int)length < offset) {
-            memcpy(&body[0], data, length);
-            len = length;
-        }
-        else {
-            memcpy(&body[0], data, offset);
-            len = offset;
-        }
-        length -= offset;
-        if (length > 0) {
-            if (readFixSize(&body[len], length) < 0) {
-                close();
-                return nullptr;
-            }
-        }
-        parser->getRequest()->set_body(body);
+        size_t cached = std::min<uint64_t>(length, bufferedBytes());
+        memcpy(&body[0], bufferData(), cached);
+        consumeBuffer(cached);
+        if (length > cached && readFixSize(&body[cached], length - cached) <= 0) { return nullptr; }
+        req->set_body(body);
     }
-    parser->getRequest()->init();
-    return parser->getRequest();
+    if (m_bufferLen == 0 && m_buffer.size() > kIdleBufferSize) { std::vector<char>().swap(m_buffer); }
+    req->init();
+    return req;
 }
 
 int HttpConnection::sendResponse(HttpResponse::Ptr resp) {
-    std::string content = resp->to_string();
-    return write(content.data(), content.size());
+    std::vector<HttpResponse::Ptr> resps(1, resp);
+    return sendResponses(resps);
+}
+
+bool HttpConnection::hasBufferedRequest() const {
+    size_t from = 0;
+    return find_header_end(bufferData(), bufferedBytes(), from) != 0;
+}
+
+int HttpConnection::sendResponses(const std::vector<HttpResponse::Ptr>& resps) {
+    // 响应头依次写入连接的发送缓冲区, 缓冲区可能重新分配, 先记下每个响应头的结束位置
+    m_sendBuffer.clear();
+    std::vector<size_t> ends;
+    ends.reserve(resps.size());
+    for (auto& resp : resps) {
+        resp->serialize_head(m_sendBuffer);
+        ends.push_back(m_sendBuffer.size());
+    }
+    // 响应体直接引用, 不复制
+    std::vector<iovec> iov;
+    iov.reserve(resps.size() * 2);
+    size_t begin = 0;
+    for (size_t i = 0; i < resps.size(); ++i) {
+        iovec head;
+        head.iov_base = &m_sendBuffer[begin];
+        head.iov_len = ends[i] - begin;
+        iov.push_back(head);
+        begin = ends[i];
+        const std::string& body = resps[i]->get_body_ref();
+        if (!body.empty()) {
+            iovec data;
+            data.iov_base = (void*)body.data();
+            data.iov_len = body.size();
+            iov.push_back(data);
+        }
+    }
+    int rt = writeFixSize(iov.data(), (int)iov.size());
+    if (m_sendBuffer.capacity() > kIdleBufferSize) { std::string().swap(m_sendBuffer); }
+    return rt;
 }
 
 
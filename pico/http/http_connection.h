@@ -9,6 +9,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace pico {
 class HttpConnection : public SocketStream
@@ -17,8 +18,61 @@ public:
     typedef std::shared_ptr<HttpConnection> Ptr;
     explicit HttpConnection(Socket::Ptr sock, bool owner = true);
 
+    /**
+     * @brief 读取一个请求, 读多的数据留在连接的缓冲区中供下一个请求使用
+     * @return 连接断开或请求错误时返回nullptr, 不关闭连接,
+     *         调用者可以先发送之前读取的请求的响应再关闭
+     */
     HttpRequest::Ptr recvRequest();
+    /**
+     * @brief 上一次recvRequest因为请求本身有误失败时应答的错误状态, 其他情况为OK
+     * @details 请求体的边界不明确时剩下的数据无法再按请求解析, 返回错误后应关闭连接
+     */
+    HttpStatus getRequestError() const { return m_requestError; }
+    /**
+     * @brief 响应头写入连接的发送缓冲区, 与响应体一起通过一次writev写出
+     */
     int sendResponse(HttpResponse::Ptr resp);
+
+    /**
+     * @brief 缓冲区中是否已经有完整的请求头, 为true时recvRequest不需要等待请求头
+     */
+    bool hasBufferedRequest() const;
+
+    /**
+     * @brief 读缓冲区当前分配的大小, 释放后为0
+     */
+    size_t getBufferSize() const { return m_buffer.size(); }
+
+    /**
+     * @brief 按顺序把多个响应合并为一次写出, 每个响应的头和体各占一个iovec
+     */
+    int sendResponses(const std::vector<HttpResponse::Ptr>& resps);
+
+private:
+    /**
+     * @brief 从socket读取数据追加到缓冲区, 缓冲区满时加倍, 不超过请求头的上限
+     * @details 读取前把未处理的数据移到缓冲区开头, 每次读取最多移动一次
+     * @return read的返回值, 缓冲区已经达到上限时返回-1
+     */
+    int fillBuffer();
+    /**
+     * @brief 丢弃未处理数据开头的len字节, 只移动读位置, 不移动数据
+     */
+    void consumeBuffer(size_t len);
+    const char* bufferData() const { return m_buffer.data() + m_bufferPos; }
+    size_t bufferedBytes() const { return m_bufferLen - m_bufferPos; }
+
+private:
+    /// 连接上所有请求共用的解析器, 每个请求开始前重置
+    HttpRequestParser::Ptr m_parser;
+    /// 连接的读缓冲区, 未处理的数据位于[m_bufferPos, m_bufferLen)
+    std::vector<char> m_buffer;
+    size_t m_bufferPos = 0;
+    size_t m_bufferLen = 0;
+    /// 连接的发送缓冲区, 只存放响应头, 在请求之间复用
+    std::string m_sendBuffer;
+    HttpStatus m_requestError = HttpStatus::OK;
 };
 
 
@@ -2,6 +2,7 @@
 
 #include <iostream>
 
+#include "../config.h"
 #include "../logging.h"
 
 
@@ -15,8 +16,20 @@ uint64_t HttpRequestParser::getHttpRequestBufferSize() {
     return kHttpRequestBufferSize;
 }
 
+static ConfigVar<uint64_t>::Ptr g_http_request_max_body_size =
+    Config::Lookup<uint64_t>("http.request.max_body_size", kHttpRequestMaxBodySize,
+                             "max http request body size in bytes, larger requests get 413");
+
 uint64_t HttpRequestParser::getHttpRequestMaxBodySize() {
-    return kHttpRequestMaxBodySize;
+    return g_http_request_max_body_size->getValue();
+}
+
+static ConfigVar<uint32_t>::Ptr g_http_request_max_headers =
+    Config::Lookup<uint32_t>("http.request.max_headers", 100,
+                             "max header fields of a http request, more get 431");
+
+uint32_t HttpRequestParser::getHttpRequestMaxHeaders() {
+    return g_http_request_max_headers->getValue();
 }
 
 uint64_t HttpResponseParser::getHttpResponseBufferSize() {
@@ -43,7 +56,7 @@ typedef void (*field_cb)(void* data, const char* field, size_t flen, const char*
 
 void on_request_method(void* data, const char* at, size_t length) {
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    HttpMethod method = http_method_from_string(std::string(at, length));
+    HttpMethod method = http_method_from_string(StringView(at, length));
     parser->getRequest()->set_method(method);
 }
 
@@ -51,22 +64,22 @@ void on_request_uri(void* data, const char* at, size_t length) {}
 
 void on_request_fragment(void* data, const char* at, size_t length) {
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    parser->getRequest()->set_fragment(std::string(at, length));
+    parser->getRequest()->view().setFragment(StringView(at, length));
 }
 
 void on_request_path(void* data, const char* at, size_t length) {
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    parser->getRequest()->set_path(std::string(at, length));
+    parser->getRequest()->view().setPath(StringView(at, length));
 }
 
 void on_request_query_string(void* data, const char* at, size_t length) {
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    parser->getRequest()->set_query(std::string(at, length));
+    parser->getRequest()->view().setQuery(StringView(at, length));
 }
 
 void on_request_http_version(void* data, const char* at, size_t length) {
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    parser->getRequest()->set_version(std::string(at, length));
+    parser->getRequest()->view().setVersion(StringView(at, length));
 }
 
 void on_request_header_done(void* data, const char* at, size_t length) {}
@@ -74,7 +87,19 @@ void on_request_header_done(void* data, const char* at, size_t length) {}
 void on_request_http_field(void* data, const char* field, size_t flen, const char* value,
                            size_t vlen) {
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    parser->getRequest()->set_header(std::string(field, flen), std::string(value, vlen));
+    // 同名请求头需要逐个查找, 数量不受限时解析一个请求的开销随请求头数量平方增长
+    if (!parser->countHeader()) { return; }
+    HttpRequestView& view = parser->getRequest()->view();
+    StringView name(field, flen);
+    StringView val(value, vlen);
+    // 同名请求头只保留最后一个, 重复的Content-Length取值不同时请求体的边界不明确
+    StringView length;
+    if (view.getHeader(HttpRequestView::CONTENT_LENGTH, &length) && length != val &&
+        HttpRequestView::LookupKnown(name, HttpRequestView::HashName(name)) ==
+            HttpRequestView::CONTENT_LENGTH) {
+        parser->setConflictingLength();
+    }
+    view.setHeader(name, val);
 }
 
 HttpRequestParser::HttpRequestParser() {
@@ -94,7 +119,9 @@ HttpRequestParser::HttpRequestParser() {
 HttpRequestParser::~HttpRequestParser() {}
 
 int HttpRequestParser::parse(char* data, size_t len) {
-    int offset = http_parser_execute(&m_parser, data, len, 0);
+    // 在请求保存的副本上解析, 回调给出的字段都位于副本中, 只记录位置不再复制
+    char* copy = m_request->view().load(data, len);
+    int offset = http_parser_execute(&m_parser, copy, len, 0);
     if (http_parser_has_error(&m_parser)) {
         LOG_ERROR("http_parser_execute error");
         return -1;
@@ -112,12 +139,46 @@ int HttpRequestParser::hasError() {
 }
 
 void HttpRequestParser::reset() {
+    // 已经返回给调用方的请求仍在使用, 换一个新的请求对象
+    m_request.reset(new HttpRequest());
     http_parser_init(&m_parser);
+    m_conflictingLength = false;
+    m_tooManyHeaders = false;
+    m_headerCount = 0;
+    m_maxHeaders = getHttpRequestMaxHeaders();
 }
 
 uint64_t HttpRequestParser::getContentLength() {
-    std::string ret = m_request->get_header("Content-Length", "0");
-    return std::stoull(ret);
+    StringView length;
+    if (!m_request->view().getHeader(HttpRequestView::CONTENT_LENGTH, &length)) {
+        return 0;
+    }
+    return std::stoull(length.to_string());
+}
+
+HttpStatus HttpRequestParser::checkBodyLength(uint64_t& length) {
+    length = 0;
+    const HttpRequestView& view = m_request->view();
+    StringView value;
+    // 不解码分块的请求体, 否则请求体会被当作后续的流水线请求解析
+    if (view.getHeader(HttpRequestView::TRANSFER_ENCODING, &value)) {
+        return HttpStatus::NOT_IMPLEMENTED;
+    }
+    if (m_conflictingLength) { return HttpStatus::BAD_REQUEST; }
+    if (!view.getHeader(HttpRequestView::CONTENT_LENGTH, &value)) { return HttpStatus::OK; }
+    // 只接受十进制数字, stoull会放过的前导符号和结尾的非数字字符都按错误处理
+    size_t size = value.size();
+    while (size > 0 && (value.data()[size - 1] == ' ' || value.data()[size - 1] == '\t')) {
+        --size;
+    }
+    if (size == 0 || size > 19) { return HttpStatus::BAD_REQUEST; }
+    for (size_t i = 0; i < size; ++i) {
+        char c = value.data()[i];
+        if (c < '0' || c > '9') { return HttpStatus::BAD_REQUEST; }
+        length = length * 10 + (c - '0');
+    }
+    if (length > getHttpRequestMaxBodySize()) { return HttpStatus::PAYLOAD_TOO_LARGE; }
+    return HttpStatus::OK;
 }
 
 /*
@@ -28,14 +28,45 @@ public:
 
     uint64_t getContentLength();
 
+    /**
+     * @brief 检查请求头是否明确给出了请求体的长度
+     * @param[out] length 请求体的长度
+     * @return 可以读取请求体时返回OK; 带Transfer-Encoding返回NOT_IMPLEMENTED,
+     *         Content-Length不是十进制数或者重复出现且取值不同返回BAD_REQUEST,
+     *         超过http.request.max_body_size返回PAYLOAD_TOO_LARGE
+     */
+    HttpStatus checkBodyLength(uint64_t& length);
+
+    /**
+     * @brief 记录请求中出现了取值不同的Content-Length
+     */
+    void setConflictingLength() { m_conflictingLength = true; }
+
+    /**
+     * @brief 记录解析到一个请求头字段
+     * @return 超过http.request.max_headers时返回false, 该字段及之后的字段不再保存
+     */
+    bool countHeader() {
+        if (++m_headerCount <= m_maxHeaders) { return true; }
+        m_tooManyHeaders = true;
+        return false;
+    }
+    bool hasTooManyHeaders() const { return m_tooManyHeaders; }
+
 
 public:
     static uint64_t getHttpRequestBufferSize();
     static uint64_t getHttpRequestMaxBodySize();
+    static uint32_t getHttpRequestMaxHeaders();
 
 private:
     http_parser m_parser;
     HttpRequest::Ptr m_request;
+    bool m_conflictingLength = false;
+    bool m_tooManyHeaders = false;
+    uint32_t m_headerCount = 0;
+    /// 解析开始时读取的http.request.max_headers
+    uint32_t m_maxHeaders = getHttpRequestMaxHeaders();
 };
 
 class HttpResponseParser {
@@ -1,88 +1,253 @@
 #include "http_server.h"
 
+#include <exception>
+
 #include "../class_factory.h"
 #include "../compression.h"
+#include "../hook.h"
 #include "pico/config.h"
 
 namespace pico {
 
+static ConfigVar<uint32_t>::Ptr g_pipeline_depth = Config::Lookup<uint32_t>(
+    "http.pipeline.depth", 16, "max pipelined requests of a connection handled in one batch");
+
+static ConfigVar<bool>::Ptr g_pipeline_parallel = Config::Lookup<bool>(
+    "http.pipeline.parallel", false, "handle pipelined requests of a batch concurrently");
+
+/// 过载时直接写出的响应, 不经过解析和处理流程
+static const char s_overload_response[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                          "Content-Length: 0\r\n"
+                                          "Connection: close\r\n"
+                                          "Retry-After: 1\r\n\r\n";
+
 
 HttpServer::HttpServer(bool keepalive, IOManager* worker, IOManager* acceptor)
     : TcpServer(worker, acceptor)
     , m_request_handler(new RequestHandler())
     , m_is_KeepAlive(keepalive) {}
 
+HttpServer::~HttpServer() {
+    stopDateClock();
+}
+
+void HttpServer::addFixedHeader(const std::string& name, const std::string& value) {
+    m_fixedHeaders.push_back(std::make_pair(name, value));
+}
+
+bool HttpServer::start() {
+    if (!m_dateTimer) {
+        HttpHeaderBlock::HeaderList headers;
+        headers.push_back(std::make_pair("Server", getName()));
+        headers.insert(headers.end(), m_fixedHeaders.begin(), m_fixedHeaders.end());
+        m_headerBlock = std::make_shared<HttpHeaderBlock>(headers);
+        HttpDateClock::Acquire();
+        m_dateTimer = getWorker()->addTimer(1000, &HttpDateClock::Tick, true);
+    }
+    return TcpServer::start();
+}
+
+void HttpServer::stop() {
+    stopDateClock();
+    TcpServer::stop();
+}
+
+void HttpServer::stopDateClock() {
+    if (m_dateTimer) {
+        // 定时器会阻止IOManager退出, 停止时必须取消
+        m_dateTimer->cancel();
+        m_dateTimer.reset();
+        HttpDateClock::Release();
+    }
+}
+
 void HttpServer::handleClient(Socket::Ptr& sock) {
     HttpConnection::Ptr conn(new HttpConnection(sock));
+    std::vector<HttpRequest::Ptr> reqs;
     do {
+        reqs.clear();
         auto req = conn->recvRequest();
         if (!req) {
             LOG_ERROR("recvRequest failed, close connection, sock: %s, errno=%d, %s",
                       sock->to_string().c_str(),
                       errno,
                       strerror(errno));
+            sendRequestError(conn);
+            break;
+        }
+        reqs.push_back(req);
+        // 客户端流水线发送的请求已经在缓冲区中时一起处理, 响应按请求顺序一次写出
+        bool broken = false;
+        while (m_is_KeepAlive && !req->is_close() && reqs.size() < g_pipeline_depth->getValue() &&
+               conn->hasBufferedRequest()) {
+            req = conn->recvRequest();
+            if (!req) {
+                // 之前读取的请求仍然正常响应, 之后再关闭连接
+                LOG_ERROR("recvRequest failed after %lu pipelined requests, sock: %s",
+                          (unsigned long)reqs.size(),
+                          sock->to_string().c_str());
+                broken = true;
+                break;
+            }
+            reqs.push_back(req);
+        }
+
+        size_t admitted = 0;
+        int sent = 1;
+        {
+            InflightGuard inflight(this);
+            while (inflight.count() < reqs.size() && inflight.enter()) {}
+            admitted = inflight.count();
+            std::vector<HttpResponse::Ptr> resps = handleRequests(sock, reqs, admitted);
+            if (!resps.empty()) { sent = conn->sendResponses(resps); }
+        }
+        if (sent <= 0) {
+            // 连接已经不可写, 不再读取和处理后面的请求
+            LOG_ERROR("sendResponses failed, close connection, sock: %s, errno=%d, %s",
+                      sock->to_string().c_str(),
+                      errno,
+                      strerror(errno));
+            break;
+        }
+        if (admitted < reqs.size()) {
+            LOG_WARN("server [%s] too many inflight requests, reject request from %s",
+                     this->getName().c_str(),
+                     sock->getPeerAddress()->to_string().c_str());
+            sock->send(s_overload_response, sizeof(s_overload_response) - 1);
+            break;
+        }
+        if (broken) {
+            sendRequestError(conn);
             break;
         }
+        if (!m_is_KeepAlive || req->is_close()) {
+            break;
+        }
+    } while (true);
+    conn->close();
+}
+
+void HttpServer::sendRequestError(HttpConnection::Ptr conn) {
+    HttpStatus status = conn->getRequestError();
+    if (status == HttpStatus::OK) { return; }
+    HttpResponse::Ptr resp(new HttpResponse("HTTP/1.1", true));
+    resp->set_status(status);
+    resp->set_header_block(m_headerBlock);
+    conn->sendResponse(resp);
+}
 
-        if (compression::is_compression_enabled()) {
-            std::string compress_type;
-            if (req->has_header("Content-Encoding", &compress_type)) {
-                if (compress_type == "gzip") {
-                    req->set_body(compression::decompress(req->get_body(), compression::GZIP));
-                    req->del_header("Content-Encoding");
-                }
-                else if (compress_type == "deflate") {
-                    req->set_body(compression::decompress(req->get_body(), compression::DEFLATE));
-                    req->del_header("Content-Encoding");
-                }
-                req->set_header("Content-Length", std::to_string(req->get_body().size()));
+std::vector<HttpResponse::Ptr> HttpServer::handleRequests(Socket::Ptr sock,
+                                                          const std::vector<HttpRequest::Ptr>& reqs,
+                                                          size_t count) {
+    if (count <= 1 || !g_pipeline_parallel->getValue()) {
+        std::vector<HttpResponse::Ptr> resps;
+        for (size_t i = 0; i < count; ++i) { resps.push_back(handleRequest(sock, reqs[i])); }
+        return resps;
+    }
+
+    // 其他请求交给当前worker的其他协程, 结果和信号量放在堆上, 共享栈协程挂起后其栈不可访问
+    struct Batch
+    {
+        explicit Batch(size_t count) : resps(count), errors(count) {}
+        std::vector<HttpResponse::Ptr> resps;
+        /// 每个请求抛出的异常, 各协程只写自己的位置
+        std::vector<std::exception_ptr> errors;
+        FiberSemaphore done;
+    };
+    auto batch = std::make_shared<Batch>(count);
+    auto self = std::static_pointer_cast<HttpServer>(shared_from_this());
+    for (size_t i = 1; i < count; ++i) {
+        HttpRequest::Ptr req = reqs[i];
+        IOManager::GetThis()->schedule([self, sock, req, batch, i]() {
+            // 抛出异常时也要通知, 否则连接协程会一直等待
+            try {
+                batch->resps[i] = self->handleRequest(sock, req);
+            } catch (...) {
+                batch->errors[i] = std::current_exception();
             }
+            batch->done.notify();
+        });
+    }
+    try {
+        batch->resps[0] = handleRequest(sock, reqs[0]);
+    } catch (...) {
+        batch->errors[0] = std::current_exception();
+    }
+    for (size_t i = 1; i < count; ++i) { batch->done.wait(); }
+    // 所有请求结束后再按顺序抛出第一个异常, 与顺序处理时一样结束连接
+    for (auto& error : batch->errors) {
+        if (error) { std::rethrow_exception(error); }
+    }
+    return batch->resps;
+}
+
+HttpResponse::Ptr HttpServer::handleRequest(Socket::Ptr sock, HttpRequest::Ptr req) {
+    if (compression::is_compression_enabled()) {
+        std::string compress_type;
+        if (req->has_header("Content-Encoding", &compress_type)) {
+            if (compress_type == "gzip") {
+                req->set_body(compression::decompress(req->get_body(), compression::GZIP));
+                req->del_header("Content-Encoding");
+            }
+            else if (compress_type == "deflate") {
+                req->set_body(compression::decompress(req->get_body(), compression::DEFLATE));
+                req->del_header("Content-Encoding");
+            }
+            req->set_header("Content-Length", std::to_string(req->get_body().size()));
         }
+    }
 
 
-        LOG_INFO("server [%s] recv request from %s, %s %s",
-                 this->getName().c_str(),
-                 sock->getPeerAddress()->to_string().c_str(),
-                 http_method_to_string(req->get_method()),
-                 req->get_path().c_str());
+    LOG_INFO("server [%s] recv request from %s, %s %s",
+             this->getName().c_str(),
+             sock->getPeerAddress()->to_string().c_str(),
+             http_method_to_string(req->get_method()),
+             req->get_path().c_str());
 
-        HttpResponse::Ptr resp(
-            new HttpResponse(req->get_version(), req->is_close() || !m_is_KeepAlive));
+    HttpResponse::Ptr resp(
+        new HttpResponse(req->get_version(), req->is_close() || !m_is_KeepAlive));
 
 
-        {
-            if (req->get_request_session_id().empty()) {
-                std::string session_id = genRandomString(128);
+    {
+        if (req->get_request_session_id().empty()) {
+            std::string session_id = genRandomString(128);
 
-                req->set_cookie("PSESSIONID", session_id);
-                resp->set_cookie("PSESSIONID", session_id);
+            req->set_cookie("PSESSIONID", session_id);
+            resp->set_cookie("PSESSIONID", session_id);
 
-                tools::SessionManager::getInstance()->create(session_id);
-            }
+            tools::SessionManager::getInstance()->create(session_id);
         }
+    }
 
 
-        resp->set_header("Server", getName());
-        m_request_handler->handle(req, resp);
+    resp->set_header_block(m_headerBlock);
+    m_request_handler->handle(req, resp);
 
 
-        if (compression::is_compression_enabled()) {
-            std::string accept_encoding = req->get_header("Accept-Encoding");
-            if (accept_encoding.find("gzip") != std::string::npos) {
-                resp->set_header("Content-Encoding", "gzip");
-                resp->set_body(compression::compress(resp->get_body(), compression::GZIP));
-            }
-            else if (accept_encoding.find("deflate") != std::string::npos) {
-                resp->set_header("Content-Encoding", "deflate");
-                resp->set_body(compression::compress(resp->get_body(), compression::DEFLATE));
-            }
+    if (compression::is_compression_enabled()) {
+        std::string accept_encoding = req->get_header("Accept-Encoding");
+        if (accept_encoding.find("gzip") != std::string::npos) {
+            resp->set_header("Content-Encoding", "gzip");
+            resp->set_body(compression::compress(resp->get_body(), compression::GZIP));
         }
-        conn->sendResponse(resp);
-        if (!m_is_KeepAlive || req->is_close()) {
-            break;
+        else if (accept_encoding.find("deflate") != std::string::npos) {
+            resp->set_header("Content-Encoding", "deflate");
+            resp->set_body(compression::compress(resp->get_body(), compression::DEFLATE));
         }
-    } while (true);
-    conn->close();
+    }
+    return resp;
+}
+
+void HttpServer::rejectClient(Socket::Ptr& sock) {
+    if (std::dynamic_pointer_cast<SSLSocket>(sock)) {
+        TcpServer::rejectClient(sock);
+        return;
+    }
+    // 接收缓冲区中留有未读数据时close会发出RST, 客户端可能收不到响应
+    char buf[4096];
+    while (recv_f(sock->getSocket(), buf, sizeof(buf), MSG_DONTWAIT) == sizeof(buf)) {}
+    send_f(sock->getSocket(), s_overload_response, sizeof(s_overload_response) - 1, MSG_DONTWAIT);
+    sock->close();
 }
 
 }   // namespace pico
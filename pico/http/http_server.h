@@ -26,17 +26,65 @@ public:
     HttpServer(bool keepalive = false, IOManager* worker = IOManager::GetThis(),
                IOManager* acceptor = IOManager::GetThis());
 
-    ~HttpServer(){};
+    /**
+     * @brief 没有调用stop时也取消Date定时器并释放时钟
+     */
+    ~HttpServer();
 
     RequestHandler::Ptr getRequestHandler() { return m_request_handler; }
 
+    /**
+     * @brief 添加所有响应都带有的固定响应头, 需在start之前调用
+     * @details start时与Server头一起预先渲染, 之后每个响应直接复制
+     */
+    void addFixedHeader(const std::string& name, const std::string& value);
+
+    /**
+     * @brief 渲染固定响应头, 并在worker上启动每秒刷新一次Date的定时器
+     */
+    bool start() override;
+    void stop() override;
+
 
 protected:
     void handleClient(Socket::Ptr& sock) override;
 
+    /**
+     * @brief 处理一个请求并生成响应
+     */
+    HttpResponse::Ptr handleRequest(Socket::Ptr sock, HttpRequest::Ptr req);
+
+    /**
+     * @brief 处理同一连接上流水线发送的前count个请求, 响应与请求顺序一致
+     * @details http.pipeline.parallel开启时在当前worker上并发处理
+     */
+    std::vector<HttpResponse::Ptr> handleRequests(Socket::Ptr sock,
+                                                  const std::vector<HttpRequest::Ptr>& reqs,
+                                                  size_t count);
+
+    /**
+     * @brief 请求本身有误而读取失败时, 在关闭连接前返回对应的错误状态
+     */
+    void sendRequestError(HttpConnection::Ptr conn);
+
+    /**
+     * @brief 读出已经到达的请求数据后返回固定的503响应并关闭连接, ssl连接直接以RST关闭
+     */
+    void rejectClient(Socket::Ptr& sock) override;
+
+private:
+    /**
+     * @brief 取消刷新Date的定时器并释放时钟, 未启动时什么也不做
+     */
+    void stopDateClock();
+
 private:
     RequestHandler::Ptr m_request_handler;
     bool m_is_KeepAlive;
+    HttpHeaderBlock::HeaderList m_fixedHeaders;
+    /// start时渲染, 运行期间只读
+    HttpHeaderBlock::Ptr m_headerBlock;
+    Timer::Ptr m_dateTimer;
 };
 }   // namespace pico
 
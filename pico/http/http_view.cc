@@ -0,0 +1,187 @@
+#include "http_view.h"
+
+#include <stdint.h>
+
+namespace pico {
+
+static const char* const s_known_names[HttpRequestView::UNKNOWN_HEADER] = {
+    "Host",
+    "Connection",
+    "Content-Length",
+    "Content-Type",
+    "Content-Encoding",
+    "Transfer-Encoding",
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Authorization",
+    "Cookie",
+    "User-Agent",
+    "Upgrade",
+    "Origin",
+    "Referer",
+    "Sec-WebSocket-Key",
+    "Sec-WebSocket-Version",
+};
+
+namespace {
+
+struct KnownHeaderTable
+{
+    KnownHeaderTable() {
+        for (size_t i = 0; i < HttpRequestView::UNKNOWN_HEADER; ++i) {
+            names[i] = StringView(s_known_names[i]);
+            hashes[i] = HttpRequestView::HashName(names[i]);
+        }
+    }
+
+    StringView names[HttpRequestView::UNKNOWN_HEADER];
+    uint32_t hashes[HttpRequestView::UNKNOWN_HEADER];
+};
+
+const KnownHeaderTable& GetKnownHeaderTable() {
+    static KnownHeaderTable s_table;
+    return s_table;
+}
+
+}   // namespace
+
+uint32_t HttpRequestView::HashName(const StringView& name) {
+    // FNV-1a, 置上0x20把字母统一为小写, 名字中的其他字符受影响也只会增加冲突, 命中后仍会比较名字
+    uint32_t hash = 2166136261u;
+    const char* p = name.data();
+    for (size_t i = 0; i < name.size(); ++i) {
+        hash ^= (uint8_t)(p[i] | 0x20);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+HttpRequestView::KnownHeader HttpRequestView::LookupKnown(const StringView& name, uint32_t hash) {
+    const KnownHeaderTable& table = GetKnownHeaderTable();
+    for (size_t i = 0; i < UNKNOWN_HEADER; ++i) {
+        if (table.hashes[i] == hash && table.names[i].iequals(name)) { return (KnownHeader)i; }
+    }
+    return UNKNOWN_HEADER;
+}
+
+HttpRequestView::HttpRequestView() {
+    memset(m_known, -1, sizeof(m_known));
+}
+
+char* HttpRequestView::load(const char* data, size_t len) {
+    size_t offset = m_buffer.size();
+    m_buffer.append(data, len);
+    return &m_buffer[offset];
+}
+
+bool HttpRequestView::getHeader(KnownHeader id, StringView* value) const {
+    if (id >= UNKNOWN_HEADER || m_known[id] < 0) { return false; }
+    *value = get(m_headers[m_known[id]].value);
+    return true;
+}
+
+bool HttpRequestView::getHeader(const StringView& name, StringView* value) const {
+    uint32_t hash = HashName(name);
+    int index = find(name, hash, LookupKnown(name, hash));
+    if (index < 0) { return false; }
+    *value = get(m_headers[index].value);
+    return true;
+}
+
+void HttpRequestView::setHeader(const StringView& name, const StringView& value) {
+    uint32_t hash = HashName(name);
+    KnownHeader id = LookupKnown(name, hash);
+    int index = find(name, hash, id);
+    if (index >= 0) {
+        assign(m_headers[index].value, value);
+        return;
+    }
+    // 先取得位于缓冲区中的偏移, 追加数据可能使缓冲区重新分配
+    Slice n, v;
+    bool value_located = locate(value, v);
+    if (!locate(name, n)) { n = append(name); }
+    // 值追加在名字之后, 再次设置更长的值时可以截掉后追加
+    if (!value_located) { v = append(value); }
+    if (m_headers.empty()) { m_headers.reserve(16); }
+    Header header;
+    header.name = n;
+    header.value = v;
+    header.hash = hash;
+    header.id = id;
+    if (id != UNKNOWN_HEADER) { m_known[id] = m_headers.size(); }
+    m_headers.push_back(header);
+}
+
+bool HttpRequestView::delHeader(const StringView& name) {
+    uint32_t hash = HashName(name);
+    int index = find(name, hash, LookupKnown(name, hash));
+    if (index < 0) { return false; }
+    m_headers.erase(m_headers.begin() + index);
+    memset(m_known, -1, sizeof(m_known));
+    for (size_t i = 0; i < m_headers.size(); ++i) {
+        if (m_headers[i].id != UNKNOWN_HEADER) { m_known[m_headers[i].id] = i; }
+    }
+    return true;
+}
+
+bool HttpRequestView::locate(const StringView& str, Slice& s) const {
+    uintptr_t begin = (uintptr_t)m_buffer.data();
+    uintptr_t p = (uintptr_t)str.data();
+    if (p < begin || p + str.size() > begin + m_buffer.size()) { return false; }
+    s.offset = p - begin;
+    s.size = str.size();
+    return true;
+}
+
+HttpRequestView::Slice HttpRequestView::append(const StringView& str) {
+    Slice s;
+    s.offset = m_buffer.size();
+    s.size = str.size();
+    m_buffer.append(str.data(), str.size());
+    return s;
+}
+
+void HttpRequestView::assign(Slice& slot, const StringView& str) {
+    Slice s;
+    if (locate(str, s)) {
+        slot = s;
+        return;
+    }
+    if (!shared(slot)) {
+        // 旧值只属于这个字段, 放得下时原地覆盖, 位于末尾时截掉后追加
+        if (str.size() <= slot.size) {
+            memcpy(&m_buffer[slot.offset], str.data(), str.size());
+            slot.size = str.size();
+            return;
+        }
+        if (slot.offset + slot.size == m_buffer.size()) { m_buffer.resize(slot.offset); }
+    }
+    slot = append(str);
+}
+
+bool HttpRequestView::shared(const Slice& slot) const {
+    if (slot.size == 0) { return false; }
+    auto overlap = [&slot](const Slice& s) {
+        return &s != &slot && s.size > 0 && s.offset < slot.offset + slot.size &&
+               slot.offset < s.offset + s.size;
+    };
+    if (overlap(m_path) || overlap(m_query) || overlap(m_fragment) || overlap(m_version)) {
+        return true;
+    }
+    for (auto& h : m_headers) {
+        if (overlap(h.name) || overlap(h.value)) { return true; }
+    }
+    return false;
+}
+
+int HttpRequestView::find(const StringView& name, uint32_t hash, KnownHeader id) const {
+    if (id != UNKNOWN_HEADER) { return m_known[id]; }
+    for (size_t i = 0; i < m_headers.size(); ++i) {
+        const Header& h = m_headers[i];
+        if (h.hash == hash && get(h.name).iequals(name)) { return i; }
+    }
+    return -1;
+}
+
+}   // namespace pico
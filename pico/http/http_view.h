@@ -0,0 +1,176 @@
+#ifndef __PICO_HTTP_HTTP_VIEW_H__
+#define __PICO_HTTP_HTTP_VIEW_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace pico {
+
+/**
+ * @brief 只读字符串视图, 不持有数据, 也不保证以'\0'结尾
+ */
+class StringView
+{
+public:
+    StringView() : m_data(""), m_size(0) {}
+    StringView(const char* data, size_t size) : m_data(data), m_size(size) {}
+    StringView(const char* str) : m_data(str), m_size(strlen(str)) {}
+    StringView(const std::string& str) : m_data(str.data()), m_size(str.size()) {}
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    std::string to_string() const { return std::string(m_data, m_size); }
+
+    bool operator==(const StringView& rhs) const {
+        return m_size == rhs.m_size && memcmp(m_data, rhs.m_data, m_size) == 0;
+    }
+    bool operator!=(const StringView& rhs) const { return !(*this == rhs); }
+
+    /**
+     * @brief 忽略大小写比较
+     */
+    bool iequals(const StringView& rhs) const {
+        return m_size == rhs.m_size && strncasecmp(m_data, rhs.m_data, m_size) == 0;
+    }
+
+private:
+    const char* m_data;
+    size_t m_size;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const StringView& str) {
+    return os.write(str.data(), str.size());
+}
+
+/**
+ * @brief 请求行和请求头的视图
+ * @details 原始请求头整段复制到请求自己的缓冲区, 解析时各字段只记录在缓冲区中的偏移和长度,
+ *          不再逐个分配字符串. 请求头按到达顺序放在数组中, 常用请求头按预先计算的名字哈希
+ *          直接定位, 其余的先比较哈希再忽略大小写比较名字.
+ *          返回的StringView在修改请求(设置字段或追加数据)之前有效.
+ *          设置已有字段时, 新值不长于旧值且旧值没有被其他字段引用则原地覆盖, 旧值在缓冲区末尾
+ *          则截掉后追加, 否则追加到缓冲区末尾, 旧值占用的空间直到请求销毁才释放.
+ *          因此反复把多个字段交替设置为更长的值时缓冲区会持续增长
+ */
+class HttpRequestView
+{
+public:
+    /// 常用请求头
+    enum KnownHeader
+    {
+        HOST = 0,
+        CONNECTION,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        CONTENT_ENCODING,
+        TRANSFER_ENCODING,
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_LANGUAGE,
+        AUTHORIZATION,
+        COOKIE,
+        USER_AGENT,
+        UPGRADE,
+        ORIGIN,
+        REFERER,
+        SEC_WEBSOCKET_KEY,
+        SEC_WEBSOCKET_VERSION,
+        UNKNOWN_HEADER,
+    };
+
+    /**
+     * @brief 忽略大小写的请求头名字哈希
+     */
+    static uint32_t HashName(const StringView& name);
+
+    /**
+     * @brief 查找常用请求头, 不是常用请求头时返回UNKNOWN_HEADER
+     */
+    static KnownHeader LookupKnown(const StringView& name, uint32_t hash);
+
+    HttpRequestView();
+
+    /**
+     * @brief 把原始数据追加到请求的缓冲区
+     * @return 副本的起始地址, 在副本上解析时回调给出的位置都位于缓冲区中, 只记录偏移
+     */
+    char* load(const char* data, size_t len);
+
+    StringView path() const { return get(m_path); }
+    StringView query() const { return get(m_query); }
+    StringView fragment() const { return get(m_fragment); }
+    StringView version() const { return get(m_version); }
+
+    void setPath(const StringView& path) { assign(m_path, path); }
+    void setQuery(const StringView& query) { assign(m_query, query); }
+    void setFragment(const StringView& fragment) { assign(m_fragment, fragment); }
+    void setVersion(const StringView& version) { assign(m_version, version); }
+
+    size_t headerCount() const { return m_headers.size(); }
+    StringView headerName(size_t index) const { return get(m_headers[index].name); }
+    StringView headerValue(size_t index) const { return get(m_headers[index].value); }
+
+    /**
+     * @brief 获取常用请求头
+     * @return 不存在时返回false, 不修改value
+     */
+    bool getHeader(KnownHeader id, StringView* value) const;
+    bool getHeader(const StringView& name, StringView* value) const;
+
+    /**
+     * @brief 设置请求头, 同名请求头已存在时替换其值
+     */
+    void setHeader(const StringView& name, const StringView& value);
+    bool delHeader(const StringView& name);
+
+private:
+    struct Slice
+    {
+        uint32_t offset = 0;
+        uint32_t size = 0;
+    };
+
+    struct Header
+    {
+        Slice name;
+        Slice value;
+        uint32_t hash;
+        KnownHeader id;
+    };
+
+    StringView get(const Slice& s) const { return StringView(m_buffer.data() + s.offset, s.size); }
+    /**
+     * @brief 视图位于缓冲区中时返回其偏移
+     */
+    bool locate(const StringView& str, Slice& s) const;
+    Slice append(const StringView& str);
+    /**
+     * @brief 设置字段的值, 视图位于缓冲区中时直接引用, 否则尽量复用字段原来占用的空间
+     */
+    void assign(Slice& slot, const StringView& str);
+    /**
+     * @brief 是否有其他字段引用了slot中的数据
+     */
+    bool shared(const Slice& slot) const;
+    int find(const StringView& name, uint32_t hash, KnownHeader id) const;
+
+private:
+    std::string m_buffer;
+    Slice m_path;
+    Slice m_query;
+    Slice m_fragment;
+    Slice m_version;
+    std::vector<Header> m_headers;
+    /// 常用请求头在m_headers中的下标, 不存在时为-1
+    int32_t m_known[UNKNOWN_HEADER];
+};
+
+}   // namespace pico
+
+#endif
@@ -2,11 +2,18 @@
 #include <algorithm>
 #include <assert.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include "config.h"
 #include "logging.h"
+#include "uring.h"
 
 namespace pico {
 
@@ -18,6 +25,90 @@ namespace pico {
 #    define PICO_UNLIKELY(x) (x)
 #endif
 
+static ConfigVar<bool>::Ptr g_iomanager_register_once = Config::Lookup<bool>(
+    "iomanager.register_once",
+    false,
+    "register each fd with epoll once, edge-triggered, and track read/write interest in user "
+    "space; fds closed without the hooked close are registered again once FdManager "
+    "tracks the reused fd");
+
+static ConfigVar<uint32_t>::Ptr g_iomanager_batch_size = Config::Lookup<uint32_t>(
+    "iomanager.event_batch_size", 256, "max events returned by one epoll_wait");
+
+static ConfigVar<std::string>::Ptr g_iomanager_backend = Config::Lookup<std::string>(
+    "iomanager.backend",
+    "epoll",
+    "io backend, epoll or io_uring; io_uring submits hooked socket io directly to the ring "
+    "and falls back to epoll when the kernel does not support it");
+
+static ConfigVar<uint32_t>::Ptr g_iomanager_uring_entries = Config::Lookup<uint32_t>(
+    "iomanager.uring_entries", 1024, "io_uring submission queue size");
+
+static ConfigVar<int32_t>::Ptr g_iomanager_wakeup_signal = Config::Lookup<int32_t>(
+    "iomanager.wakeup_signal",
+    4,
+    "real-time signal SIGRTMIN+N reserved for waking one idle scheduler thread; the process "
+    "must not use it for anything else. read when the first IOManager is created");
+
+/**
+ * @brief 定向唤醒idle线程使用的信号
+ * @details 该信号在调度线程中始终被屏蔽, 只在epoll_pwait/io_uring_enter期间解除屏蔽,
+ *          因此只会打断阻塞在等待中的目标线程. 信号处理函数是进程级的, 第一次使用时确定后不再改变
+ */
+static int WakeupSignal() {
+    static int s_signal = []() {
+        int offset = g_iomanager_wakeup_signal->getValue();
+        if (offset < 0 || offset > SIGRTMAX - SIGRTMIN) {
+            LOG_ERROR("iomanager.wakeup_signal %d out of range [0, %d], use 4",
+                      offset,
+                      SIGRTMAX - SIGRTMIN);
+            offset = 4;
+        }
+        return SIGRTMIN + offset;
+    }();
+    return s_signal;
+}
+
+/// 调度线程进入调度循环之前的信号掩码, 退出时恢复
+static thread_local sigset_t t_saved_mask;
+
+/**
+ * @brief io_uring的user_data编码
+ * @details 0表示取消请求, 忽略其完成事件; kUringTickleKey表示tickle; FdContext地址|事件表示poll;
+ *          UringRequest地址|kUringRequestTag表示直接提交的请求. 两者都至少8字节对齐
+ */
+static const uint64_t kUringTickleKey = 0x1;
+static const uint64_t kUringRequestTag = 0x2;
+
+/// idle线程单次等待的最长毫秒数
+static const uint64_t kMaxIdleTimeout = 3000;
+
+/// fd表每段包含的FdContext个数
+static const int kFdSegmentBits = 10;
+static const size_t kFdSegmentSize = 1 << kFdSegmentBits;
+/// RLIMIT_NOFILE不限制时fd表的最大容量
+static const size_t kMaxFds = 1 << 24;
+
+/// 常驻注册模式的IOManager, fd的记录重建时逐个清除其注册状态
+static Mutex s_register_once_mutex;
+static std::vector<IOManager*> s_register_once_managers;
+static std::atomic<size_t> s_register_once_count = {0};
+
+static void OnWakeupSignal(int) {}
+
+static void InstallWakeupSignal() {
+    static bool s_installed = []() {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = &OnWakeupSignal;
+        sigemptyset(&sa.sa_mask);
+        // 不设置SA_RESTART, 让epoll_pwait返回EINTR
+        sa.sa_flags = 0;
+        return sigaction(WakeupSignal(), &sa, nullptr) == 0;
+    }();
+    assert(s_installed);
+    (void)s_installed;
+}
 
 IOManager::FdContext::EventContext& IOManager::FdContext::getContext(IOManager::Event event) {
     switch (event) {
@@ -47,80 +138,147 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
 }
 
 IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    : Scheduler(threads, use_caller, name) {
-    m_epfd = epoll_create(5000);
-    assert(m_epfd > 0);
+    : Scheduler(threads, use_caller, name)
+    , m_registerOnce(g_iomanager_register_once->getValue())
+    , m_batchSize(std::max<uint32_t>(g_iomanager_batch_size->getValue(), 1)) {
+    InstallWakeupSignal();
+
+    if (g_iomanager_backend->getValue() == "io_uring") {
+        m_uring.reset(new IOUring);
+        if (!m_uring->init(g_iomanager_uring_entries->getValue())) {
+            LOG_ERROR("io_uring unavailable, %s falls back to epoll", name.c_str());
+            m_uring.reset();
+        }
+    }
+    else if (g_iomanager_backend->getValue() != "epoll") {
+        LOG_ERROR("unknown iomanager.backend %s, use epoll",
+                  g_iomanager_backend->getValue().c_str());
+    }
 
-    int rt = pipe(m_tickleFds);
-    assert(!rt);
+    if (!m_uring) {
+        m_epfd = epoll_create(5000);
+        assert(m_epfd > 0);
 
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+        m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(m_tickleFd >= 0);
 
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    assert(!rt);
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN | EPOLLET;
+        // data是联合体, 用空指针区分tickle的eventfd和FdContext
+        event.data.ptr = nullptr;
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    assert(!rt);
+        int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event);
+        assert(!rt);
+        (void)rt;
+    }
 
-    contextResize(32);
+    // use_caller时调用线程也会进入idle
+    m_sleepFlagCount = m_threadCount + 1;
+    m_sleepFlags.reset(new SleepFlag[m_sleepFlagCount]);
+
+    // 按硬限制预留段指针, 运行时调高软限制后新的fd也能放入
+    size_t max_fds = kMaxFds;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_max != RLIM_INFINITY) {
+        max_fds = std::min<size_t>(rl.rlim_max, kMaxFds);
+    }
+    m_segmentCount = (max_fds + kFdSegmentSize - 1) / kFdSegmentSize;
+    m_fdContexts.reset(new std::atomic<FdContext*>[m_segmentCount]());
+
+    if (m_registerOnce && !m_uring) {
+        Mutex::Lock lock(s_register_once_mutex);
+        s_register_once_managers.push_back(this);
+        ++s_register_once_count;
+    }
 
     start();
 }
 
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
+    if (m_registerOnce && !m_uring) {
+        Mutex::Lock lock(s_register_once_mutex);
+        s_register_once_managers.erase(std::find(
+            s_register_once_managers.begin(), s_register_once_managers.end(), this));
+        --s_register_once_count;
+    }
+    if (m_epfd >= 0) {
+        close(m_epfd);
+        close(m_tickleFd);
+    }
 
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (m_fdContexts[i]) { delete m_fdContexts[i]; }
+    for (size_t i = 0; i < m_segmentCount; ++i) {
+        delete[] m_fdContexts[i].load();
     }
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
-
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if (!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
+IOManager::FdContext* IOManager::getFdContext(int fd, bool auto_create) {
+    if (PICO_UNLIKELY(fd < 0)) { return nullptr; }
+    size_t index = (size_t)fd >> kFdSegmentBits;
+    if (PICO_UNLIKELY(index >= m_segmentCount)) { return nullptr; }
+    FdContext* segment = m_fdContexts[index].load(std::memory_order_acquire);
+    if (PICO_UNLIKELY(!segment)) {
+        if (!auto_create) { return nullptr; }
+        FdContext* created = new FdContext[kFdSegmentSize];
+        for (size_t i = 0; i < kFdSegmentSize; ++i) { created[i].fd = (index << kFdSegmentBits) + i; }
+        // 多个线程同时分配同一段时只保留一个
+        if (m_fdContexts[index].compare_exchange_strong(segment, created)) { segment = created; }
+        else {
+            delete[] created;
         }
     }
+    return &segment[fd & (kFdSegmentSize - 1)];
 }
 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    }
-    else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if (!fd_ctx) {
+        LOG_ERROR("fd %d exceeds RLIMIT_NOFILE", fd);
+        return -1;
     }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (PICO_UNLIKELY(fd_ctx->events & event)) {
-        LOG_ERROR("fd %d event %d already added", fd, event);
-        assert(!(fd_ctx->events & event));
+        // 该方向已有等待者, 不能覆盖其上下文, 由调用方决定如何处理
+        LOG_DEBUG("fd %d event %d already added", fd, event);
+        errno = EEXIST;
+        return -1;
     }
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        LOG_ERROR("epoll_ctl fd %d event %d error %d", fd, event, rt);
-        return -1;
+    if (m_uring) {
+        // 单次poll, 提交时已就绪则立即完成
+        io_uring_sqe sqe;
+        IOUring::Prep(sqe, IORING_OP_POLL_ADD, fd, nullptr, 0, 0);
+        sqe.poll32_events = event == READ ? POLLIN : POLLOUT;
+        sqe.user_data = (uint64_t)(uintptr_t)fd_ctx | event;
+        pushUring(sqe);
+    }
+    else if (m_registerOnce) {
+        if (!fd_ctx->registered) {
+            epoll_event epevent;
+            epevent.events = EPOLLET | EPOLLIN | EPOLLOUT;
+            epevent.data.ptr = fd_ctx;
+            int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &epevent);
+            if (rt && errno == EEXIST) { rt = epoll_ctl(m_epfd, EPOLL_CTL_MOD, fd, &epevent); }
+            if (rt) {
+                LOG_ERROR("epoll_ctl fd %d event %d error %d", fd, event, errno);
+                return -1;
+            }
+            fd_ctx->registered = true;
+        }
+    }
+    else {
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | fd_ctx->events | event;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if (rt) {
+            LOG_ERROR("epoll_ctl fd %d event %d error %d", fd, event, rt);
+            return -1;
+        }
     }
 
     ++m_pendingEventCount;
@@ -134,28 +292,36 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         event_ctx.fiber = Fiber::GetThis();
         assert(event_ctx.fiber->getState() == Fiber::EXEC);
     }
+
+    // 等待之前边缘已经到达, 直接触发; 就绪标记可能已过时, 最多导致调用方多重试一次
+    if (fd_ctx->ready & event) {
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        fd_ctx->triggerEvent(event);
+        --m_pendingEventCount;
+    }
     return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) { return false; }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) { return false; }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if (PICO_UNLIKELY(!(fd_ctx->events & event))) { return false; }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        LOG_ERROR("epoll_ctl fd %d event %d error %d", fd, event, rt);
-        return false;
+    if (m_uring) { cancelUring((uint64_t)(uintptr_t)fd_ctx | event); }
+    else if (!m_registerOnce) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if (rt) {
+            LOG_ERROR("epoll_ctl fd %d event %d error %d", fd, event, rt);
+            return false;
+        }
     }
 
     --m_pendingEventCount;
@@ -166,24 +332,33 @@ bool IOManager::delEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) { return false; }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) { return false; }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if (m_uring) {
+        UringRequest* request = fd_ctx->getContext(event).request;
+        if (request) {
+            // 请求以-ECANCELED完成后由完成事件恢复协程
+            cancelUring((uint64_t)(uintptr_t)request | kUringRequestTag);
+            return true;
+        }
+    }
     if (PICO_UNLIKELY(!(fd_ctx->events & event))) { return false; }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        LOG_ERROR("epoll_ctl fd %d event %d error %d", fd, event, rt);
-        return false;
+    if (m_uring) { cancelUring((uint64_t)(uintptr_t)fd_ctx | event); }
+    else if (!m_registerOnce) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if (rt) {
+            LOG_ERROR("epoll_ctl fd %d event %d error %d", fd, event, rt);
+            return false;
+        }
     }
 
     fd_ctx->triggerEvent(event);
@@ -191,24 +366,64 @@ bool IOManager::cancelEvent(int fd, Event event) {
     return true;
 }
 
+void IOManager::ResetFd(int fd) {
+    if (s_register_once_count.load(std::memory_order_relaxed) == 0) { return; }
+    Mutex::Lock lock(s_register_once_mutex);
+    for (IOManager* iom : s_register_once_managers) { iom->resetFd(fd); }
+}
+
+void IOManager::resetFd(int fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) { return; }
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
+}
+
 bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if ((int)m_fdContexts.size() <= fd) { return false; }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if (!fd_ctx) { return false; }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if (!fd_ctx->events) { return false; }
+    if (m_uring) {
+        // poll和请求持有文件的引用, close之后不会自行结束, 必须显式取消
+        bool cancelled = false;
+        if (fd_ctx->read.request) {
+            cancelUring((uint64_t)(uintptr_t)fd_ctx->read.request | kUringRequestTag);
+            cancelled = true;
+        }
+        if (fd_ctx->write.request) {
+            cancelUring((uint64_t)(uintptr_t)fd_ctx->write.request | kUringRequestTag);
+            cancelled = true;
+        }
+        if (!fd_ctx->events) { return cancelled; }
+        if (fd_ctx->events & READ) { cancelUring((uint64_t)(uintptr_t)fd_ctx | READ); }
+        if (fd_ctx->events & WRITE) { cancelUring((uint64_t)(uintptr_t)fd_ctx | WRITE); }
+    }
+    else if (m_registerOnce) {
+        // hook的close会调用cancelAll, 在这里撤销注册, fd复用时重新注册
+        if (fd_ctx->registered) {
+            epoll_event epevent;
+            memset(&epevent, 0, sizeof(epevent));
+            epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, &epevent);
+            fd_ctx->registered = false;
+        }
+        fd_ctx->ready = NONE;
+        if (!fd_ctx->events) { return false; }
+    }
+    else {
+        if (!fd_ctx->events) { return false; }
 
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = 0;
+        epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) {
-        LOG_ERROR("epoll_ctl fd %d error %d", fd, rt);
-        return false;
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if (rt) {
+            LOG_ERROR("epoll_ctl fd %d error %d", fd, rt);
+            return false;
+        }
     }
 
     if (fd_ctx->events & READ) {
@@ -229,9 +444,37 @@ IOManager* IOManager::GetThis() {
 }
 
 void IOManager::tickle() {
-    if (!hasIdleThreads()) { return; }
-    int rt = write(m_tickleFds[1], "T", 1);
-    assert(rt == 1);
+    // 只在有线程阻塞等待时唤醒, 且同一时间只有一次唤醒在途;
+    // 被唤醒的线程发现还有剩余任务时会再次tickle, 依次唤醒下一个
+    if (!hasSleepingThreads()) { return; }
+    if (m_wakePending.exchange(true)) { return; }
+    if (m_uring) {
+        // 空操作的完成事件会唤醒阻塞在io_uring_enter上的线程
+        io_uring_sqe sqe;
+        IOUring::Prep(sqe, IORING_OP_NOP, -1, nullptr, 0, 0);
+        sqe.user_data = kUringTickleKey;
+        m_uring->push(sqe);
+        m_uring->submit();
+        return;
+    }
+    uint64_t one = 1;
+    int rt = write(m_tickleFd, &one, sizeof(one));
+    assert(rt == sizeof(one));
+    (void)rt;
+}
+
+bool IOManager::hasSleepingThreads() {
+    for (size_t i = 0; i < m_sleepFlagCount; ++i) {
+        if (m_sleepFlags[i].sleeping.load()) { return true; }
+    }
+    return false;
+}
+
+void IOManager::tickle(int thread) {
+    // 目标线程正在执行任务时会在下一轮循环中检查邮箱, 无需唤醒
+    if (!isThreadIdle(thread)) { return; }
+    int rt = syscall(SYS_tgkill, getpid(), thread, WakeupSignal());
+    if (rt) { LOG_ERROR("tgkill thread %d error %d", thread, errno); }
 }
 
 bool IOManager::stopping(uint64_t& timeout) {
@@ -244,32 +487,56 @@ bool IOManager::stopping() {
     return stopping(timeout);
 }
 
+void IOManager::onThreadStart() {
+    // 在线程第一次被标记为idle之前屏蔽唤醒信号, 否则标记之后、屏蔽之前到达的信号会被直接处理掉,
+    // 随后的epoll_pwait要等到超时才返回
+    sigset_t block_mask;
+    sigemptyset(&block_mask);
+    sigaddset(&block_mask, WakeupSignal());
+    pthread_sigmask(SIG_BLOCK, &block_mask, &t_saved_mask);
+}
+
+void IOManager::onThreadExit() {
+    pthread_sigmask(SIG_SETMASK, &t_saved_mask, nullptr);
+}
+
 void IOManager::idle() {
-    const uint64_t MAX_EVNETS = 256;
-    epoll_event* events = new epoll_event[MAX_EVNETS]();
-    std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) { delete[] ptr; });
+    // 唤醒信号已在onThreadStart中屏蔽, 只在epoll_pwait/io_uring_enter期间接收
+    sigset_t wait_mask;
+    pthread_sigmask(SIG_BLOCK, nullptr, &wait_mask);
+    sigdelset(&wait_mask, WakeupSignal());
+
+    // 每个线程的idle协程只创建一次, 在这里领取本线程的睡眠标记
+    size_t slot = m_nextSleepFlag++;
+    assert(slot < m_sleepFlagCount);
+    SleepFlag& flag = m_sleepFlags[slot];
+
+    if (m_uring) {
+        idleUring(wait_mask, flag);
+        return;
+    }
+
+    // idle协程在线程的整个生命周期内复用同一组缓冲区
+    std::vector<epoll_event> events(m_batchSize);
+    std::vector<std::function<void()>> cbs;
 
     while (true) {
+        // 先标记睡眠再计算超时和检查任务, 与添加定时器、投递任务时先修改再检查标记相配合
+        flag.sleeping = true;
         uint64_t next_timeout = 0;
-        if (PICO_UNLIKELY(stopping(next_timeout))) { break; }
-
-        int rt = 0;
-        do {
-            static const int MAX_TIMEOUT = 3000;
-            if (next_timeout != ~0ull) {
-                next_timeout = (int)next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
-            }
-            else {
-                next_timeout = MAX_TIMEOUT;
-            }
-            rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
-            if (rt < 0 && errno == EINTR) {}
-            else {
-                break;
-            }
-        } while (true);
+        if (PICO_UNLIKELY(stopping(next_timeout))) {
+            flag.sleeping = false;
+            // 依次唤醒其他线程退出
+            tickle();
+            break;
+        }
+        next_timeout = std::min(next_timeout, kMaxIdleTimeout);
+        if (hasPendingTasks()) { next_timeout = 0; }
+        // 被定向唤醒时返回EINTR, 直接回到调度循环检查邮箱
+        int rt =
+            epoll_pwait(m_epfd, &events[0], events.size(), (int)next_timeout, &wait_mask);
+        flag.sleeping = false;
 
-        std::vector<std::function<void()>> cbs;
         listExpiredCb(cbs);
         if (!cbs.empty()) {
             schedule(cbs.begin(), cbs.end());
@@ -278,10 +545,11 @@ void IOManager::idle() {
 
         for (int i = 0; i < rt; ++i) {
             epoll_event& event = events[i];
-            if (event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0)
+            if (!event.data.ptr) {
+                uint64_t dummy;
+                while (read(m_tickleFd, &dummy, sizeof(dummy)) > 0)
                     ;
+                m_wakePending = false;
                 continue;
             }
 
@@ -294,6 +562,22 @@ void IOManager::idle() {
             if (event.events & EPOLLIN) { real_events |= READ; }
             if (event.events & EPOLLOUT) { real_events |= WRITE; }
 
+            if (m_registerOnce) {
+                if (event.events & (EPOLLERR | EPOLLHUP)) { real_events |= READ | WRITE; }
+                // 没有等待者的事件记为就绪, 由下一次addEvent消费, 注册保持不变
+                fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+                real_events &= fd_ctx->events;
+                if (real_events & READ) {
+                    fd_ctx->triggerEvent(READ);
+                    --m_pendingEventCount;
+                }
+                if (real_events & WRITE) {
+                    fd_ctx->triggerEvent(WRITE);
+                    --m_pendingEventCount;
+                }
+                continue;
+            }
+
             if ((fd_ctx->events & real_events) == NONE) { continue; }
 
             int left_events = (fd_ctx->events & ~real_events);
@@ -323,8 +607,143 @@ void IOManager::idle() {
     }
 }
 
+void IOManager::idleUring(const sigset_t& wait_mask, SleepFlag& flag) {
+    std::vector<std::function<void()>> cbs;
+
+    while (true) {
+        flag.sleeping = true;
+        uint64_t next_timeout = 0;
+        if (PICO_UNLIKELY(stopping(next_timeout))) {
+            flag.sleeping = false;
+            tickle();
+            break;
+        }
+        next_timeout = std::min(next_timeout, kMaxIdleTimeout);
+        if (hasPendingTasks()) { next_timeout = 0; }
+        // 顺带提交积累的请求; 被定向唤醒时返回EINTR, 直接回到调度循环检查邮箱
+        m_uring->wait(&wait_mask, next_timeout);
+        flag.sleeping = false;
+
+        listExpiredCb(cbs);
+        if (!cbs.empty()) {
+            schedule(cbs.begin(), cbs.end());
+            cbs.clear();
+        }
+        reapUring();
+
+        Fiber::Ptr cur = Fiber::GetThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
+
+        raw_ptr->swapOut();
+    }
+}
+
+int IOManager::submitRequest(int fd, Event event, io_uring_sqe& sqe) {
+    assert(m_uring);
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if (!fd_ctx) {
+        LOG_ERROR("fd %d exceeds RLIMIT_NOFILE", fd);
+        return -EBADF;
+    }
+
+    UringRequest request;
+    request.fd_ctx = fd_ctx;
+    request.event = event;
+    request.scheduler = Scheduler::GetThis();
+    request.fiber = Fiber::GetThis();
+    assert(!request.fiber->isSharedStack());
+    sqe.user_data = (uint64_t)(uintptr_t)&request | kUringRequestTag;
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if (event != NONE) {
+            FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
+            if (PICO_UNLIKELY(event_ctx.request)) {
+                LOG_ERROR("fd %d event %d already has a request in flight", fd, event);
+                assert(!event_ctx.request);
+            }
+            // 在锁内写入提交队列, 保证cancelEvent看到的请求已经排在取消请求之前
+            event_ctx.request = &request;
+        }
+        ++m_pendingEventCount;
+        pushUring(sqe);
+    }
+    Fiber::yieldToHold();
+    return request.result;
+}
+
+void IOManager::pushUring(const io_uring_sqe& sqe) {
+    m_uring->push(sqe);
+    // 没有线程阻塞等待时所有线程都在执行任务, 留到本地队列为空或idle时一次系统调用批量提交
+    if (hasSleepingThreads()) { m_uring->submit(); }
+}
+
+void IOManager::cancelUring(uint64_t key) {
+    io_uring_sqe sqe;
+    IOUring::Prep(sqe, IORING_OP_ASYNC_CANCEL, -1, nullptr, 0, 0);
+    sqe.addr = key;
+    m_uring->push(sqe);
+    // hook的close在cancelAll之后立即关闭fd, 取消必须马上生效
+    m_uring->submit();
+}
+
+void IOManager::reapUring() {
+    io_uring_cqe cqes[64];
+    size_t count = 0;
+    do {
+        count = m_uring->reap(cqes, sizeof(cqes) / sizeof(cqes[0]));
+        for (size_t i = 0; i < count; ++i) { handleCompletion(cqes[i]); }
+    } while (count == sizeof(cqes) / sizeof(cqes[0]));
+}
+
+void IOManager::handleCompletion(const io_uring_cqe& cqe) {
+    uint64_t key = cqe.user_data;
+    if (!key) { return; }
+    if (key == kUringTickleKey) {
+        m_wakePending = false;
+        return;
+    }
+
+    if (key & kUringRequestTag) {
+        UringRequest* request = (UringRequest*)(uintptr_t)(key & ~kUringRequestTag);
+        FdContext* fd_ctx = request->fd_ctx;
+        Fiber::Ptr fiber;
+        Scheduler* scheduler = nullptr;
+        {
+            FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            if (request->event != NONE) {
+                FdContext::EventContext& event_ctx = fd_ctx->getContext(request->event);
+                if (event_ctx.request == request) { event_ctx.request = nullptr; }
+            }
+            request->result = cqe.res;
+            fiber.swap(request->fiber);
+            scheduler = request->scheduler;
+        }
+        // 协程恢复后request随栈帧失效, 此后不能再访问
+        --m_pendingEventCount;
+        scheduler->schedule(&fiber);
+        return;
+    }
+
+    // 被取消的poll已经在取消时触发过, 该方向上可能已有新的等待者
+    if (cqe.res == -ECANCELED) { return; }
+    FdContext* fd_ctx = (FdContext*)(uintptr_t)(key & ~(uint64_t)(READ | WRITE));
+    Event event = (Event)(key & (READ | WRITE));
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if (!(fd_ctx->events & event)) { return; }
+    fd_ctx->triggerEvent(event);
+    --m_pendingEventCount;
+}
+
 void IOManager::onTimerInsertAtFront() {
     tickle();
 }
 
+void IOManager::onQueueDrained() {
+    if (!m_uring) { return; }
+    m_uring->submit();
+    // 忙碌的线程不会进入idle, 在这里处理已经完成的事件
+    reapUring();
+}
+
 }   // namespace pico
\ No newline at end of file
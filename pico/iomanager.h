@@ -1,6 +1,8 @@
 #ifndef __PICO_IOMANAGER_H__
 #define __PICO_IOMANAGER_H__
 
+#include <signal.h>
+
 #include <functional>
 #include <memory>
 #include <string>
@@ -8,13 +10,17 @@
 #include "scheduler.h"
 #include "timer.h"
 
+struct io_uring_sqe;
+struct io_uring_cqe;
+
 namespace pico {
 
+class IOUring;
+
 class IOManager : public Scheduler, public TimerManager
 {
 public:
     typedef std::shared_ptr<IOManager> Ptr;
-    typedef RWMutex RWMutexType;
     enum Event
     {
         /// 无事件
@@ -26,14 +32,30 @@ public:
     };
 
 private:
+    struct FdContext;
+    /**
+     * @brief io_uring后端中正在执行的请求, 位于发起请求的协程栈上, 完成前协程不会返回
+     */
+    struct UringRequest
+    {
+        FdContext* fd_ctx = nullptr;
+        Event event = NONE;
+        Scheduler* scheduler = nullptr;
+        Fiber::Ptr fiber;
+        /// 内核返回的结果, 失败时为-errno
+        int result = 0;
+    };
+
     struct FdContext
     {
-        typedef Mutex MutexType;
+        typedef Spinlock MutexType;
         struct EventContext
         {
             Scheduler* scheduler = nullptr;
             Fiber::Ptr fiber;
             std::function<void()> cb;
+            /// io_uring后端中该方向上正在执行的请求, 供cancelEvent/cancelAll取消
+            UringRequest* request = nullptr;
         };
         EventContext& getContext(Event event);
         void resetContext(EventContext& ctx);
@@ -43,35 +65,118 @@ private:
         EventContext read;
         EventContext write;
         int fd = 0;
+        /// 正在等待的事件
         Event events = NONE;
+        /// 常驻注册模式下, 到达时没有等待者的事件
+        Event ready = NONE;
+        /// 常驻注册模式下是否已加入epoll
+        bool registered = false;
         MutexType mutex;
     };
 
 public:
     IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
     ~IOManager();
+    /**
+     * @brief 登记fd上一个方向的等待, 事件到达时调度cb, cb为空时调度当前协程
+     * @return 成功返回0; 失败返回-1, 该方向已有等待者时errno为EEXIST
+     */
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
 
     bool cancelAll(int fd);
 
+    /**
+     * @brief FdManager重建fd的记录时调用, 清除常驻注册模式下该fd残留的注册状态
+     * @details fd没有经过hook的close就被关闭时, 内核已经把它移出epoll, 而registered和ready
+     *          仍是旧fd的状态, 复用该fd的新连接会永远等不到事件. 清除后下一次addEvent重新注册,
+     *          注册时内核会报告当时已经就绪的事件
+     */
+    static void ResetFd(int fd);
+
+    /**
+     * @brief 是否使用io_uring后端
+     */
+    bool isUring() const { return m_uring != nullptr; }
+
+    /**
+     * @brief 在调度器负载之上加上等待中的事件数, 挂起等待读写的长连接也计入负载
+     */
+    size_t getLoad() override { return Scheduler::getLoad() + m_pendingEventCount; }
+
+    /**
+     * @brief 向io_uring提交请求并挂起当前协程, 完成后返回内核给出的结果
+     * @param[in] event 请求的方向, cancelEvent/cancelAll按方向取消; 为NONE时不占用fd的等待位,
+     *                  同一fd上可以同时有多个请求, 但不能被取消, 用于普通文件的读写
+     * @return 成功时为系统调用的返回值, 失败时为-errno, 被取消时为-ECANCELED
+     * @pre isUring()为true; 当前协程不能是共享栈协程, 挂起期间内核会访问其栈上的缓冲区
+     */
+    int submitRequest(int fd, Event event, io_uring_sqe& sqe);
+
     static IOManager* GetThis();
 
 protected:
     void tickle() override;
+    void tickle(int thread) override;
     bool stopping() override;
     void idle() override;
     void onTimerInsertAtFront() override;
-    void contextResize(size_t size);
+    void onQueueDrained() override;
+    void onThreadStart() override;
+    void onThreadExit() override;
+    /**
+     * @brief 获取fd对应的FdContext
+     * @param[in] auto_create 所在的段不存在时是否分配
+     * @return fd超出RLIMIT_NOFILE或者段不存在且auto_create为false时返回nullptr
+     */
+    FdContext* getFdContext(int fd, bool auto_create);
     bool stopping(uint64_t& timeout);
 
 private:
-    int m_epfd = 0;
-    int m_tickleFds[2];
+    /**
+     * @brief 线程是否阻塞或即将阻塞在epoll_wait/io_uring_enter上, 每个调度线程一个
+     */
+    struct SleepFlag
+    {
+        std::atomic<bool> sleeping = {false};
+        /// 避免相邻线程的标记位于同一缓存行
+        char padding[63];
+    };
+
+    bool hasSleepingThreads();
+    void resetFd(int fd);
+    void idleUring(const sigset_t& wait_mask, SleepFlag& flag);
+    /**
+     * @brief 向io_uring写入sqe, 有空闲线程时立即提交, 否则留到本地队列为空或idle时批量提交
+     */
+    void pushUring(const io_uring_sqe& sqe);
+    /**
+     * @brief 取消io_uring中用户数据为key的请求或poll
+     */
+    void cancelUring(uint64_t key);
+    void reapUring();
+    void handleCompletion(const io_uring_cqe& cqe);
+
+private:
+    int m_epfd = -1;
+    /// 唤醒阻塞在epoll_wait上的线程, 以边缘触发注册, 每次写入只唤醒一个等待者
+    int m_tickleFd = -1;
+    /// 配置为io_uring且初始化成功时不为空, 此时不使用epoll
+    std::unique_ptr<IOUring> m_uring;
     std::atomic<size_t> m_pendingEventCount = {0};
-    RWMutexType m_mutex;
-    std::vector<FdContext*> m_fdContexts;
+    std::unique_ptr<SleepFlag[]> m_sleepFlags;
+    size_t m_sleepFlagCount = 0;
+    std::atomic<size_t> m_nextSleepFlag = {0};
+    /// 已发出但还没有线程处理的唤醒, 期间的tickle合并为一次
+    std::atomic<bool> m_wakePending = {false};
+    /// fd只在首次等待时注册一次边缘触发的读写事件, 之后只在用户态记录关注的事件
+    bool m_registerOnce = false;
+    /// 每次epoll_wait最多返回的事件数
+    size_t m_batchSize = 256;
+    /// 分段fd表, 段数按RLIMIT_NOFILE预留, 段按需分配且不再释放, 查找不加锁
+    std::unique_ptr<std::atomic<FdContext*>[]> m_fdContexts;
+    size_t m_segmentCount = 0;
 };
 
 
@@ -38,9 +38,9 @@ Connection* ConnectionPool::createConnection() {
 
 void ConnectionPool::releaseConnection(Connection* conn) {
     if (conn) {
-        std::unique_lock<std::mutex> lock(_mutex);
+        FiberMutex::Lock lock(_mutex);
         _conns.push(conn);
-        _cond.notify_one();
+        _cond.notifyOne();
     }
 }
 
@@ -52,7 +52,7 @@ std::shared_ptr<Connection> ConnectionPool::popConnection() {
 }
 
 std::shared_ptr<Connection> ConnectionPool::getConnection() {
-    std::unique_lock<std::mutex> lock(_mutex);
+    FiberMutex::Lock lock(_mutex);
 
     std::shared_ptr<Connection> conn = nullptr;
 
@@ -69,8 +69,7 @@ std::shared_ptr<Connection> ConnectionPool::getConnection() {
                                            [this](Connection* conn) { releaseConnection(conn); });
     }
 
-    if (!_cond.wait_for(
-            lock, std::chrono::seconds(_idle_timeout), [this]() { return !_conns.empty(); })) {
+    if (!_cond.waitFor(lock, _idle_timeout, [this]() { return !_conns.empty(); })) {
         LOG_ERROR("wait for connection timeout");
         return conn;
     }
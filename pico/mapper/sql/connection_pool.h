@@ -1,8 +1,6 @@
 #ifndef __PICO_MAPPER_SQL_CONNECTION_POOL_H__
 #define __PICO_MAPPER_SQL_CONNECTION_POOL_H__
 
-#include <chrono>
-#include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -10,6 +8,7 @@
 #include <thread>
 #include <unordered_map>
 
+#include "../../mutex.h"
 #include "../../singleton.h"
 #include "connection.h"
 #include "sql_option.h"
@@ -38,13 +37,15 @@ private:
     std::shared_ptr<Connection> popConnection();
 
 private:
-    std::mutex _mutex;
-    std::condition_variable _cond;
+    /// 等待连接时只挂起当前协程, 不阻塞调度线程
+    FiberMutex _mutex;
+    FiberCondition _cond;
     std::queue<Connection*> _conns;
 
     int _min_conn_num = 1;
     int _max_conn_num = 20;
-    int _idle_timeout = 60;
+    /// 连接耗尽时的最长等待时间(毫秒)
+    int _idle_timeout = 60 * 1000;
 
     int _open_conn_num = 0;
 
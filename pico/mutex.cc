@@ -1,5 +1,14 @@
 #include "mutex.h"
 
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "fiber.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "util.h"
+
 namespace pico {
 Semaphore::Semaphore(uint32_t count) {
     if (sem_init(&m_semaphore, 0, count)) { throw std::logic_error("sem_init error"); }
@@ -17,4 +26,188 @@ void Semaphore::notify() {
     if (sem_post(&m_semaphore)) { throw std::logic_error("sem_post error"); }
 }
 
-}   // namespace pico
\ No newline at end of file
+/**
+ * @brief 当前是否运行在调度器的任务协程中, 只有任务协程可以挂起后由调度器恢复
+ */
+static bool InTaskFiber() {
+    if (!Scheduler::GetThis()) { return false; }
+    Fiber::Ptr cur = Fiber::GetThis();
+    return cur.get() != Scheduler::GetMainFiber() && !cur->isThreadMain();
+}
+
+FiberWaiter::FiberWaiter(uint64_t timeout_ms)
+    : m_timeout(timeout_ms) {
+    if (!InTaskFiber()) { return; }
+    if (timeout_ms != ~0ull && !dynamic_cast<TimerManager*>(Scheduler::GetThis())) { return; }
+    m_scheduler = Scheduler::GetThis();
+    m_fiber = Fiber::GetThis();
+}
+
+bool FiberWaiter::park() {
+    if (!m_scheduler) {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        if (m_timeout == ~0ull) {
+            m_cond.wait(guard, [this]() { return m_woken; });
+            return true;
+        }
+        if (m_cond.wait_for(
+                guard, std::chrono::milliseconds(m_timeout), [this]() { return m_woken; })) {
+            return true;
+        }
+        int expected = WAITING;
+        // 超时与唤醒同时发生时以唤醒为准, 交接已经完成
+        return !m_state.compare_exchange_strong(expected, TIMEOUT);
+    }
+
+    Timer::Ptr timer;
+    if (m_timeout != ~0ull) {
+        std::weak_ptr<FiberWaiter> weak_waiter(shared_from_this());
+        timer = dynamic_cast<TimerManager*>(m_scheduler)->addTimer(m_timeout, [weak_waiter]() {
+            FiberWaiter::Ptr waiter = weak_waiter.lock();
+            if (!waiter) { return; }
+            int expected = WAITING;
+            if (waiter->m_state.compare_exchange_strong(expected, TIMEOUT)) { waiter->wake(); }
+        });
+    }
+    Fiber::yieldToHold();
+    if (timer) { timer->cancel(); }
+    return m_state == NOTIFIED;
+}
+
+bool FiberWaiter::notify() {
+    int expected = WAITING;
+    return m_state.compare_exchange_strong(expected, NOTIFIED);
+}
+
+void FiberWaiter::wake() {
+    if (m_scheduler) {
+        Fiber::Ptr fiber;
+        fiber.swap(m_fiber);
+        m_scheduler->schedule(fiber);
+        return;
+    }
+    std::unique_lock<std::mutex> guard(m_mutex);
+    m_woken = true;
+    m_cond.notify_one();
+}
+
+bool FiberWaitQueue::wait(Spinlock::Lock& lock, uint64_t timeout_ms) {
+    FiberWaiter::Ptr waiter = std::make_shared<FiberWaiter>(timeout_ms);
+    m_waiters.push_back(waiter);
+    lock.unlock();
+    if (waiter->park()) { return true; }
+    // 超时的等待者可能已被pop跳过
+    Spinlock::Lock relock(m_mutex);
+    auto it = std::find(m_waiters.begin(), m_waiters.end(), waiter);
+    if (it != m_waiters.end()) { m_waiters.erase(it); }
+    return false;
+}
+
+FiberWaiter::Ptr FiberWaitQueue::pop() {
+    while (!m_waiters.empty()) {
+        FiberWaiter::Ptr waiter = m_waiters.front();
+        m_waiters.pop_front();
+        if (waiter->notify()) { return waiter; }
+    }
+    return nullptr;
+}
+
+void FiberMutex::lock() {
+    Spinlock::Lock lock(m_mutex);
+    if (!m_locked) {
+        m_locked = true;
+        return;
+    }
+    // 被唤醒时解锁方已经把所有权交给了当前协程
+    m_waiters.wait(lock);
+}
+
+bool FiberMutex::tryLock() {
+    Spinlock::Lock lock(m_mutex);
+    if (m_locked) { return false; }
+    m_locked = true;
+    return true;
+}
+
+void FiberMutex::unlock() {
+    Spinlock::Lock lock(m_mutex);
+    FiberWaiter::Ptr waiter = m_waiters.pop();
+    if (!waiter) { m_locked = false; }
+    lock.unlock();
+    if (waiter) { waiter->wake(); }
+}
+
+void FiberCondition::wait(FiberMutex::Lock& lock) {
+    waitFor(lock, ~0ull);
+}
+
+bool FiberCondition::waitFor(FiberMutex::Lock& lock, uint64_t timeout_ms) {
+    Spinlock::Lock guard(m_mutex);
+    // 先入队再释放FiberMutex, 持锁方在此之后的notify不会丢失
+    lock.unlock();
+    bool rt = m_waiters.wait(guard, timeout_ms);
+    lock.lock();
+    return rt;
+}
+
+bool FiberCondition::waitFor(FiberMutex::Lock& lock, uint64_t timeout_ms,
+                             std::function<bool()> pred) {
+    if (timeout_ms == ~0ull) {
+        while (!pred()) { wait(lock); }
+        return true;
+    }
+    uint64_t deadline = pico::getCurrentTime() + timeout_ms;
+    while (!pred()) {
+        uint64_t now = pico::getCurrentTime();
+        if (now >= deadline) { return false; }
+        if (!waitFor(lock, deadline - now)) { return pred(); }
+    }
+    return true;
+}
+
+void FiberCondition::notifyOne() {
+    Spinlock::Lock guard(m_mutex);
+    FiberWaiter::Ptr waiter = m_waiters.pop();
+    guard.unlock();
+    if (waiter) { waiter->wake(); }
+}
+
+void FiberCondition::notifyAll() {
+    std::vector<FiberWaiter::Ptr> waiters;
+    {
+        Spinlock::Lock guard(m_mutex);
+        while (FiberWaiter::Ptr waiter = m_waiters.pop()) { waiters.push_back(waiter); }
+    }
+    for (auto& waiter : waiters) { waiter->wake(); }
+}
+
+void FiberSemaphore::wait() {
+    waitFor(~0ull);
+}
+
+bool FiberSemaphore::waitFor(uint64_t timeout_ms) {
+    Spinlock::Lock lock(m_mutex);
+    if (m_count > 0) {
+        --m_count;
+        return true;
+    }
+    // 被唤醒时notify已经把计数直接交给当前协程
+    return m_waiters.wait(lock, timeout_ms);
+}
+
+bool FiberSemaphore::tryWait() {
+    Spinlock::Lock lock(m_mutex);
+    if (m_count == 0) { return false; }
+    --m_count;
+    return true;
+}
+
+void FiberSemaphore::notify() {
+    Spinlock::Lock lock(m_mutex);
+    FiberWaiter::Ptr waiter = m_waiters.pop();
+    if (!waiter) { ++m_count; }
+    lock.unlock();
+    if (waiter) { waiter->wake(); }
+}
+
+}   // namespace pico
@@ -5,8 +5,11 @@
 #include <semaphore.h>
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 
@@ -297,6 +300,174 @@ private:
     volatile std::atomic_flag m_mutex;
 };
 
+class Fiber;
+class Scheduler;
+
+/**
+ * @brief 挂起中的等待者
+ * @details 在调度器的任务协程中创建时只挂起当前协程, 唤醒时通过协程所属的Scheduler重新调度,
+ *          超时由调度器的TimerManager驱动; 在调度器之外(或调度器不带定时器却需要超时)创建时
+ *          退化为阻塞线程. 可以同时挂在多个等待队列上, 唤醒方与超时通过notify的CAS竞争,
+ *          只有一方生效; 等待者返回后自己负责从仍挂着的队列上摘除
+ */
+class FiberWaiter : public std::enable_shared_from_this<FiberWaiter>, Noncopyable
+{
+public:
+    typedef std::shared_ptr<FiberWaiter> Ptr;
+    enum State
+    {
+        WAITING,
+        NOTIFIED,
+        TIMEOUT
+    };
+
+    /**
+     * @param[in] timeout_ms park的超时时间(毫秒), ~0ull表示一直等待
+     */
+    explicit FiberWaiter(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 挂起直到被唤醒或超时, 调用前需要已经加入等待队列
+     * @details notify与wake发生在park之前时立即返回
+     * @return 被唤醒返回true, 超时返回false
+     */
+    bool park();
+
+    /**
+     * @brief 抢占等待者, 成功后调用方完成交接并在释放队列锁之后调用wake
+     * @return 已被其他唤醒方抢占或已超时返回false
+     */
+    bool notify();
+
+    void wake();
+
+    State getState() const { return (State)m_state.load(); }
+
+private:
+    std::atomic<int> m_state = {WAITING};
+    uint64_t m_timeout;
+    /// 在任务协程中等待时有效
+    Scheduler* m_scheduler = nullptr;
+    std::shared_ptr<Fiber> m_fiber;
+    /// 阻塞线程等待时使用
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_woken = false;
+};
+
+/**
+ * @brief 协程同步原语的等待队列, 由所属原语的Spinlock保护
+ * @details 原语不能放在共享栈协程的栈上, 该协程挂起后其他协程无法访问
+ */
+class FiberWaitQueue : Noncopyable
+{
+public:
+    explicit FiberWaitQueue(Spinlock& mutex)
+        : m_mutex(mutex) {}
+
+    /**
+     * @brief 加入队尾并挂起, 直到被pop或超时
+     * @param[in] lock 已持有的原语锁, 入队后释放, 返回时不再持有
+     * @param[in] timeout_ms 超时时间(毫秒), ~0ull表示一直等待
+     * @return 被唤醒返回true, 超时返回false
+     */
+    bool wait(Spinlock::Lock& lock, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 取出队首等待者并notify, 跳过已超时的, 调用方持有原语锁
+     * @return 队列为空时返回nullptr; 返回的等待者需要在释放锁之后wake
+     */
+    FiberWaiter::Ptr pop();
+
+    bool empty() const { return m_waiters.empty(); }
+
+private:
+    Spinlock& m_mutex;
+    std::list<FiberWaiter::Ptr> m_waiters;
+};
+
+/**
+ * @brief 协程互斥锁, 竞争时只挂起当前协程, 持有期间可以执行会让出协程的io
+ * @details 解锁时所有权直接交给队首等待者
+ */
+class FiberMutex : Noncopyable
+{
+public:
+    typedef ScopedLockImpl<FiberMutex> Lock;
+
+    FiberMutex()
+        : m_waiters(m_mutex) {}
+
+    void lock();
+
+    bool tryLock();
+
+    void unlock();
+
+private:
+    Spinlock m_mutex;
+    bool m_locked = false;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程条件变量, 配合FiberMutex使用
+ */
+class FiberCondition : Noncopyable
+{
+public:
+    FiberCondition()
+        : m_waiters(m_mutex) {}
+
+    void wait(FiberMutex::Lock& lock);
+
+    /**
+     * @brief 最多等待timeout_ms毫秒, 返回前重新加锁
+     * @return 被唤醒返回true, 超时返回false
+     */
+    bool waitFor(FiberMutex::Lock& lock, uint64_t timeout_ms);
+
+    /**
+     * @brief 等待直到pred为true或超时
+     * @return 返回时pred的结果
+     */
+    bool waitFor(FiberMutex::Lock& lock, uint64_t timeout_ms, std::function<bool()> pred);
+
+    void notifyOne();
+
+    void notifyAll();
+
+private:
+    Spinlock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程信号量, 计数为0时只挂起当前协程
+ */
+class FiberSemaphore : Noncopyable
+{
+public:
+    explicit FiberSemaphore(uint32_t count = 0)
+        : m_count(count)
+        , m_waiters(m_mutex) {}
+
+    void wait();
+
+    /**
+     * @return 获取成功返回true, 超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms);
+
+    bool tryWait();
+
+    void notify();
+
+private:
+    Spinlock m_mutex;
+    uint32_t m_count;
+    FiberWaitQueue m_waiters;
+};
 
 }   // namespace pico
 
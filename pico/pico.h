@@ -1,11 +1,13 @@
 #include "address.h"
 #include "application.h"
+#include "channel.h"
 #include "class_factory.h"
 #include "common.h"
 #include "compression.h"
 #include "config.h"
 #include "daemon.h"
 #include "date.h"
+#include "dns.h"
 #include "env.h"
 #include "fdmanager.h"
 #include "fiber.h"
@@ -2,7 +2,6 @@
 #define __PICO_REDIS_H__
 
 #include <assert.h>
-#include <condition_variable>
 #include <hiredis/hiredis.h>
 #include <memory>
 #include <mutex>
@@ -12,6 +11,7 @@
 
 
 #include "config.h"
+#include "mutex.h"
 #include "serialize.hpp"
 #include "singleton.h"
 
@@ -717,7 +717,7 @@ public:
     }
 
     std::shared_ptr<RedisConnection> getConnection() {
-        std::unique_lock<std::mutex> lock(_mutex);
+        FiberMutex::Lock lock(_mutex);
         if (!_connections.empty()) {
             return popConnection();
         }
@@ -725,9 +725,7 @@ public:
             return std::shared_ptr<RedisConnection>(
                 createConnection(), [this](RedisConnection* conn) { releaseConnection(conn); });
         }
-        if (!_cond.wait_for(lock, std::chrono::seconds(_idle_time), [this]() {
-                return !_connections.empty();
-            })) {
+        if (!_cond.waitFor(lock, _idle_time, [this]() { return !_connections.empty(); })) {
             return nullptr;
         }
 
@@ -757,9 +755,9 @@ private:
 
     void releaseConnection(RedisConnection* conn) {
         if (conn) {
-            std::unique_lock<std::mutex> lock(_mutex);
+            FiberMutex::Lock lock(_mutex);
             _connections.push(conn);
-            _cond.notify_one();
+            _cond.notifyOne();
         }
     }
 
@@ -775,13 +773,15 @@ private:
 
 private:
     std::queue<RedisConnection*> _connections;
-    std::mutex _mutex;
-    std::condition_variable _cond;
+    /// 等待连接时只挂起当前协程, 不阻塞调度线程
+    FiberMutex _mutex;
+    FiberCondition _cond;
 
     int _min_conn_num = 10;
     int _max_conn_num = 20;
 
-    int _idle_time = 60;
+    /// 连接耗尽时的最长等待时间(毫秒)
+    int _idle_time = 60 * 1000;
 
 
     int _open_conn_num = 0;
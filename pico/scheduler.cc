@@ -1,4 +1,5 @@
 #include "scheduler.h"
+#include "config.h"
 #include "hook.h"
 #include "logging.h"
 #include "util.h"
@@ -7,6 +8,72 @@
 namespace pico {
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+/// 当前线程在所属调度器中的本地队列下标, -1表示没有本地队列
+static thread_local int t_queue_index = -1;
+
+static pico::ConfigVar<uint32_t>::Ptr g_local_queue_size = pico::Config::Lookup<uint32_t>(
+    "scheduler.local_queue_size", 256, "scheduler per-thread run queue capacity");
+
+/// 每调度多少次任务后优先检查一次全局队列, 避免全局队列中的任务饿死
+static const uint32_t kGlobalQueueCheckInterval = 61;
+
+bool Scheduler::LocalQueue::push(FiberAndThread& ft) {
+    MutexType::Lock lock(mutex);
+    size_t n = size;
+    if (n == tasks.size()) { return false; }
+    tasks[(head + n) % tasks.size()] = std::move(ft);
+    size = n + 1;
+    return true;
+}
+
+bool Scheduler::LocalQueue::pop(FiberAndThread& ft) {
+    if (empty()) { return false; }
+    MutexType::Lock lock(mutex);
+    size_t n = size;
+    if (n == 0) { return false; }
+    ft = std::move(tasks[head]);
+    head = (head + 1) % tasks.size();
+    size = n - 1;
+    return true;
+}
+
+size_t Scheduler::LocalQueue::steal(std::vector<FiberAndThread>& out) {
+    if (empty()) { return 0; }
+    MutexType::Lock lock(mutex);
+    size_t n = size;
+    // 窃取一半, 至少一个
+    size_t count = n - n / 2;
+    for (size_t i = 0; i < count; ++i) {
+        out.push_back(std::move(tasks[head]));
+        head = (head + 1) % tasks.size();
+    }
+    size = n - count;
+    return count;
+}
+
+bool Scheduler::LocalQueue::post(FiberAndThread& ft) {
+    MutexType::Lock lock(mailboxMutex);
+    bool was_empty = mailbox.empty();
+    mailbox.push_back(std::move(ft));
+    pinned = mailbox.size();
+    return was_empty;
+}
+
+bool Scheduler::LocalQueue::fetch(FiberAndThread& ft) {
+    if (mailboxEmpty()) { return false; }
+    MutexType::Lock lock(mailboxMutex);
+    if (mailbox.empty()) { return false; }
+    ft = std::move(mailbox.front());
+    mailbox.pop_front();
+    pinned = mailbox.size();
+    return true;
+}
+
+void Scheduler::LocalQueue::repost(FiberAndThread& ft) {
+    MutexType::Lock lock(mailboxMutex);
+    mailbox.push_front(std::move(ft));
+    pinned = mailbox.size();
+}
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     : m_name(name) {
@@ -55,13 +122,46 @@ void Scheduler::start() {
     m_stopping = false;
     assert(m_threads.empty());
 
+    // 外部线程不加锁读取m_queues, 在本地构建完成后一次性发布;
+    // 发布前findQueue返回空, 指定线程的任务先进入全局队列, 下面再移入邮箱
+    m_queuesReady.store(false, std::memory_order_release);
+    size_t queue_size = std::max<uint32_t>(g_local_queue_size->getValue(), 1);
+    std::vector<LocalQueue::Ptr> queues;
+    if (m_rootThread != -1) {
+        queues.push_back(LocalQueue::Ptr(new LocalQueue(queue_size)));
+        queues.back()->thread = m_rootThread;
+    }
+
+    // 新线程在queueIndex中等待m_mutex, 直到队列发布后才会访问m_queues
     m_threads.resize(m_threadCount);
     for (size_t i = 0; i < m_threadCount; ++i) {
         m_threads[i].reset(
             new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
         m_threadIds.push_back(m_threads[i]->getId());
+        queues.push_back(LocalQueue::Ptr(new LocalQueue(queue_size)));
+        queues.back()->thread = m_threads[i]->getId();
+    }
+    m_queues.swap(queues);
+    m_queuesReady.store(true, std::memory_order_release);
+
+    // 启动前投递的指定线程任务移入对应线程的邮箱
+    std::vector<int> targets;
+    for (auto it = m_fibers.begin(); it != m_fibers.end();) {
+        LocalQueue* queue = it->thread == -1 ? nullptr : findQueue(it->thread);
+        if (queue) {
+            queue->post(*it);
+            targets.push_back(queue->thread);
+            it = m_fibers.erase(it);
+        }
+        else {
+            ++it;
+        }
     }
     lock.unlock();
+
+    for (int thread : targets) {
+        tickle(thread);
+    }
 }
 
 void Scheduler::stop() {
@@ -115,28 +215,170 @@ void Scheduler::setThis() {
     t_scheduler = this;
 }
 
+size_t Scheduler::queueIndex() {
+    MutexType::Lock lock(m_mutex);
+    pid_t tid = pico::getThreadId();
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+        if (m_queues[i]->thread == tid) { return i; }
+    }
+    assert(false);
+    return 0;
+}
+
+Scheduler::LocalQueue* Scheduler::findQueue(int thread) {
+    if (!m_queuesReady.load(std::memory_order_acquire)) { return nullptr; }
+    for (auto& q : m_queues) {
+        if (q->thread == thread) { return q.get(); }
+    }
+    return nullptr;
+}
+
+bool Scheduler::hasPendingTasks() {
+    if (t_queue_index != -1 && !m_queues[t_queue_index]->mailboxEmpty()) { return true; }
+    // 其他线程本地队列中的任务可以窃取; 计数在入队前增加, 不会漏掉刚投递的任务
+    if (m_localTaskCount) { return true; }
+    const int thread_id = pico::getThreadId();
+    MutexType::Lock lock(m_mutex);
+    for (auto& ft : m_fibers) {
+        if (ft.thread != -1 && ft.thread != thread_id) { continue; }
+        if (ft.fiber && ft.fiber->getState() == Fiber::EXEC) { continue; }
+        return true;
+    }
+    return false;
+}
+
+size_t Scheduler::getLoad() {
+    size_t load = m_activeThreadCount + m_localTaskCount;
+    MutexType::Lock lock(m_mutex);
+    return load + m_fibers.size();
+}
+
+bool Scheduler::isThreadIdle(int thread) {
+    LocalQueue* queue = findQueue(thread);
+    return queue && queue->idle;
+}
+
+bool Scheduler::enqueue(FiberAndThread& ft) {
+    if (ft.fiber && ft.fiber->getBoundThread() != -1) {
+        // 共享栈协程的栈内容只在所属线程的共享栈上有效
+        ft.thread = ft.fiber->getBoundThread();
+    }
+    if (ft.thread != -1) {
+        LocalQueue* queue = findQueue(ft.thread);
+        if (queue) {
+            int thread = ft.thread;
+            bool self = t_queue_index != -1 && GetThis() == this &&
+                        m_queues[t_queue_index].get() == queue;
+            // 只有邮箱由空变为非空时才需要唤醒, 且只唤醒所属线程
+            if (queue->post(ft) && !self) { tickle(thread); }
+            return false;
+        }
+    }
+    else if (t_queue_index != -1 && GetThis() == this) {
+        LocalQueue::Ptr& queue = m_queues[t_queue_index];
+        bool need_tickle = queue->empty();
+        ++m_localTaskCount;
+        if (queue->push(ft)) { return need_tickle; }
+        --m_localTaskCount;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    bool need_tickle = m_fibers.empty();
+    m_fibers.push_back(std::move(ft));
+    return need_tickle;
+}
+
+bool Scheduler::dequeue(FiberAndThread& ft, size_t index) {
+    if (!m_queues[index]->pop(ft)) { return false; }
+    --m_localTaskCount;
+    if (ft.fiber && ft.fiber->getState() == Fiber::EXEC) {
+        // 协程已被重新调度但尚未切出, 交给全局队列稍后执行
+        MutexType::Lock lock(m_mutex);
+        m_fibers.push_back(std::move(ft));
+        ft.reset();
+        return false;
+    }
+    return true;
+}
+
+bool Scheduler::stealTask(FiberAndThread& ft, size_t index) {
+    LocalQueue::Ptr& self = m_queues[index];
+    size_t n = m_queues.size();
+    for (size_t i = 1; i < n; ++i) {
+        LocalQueue::Ptr& victim = m_queues[(index + i) % n];
+        if (victim->empty()) { continue; }
+
+        self->stolen.clear();
+        if (victim->steal(self->stolen) == 0) { continue; }
+
+        // 第一个任务直接执行, 其余放入本地队列
+        auto it = self->stolen.begin();
+        for (++it; it != self->stolen.end(); ++it) {
+            if (!self->push(*it)) {
+                --m_localTaskCount;
+                MutexType::Lock lock(m_mutex);
+                m_fibers.push_back(std::move(*it));
+            }
+        }
+        ft = std::move(self->stolen.front());
+        self->stolen.clear();
+        --m_localTaskCount;
+
+        if (ft.fiber && ft.fiber->getState() == Fiber::EXEC) {
+            MutexType::Lock lock(m_mutex);
+            m_fibers.push_back(std::move(ft));
+            ft.reset();
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
 void Scheduler::run() {
     set_hook_enable(true);
     setThis();
-    if (pico::getThreadId() != m_rootThread) {
+    const int thread_id = pico::getThreadId();
+    if (thread_id != m_rootThread) {
         t_scheduler_fiber = Fiber::GetThis().get();
     }
+    const size_t index = queueIndex();
+    t_queue_index = index;
+    onThreadStart();
 
     Fiber::Ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::Ptr cb_fiber;
 
+    LocalQueue::Ptr queue = m_queues[index];
     FiberAndThread ft;
+    uint32_t tick = 0;
     while (true) {
         ft.reset();
         bool tickle_me = false;
         bool is_active = false;
-        {
+        bool retry = false;
+
+        bool found = queue->fetch(ft);
+        if (found && ft.fiber && ft.fiber->getState() == Fiber::EXEC) {
+            // 协程切换到本线程时可能尚未在原线程上切出, 稍后重试
+            queue->repost(ft);
+            ft.reset();
+            found = false;
+            retry = true;
+        }
+
+        bool check_global = !found && ++tick % kGlobalQueueCheckInterval == 0;
+        if (!found && !check_global) {
+            found = dequeue(ft, index);
+            check_global = !found;
+        }
+        if (check_global) {
             MutexType::Lock lock(m_mutex);
             auto it = m_fibers.begin();
             while (it != m_fibers.end()) {
-                if (it->thread != -1 && it->thread != pico::getThreadId()) {
+                // 指定了不属于本调度器的线程, 无法执行
+                if (it->thread != -1 && it->thread != thread_id) {
                     ++it;
-                    tickle_me = true;
                     continue;
                 }
 
@@ -146,13 +388,21 @@ void Scheduler::run() {
                     continue;
                 }
 
-                ft = *it;
+                ft = std::move(*it);
                 m_fibers.erase(it++);
-                ++m_activeThreadCount;
-                is_active = true;
+                found = true;
                 break;
             }
-            tickle_me |= it != m_fibers.end();
+            tickle_me = !m_fibers.empty() && hasIdleThreads();
+        }
+        if (!found) {
+            found = dequeue(ft, index) || stealTask(ft, index);
+        }
+        if (found) {
+            ++m_activeThreadCount;
+            is_active = true;
+            // 本地队列仍有任务时唤醒空闲线程来窃取
+            tickle_me |= !queue->empty() && hasIdleThreads();
         }
         if (tickle_me) {
             tickle();
@@ -170,13 +420,14 @@ void Scheduler::run() {
                 ft.fiber->m_state = Fiber::HOLD;
             }
             ft.reset();
+            if (queue->empty()) { onQueueDrained(); }
         }
         else if (ft.cb) {
             if (cb_fiber) {
                 cb_fiber->reset(ft.cb);
             }
             else {
-                cb_fiber.reset(new Fiber(ft.cb));
+                cb_fiber.reset(new Fiber(ft.cb, 0, false, m_sharedStack));
             }
             ft.reset();
             cb_fiber->swapIn();
@@ -192,33 +443,54 @@ void Scheduler::run() {
                 cb_fiber->m_state = Fiber::HOLD;
                 cb_fiber.reset();
             }
+            if (queue->empty()) { onQueueDrained(); }
         }
         else {
-            if (is_active) {
-                --m_activeThreadCount;
+            if (is_active || retry) {
+                if (is_active) { --m_activeThreadCount; }
                 continue;
             }
             if (idle_fiber->getState() == Fiber::TERM) {
                 break;
             }
 
+            // 先标记idle再检查邮箱, 与enqueue中的先投递后检查配合, 避免丢失唤醒
+            queue->idle = true;
+            if (!queue->mailboxEmpty()) {
+                queue->idle = false;
+                continue;
+            }
             ++m_idleThreadCount;
             idle_fiber->swapIn();
             --m_idleThreadCount;
+            queue->idle = false;
             if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
                 idle_fiber->m_state = Fiber::HOLD;
             }
         }
     }
+    onThreadExit();
+    t_queue_index = -1;
 }
 
 void Scheduler::tickle() {
     LOG_INFO("tickle");
 }
 
+void Scheduler::tickle(int thread) {
+    tickle();
+}
+
 bool Scheduler::stopping() {
     MutexType::Lock lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    if (!(m_autoStop && m_stopping && m_fibers.empty() && m_localTaskCount == 0 &&
+          m_activeThreadCount == 0)) {
+        return false;
+    }
+    for (auto& q : m_queues) {
+        if (!q->mailboxEmpty()) { return false; }
+    }
+    return true;
 }
 
 void Scheduler::idle() {
@@ -235,7 +507,14 @@ void Scheduler::switchTo(int thread) {
             return;
         }
     }
-    schedule(Fiber::GetThis(), thread);
+    Fiber::Ptr cur = Fiber::GetThis();
+    if (cur->getBoundThread() != -1) {
+        LOG_ERROR("shared stack fiber %lu is bound to thread %d, can not switch",
+                  cur->getId(),
+                  cur->getBoundThread());
+        return;
+    }
+    schedule(cur, thread);
     Fiber::yieldToHold();
 }
 
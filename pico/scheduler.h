@@ -4,6 +4,7 @@
 #include "fiber.h"
 #include "mutex.h"
 #include "thread.h"
+#include <deque>
 #include <list>
 #include <memory>
 #include <string>
@@ -21,6 +22,16 @@ public:
 
     const std::string& getName() const { return m_name; }
 
+    /**
+     * @brief 调度线程的id, use_caller时第一个是调用线程
+     */
+    const std::vector<int>& getThreadIds() const { return m_threadIds; }
+
+    /**
+     * @brief use_caller时调用线程的id, 否则为-1; 调用线程只在stop时参与调度
+     */
+    int getRootThread() const { return m_rootThread; }
+
     static Scheduler* GetThis();
 
     static Fiber* GetMainFiber();
@@ -31,50 +42,82 @@ public:
 
     template<class FiberOrCb>
     void schedule(FiberOrCb fc, int thread = -1) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
+        FiberAndThread ft(fc, thread);
+        if (!ft.fiber && !ft.cb) { return; }
 
-        if (need_tickle) { tickle(); }
+        if (enqueue(ft)) { tickle(); }
     }
 
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
         bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            while (begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
-            }
+        while (begin != end) {
+            FiberAndThread ft(&*begin, -1);
+            if (ft.fiber || ft.cb) { need_tickle = enqueue(ft) || need_tickle; }
+            ++begin;
         }
         if (need_tickle) { tickle(); }
     }
 
     void switchTo(int thread = -1);
 
+    /**
+     * @brief 设置回调任务是否运行在共享栈协程上
+     * @details 适合大量长时间挂起的连接, 每个挂起的协程只占用实际使用的栈空间;
+     *          共享栈协程首次执行后固定在该线程上, 不会被其他线程窃取
+     */
+    void setSharedStack(bool v) { m_sharedStack = v; }
+    bool isSharedStack() const { return m_sharedStack; }
+
+    /**
+     * @brief 当前负载: 正在执行任务的线程数加上排队中的任务数, 用于在多个调度器之间选择
+     */
+    virtual size_t getLoad();
+
 protected:
     virtual void tickle();
+    /**
+     * @brief 唤醒指定线程, 用于投递到该线程邮箱的任务
+     * @details 默认实现退化为tickle()
+     */
+    virtual void tickle(int thread);
     void run();
 
     virtual bool stopping();
 
     virtual void idle();
 
+    /**
+     * @brief 本线程执行完一个任务后本地队列已空时调用
+     * @details 子类可以在这里批量提交本轮调度中积累的请求
+     */
+    virtual void onQueueDrained() {}
+
+    /**
+     * @brief 调度线程进入调度循环时调用, 此时线程还不会被标记为idle
+     * @details 子类可以在这里设置线程的信号屏蔽等每个线程只需做一次的状态
+     */
+    virtual void onThreadStart() {}
+
+    /**
+     * @brief 调度线程退出调度循环时调用, 用于恢复onThreadStart修改的线程状态
+     */
+    virtual void onThreadExit() {}
+
     void setThis();
 
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
-private:
-    template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
-        if (ft.fiber || ft.cb) { m_fibers.push_back(ft); }
-        return need_tickle;
-    }
+    /**
+     * @brief 全局队列、本线程邮箱或其他线程的本地队列中是否有本线程可以执行的任务
+     * @details idle线程标记即将阻塞之后再检查一次, 避免与投递任务的线程错过彼此
+     */
+    bool hasPendingTasks();
+
+    /**
+     * @brief 指定线程当前是否处于idle状态
+     */
+    bool isThreadIdle(int thread);
 
 private:
     struct FiberAndThread
@@ -111,12 +154,63 @@ private:
         }
     };
 
+    /**
+     * @brief 调度线程私有的有界任务队列(环形缓冲区)
+     * @details 只有所属线程会向队列尾部投递任务, 其他空闲线程可以从头部窃取任务;
+     *          指定了该线程的任务投递到邮箱中, 邮箱只由所属线程消费, 不会被窃取
+     */
+    struct LocalQueue
+    {
+        typedef std::shared_ptr<LocalQueue> Ptr;
+        typedef Spinlock MutexType;
+
+        explicit LocalQueue(size_t capacity)
+            : tasks(capacity) {}
+
+        bool push(FiberAndThread& ft);
+        bool pop(FiberAndThread& ft);
+        size_t steal(std::vector<FiberAndThread>& out);
+        bool empty() const { return size == 0; }
+
+        bool post(FiberAndThread& ft);
+        bool fetch(FiberAndThread& ft);
+        void repost(FiberAndThread& ft);
+        bool mailboxEmpty() const { return pinned == 0; }
+
+        MutexType mutex;
+        std::vector<FiberAndThread> tasks;
+        size_t head = 0;
+        std::atomic<size_t> size = {0};
+        /// 窃取任务时使用的临时缓冲, 仅所属线程访问
+        std::vector<FiberAndThread> stolen;
+
+        /// 所属线程id
+        int thread = -1;
+        /// 所属线程是否处于idle状态
+        std::atomic<bool> idle = {false};
+        MutexType mailboxMutex;
+        std::deque<FiberAndThread> mailbox;
+        std::atomic<size_t> pinned = {0};
+    };
+
+    bool enqueue(FiberAndThread& ft);
+    bool dequeue(FiberAndThread& ft, size_t index);
+    bool stealTask(FiberAndThread& ft, size_t index);
+    size_t queueIndex();
+    LocalQueue* findQueue(int thread);
+
 private:
     MutexType m_mutex;
     std::vector<Thread::Ptr> m_threads;
+    /// 全局队列, 存放外部线程投递的任务以及本地队列溢出的任务
     std::list<FiberAndThread> m_fibers;
+    /// 只在start()中整体替换, 发布后大小不再变化
+    std::vector<LocalQueue::Ptr> m_queues;
+    std::atomic<bool> m_queuesReady = {false};
+    std::atomic<size_t> m_localTaskCount = {0};
     Fiber::Ptr m_rootFiber;
     std::string m_name;
+    bool m_sharedStack = false;
 
 protected:
     std::vector<int> m_threadIds;
@@ -65,8 +65,6 @@ bool Socket::init(int sock) {
     if (ctx && ctx->isSocket() && !ctx->isClosed()) {
         m_sockfd = sock;
         m_is_connected = true;
-        initSock();
-        getLocalAddress();
         getPeerAddress();
         return true;
     }
@@ -220,12 +218,45 @@ Socket::Ptr Socket::accept() {
         return nullptr;
     }
 
-    int sock = ::accept(m_sockfd, nullptr, nullptr);
+    sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int sock = ::accept4(m_sockfd, (sockaddr*)&addr, &addrlen, SOCK_CLOEXEC);
     if (sock == -1) {
         LOG_ERROR("accept failed, errno = %d, %s", errno, strerror(errno));
         return nullptr;
     }
-    Socket::Ptr sock_ptr(new Socket(m_family, m_type, m_protocol));
+    return accepted(sock, (const sockaddr*)&addr, addrlen);
+}
+
+Socket::Ptr Socket::tryAccept() {
+    FdCtx::Ptr ctx = FdMgr::getInstance()->getFdCtx(m_sockfd);
+    if (!ctx || !ctx->isSysNonBlock() || ctx->isClosed()) {
+        errno = EAGAIN;
+        return nullptr;
+    }
+
+    sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int sock = accept4_f(m_sockfd, (sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sock == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            LOG_ERROR("accept failed, errno = %d, %s", errno, strerror(errno));
+        }
+        return nullptr;
+    }
+    FdMgr::getInstance()->addSocket(sock, false);
+    return accepted(sock, (const sockaddr*)&addr, addrlen);
+}
+
+Socket::Ptr Socket::newAccepted() const {
+    return Socket::Ptr(new Socket(m_family, m_type, m_protocol));
+}
+
+Socket::Ptr Socket::accepted(int sock, const sockaddr* addr, socklen_t addrlen) {
+    Socket::Ptr sock_ptr = newAccepted();
+    if (addrlen > 0 && addrlen <= sizeof(sockaddr_storage)) {
+        sock_ptr->m_peer_addr = Address::Create(addr, addrlen);
+    }
     if (sock_ptr->init(sock)) {
         return sock_ptr;
     }
@@ -397,8 +428,10 @@ int Socket::shutdown(int how) {
 
 std::string Socket::to_string() const {
     std::stringstream ss;
-    ss << "[family: " << m_family << ", type: " << m_type << ", protocol: " << m_protocol
-       << "], addr: " << m_local_addr->to_string();
+    ss << "[family: " << m_family << ", type: " << m_type << ", protocol: " << m_protocol << "]";
+    // 接受的连接只记录了对端地址, 本端地址在getLocalAddress时才获取
+    if (m_local_addr) { ss << ", addr: " << m_local_addr->to_string(); }
+    if (m_peer_addr) { ss << ", peer: " << m_peer_addr->to_string(); }
     return ss.str();
 }
 
@@ -515,18 +548,12 @@ bool SSLSocket::listen(int backlog) {
     return Socket::listen(backlog);
 }
 
-Socket::Ptr SSLSocket::accept() {
+Socket::Ptr SSLSocket::newAccepted() const {
     SSLSocket::Ptr sock(new SSLSocket(m_family, m_type, m_protocol));
-    int newsock = ::accept(m_sockfd, nullptr, nullptr);
-    if (newsock == -1) {
-        return nullptr;
-    }
     sock->m_ctx = m_ctx;
-    if (sock->init(newsock)) {
-        return sock;
-    }
-    return nullptr;
+    return sock;
 }
+
 int SSLSocket::send(const void* buf, size_t len, int flags) {
     if (!m_ssl) {
         LOG_ERROR("ssl is not init");
@@ -100,6 +100,12 @@ public:
 
     virtual Socket::Ptr accept();
 
+    /**
+     * @brief 不等待地接受一个已经在队列中的连接, 用于一次唤醒后连续接受多个连接
+     * @return 没有待接受的连接或监听socket未登记为非阻塞时返回nullptr, errno为EAGAIN
+     */
+    Socket::Ptr tryAccept();
+
     virtual int send(const void* buf, size_t len, int flags = 0);
     virtual int send(const iovec* iov, int iovcnt, int flags = 0);
 
@@ -126,9 +132,17 @@ public:
     Address::Ptr getPeerAddress();
 
 protected:
+    /**
+     * @brief 接管accept得到的fd, 连接的socket选项从监听socket继承, 不再逐个设置
+     */
     virtual bool init(int sock);
     void newSock();
     void initSock();
+    /**
+     * @brief 创建与监听socket同类型的连接对象
+     */
+    virtual Socket::Ptr newAccepted() const;
+    Socket::Ptr accepted(int sock, const sockaddr* addr, socklen_t addrlen);
 
 protected:
     int m_sockfd;
@@ -158,8 +172,6 @@ public:
 
     virtual bool listen(int backlog = 5) override;
 
-    virtual Socket::Ptr accept() override;
-
     virtual int send(const void* buf, size_t len, int flags = 0) override;
     virtual int send(const iovec* iov, int iovcnt, int flags = 0) override;
 
@@ -177,6 +189,7 @@ public:
 
 protected:
     virtual bool init(int sock) override;
+    virtual Socket::Ptr newAccepted() const override;
 
 private:
     std::shared_ptr<SSL_CTX> m_ctx;
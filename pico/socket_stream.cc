@@ -1,5 +1,9 @@
 #include "socket_stream.h"
 
+#include <limits.h>
+
+#include <algorithm>
+
 namespace pico {
 SocketStream::SocketStream(Socket::Ptr sock, bool owner)
     : m_sock(sock)
@@ -43,6 +47,27 @@ int SocketStream::writeFixSize(const void* buf, size_t length) {
     return length;
 }
 
+int SocketStream::writeFixSize(iovec* iov, int iovcnt) {
+    if (!isConnected()) { return -1; }
+    int64_t total = 0;
+    while (iovcnt > 0) {
+        int64_t len = m_sock->send(iov, std::min(iovcnt, IOV_MAX));
+        if (len <= 0) { return len; }
+        total += len;
+        // 跳过已经写完的部分, 从第一个没写完的iovec继续
+        while (iovcnt > 0 && (size_t)len >= iov->iov_len) {
+            len -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + len;
+            iov->iov_len -= len;
+        }
+    }
+    return total;
+}
+
 void SocketStream::close() {
     if (m_sock) m_sock->close();
 }
@@ -19,6 +19,12 @@ public:
     virtual int write(const void* buf, size_t len);
     virtual int readFixSize(void* buf, size_t length);
     virtual int writeFixSize(const void* buf, size_t length);
+    /**
+     * @brief 以尽量少的系统调用写完所有iovec
+     * @param[in,out] iov 部分写入时会被修改
+     * @return 写入的总字节数, 出错时返回send的返回值
+     */
+    virtual int writeFixSize(iovec* iov, int iovcnt);
 
     virtual void close();
 
@@ -1,5 +1,8 @@
 #include "tcp_server.h"
 
+#include <netinet/tcp.h>
+
+#include <algorithm>
 #include <cerrno>
 #include <sstream>
 
@@ -29,37 +32,162 @@ bool TcpServer::bind(Address::Ptr& addr, bool ssl) {
 }
 
 
+std::vector<std::pair<IOManager*, int>> TcpServer::getWorkerThreads() {
+    std::vector<IOManager*> workers;
+    if (m_workerGroup) {
+        for (auto& worker : m_workerGroup->getWorkers()) {
+            workers.push_back(worker.get());
+        }
+    }
+    else if (m_worker) {
+        workers.push_back(m_worker);
+    }
+
+    std::vector<std::pair<IOManager*, int>> threads;
+    for (auto worker : workers) {
+        for (int thread : worker->getThreadIds()) {
+            // 调用线程只在stop时进入调度, 不能运行accept循环
+            if (thread != worker->getRootThread()) {
+                threads.push_back(std::make_pair(worker, thread));
+            }
+        }
+    }
+    return threads;
+}
+
 bool TcpServer::bind(std::vector<Address::Ptr>& addrs, std::vector<Address::Ptr>& fails, bool ssl) {
     m_is_ssl = ssl;
-    for (auto&& addr : addrs) {
-        Socket::Ptr sock = ssl ? SSLSocket::CreateTcp(addr) : Socket::CreateTcp(addr);
-        if (!sock->bind(addr)) {
-            LOG_ERROR("addr[%s] bind error, errno=%d, %s",
-                      addr->to_string().c_str(),
-                      errno,
-                      strerror(errno));
-            fails.push_back(addr);
-            continue;
+    std::vector<std::pair<IOManager*, int>> threads;
+    if (m_reuseportListeners != 0) {
+        threads = getWorkerThreads();
+        if (threads.empty()) {
+            LOG_WARN("server [%s] has no worker threads for reuseport listeners", m_name.c_str());
         }
-        if (!sock->listen()) {
-            LOG_ERROR("listen on addr[%s] failed, errno=%d, %s",
-                      addr->to_string().c_str(),
-                      errno,
-                      strerror(errno));
-            fails.push_back(addr);
-            continue;
+    }
+    size_t listeners = m_reuseportListeners < 0 ? threads.size() : m_reuseportListeners;
+    if (threads.empty()) {
+        listeners = 0;
+    }
+
+    size_t next = 0;
+    for (auto&& addr : addrs) {
+        // 所有socket都设置了SO_REUSEPORT, 同一地址可以绑定多个监听socket
+        for (size_t i = 0; i < std::max<size_t>(listeners, 1); ++i) {
+            Socket::Ptr sock = ssl ? SSLSocket::CreateTcp(addr) : Socket::CreateTcp(addr);
+            if (!sock->bind(addr)) {
+                LOG_ERROR("addr[%s] bind error, errno=%d, %s",
+                          addr->to_string().c_str(),
+                          errno,
+                          strerror(errno));
+                fails.push_back(addr);
+                break;
+            }
+            applySocketOptions(sock);
+            if (!sock->listen(m_socketOptions.backlog)) {
+                LOG_ERROR("listen on addr[%s] failed, errno=%d, %s",
+                          addr->to_string().c_str(),
+                          errno,
+                          strerror(errno));
+                fails.push_back(addr);
+                break;
+            }
+            m_sockets.push_back(sock);
+            if (listeners) {
+                m_acceptThreads.push_back(threads[next++ % threads.size()]);
+            }
         }
-        m_sockets.push_back(sock);
     }
     if (!fails.empty()) {
         m_sockets.clear();
+        m_acceptThreads.clear();
         return false;
     }
     return true;
 }
 
+void TcpServer::applySocketOptions(Socket::Ptr& sock) {
+    const TcpSocketOptions& opts = m_socketOptions;
+    // 设置失败不影响监听, 只记录日志
+    auto set = [&](int level, int optname, int value, const char* name) {
+        if (sock->setopt(level, optname, value)) {
+            LOG_WARN("server [%s] set %s failed, errno=%d, %s",
+                     m_name.c_str(),
+                     name,
+                     errno,
+                     strerror(errno));
+        }
+    };
+    // 缓冲区大小要在listen之前设置, 才能参与握手时窗口扩大因子的协商
+    if (opts.rcvbuf > 0) { set(SOL_SOCKET, SO_RCVBUF, opts.rcvbuf, "SO_RCVBUF"); }
+    if (opts.sndbuf > 0) { set(SOL_SOCKET, SO_SNDBUF, opts.sndbuf, "SO_SNDBUF"); }
+    set(IPPROTO_TCP, TCP_NODELAY, (int)opts.nodelay, "TCP_NODELAY");
+    if (opts.keepalive_idle > 0) {
+        set(IPPROTO_TCP, TCP_KEEPIDLE, opts.keepalive_idle, "TCP_KEEPIDLE");
+    }
+    if (opts.keepalive_interval > 0) {
+        set(IPPROTO_TCP, TCP_KEEPINTVL, opts.keepalive_interval, "TCP_KEEPINTVL");
+    }
+    if (opts.keepalive_count > 0) {
+        set(IPPROTO_TCP, TCP_KEEPCNT, opts.keepalive_count, "TCP_KEEPCNT");
+    }
+    if (opts.defer_accept > 0) {
+        set(IPPROTO_TCP, TCP_DEFER_ACCEPT, opts.defer_accept, "TCP_DEFER_ACCEPT");
+    }
+    if (opts.fastopen > 0) { set(IPPROTO_TCP, TCP_FASTOPEN, opts.fastopen, "TCP_FASTOPEN"); }
+}
+
+void TcpServer::setAdmissionOptions(const AdmissionOptions& opts) {
+    m_maxConnections = std::max(opts.max_connections, 0);
+    m_resumeConnections = std::max(opts.resume_connections, 0);
+    if (m_resumeConnections == 0 || m_resumeConnections >= m_maxConnections) {
+        m_resumeConnections = m_maxConnections * 9 / 10;
+    }
+    m_maxInflightRequests = std::max(opts.max_inflight_requests, 0);
+    if (opts.overload == "reject") {
+        m_overloadAction = REJECT;
+    }
+    else if (opts.overload == "reset") {
+        m_overloadAction = RESET;
+    }
+    else {
+        if (opts.overload != "pause") {
+            LOG_WARN("server [%s] unknown overload action: %s, use pause",
+                     m_name.c_str(),
+                     opts.overload.c_str());
+        }
+        m_overloadAction = PAUSE;
+    }
+}
+
+bool TcpServer::enterRequest() {
+    size_t n = ++m_inflightRequests;
+    if (m_maxInflightRequests && n > m_maxInflightRequests) {
+        --m_inflightRequests;
+        return false;
+    }
+    return true;
+}
+
+void TcpServer::leaveRequest() {
+    --m_inflightRequests;
+}
+
+void TcpServer::waitAdmission() {
+    FiberMutex::Lock lock(m_admissionMutex);
+    // 定时重新检查, 不完全依赖唤醒
+    m_admissionCond.waitFor(lock, 1000, [this]() { return !m_overloaded || m_is_stop; });
+}
+
 void TcpServer::startAccept(Socket::Ptr& sock) {
+    int batch = std::max(m_socketOptions.accept_batch, 1);
+    // reuseport模式下accept循环绑定在线程上, 连接也固定在该线程处理
+    const int thread = Fiber::GetThis()->getBoundThread();
     while (!m_is_stop) {
+        if (m_overloadAction == PAUSE && m_overloaded) {
+            // 新连接留在内核的accept队列中, 队列满后由内核拒绝或丢弃SYN
+            waitAdmission();
+            continue;
+        }
         Socket::Ptr client = sock->accept();
         if (!client) {
             if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == 0) {
@@ -68,8 +196,89 @@ void TcpServer::startAccept(Socket::Ptr& sock) {
             LOG_ERROR("accept failed, errno=%d, %s", errno, strerror(errno));
             continue;
         }
-        client->setRecvTimeout(m_recvTimeout);
-        m_worker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+        dispatchClient(client, thread);
+        // 一次唤醒后继续取出已经在队列中的连接, 队列为空时才重新等待
+        for (int i = 1; i < batch && !m_is_stop; ++i) {
+            if (m_overloadAction == PAUSE && m_overloaded) {
+                break;
+            }
+            client = sock->tryAccept();
+            if (!client) {
+                break;
+            }
+            dispatchClient(client, thread);
+        }
+    }
+}
+
+void TcpServer::rejectClient(Socket::Ptr& sock) {
+    struct linger lg = {1, 0};
+    sock->setopt(SOL_SOCKET, SO_LINGER, lg);
+    sock->close();
+}
+
+void TcpServer::dispatchClient(Socket::Ptr& client, int thread) {
+    if (m_overloaded && m_overloadAction != PAUSE) {
+        if (m_overloadAction == RESET) {
+            TcpServer::rejectClient(client);
+        }
+        else {
+            rejectClient(client);
+        }
+        return;
+    }
+    size_t connections = ++m_connections;
+    if (m_maxConnections && connections >= m_maxConnections && !m_overloaded.exchange(true)) {
+        LOG_WARN("server [%s] is overloaded with %lu connections",
+                 m_name.c_str(),
+                 (unsigned long)connections);
+    }
+
+    client->setRecvTimeout(m_recvTimeout);
+    if (m_socketOptions.quickack) {
+        client->setopt(IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+    IOManager::Ptr selected;
+    IOManager* worker = m_worker;
+    if (thread != -1) {
+        worker = IOManager::GetThis();
+    }
+    else if (m_workerGroup) {
+        selected = m_workerGroup->select();
+        worker = selected ? selected.get() : m_worker;
+    }
+    if (m_sharedStack) {
+        Fiber::Ptr fiber(new Fiber(
+            std::bind(&TcpServer::runClient, shared_from_this(), client), 0, false, true));
+        worker->schedule(fiber, thread);
+    }
+    else {
+        worker->schedule(std::bind(&TcpServer::runClient, shared_from_this(), client), thread);
+    }
+}
+
+void TcpServer::runClient(Socket::Ptr& client) {
+    // handleClient抛出的异常由协程入口捕获, 连接数必须在析构中释放, 否则服务器会一直处于过载状态
+    struct ConnectionGuard
+    {
+        TcpServer* server;
+        ~ConnectionGuard() { server->leaveConnection(); }
+    } guard = {this};
+    handleClient(client);
+}
+
+void TcpServer::leaveConnection() {
+    size_t connections = --m_connections;
+    if (!m_overloaded || connections > m_resumeConnections) {
+        return;
+    }
+    bool overloaded = true;
+    if (m_overloaded.compare_exchange_strong(overloaded, false)) {
+        LOG_INFO("server [%s] resumes accepting with %lu connections",
+                 m_name.c_str(),
+                 (unsigned long)connections);
+        FiberMutex::Lock lock(m_admissionMutex);
+        m_admissionCond.notifyAll();
     }
 }
 
@@ -87,8 +296,15 @@ bool TcpServer::start() {
                  m_name.c_str(),
                  sock->getLocalAddress()->to_string().c_str());
     }
-    for (auto&& sock : m_sockets) {
-        m_acceptor->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+    for (size_t i = 0; i < m_sockets.size(); ++i) {
+        auto cb = std::bind(&TcpServer::startAccept, shared_from_this(), m_sockets[i]);
+        if (m_acceptThreads.empty()) {
+            m_acceptor->schedule(cb);
+            continue;
+        }
+        Fiber::Ptr fiber(new Fiber(cb));
+        fiber->bindThread(m_acceptThreads[i].second);
+        m_acceptThreads[i].first->schedule(fiber);
     }
 
     return true;
@@ -99,6 +315,27 @@ void TcpServer::stop() {
 
     auto self = shared_from_this();
 
+    {
+        FiberMutex::Lock lock(m_admissionMutex);
+        m_admissionCond.notifyAll();
+    }
+
+    if (!m_acceptThreads.empty()) {
+        // 等待登记在accept所在的IOManager上, 只能在该IOManager中取消
+        for (size_t i = 0; i < m_sockets.size(); ++i) {
+            Socket::Ptr sock = m_sockets[i];
+            m_acceptThreads[i].first->schedule(
+                [self, sock]() {
+                    sock->cancelAll();
+                    sock->close();
+                },
+                m_acceptThreads[i].second);
+        }
+        m_sockets.clear();
+        m_acceptThreads.clear();
+        return;
+    }
+
     m_acceptor->schedule([self, this]() {
         for (auto&& sock : m_sockets) {
             sock->cancelAll();
@@ -2,6 +2,7 @@
 #define __PICO_TCP_SERVER_H__
 
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -11,10 +12,53 @@
 #include "config.h"
 #include "http/middleware.h"
 #include "iomanager.h"
+#include "mutex.h"
 #include "socket.h"
+#include "worker.h"
 
 namespace pico {
 
+/**
+ * @brief 监听socket的TCP选项, 接受的连接从监听socket继承
+ */
+struct TcpSocketOptions
+{
+    /// listen的backlog, 实际长度还受net.core.somaxconn限制
+    int backlog = SOMAXCONN;
+    bool nodelay = true;
+    /// TCP_DEFER_ACCEPT的秒数, 连接上有数据到达后才被accept, 0关闭
+    int defer_accept = 0;
+    /// TCP_FASTOPEN的等待队列长度, 0关闭
+    int fastopen = 0;
+    /// SO_RCVBUF/SO_SNDBUF的字节数, 0使用系统默认值
+    int rcvbuf = 0;
+    int sndbuf = 0;
+    /// TCP_KEEPIDLE/TCP_KEEPINTVL的秒数和TCP_KEEPCNT的次数, 0使用系统默认值
+    int keepalive_idle = 0;
+    int keepalive_interval = 0;
+    int keepalive_count = 0;
+    /// 接受连接后设置TCP_QUICKACK, 关闭开始阶段的延迟确认
+    bool quickack = false;
+    /// 每次唤醒后最多连续accept的连接数
+    int accept_batch = 16;
+};
+
+/**
+ * @brief 连接和请求的准入控制
+ */
+struct AdmissionOptions
+{
+    /// 同时处理的最大连接数, 0不限制
+    int max_connections = 0;
+    /// 过载后连接数降到该值才恢复接受, 0或不小于max_connections时取max_connections的90%
+    int resume_connections = 0;
+    /// 同时处理的最大请求数, 超出的请求直接返回503, 0不限制
+    int max_inflight_requests = 0;
+    /// 过载时的处理方式: pause暂停accept, 新连接留在内核队列中; reject接受后立即拒绝,
+    /// http返回503; reset接受后立即以RST关闭
+    std::string overload = "pause";
+};
+
 struct TcpServerOptions
 {
     typedef std::shared_ptr<TcpServerOptions> Ptr;
@@ -31,6 +75,12 @@ struct TcpServerOptions
     std::string cert_file = "";
     std::string key_file = "";
     bool keep_alive = false;
+    /// 连接处理协程是否运行在共享栈上, 适合大量空闲长连接
+    bool shared_stack = false;
+    /// 每个地址上SO_REUSEPORT监听socket的数量, 小于0表示每个worker线程一个, 0关闭
+    int reuseport_listeners = 0;
+    TcpSocketOptions tcp;
+    AdmissionOptions admission;
     std::vector<std::string> servlets;
     std::vector<Middleware::Ptr> middlewares;
     std::vector<std::string> exclude_paths;
@@ -55,8 +105,36 @@ public:
         options.name = node["name"].as<std::string>(options.name);
         options.ssl = node["ssl"].as<bool>(options.ssl);
         options.keep_alive = node["keep_alive"].as<bool>(options.keep_alive);
+        options.shared_stack = node["shared_stack"].as<bool>(options.shared_stack);
+        options.reuseport_listeners =
+            node["reuseport_listeners"].as<int>(options.reuseport_listeners);
         options.worker = node["worker"].as<std::string>(options.worker);
         options.acceptor = node["acceptor"].as<std::string>(options.acceptor);
+        if (node["tcp"].IsDefined()) {
+            YAML::Node tcp = node["tcp"];
+            TcpSocketOptions& opts = options.tcp;
+            opts.backlog = tcp["backlog"].as<int>(opts.backlog);
+            opts.nodelay = tcp["nodelay"].as<bool>(opts.nodelay);
+            opts.defer_accept = tcp["defer_accept"].as<int>(opts.defer_accept);
+            opts.fastopen = tcp["fastopen"].as<int>(opts.fastopen);
+            opts.rcvbuf = tcp["rcvbuf"].as<int>(opts.rcvbuf);
+            opts.sndbuf = tcp["sndbuf"].as<int>(opts.sndbuf);
+            opts.keepalive_idle = tcp["keepalive_idle"].as<int>(opts.keepalive_idle);
+            opts.keepalive_interval = tcp["keepalive_interval"].as<int>(opts.keepalive_interval);
+            opts.keepalive_count = tcp["keepalive_count"].as<int>(opts.keepalive_count);
+            opts.quickack = tcp["quickack"].as<bool>(opts.quickack);
+            opts.accept_batch = tcp["accept_batch"].as<int>(opts.accept_batch);
+        }
+        if (node["admission"].IsDefined()) {
+            YAML::Node admission = node["admission"];
+            AdmissionOptions& opts = options.admission;
+            opts.max_connections = admission["max_connections"].as<int>(opts.max_connections);
+            opts.resume_connections =
+                admission["resume_connections"].as<int>(opts.resume_connections);
+            opts.max_inflight_requests =
+                admission["max_inflight_requests"].as<int>(opts.max_inflight_requests);
+            opts.overload = admission["overload"].as<std::string>(opts.overload);
+        }
         if (options.ssl) {
             // std::cout << node["certificates"] << std::endl;
             options.cert_file = node["certificates"]["file"].as<std::string>(options.cert_file);
@@ -99,8 +177,25 @@ public:
         node["name"] = options.name;
         node["ssl"] = options.ssl;
         node["keep_alive"] = options.keep_alive;
+        node["shared_stack"] = options.shared_stack;
+        node["reuseport_listeners"] = options.reuseport_listeners;
         node["worker"] = options.worker;
         node["acceptor"] = options.acceptor;
+        node["tcp"]["backlog"] = options.tcp.backlog;
+        node["tcp"]["nodelay"] = options.tcp.nodelay;
+        node["tcp"]["defer_accept"] = options.tcp.defer_accept;
+        node["tcp"]["fastopen"] = options.tcp.fastopen;
+        node["tcp"]["rcvbuf"] = options.tcp.rcvbuf;
+        node["tcp"]["sndbuf"] = options.tcp.sndbuf;
+        node["tcp"]["keepalive_idle"] = options.tcp.keepalive_idle;
+        node["tcp"]["keepalive_interval"] = options.tcp.keepalive_interval;
+        node["tcp"]["keepalive_count"] = options.tcp.keepalive_count;
+        node["tcp"]["quickack"] = options.tcp.quickack;
+        node["tcp"]["accept_batch"] = options.tcp.accept_batch;
+        node["admission"]["max_connections"] = options.admission.max_connections;
+        node["admission"]["resume_connections"] = options.admission.resume_connections;
+        node["admission"]["max_inflight_requests"] = options.admission.max_inflight_requests;
+        node["admission"]["overload"] = options.admission.overload;
         node["certicates"]["file"] = options.cert_file;
         node["certicates"]["key"] = options.key_file;
         for (auto& addr : options.addresses) {
@@ -148,8 +243,56 @@ public:
 
     virtual std::string to_string();
 
+    IOManager* getWorker() const { return m_worker; }
+
     virtual void setType(const std::string& type) { m_type = type; }
 
+    /**
+     * @brief 设置连接处理协程是否使用共享栈, 需要在start之前设置
+     */
+    void setSharedStack(bool v) { m_sharedStack = v; }
+    bool isSharedStack() const { return m_sharedStack; }
+
+    /**
+     * @brief 设置处理连接的工作组, 每个新连接按工作组的选择策略分配到一个成员上
+     * @details 为空时所有连接都交给构造时指定的worker, 需要在start之前设置
+     */
+    void setWorkerGroup(WorkerGroup::Ptr group) { m_workerGroup = group; }
+
+    /**
+     * @brief 设置每个地址上SO_REUSEPORT监听socket的数量, 需要在bind之前设置
+     * @details 开启后每个监听socket的accept循环固定在一个worker线程上(工作组的全部线程,
+     *          没有工作组时为worker的线程), 由内核在监听socket之间分配新连接,
+     *          接受的连接直接在该线程的IOManager上处理, 不再经过acceptor和跨线程投递
+     * @param[in] n 小于0表示每个worker线程一个, 0关闭
+     */
+    void setReuseportListeners(int n) { m_reuseportListeners = n; }
+
+    /**
+     * @brief 设置监听socket的TCP选项, 需要在bind之前设置
+     */
+    void setSocketOptions(const TcpSocketOptions& opts) { m_socketOptions = opts; }
+    const TcpSocketOptions& getSocketOptions() const { return m_socketOptions; }
+
+    /**
+     * @brief 设置连接数和请求数的限制, 需要在start之前设置
+     * @details 连接数达到max_connections后进入过载状态, 降到resume_connections时恢复,
+     *          避免在上限附近反复切换
+     */
+    void setAdmissionOptions(const AdmissionOptions& opts);
+
+    /**
+     * @brief 正在处理的连接数
+     */
+    size_t getConnectionCount() const { return m_connections; }
+
+    /**
+     * @brief 正在处理的请求数
+     */
+    size_t getInflightRequests() const { return m_inflightRequests; }
+
+    bool isOverloaded() const { return m_overloaded; }
+
     virtual bool loadCertificate(const std::string& cert_file, const std::string& key_file);
 
 protected:
@@ -157,6 +300,76 @@ protected:
 
     virtual void handleClient(Socket::Ptr& sock);
 
+    /**
+     * @brief 过载时拒绝刚接受的连接, 在accept协程中执行, 不能等待
+     * @details 默认以RST关闭, reset模式下总是使用默认实现
+     */
+    virtual void rejectClient(Socket::Ptr& sock);
+
+    /**
+     * @brief 开始处理一个请求, 超出max_inflight_requests时返回false, 调用方应直接拒绝该请求
+     * @details 返回true时处理完成后需要调用leaveRequest, 处理可能抛出异常时使用InflightGuard
+     */
+    bool enterRequest();
+    void leaveRequest();
+
+    /**
+     * @brief 在作用域内占用在途请求名额, 析构时全部释放, 处理请求抛出异常时也不会泄漏
+     */
+    class InflightGuard : Noncopyable
+    {
+    public:
+        explicit InflightGuard(TcpServer* server) : m_server(server) {}
+        ~InflightGuard() {
+            for (size_t i = 0; i < m_count; ++i) { m_server->leaveRequest(); }
+        }
+
+        /**
+         * @brief 再占用一个名额, 超出上限时返回false
+         */
+        bool enter() {
+            if (!m_server->enterRequest()) { return false; }
+            ++m_count;
+            return true;
+        }
+        size_t count() const { return m_count; }
+
+    private:
+        TcpServer* m_server;
+        size_t m_count = 0;
+    };
+
+    /**
+     * @brief 把接受的连接交给处理连接的IOManager, 过载时拒绝
+     * @param[in] thread reuseport模式下accept所在的线程, 连接在该线程上处理; 其余为-1
+     */
+    void dispatchClient(Socket::Ptr& client, int thread);
+
+    /**
+     * @brief 在worker中处理连接, 结束后(包括抛出异常时)释放连接数
+     */
+    void runClient(Socket::Ptr& client);
+
+    /**
+     * @brief 释放一个连接数, 降到resume_connections时恢复
+     */
+    void leaveConnection();
+
+    /**
+     * @brief pause模式下过载时挂起accept协程, 直到退出过载或服务器停止
+     */
+    void waitAdmission();
+
+    /**
+     * @brief 在listen之前把m_socketOptions设置到监听socket上
+     */
+    void applySocketOptions(Socket::Ptr& sock);
+
+    /**
+     * @brief reuseport模式下可以运行accept循环的线程
+     */
+    std::vector<std::pair<IOManager*, int>> getWorkerThreads();
+
 
 private:
     std::vector<Socket::Ptr> m_sockets;
@@ -172,6 +385,33 @@ private:
     std::string m_type;
 
     bool m_is_ssl = false;
+
+    bool m_sharedStack = false;
+
+    WorkerGroup::Ptr m_workerGroup;
+
+    int m_reuseportListeners = 0;
+    /// reuseport模式下m_sockets中每个监听socket的accept循环所在的IOManager和线程
+    std::vector<std::pair<IOManager*, int>> m_acceptThreads;
+
+    TcpSocketOptions m_socketOptions;
+
+    enum OverloadAction
+    {
+        PAUSE,
+        REJECT,
+        RESET
+    };
+    size_t m_maxConnections = 0;
+    size_t m_resumeConnections = 0;
+    size_t m_maxInflightRequests = 0;
+    OverloadAction m_overloadAction = PAUSE;
+    std::atomic<size_t> m_connections = {0};
+    std::atomic<size_t> m_inflightRequests = {0};
+    std::atomic<bool> m_overloaded = {false};
+    /// 唤醒pause模式下挂起的accept协程
+    FiberMutex m_admissionMutex;
+    FiberCondition m_admissionCond;
 };
 
 }   // namespace pico
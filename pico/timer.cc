@@ -2,8 +2,251 @@
 #include "logging.h"
 #include "util.h"
 #include <algorithm>
+#include <string.h>
 
 namespace pico {
+static std::atomic<uint64_t> s_timer_manager_id{0};
+
+/**
+ * @brief 分层时间轮, 精度1ms
+ * @details 第0层256个槽, 每槽1ms; 其上4层各64个槽, 每个槽覆盖下一层转一圈的时间,
+ *          共覆盖2^32ms; 定时器按到期时间与当前刻度的差值放入对应层,
+ *          第0层每转一圈, 上层的下一个槽被下放到下层
+ */
+class TimerWheel
+{
+public:
+    typedef Spinlock MutexType;
+
+    TimerWheel(int thr, uint64_t now)
+        : thread(thr)
+        , m_current(now) {
+        memset(m_near, 0, sizeof(m_near));
+        memset(m_nearBits, 0, sizeof(m_nearBits));
+        memset(m_levels, 0, sizeof(m_levels));
+        memset(m_levelBits, 0, sizeof(m_levelBits));
+    }
+
+    ~TimerWheel() {
+        std::vector<Timer::Ptr> timers;
+        takeAll(timers);
+    }
+
+    /**
+     * @brief 加入时间轮, 调用方持有mutex
+     */
+    void add(const Timer::Ptr& timer, uint64_t now) {
+        if (m_size == 0) { m_current = std::max(m_current, now); }
+        timer->m_self = timer;
+        place(timer.get());
+        ++m_size;
+    }
+
+    /**
+     * @brief 从时间轮移除, 调用方持有mutex并且持有timer的引用
+     */
+    void remove(Timer* timer) {
+        unlink(timer);
+        timer->m_self.reset();
+        --m_size;
+    }
+
+    /**
+     * @brief 推进到now, 取出所有到期的定时器
+     */
+    void expire(uint64_t now, std::vector<Timer::Ptr>& expired) {
+        if (m_size == 0) {
+            m_current = std::max(m_current, now + 1);
+            return;
+        }
+        // 时钟回拨超过阈值, 视为全部到期
+        if (m_current > now + kRolloverMs) {
+            takeAll(expired);
+            m_current = now + 1;
+            return;
+        }
+        while (m_current <= now) {
+            size_t index = m_current & kNearMask;
+            if (index == 0) { cascade(); }
+            if (!(m_nearBits[index >> 6] & (1ull << (index & 63)))) {
+                // 跳过空槽, 最远跳到本轮结束处
+                size_t next = findNear(index);
+                m_current = std::min(m_current + (next - index), now + 1);
+                continue;
+            }
+            Timer* timer = m_near[index];
+            m_near[index] = nullptr;
+            m_nearBits[index >> 6] &= ~(1ull << (index & 63));
+            ++m_current;
+            while (timer) {
+                Timer* next = timer->m_nextTimer;
+                timer->m_prevTimer = timer->m_nextTimer = nullptr;
+                expired.push_back(std::move(timer->m_self));
+                --m_size;
+                timer = next;
+            }
+        }
+    }
+
+    /**
+     * @brief 距离下一个可能到期时刻的毫秒数, 空时返回~0ull
+     */
+    uint64_t nextTimeout(uint64_t now) const {
+        if (m_size == 0) { return ~0ull; }
+        uint64_t next = ~0ull;
+        size_t index = m_current & kNearMask;
+        size_t slot = findNear(index);
+        if (index == 0) {
+            // 本轮起点的下放尚未执行, 上层可能有本轮到期的定时器
+            next = m_current;
+        }
+        else if (slot < kNearSize) { next = m_current + (slot - index); }
+        else {
+            // 第0层本轮已空, 剩余的定时器在下一轮或者上层下放之后到期
+            uint64_t boundary = (m_current | kNearMask) + 1;
+            slot = findNear(0);
+            if (slot < kNearSize) { next = boundary + slot; }
+            for (int level = 0; level < kLevels; ++level) {
+                uint64_t bits = m_levelBits[level];
+                if (!bits) { continue; }
+                int shift = kNearBits + level * kLevelBits;
+                uint64_t cur = m_current >> shift;
+                // 从当前槽的下一个槽开始找最近的非空槽, 当前槽只可能存放下一圈的定时器
+                int start = (cur + 1) & kLevelMask;
+                uint64_t rotated = start ? (bits >> start) | (bits << (64 - start)) : bits;
+                uint64_t distance = __builtin_ctzll(rotated) + 1;
+                next = std::min(next, (cur + distance) << shift);
+            }
+        }
+        return next <= now ? 0 : next - now;
+    }
+
+    bool empty() const { return m_size == 0; }
+
+    MutexType mutex;
+    /// 创建该时间轮的线程
+    const int thread;
+
+private:
+    static const int kNearBits = 8;
+    static const size_t kNearSize = 1 << kNearBits;
+    static const uint64_t kNearMask = kNearSize - 1;
+    static const int kLevelBits = 6;
+    static const size_t kLevelSize = 1 << kLevelBits;
+    static const uint64_t kLevelMask = kLevelSize - 1;
+    static const int kLevels = 4;
+    static const uint64_t kMaxDelta = (1ull << (kNearBits + kLevels * kLevelBits)) - 1;
+    static const uint64_t kRolloverMs = 10000;
+
+    Timer** slotHead(Timer* timer) {
+        return timer->m_level == 0 ? &m_near[timer->m_slot]
+                                   : &m_levels[timer->m_level - 1][timer->m_slot];
+    }
+
+    void link(Timer* timer, uint8_t level, uint8_t slot) {
+        timer->m_level = level;
+        timer->m_slot = slot;
+        Timer** head = slotHead(timer);
+        timer->m_prevTimer = nullptr;
+        timer->m_nextTimer = *head;
+        if (*head) { (*head)->m_prevTimer = timer; }
+        *head = timer;
+        if (level == 0) { m_nearBits[slot >> 6] |= 1ull << (slot & 63); }
+        else {
+            m_levelBits[level - 1] |= 1ull << slot;
+        }
+    }
+
+    void unlink(Timer* timer) {
+        Timer** head = slotHead(timer);
+        if (timer->m_prevTimer) { timer->m_prevTimer->m_nextTimer = timer->m_nextTimer; }
+        else {
+            *head = timer->m_nextTimer;
+        }
+        if (timer->m_nextTimer) { timer->m_nextTimer->m_prevTimer = timer->m_prevTimer; }
+        timer->m_prevTimer = timer->m_nextTimer = nullptr;
+        if (*head) { return; }
+        if (timer->m_level == 0) {
+            m_nearBits[timer->m_slot >> 6] &= ~(1ull << (timer->m_slot & 63));
+        }
+        else {
+            m_levelBits[timer->m_level - 1] &= ~(1ull << timer->m_slot);
+        }
+    }
+
+    void place(Timer* timer) {
+        uint64_t expires = std::max(timer->m_next, m_current);
+        uint64_t delta = expires - m_current;
+        if (delta < kNearSize) {
+            link(timer, 0, expires & kNearMask);
+            return;
+        }
+        if (delta > kMaxDelta) { expires = m_current + kMaxDelta; }
+        int level = 0;
+        while (level < kLevels - 1 && delta >= (1ull << (kNearBits + (level + 1) * kLevelBits))) {
+            ++level;
+        }
+        link(timer, level + 1, (expires >> (kNearBits + level * kLevelBits)) & kLevelMask);
+    }
+
+    /**
+     * @brief 第0层转完一圈, 把上层当前槽中的定时器重新放置到下层
+     */
+    void cascade() {
+        for (int level = 0; level < kLevels; ++level) {
+            size_t slot = (m_current >> (kNearBits + level * kLevelBits)) & kLevelMask;
+            Timer* timer = m_levels[level][slot];
+            m_levels[level][slot] = nullptr;
+            m_levelBits[level] &= ~(1ull << slot);
+            while (timer) {
+                Timer* next = timer->m_nextTimer;
+                place(timer);
+                timer = next;
+            }
+            if (slot != 0) { break; }
+        }
+    }
+
+    size_t findNear(size_t index) const {
+        for (size_t word = index >> 6; word < kNearSize / 64; ++word) {
+            uint64_t bits = m_nearBits[word];
+            if (word == (index >> 6)) { bits &= ~0ull << (index & 63); }
+            if (bits) { return word * 64 + __builtin_ctzll(bits); }
+        }
+        return kNearSize;
+    }
+
+    void takeAll(std::vector<Timer::Ptr>& out) {
+        for (size_t i = 0; i < kNearSize; ++i) { takeSlot(m_near[i], out); }
+        for (int level = 0; level < kLevels; ++level) {
+            for (size_t i = 0; i < kLevelSize; ++i) { takeSlot(m_levels[level][i], out); }
+        }
+        memset(m_nearBits, 0, sizeof(m_nearBits));
+        memset(m_levelBits, 0, sizeof(m_levelBits));
+        m_size = 0;
+    }
+
+    void takeSlot(Timer*& head, std::vector<Timer::Ptr>& out) {
+        Timer* timer = head;
+        head = nullptr;
+        while (timer) {
+            Timer* next = timer->m_nextTimer;
+            timer->m_prevTimer = timer->m_nextTimer = nullptr;
+            out.push_back(std::move(timer->m_self));
+            timer = next;
+        }
+    }
+
+private:
+    Timer* m_near[kNearSize];
+    uint64_t m_nearBits[kNearSize / 64];
+    Timer* m_levels[kLevels][kLevelSize];
+    uint64_t m_levelBits[kLevels];
+    /// 下一个待处理的刻度, 之前的刻度都已处理
+    uint64_t m_current;
+    std::atomic<size_t> m_size = {0};
+};
+
 Timer::Timer(uint64_t timeout, Callback callback, bool repeat, TimerManager* manager)
     : m_repeat(repeat)
     , m_interval(timeout)
@@ -12,79 +255,108 @@ Timer::Timer(uint64_t timeout, Callback callback, bool repeat, TimerManager* man
     m_next = m_interval + pico::getCurrentTime();
 }
 
-Timer::Timer(uint64_t next)
-    : m_repeat(false)
-    , m_interval(0)
-    , m_next(next) {}
-
 bool Timer::cancel() {
-    TimerManager::MutexType::WriteLock wlock(m_manager->m_mutex);
+    Ptr self = shared_from_this();
+    TimerWheel::MutexType::Lock lock(m_wheel->mutex);
     if (m_callback) {
         m_callback = nullptr;
-        auto it =
-            std::find(m_manager->m_timers.begin(), m_manager->m_timers.end(), shared_from_this());
-        if (it != m_manager->m_timers.end()) { m_manager->m_timers.erase(it); }
+        if (m_self) { m_wheel->remove(this); }
         return true;
     }
     return false;
 }
 
 bool Timer::refresh() {
-    TimerManager::MutexType::WriteLock wlock(m_manager->m_mutex);
-    if (m_callback) {
-        auto it =
-            std::find(m_manager->m_timers.begin(), m_manager->m_timers.end(), shared_from_this());
-        if (it != m_manager->m_timers.end()) {
-            m_manager->m_timers.erase(it);
-            m_next = m_interval + pico::getCurrentTime();
-            m_manager->m_timers.insert(shared_from_this());
-            return true;
-        }
+    Ptr self = shared_from_this();
+    TimerWheel::MutexType::Lock lock(m_wheel->mutex);
+    if (m_callback && m_self) {
+        uint64_t now = pico::getCurrentTime();
+        m_wheel->remove(this);
+        m_next = m_interval + now;
+        m_wheel->add(self, now);
+        return true;
     }
     return false;
 }
 
 bool Timer::reset(uint64_t timeout, bool fromNow) {
     if (timeout == m_interval && !fromNow) { return true; }
-    TimerManager::MutexType::WriteLock wlock(m_manager->m_mutex);
-    if (m_callback) {
-        auto it =
-            std::find(m_manager->m_timers.begin(), m_manager->m_timers.end(), shared_from_this());
-        if (it != m_manager->m_timers.end()) {
-            m_manager->m_timers.erase(it);
-            m_interval = timeout;
-            if (fromNow) { m_next = pico::getCurrentTime() + timeout; }
-            else {
-                m_next = m_interval + pico::getCurrentTime();
-            }
-            m_manager->m_timers.insert(shared_from_this());
-            return true;
-        }
+    Ptr self = shared_from_this();
+    TimerWheel::MutexType::Lock lock(m_wheel->mutex);
+    if (m_callback && m_self) {
+        uint64_t now = pico::getCurrentTime();
+        m_wheel->remove(this);
+        m_interval = timeout;
+        m_next = now + timeout;
+        m_wheel->add(self, now);
+        lock.unlock();
+        m_manager->notifyInsert(m_next);
+        return true;
     }
     return false;
 }
 
-TimerManager::TimerManager() {
-    m_previous = pico::getCurrentTime();
+TimerManager::TimerManager()
+    : m_id(++s_timer_manager_id) {
+    memset(m_wheels, 0, sizeof(m_wheels));
 }
 
-TimerManager::~TimerManager() {}
+TimerManager::~TimerManager() {
+    for (size_t i = 0; i < m_wheelCount; ++i) { delete m_wheels[i]; }
+}
+
+TimerWheel* TimerManager::getWheel() {
+    // 缓存最近一次使用的时间轮, 以管理器id区分, 避免管理器地址被复用时取到已释放的时间轮
+    static thread_local uint64_t t_manager_id = 0;
+    static thread_local TimerWheel* t_wheel = nullptr;
+    if (t_manager_id == m_id) { return t_wheel; }
+
+    int thread = pico::getThreadId();
+    MutexType::Lock lock(m_mutex);
+    size_t count = m_wheelCount;
+    TimerWheel* wheel = nullptr;
+    for (size_t i = 0; i < count; ++i) {
+        if (m_wheels[i]->thread == thread) {
+            wheel = m_wheels[i];
+            break;
+        }
+    }
+    if (!wheel) {
+        if (count < kMaxWheels) {
+            wheel = new TimerWheel(thread, pico::getCurrentTime());
+            m_wheels[count] = wheel;
+            m_wheelCount = count + 1;
+        }
+        else {
+            wheel = m_wheels[count - 1];
+        }
+    }
+    t_manager_id = m_id;
+    t_wheel = wheel;
+    return wheel;
+}
+
+void TimerManager::notifyInsert(uint64_t next) {
+    uint64_t deadline = m_deadline;
+    while (next < deadline) {
+        if (m_deadline.compare_exchange_weak(deadline, next)) {
+            onTimerInsertAtFront();
+            return;
+        }
+    }
+}
 
 Timer::Ptr TimerManager::addTimer(uint64_t timeout, Callback callback, bool repeat) {
     Timer::Ptr timer(new Timer(timeout, callback, repeat, this));
-    TimerManager::MutexType::WriteLock wlock(m_mutex);
-    addTimer(timer, wlock);
+    timer->m_wheel = getWheel();
+    {
+        TimerWheel::MutexType::Lock lock(timer->m_wheel->mutex);
+        timer->m_wheel->add(timer, timer->m_next - timeout);
+    }
+    notifyInsert(timer->m_next);
     return timer;
 }
 
-void TimerManager::addTimer(Timer::Ptr timer, MutexType::WriteLock& lock) {
-    auto it = m_timers.insert(timer).first;
-    bool at_fronted = (it == m_timers.begin()) && !m_tickled;
-    if (at_fronted) { m_tickled = true; }
-    lock.unlock();
-    if (at_fronted) { onTimerInsertAtFront(); }
-}
-
 static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> callback) {
     if (auto cond = weak_cond.lock()) { callback(); }
 }
@@ -95,55 +367,58 @@ Timer::Ptr TimerManager::addCondTimer(uint64_t timeout, Callback callback,
 }
 
 uint64_t TimerManager::getNextTimer() {
-    TimerManager::MutexType::ReadLock rlock(m_mutex);
-    if (m_timers.empty()) { return ~0ull; }
-
-    const Timer::Ptr& timer = *m_timers.begin();
+    // 先撤销旧的唤醒时间再扫描, 扫描之后加入的更早的定时器一定会触发通知
+    m_deadline = ~0ull;
     uint64_t time_now = pico::getCurrentTime();
-    if (timer->m_next <= time_now) { return 0; }
-    return timer->m_next - time_now;
+    uint64_t next = ~0ull;
+    size_t count = m_wheelCount;
+    for (size_t i = 0; i < count; ++i) {
+        TimerWheel* wheel = m_wheels[i];
+        if (wheel->empty()) { continue; }
+        TimerWheel::MutexType::Lock lock(wheel->mutex);
+        next = std::min(next, wheel->nextTimeout(time_now));
+    }
+    if (next != ~0ull) {
+        uint64_t deadline = m_deadline;
+        while (time_now + next < deadline &&
+               !m_deadline.compare_exchange_weak(deadline, time_now + next)) {}
+    }
+    return next;
 }
 
 void TimerManager::listExpiredCb(std::vector<Callback>& cbs) {
     uint64_t time_now = pico::getCurrentTime();
     std::vector<Timer::Ptr> expired;
-    {
-        TimerManager::MutexType::ReadLock rlock(m_mutex);
-        if (m_timers.empty()) { return; }
-    }
-    MutexType::WriteLock wlock(m_mutex);
-    if (m_timers.empty()) { return; }
-    bool rollover = detectClockRollover(time_now);
-    if (!rollover && ((*m_timers.begin())->m_next > time_now)) return;
-
-    Timer::Ptr timer(new Timer(time_now));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(timer);
-    while (it != m_timers.end() && (*it)->m_next == time_now) { it++; }
-    expired.insert(expired.end(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-    for (auto& i : expired) {
-        cbs.push_back(i->m_callback);
-        if (i->m_repeat) {
-            i->m_next = i->m_interval + time_now;
-            m_timers.insert(i);
-        }
-        else {
-            i->m_callback = nullptr;
+    size_t count = m_wheelCount;
+    for (size_t i = 0; i < count; ++i) {
+        TimerWheel* wheel = m_wheels[i];
+        if (wheel->empty()) { continue; }
+        TimerWheel::MutexType::Lock lock(wheel->mutex);
+        size_t begin = expired.size();
+        wheel->expire(time_now, expired);
+        for (size_t j = begin; j < expired.size(); ++j) {
+            Timer::Ptr& timer = expired[j];
+            if (timer->m_repeat) {
+                cbs.push_back(timer->m_callback);
+                // 间隔为0的重复定时器推迟到下一个刻度, 避免在本次推进中反复到期
+                timer->m_next = time_now + std::max<uint64_t>(timer->m_interval, 1);
+                wheel->add(timer, time_now);
+            }
+            else {
+                cbs.push_back(std::move(timer->m_callback));
+                timer->m_callback = nullptr;
+            }
         }
     }
-}
-
-
-bool TimerManager::detectClockRollover(uint64_t time_now) {
-    if (time_now < m_previous && m_previous - time_now > 10000) { return true; }
-    m_previous = time_now;
-    return false;
+    // 在锁外释放定时器
 }
 
 bool TimerManager::hasTimer() {
-    TimerManager::MutexType::ReadLock rlock(m_mutex);
-    return !m_timers.empty();
+    size_t count = m_wheelCount;
+    for (size_t i = 0; i < count; ++i) {
+        if (!m_wheels[i]->empty()) { return true; }
+    }
+    return false;
 }
 
-}   // namespace pico
\ No newline at end of file
+}   // namespace pico
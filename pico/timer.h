@@ -2,9 +2,9 @@
 #define __PICO_TIMER_H__
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <memory>
-#include <set>
 #include <string>
 #include <vector>
 
@@ -13,10 +13,12 @@
 namespace pico {
 
 class TimerManager;
+class TimerWheel;
 
 class Timer : public std::enable_shared_from_this<Timer>
 {
     friend class TimerManager;
+    friend class TimerWheel;
 
 public:
     typedef std::shared_ptr<Timer> Ptr;
@@ -28,7 +30,6 @@ public:
 
 private:
     Timer(uint64_t timeout, Callback callback, bool repeat, TimerManager* manager);
-    explicit Timer(uint64_t next);
 
 private:
     bool m_repeat;
@@ -37,30 +38,42 @@ private:
     Callback m_callback;
     TimerManager* m_manager;
 
-private:
-    struct Compare
-    {
-        bool operator()(const Ptr& lhs, const Ptr& rhs) const { return lhs->m_next < rhs->m_next; }
-    };
+    /// 所属时间轮, 创建后不再改变
+    TimerWheel* m_wheel = nullptr;
+    /// 在时间轮槽链表中的位置
+    Timer* m_prevTimer = nullptr;
+    Timer* m_nextTimer = nullptr;
+    uint8_t m_level = 0;
+    uint8_t m_slot = 0;
+    /// 挂在时间轮上期间持有自身的引用
+    Ptr m_self;
 };
 
+/**
+ * @brief 定时器管理
+ * @details 每个添加定时器的线程拥有独立的分层时间轮, 添加和取消都是O(1),
+ *          只锁定时器所属的时间轮; 任意线程调用listExpiredCb时处理所有时间轮的到期定时器
+ */
 class TimerManager
 {
     friend class Timer;
 
 public:
-    typedef RWMutex MutexType;
+    typedef Mutex MutexType;
     typedef std::function<void(void)> Callback;
 
     TimerManager();
     virtual ~TimerManager();
 
     Timer::Ptr addTimer(uint64_t timeout, Timer::Callback callback, bool repeat = false);
-    void addTimer(Timer::Ptr timer, MutexType::WriteLock& lock);
 
     Timer::Ptr addCondTimer(uint64_t timeout, Callback callback, std::weak_ptr<void> weak_cond,
                             bool repeat = false);
 
+    /**
+     * @brief 距离最近一个定时器到期的毫秒数, 没有定时器时返回~0ull
+     * @note 远期定时器只能给出其所在时间轮槽的起始时间, 返回值可能早于实际到期时间
+     */
     uint64_t getNextTimer();
 
     void listExpiredCb(std::vector<Callback>& callbacks);
@@ -70,16 +83,25 @@ protected:
     virtual void onTimerInsertAtFront() = 0;
 
 private:
-    bool detectClockRollover(uint64_t time_now);
+    TimerWheel* getWheel();
+    /**
+     * @brief 定时器的到期时间早于空闲线程计划的唤醒时间时通知唤醒
+     */
+    void notifyInsert(uint64_t next);
 
 private:
-    std::set<Timer::Ptr, Timer::Compare> m_timers;
-    uint64_t m_previous;
-    bool m_tickled = false;
+    static const size_t kMaxWheels = 64;
+
+    uint64_t m_id;
     MutexType m_mutex;
+    /// 超过kMaxWheels个线程时共用最后一个时间轮
+    TimerWheel* m_wheels[kMaxWheels];
+    std::atomic<size_t> m_wheelCount = {0};
+    /// 空闲线程计划的最早唤醒时间
+    std::atomic<uint64_t> m_deadline = {~0ull};
 };
 
 }   // namespace pico
 
 
-#endif
\ No newline at end of file
+#endif
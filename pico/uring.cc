@@ -0,0 +1,187 @@
+#include "uring.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "logging.h"
+
+namespace pico {
+
+static unsigned LoadAcquire(const unsigned* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void StoreRelease(unsigned* p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IOUring::~IOUring() {
+    if (m_sqes) { munmap(m_sqes, m_sqesSize); }
+    if (m_cqRing && m_cqRing != m_sqRing) { munmap(m_cqRing, m_cqRingSize); }
+    if (m_sqRing) { munmap(m_sqRing, m_sqRingSize); }
+    if (m_fd >= 0) { close(m_fd); }
+}
+
+bool IOUring::init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0) {
+        LOG_ERROR("io_uring_setup entries %u error %d", entries, errno);
+        return false;
+    }
+    // 等待时需要同时指定超时和信号掩码; 完成队列溢出时不能丢弃事件
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        LOG_ERROR("io_uring features 0x%x lack EXT_ARG or NODROP", params.features);
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) { m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize); }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        LOG_ERROR("mmap io_uring sq ring error %d", errno);
+        return false;
+    }
+    if (single_mmap) { m_cqRing = m_sqRing; }
+    else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            LOG_ERROR("mmap io_uring cq ring error %d", errno);
+            return false;
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        LOG_ERROR("mmap io_uring sqes error %d", errno);
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + params.sq_off.head);
+    m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+    m_sqFlags = (unsigned*)(sq + params.sq_off.flags);
+    m_sqArray = (unsigned*)(sq + params.sq_off.array);
+    m_sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + params.cq_off.head);
+    m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    m_cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    return true;
+}
+
+int IOUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg,
+                   size_t argsz) {
+    return syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+unsigned IOUring::unsubmitted() const {
+    // 只有持有m_sqMutex的线程修改尾部, 内核消费后推进头部
+    return *m_sqTail - LoadAcquire(m_sqHead);
+}
+
+void IOUring::push(const io_uring_sqe& sqe) {
+    Spinlock::Lock lock(m_sqMutex);
+    while (unsubmitted() >= m_sqEntries) {
+        int rt = enter(m_sqEntries, 0, 0, nullptr, 0);
+        if (rt < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            LOG_ERROR("io_uring_enter submit error %d", errno);
+        }
+    }
+    unsigned tail = *m_sqTail;
+    unsigned index = tail & m_sqMask;
+    m_sqes[index] = sqe;
+    m_sqArray[index] = index;
+    StoreRelease(m_sqTail, tail + 1);
+}
+
+bool IOUring::hasPending() {
+    Spinlock::Lock lock(m_sqMutex);
+    return unsubmitted() > 0;
+}
+
+void IOUring::submit() {
+    unsigned count = 0;
+    {
+        Spinlock::Lock lock(m_sqMutex);
+        count = unsubmitted();
+    }
+    if (!count) { return; }
+    // 多个线程同时提交时内核按队列顺序消费, 先到的调用可能提交了其他线程写入的请求
+    int rt = enter(count, 0, 0, nullptr, 0);
+    if (rt < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        LOG_ERROR("io_uring_enter submit error %d", errno);
+    }
+}
+
+bool IOUring::wait(const sigset_t* sigmask, uint64_t timeout_ms) {
+    unsigned count = 0;
+    {
+        Spinlock::Lock lock(m_sqMutex);
+        count = unsubmitted();
+    }
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask = (uint64_t)(uintptr_t)sigmask;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    int rt = enter(count, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (rt < 0) {
+        if (errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+            LOG_ERROR("io_uring_enter wait error %d", errno);
+        }
+        return false;
+    }
+    return true;
+}
+
+size_t IOUring::reap(io_uring_cqe* cqes, size_t max) {
+    Spinlock::Lock lock(m_cqMutex);
+    unsigned head = *m_cqHead;
+    unsigned tail = LoadAcquire(m_cqTail);
+    if (head == tail && (LoadAcquire(m_sqFlags) & IORING_SQ_CQ_OVERFLOW)) {
+        // 溢出的完成事件暂存在内核中, 需要一次GETEVENTS才会搬回完成队列
+        enter(0, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+        tail = LoadAcquire(m_cqTail);
+    }
+    size_t count = 0;
+    while (head != tail && count < max) {
+        cqes[count++] = m_cqes[head & m_cqMask];
+        ++head;
+    }
+    StoreRelease(m_cqHead, head);
+    return count;
+}
+
+void IOUring::Prep(io_uring_sqe& sqe, uint8_t opcode, int fd, const void* addr, uint32_t len,
+                   uint64_t off) {
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)(uintptr_t)addr;
+    sqe.len = len;
+    sqe.off = off;
+}
+
+}   // namespace pico
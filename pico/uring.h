@@ -0,0 +1,103 @@
+#ifndef __PICO_URING_H__
+#define __PICO_URING_H__
+
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace pico {
+
+/**
+ * @brief io_uring的最小封装, 直接使用系统调用, 不依赖liburing
+ * @details 提交队列和完成队列各有一把锁, 多个线程可以同时提交、等待和收割完成事件;
+ *          push只写入提交队列, 由submit或wait一次系统调用批量通知内核
+ */
+class IOUring : Noncopyable
+{
+public:
+    IOUring() = default;
+    ~IOUring();
+
+    /**
+     * @brief 创建ring并映射提交队列和完成队列
+     * @param[in] entries 提交队列长度, 完成队列为其两倍
+     * @return 内核不支持io_uring或缺少EXT_ARG/NODROP特性时返回false
+     */
+    bool init(unsigned entries);
+
+    /**
+     * @brief 将sqe复制到提交队列, 暂不通知内核
+     * @details 提交队列已满时先同步提交已有的请求
+     */
+    void push(const io_uring_sqe& sqe);
+
+    /**
+     * @brief 是否有已写入提交队列但尚未提交给内核的请求
+     */
+    bool hasPending();
+
+    /**
+     * @brief 提交所有尚未提交的请求
+     */
+    void submit();
+
+    /**
+     * @brief 提交尚未提交的请求并等待至少一个完成事件
+     * @param[in] sigmask 等待期间使用的信号掩码
+     * @param[in] timeout_ms 最长等待的毫秒数
+     * @return 被信号打断或超时返回false
+     */
+    bool wait(const sigset_t* sigmask, uint64_t timeout_ms);
+
+    /**
+     * @brief 从完成队列取出最多max个完成事件
+     * @return 取出的个数
+     */
+    size_t reap(io_uring_cqe* cqes, size_t max);
+
+    /**
+     * @brief 填充sqe的通用字段, 其余字段清零
+     */
+    static void Prep(io_uring_sqe& sqe, uint8_t opcode, int fd, const void* addr, uint32_t len,
+                     uint64_t off);
+
+private:
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg,
+              size_t argsz);
+    /**
+     * @brief 尚未提交的请求数, 调用方持有m_sqMutex
+     */
+    unsigned unsubmitted() const;
+
+private:
+    int m_fd = -1;
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned* m_sqFlags = nullptr;
+    unsigned* m_sqArray = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+    unsigned m_cqMask = 0;
+
+    Spinlock m_sqMutex;
+    Spinlock m_cqMutex;
+};
+
+}   // namespace pico
+
+#endif
@@ -1,10 +1,16 @@
 #include "worker.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
 #include <memory>
 #include <string>
 
+#include "affinity.h"
+#include "class_factory.h"
 #include "config.h"
+#include "logging.h"
+#include "util.h"
 
 namespace pico {
 
@@ -12,21 +18,91 @@ pico::ConfigVar<std::map<std::string, std::map<std::string, std::string>>>::Ptr
     pico::Config::Lookup("workers", std::map<std::string, std::map<std::string, std::string>>(),
                          "workers");
 
+REGISTER_CLASS(RoundRobinSelector);
+REGISTER_CLASS(RandomSelector);
+REGISTER_CLASS(LeastLoadedSelector);
+REGISTER_CLASS(PowerOfTwoSelector);
+
+/**
+ * @brief 线程局部的xorshift随机数, 避免rand()的全局锁
+ */
+static uint64_t NextRandom() {
+    static thread_local uint64_t s_state = 0;
+    if (s_state == 0) {
+        s_state = ((uint64_t)getThreadId() << 32) ^ getCurrentTime() ^ 0x9e3779b97f4a7c15ull;
+    }
+    s_state ^= s_state << 13;
+    s_state ^= s_state >> 7;
+    s_state ^= s_state << 17;
+    return s_state;
+}
+
+IOManager::Ptr RoundRobinSelector::select(const std::vector<IOManager::Ptr>& workers) {
+    return workers[m_next.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+}
+
+IOManager::Ptr RandomSelector::select(const std::vector<IOManager::Ptr>& workers) {
+    return workers[NextRandom() % workers.size()];
+}
+
+IOManager::Ptr LeastLoadedSelector::select(const std::vector<IOManager::Ptr>& workers) {
+    size_t n = workers.size();
+    std::vector<size_t> loads(n);
+    size_t min_load = SIZE_MAX;
+    size_t min_count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        loads[i] = workers[i]->getLoad();
+        if (loads[i] < min_load) {
+            min_load = loads[i];
+            min_count = 0;
+        }
+        min_count += loads[i] == min_load;
+    }
+    // 负载最低的成员之间轮流选择, 不会总是选中第一个
+    size_t k = m_next.fetch_add(1, std::memory_order_relaxed) % min_count;
+    for (size_t i = 0; i < n; ++i) {
+        if (loads[i] == min_load && k-- == 0) { return workers[i]; }
+    }
+    return workers[0];
+}
+
+IOManager::Ptr PowerOfTwoSelector::select(const std::vector<IOManager::Ptr>& workers) {
+    uint64_t r = NextRandom();
+    size_t n = workers.size();
+    size_t a = r % n;
+    // 第二个下标与第一个不同
+    size_t b = (a + 1 + (r >> 32) % (n - 1)) % n;
+    return workers[a]->getLoad() <= workers[b]->getLoad() ? workers[a] : workers[b];
+}
+
+WorkerGroup::WorkerGroup(WorkerSelector::Ptr selector)
+    : m_selector(selector) {
+    if (!m_selector) { m_selector.reset(new RoundRobinSelector); }
+}
+
+IOManager::Ptr WorkerGroup::select() {
+    if (m_workers.empty()) { return nullptr; }
+    if (m_workers.size() == 1) { return m_workers[0]; }
+    return m_selector->select(m_workers);
+}
+
 WorkerManager::WorkerManager()
     : m_stop(false) {}
 
 void WorkerManager::add(IOManager::Ptr s) {
-    m_datas[s->getName()].push_back(s);
+    WorkerGroup::Ptr& group = m_datas[s->getName()];
+    if (!group) { group.reset(new WorkerGroup(nullptr)); }
+    group->add(s);
 }
 
 IOManager::Ptr WorkerManager::get(const std::string& name) {
-    auto it = m_datas.find(name);
-    if (it == m_datas.end()) {
-        return nullptr;
-    }
-    auto collect = it->second;
+    WorkerGroup::Ptr group = getGroup(name);
+    return group ? group->select() : nullptr;
+}
 
-    return collect[rand() % collect.size()];
+WorkerGroup::Ptr WorkerManager::getGroup(const std::string& name) {
+    auto it = m_datas.find(name);
+    return it == m_datas.end() ? nullptr : it->second;
 }
 
 
@@ -34,18 +110,107 @@ bool WorkerManager::init() {
     return init(g_config_workers->getValue());
 }
 
+static bool IsTrue(const std::map<std::string, std::string>& conf, const std::string& key) {
+    auto it = conf.find(key);
+    return it != conf.end() && (it->second == "true" || it->second == "1");
+}
+
+static std::string GetString(const std::map<std::string, std::string>& conf,
+                             const std::string& key) {
+    auto it = conf.find(key);
+    return it != conf.end() ? it->second : "";
+}
+
+/**
+ * @brief 工作组在NUMA节点node上可以使用的CPU
+ * @details 配置了cpus时取其与节点CPU的交集, 交集为空时使用节点的全部CPU
+ */
+static std::vector<int> GroupCpus(const std::map<std::string, std::string>& conf, int node,
+                                  const std::vector<int>& allowed) {
+    std::vector<int> cpus = conf.count("cpus") ? parseCpuList(GetString(conf, "cpus")) : allowed;
+    if (node < 0) { return cpus; }
+    std::vector<int> node_cpus = getNumaNodeCpus(node);
+    if (node_cpus.empty()) {
+        LOG_WARN("numa node %d has no cpus", node);
+        return cpus;
+    }
+    std::vector<int> result;
+    std::set_intersection(cpus.begin(), cpus.end(), node_cpus.begin(), node_cpus.end(),
+                          std::back_inserter(result));
+    return result.empty() ? node_cpus : result;
+}
+
 bool WorkerManager::init(std::map<std::string, std::map<std::string, std::string>> config) {
+    std::vector<int> allowed = getAllowedCpus();
+    // isolate的工作组(通常是acceptor)独占其CPU, 其他工作组的线程不会调度到这些CPU上
+    std::vector<int> isolated;
+    for (auto& it : config) {
+        if (!IsTrue(it.second, "isolate")) { continue; }
+        std::vector<int> nodes = parseCpuList(GetString(it.second, "numa_node"));
+        if (nodes.empty()) { nodes.push_back(-1); }
+        for (int node : nodes) {
+            std::vector<int> cpus = GroupCpus(it.second, node, allowed);
+            isolated.insert(isolated.end(), cpus.begin(), cpus.end());
+        }
+    }
+    std::sort(isolated.begin(), isolated.end());
+    isolated.erase(std::unique(isolated.begin(), isolated.end()), isolated.end());
+
     for (auto& it : config) {
         auto name = it.first;
         auto conf = it.second;
 
         uint32_t thread_num = conf.find("thread_num") != conf.end() ? (uint32_t)std::stoull(conf.find("thread_num")->second) : 1;
         uint32_t worker_num = conf.find("worker_num") != conf.end() ? (uint32_t)std::stoull(conf.find("worker_num")->second) : 1;
+        // numa_node可以是列表, 第i个IOManager放在第i % n个节点上
+        std::vector<int> nodes = parseCpuList(GetString(conf, "numa_node"));
+        bool pin = IsTrue(conf, "pin");
+        bool isolate = IsTrue(conf, "isolate");
+        // 绑定单个CPU时在同一组CPU内轮流分配, 同一工作组的线程不会挤在同一个CPU上
+        std::map<int, size_t> next_cpu;
+
+        WorkerSelector::Ptr selector;
+        std::string selector_class = GetString(conf, "selector");
+        if (!selector_class.empty()) {
+            selector = std::static_pointer_cast<WorkerSelector>(
+                ClassFactory::Instance().Create(selector_class));
+            if (!selector) {
+                LOG_ERROR("invalid selector %s of worker %s", selector_class.c_str(), name.c_str());
+            }
+        }
+        WorkerGroup::Ptr group(new WorkerGroup(selector));
+        m_datas[name] = group;
 
         for (uint32_t i = 0; i < worker_num; i++) {
-            IOManager::Ptr s(
-                new IOManager(thread_num, false, name + (i == 0 ? "" : "-" + std::to_string(i))));
-            add(s);
+            int node = nodes.empty() ? -1 : nodes[i % nodes.size()];
+            std::vector<int> cpus = GroupCpus(conf, node, allowed);
+            if (!isolate && !isolated.empty()) {
+                std::vector<int> rest;
+                std::set_difference(cpus.begin(), cpus.end(), isolated.begin(), isolated.end(),
+                                    std::back_inserter(rest));
+                if (rest.empty()) {
+                    LOG_WARN("worker %s has no cpus left after isolation", name.c_str());
+                }
+                else {
+                    cpus.swap(rest);
+                }
+            }
+            if (cpus == allowed) { cpus.clear(); }
+
+            IOManager::Ptr s;
+            {
+                // 调度线程继承创建线程的亲和性和内存策略
+                ThreadPlacementGuard guard(cpus, node);
+                s.reset(
+                    new IOManager(thread_num, false, name + (i == 0 ? "" : "-" + std::to_string(i))));
+            }
+            if (pin) {
+                if (cpus.empty()) { cpus = allowed; }
+                for (int tid : s->getThreadIds()) {
+                    setThreadAffinity(tid, {cpus[next_cpu[node]++ % cpus.size()]});
+                }
+            }
+            group->add(s);
         }
     }
     m_stop = m_datas.empty();
@@ -59,7 +224,7 @@ void WorkerManager::stop() {
     }
 
     for (auto& i : m_datas) {
-        for (auto& item : i.second) {
+        for (auto& item : i.second->getWorkers()) {
             item->schedule([]() {});
             item->stop();
         }
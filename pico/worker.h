@@ -1,6 +1,7 @@
 #ifndef __PICO_WORKER_H
 #define __PICO_WORKER_H
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <string>
@@ -10,6 +11,91 @@
 #include "singleton.h"
 
 namespace pico {
+
+/**
+ * @brief 从工作组中选择IOManager的策略
+ * @details 实现类通过REGISTER_CLASS注册, 在workers配置的selector中按类名指定
+ */
+class WorkerSelector
+{
+public:
+    typedef std::shared_ptr<WorkerSelector> Ptr;
+    virtual ~WorkerSelector() {}
+
+    /**
+     * @param[in] workers 工作组的成员, 至少两个
+     */
+    virtual IOManager::Ptr select(const std::vector<IOManager::Ptr>& workers) = 0;
+};
+
+/**
+ * @brief 轮流选择, 默认策略
+ */
+class RoundRobinSelector : public WorkerSelector
+{
+public:
+    IOManager::Ptr select(const std::vector<IOManager::Ptr>& workers) override;
+
+private:
+    std::atomic<size_t> m_next = {0};
+};
+
+/**
+ * @brief 随机选择, 使用线程局部的随机数发生器
+ */
+class RandomSelector : public WorkerSelector
+{
+public:
+    IOManager::Ptr select(const std::vector<IOManager::Ptr>& workers) override;
+};
+
+/**
+ * @brief 选择负载(IOManager::getLoad)最低的成员, 每次遍历全部成员
+ */
+class LeastLoadedSelector : public WorkerSelector
+{
+public:
+    IOManager::Ptr select(const std::vector<IOManager::Ptr>& workers) override;
+
+private:
+    std::atomic<size_t> m_next = {0};
+};
+
+/**
+ * @brief 随机取两个成员, 选择负载较低的一个
+ * @details 只读取两个成员的负载, 成员较多时开销低于LeastLoadedSelector,
+ *          又不会像它一样让同一时刻的所有选择都涌向同一个成员
+ */
+class PowerOfTwoSelector : public WorkerSelector
+{
+public:
+    IOManager::Ptr select(const std::vector<IOManager::Ptr>& workers) override;
+};
+
+/**
+ * @brief 同名的一组IOManager
+ */
+class WorkerGroup
+{
+public:
+    typedef std::shared_ptr<WorkerGroup> Ptr;
+
+    explicit WorkerGroup(WorkerSelector::Ptr selector);
+
+    void add(IOManager::Ptr s) { m_workers.push_back(s); }
+
+    /**
+     * @brief 按选择策略取一个成员, 工作组为空时返回nullptr
+     */
+    IOManager::Ptr select();
+
+    const std::vector<IOManager::Ptr>& getWorkers() const { return m_workers; }
+
+private:
+    std::vector<IOManager::Ptr> m_workers;
+    WorkerSelector::Ptr m_selector;
+};
+
 class WorkerManager
 {
 public:
@@ -20,6 +106,11 @@ public:
 
     IOManager::Ptr get(const std::string& name);
 
+    /**
+     * @brief 取工作组, 需要为每个请求或连接选择成员时保存工作组, 避免每次按名称查找
+     */
+    WorkerGroup::Ptr getGroup(const std::string& name);
+
     bool init();
 
     bool init(std::map<std::string, std::map<std::string, std::string>>);
@@ -29,11 +120,11 @@ public:
     int getWorkerNum();
 
 private:
-    std::map<std::string, std::vector<IOManager::Ptr>> m_datas;
+    std::map<std::string, WorkerGroup::Ptr> m_datas;
     bool m_stop;
 };
 
 typedef Singleton<WorkerManager> WorkerMgr;
 }   // namespace pico
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,74 @@
+#include "pico/fiber.h"
+#include "pico/logging.h"
+
+#include <ucontext.h>
+
+#include <chrono>
+
+static const uint64_t kRounds = 1000000;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void bench_fiber() {
+    pico::Fiber::GetThis();
+    pico::Fiber* raw = nullptr;
+    pico::Fiber::Ptr fiber(new pico::Fiber([&raw]() {
+        for (uint64_t i = 0; i <= kRounds; ++i) { raw->back(); }
+    }));
+    raw = fiber.get();
+
+    // 预热
+    fiber->call();
+
+    uint64_t begin = now_ns();
+    for (uint64_t i = 0; i < kRounds; ++i) { fiber->call(); }
+    uint64_t cost = now_ns() - begin;
+
+    // 让协程执行完毕
+    fiber->call();
+
+    // 每轮call/back包含两次切换
+    LOG_INFO("pico::Fiber %s: %lu rounds, %.1f ns/switch",
+#ifdef PICO_FIBER_ASM_CONTEXT
+             "asm context",
+#else
+             "ucontext",
+#endif
+             kRounds,
+             (double)cost / kRounds / 2);
+}
+
+static ucontext_t s_main_ctx;
+static ucontext_t s_fiber_ctx;
+
+static void ucontext_func() {
+    while (true) { swapcontext(&s_fiber_ctx, &s_main_ctx); }
+}
+
+void bench_ucontext() {
+    static char stack[128 * 1024];
+    getcontext(&s_fiber_ctx);
+    s_fiber_ctx.uc_link = nullptr;
+    s_fiber_ctx.uc_stack.ss_sp = stack;
+    s_fiber_ctx.uc_stack.ss_size = sizeof(stack);
+    makecontext(&s_fiber_ctx, &ucontext_func, 0);
+
+    swapcontext(&s_main_ctx, &s_fiber_ctx);
+
+    uint64_t begin = now_ns();
+    for (uint64_t i = 0; i < kRounds; ++i) { swapcontext(&s_main_ctx, &s_fiber_ctx); }
+    uint64_t cost = now_ns() - begin;
+
+    LOG_INFO("raw swapcontext: %lu rounds, %.1f ns/switch", kRounds, (double)cost / kRounds / 2);
+}
+
+int main(int argc, char const* argv[]) {
+    pico::Thread::SetName("main");
+    bench_fiber();
+    bench_ucontext();
+    return 0;
+}
@@ -0,0 +1,287 @@
+#include "pico/http/http_server.h"
+#include "pico/http/servlet.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "test_check.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const int kPort = 18171;
+
+class ThrowServlet : public pico::Servlet
+{
+public:
+    void doGet(const pico::request& req, pico::response& res) override {
+        if (req->get_path() == "/throw") { throw std::runtime_error("handler error"); }
+        res->set_body("ok");
+    }
+};
+
+/**
+ * 在普通线程中连接服务器, 失败返回-1
+ */
+static int connect_server(int port, int timeout_ms = 2000) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct timeval tv = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * 读到连接关闭或超时
+ */
+static std::string recv_all(int fd) {
+    std::string resp;
+    char buf[4096];
+    int n = 0;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) { resp.append(buf, n); }
+    return resp;
+}
+
+/**
+ * 在普通线程中发送一个请求并读到连接关闭或超时
+ */
+static std::string send_request(const std::string& data, int port = kPort) {
+    int fd = connect_server(port);
+    std::string resp;
+    if (fd != -1) {
+        send(fd, data.data(), data.size(), 0);
+        resp = recv_all(fd);
+        close(fd);
+    }
+    return resp;
+}
+
+static size_t count_of(const std::string& str, const std::string& sub) {
+    size_t n = 0;
+    for (size_t pos = str.find(sub); pos != std::string::npos; pos = str.find(sub, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+/**
+ * 等待条件成立, 超时返回false
+ */
+static bool wait_for(const std::function<bool()>& cond, int timeout_ms = 2000) {
+    for (int i = 0; i < timeout_ms / 10; ++i) {
+        if (cond()) { return true; }
+        usleep(10 * 1000);
+    }
+    return cond();
+}
+
+static pico::HttpServer::Ptr start_server(pico::IOManager& iom,
+                                          const pico::AdmissionOptions& opts,
+                                          int port) {
+    pico::HttpServer::Ptr server(new pico::HttpServer(true, &iom, &iom));
+    server->setAdmissionOptions(opts);
+    server->getRequestHandler()->addRoute("/*", std::make_shared<ThrowServlet>());
+    iom.schedule([server, port]() {
+        pico::Address::Ptr addr =
+            pico::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+        if (!server->bind(addr)) {
+            LOG_ERROR("bind error, errno=%d, %s", errno, strerror(errno));
+            return;
+        }
+        server->start();
+    });
+    usleep(100 * 1000);
+    return server;
+}
+
+/**
+ * 打开n个空闲连接, 等待服务器全部接受
+ */
+static std::vector<int> open_idle(pico::HttpServer::Ptr server, int port, size_t n) {
+    std::vector<int> fds;
+    for (size_t i = 0; i < n; ++i) { fds.push_back(connect_server(port)); }
+    CHECK(wait_for([&]() { return server->getConnectionCount() == n; }));
+    return fds;
+}
+
+static void close_all(std::vector<int>& fds) {
+    for (int fd : fds) { close(fd); }
+    fds.clear();
+}
+
+/**
+ * 处理连接时抛出的异常不能泄漏连接数和在途请求数, 否则服务器会一直处于过载状态
+ */
+void test_exception_release() {
+    pico::IOManager iom(2, false, "admission");
+    pico::AdmissionOptions opts;
+    opts.max_connections = 4;
+    opts.max_inflight_requests = 4;
+    opts.overload = "reject";
+    pico::HttpServer::Ptr server = start_server(iom, opts, kPort);
+
+    for (int i = 0; i < 10; ++i) {
+        // 请求头解析时抛出
+        send_request("POST / HTTP/1.1\r\nContent-Length: abc\r\n\r\n");
+        // 处理请求时抛出
+        send_request("GET /throw HTTP/1.1\r\n\r\n");
+    }
+    usleep(100 * 1000);
+    CHECK(server->getConnectionCount() == 0);
+    CHECK(server->getInflightRequests() == 0);
+    CHECK(!server->isOverloaded());
+    std::string resp = send_request("GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(resp.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+
+    server->stop();
+    iom.stop();
+}
+
+/**
+ * pause: 过载后不再accept, 新连接留在内核队列中; 连接数降到resume_connections才恢复
+ */
+void test_overload_pause() {
+    const int port = kPort + 1;
+    pico::IOManager iom(2, false, "pause");
+    pico::AdmissionOptions opts;
+    opts.max_connections = 4;
+    opts.resume_connections = 2;
+    opts.overload = "pause";
+    pico::HttpServer::Ptr server = start_server(iom, opts, port);
+
+    std::vector<int> idle = open_idle(server, port, 4);
+    CHECK(server->isOverloaded());
+
+    // 内核完成握手, 但服务器不接受, 请求得不到响应
+    int waiting = connect_server(port, 300);
+    CHECK(waiting != -1);
+    const std::string req = "GET / HTTP/1.1\r\nConnection: close\r\n\r\n";
+    send(waiting, req.data(), req.size(), 0);
+    char c;
+    CHECK(recv(waiting, &c, 1, 0) == -1 && errno == EAGAIN);
+    CHECK(server->getConnectionCount() == 4);
+
+    // 降到3个仍高于resume_connections, 继续暂停
+    close(idle.back());
+    idle.pop_back();
+    CHECK(wait_for([&]() { return server->getConnectionCount() == 3; }));
+    CHECK(recv(waiting, &c, 1, 0) == -1 && errno == EAGAIN);
+    CHECK(server->isOverloaded());
+
+    // 降到resume_connections后恢复接受, 等待中的连接得到处理
+    close(idle.back());
+    idle.pop_back();
+    struct timeval tv = {2, 0};
+    setsockopt(waiting, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::string resp = recv_all(waiting);
+    CHECK(resp.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    CHECK(!server->isOverloaded());
+    close(waiting);
+
+    close_all(idle);
+    CHECK(wait_for([&]() { return server->getConnectionCount() == 0; }));
+    server->stop();
+    iom.stop();
+}
+
+/**
+ * reject: 过载时接受新连接并返回503和Retry-After, 不计入连接数
+ */
+void test_overload_reject() {
+    const int port = kPort + 2;
+    pico::IOManager iom(2, false, "reject");
+    pico::AdmissionOptions opts;
+    opts.max_connections = 2;
+    opts.overload = "reject";
+    pico::HttpServer::Ptr server = start_server(iom, opts, port);
+
+    std::vector<int> idle = open_idle(server, port, 2);
+    CHECK(server->isOverloaded());
+    std::string resp = send_request("GET / HTTP/1.1\r\n\r\n", port);
+    CHECK(resp.compare(0, 12, "HTTP/1.1 503") == 0);
+    CHECK(resp.find("Retry-After: 1\r\n") != std::string::npos);
+    CHECK(server->getConnectionCount() == 2);
+
+    close_all(idle);
+    CHECK(wait_for([&]() { return !server->isOverloaded(); }));
+    resp = send_request("GET / HTTP/1.1\r\nConnection: close\r\n\r\n", port);
+    CHECK(resp.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    server->stop();
+    iom.stop();
+}
+
+/**
+ * reset: 过载时接受新连接后立即以RST关闭
+ */
+void test_overload_reset() {
+    const int port = kPort + 3;
+    pico::IOManager iom(2, false, "reset");
+    pico::AdmissionOptions opts;
+    opts.max_connections = 2;
+    opts.overload = "reset";
+    pico::HttpServer::Ptr server = start_server(iom, opts, port);
+
+    std::vector<int> idle = open_idle(server, port, 2);
+    CHECK(server->isOverloaded());
+    int fd = connect_server(port);
+    CHECK(fd != -1);
+    char c;
+    int rt = recv(fd, &c, 1, 0);
+    CHECK(rt == -1 && errno == ECONNRESET);
+    close(fd);
+    CHECK(server->getConnectionCount() == 2);
+
+    close_all(idle);
+    CHECK(wait_for([&]() { return server->getConnectionCount() == 0; }));
+    server->stop();
+    iom.stop();
+}
+
+/**
+ * 在途请求达到上限时, 流水线批次中只处理能占到名额的请求, 其余返回503后关闭连接
+ */
+void test_inflight_pipeline() {
+    const int port = kPort + 4;
+    pico::IOManager iom(2, false, "inflight");
+    pico::AdmissionOptions opts;
+    opts.max_inflight_requests = 2;
+    pico::HttpServer::Ptr server = start_server(iom, opts, port);
+
+    std::string batch;
+    for (int i = 0; i < 4; ++i) { batch += "GET / HTTP/1.1\r\n\r\n"; }
+    std::string resp = send_request(batch, port);
+    CHECK(count_of(resp, "HTTP/1.1 200 OK") == 2);
+    CHECK(count_of(resp, "HTTP/1.1 503") == 1);
+    CHECK(resp.find("HTTP/1.1 503") > resp.rfind("HTTP/1.1 200 OK"));
+    CHECK(resp.find("Retry-After: 1\r\n") != std::string::npos);
+    CHECK(wait_for([&]() { return server->getInflightRequests() == 0; }));
+
+    server->stop();
+    iom.stop();
+}
+
+int main(int argc, char const* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    test_exception_release();
+    test_overload_pause();
+    test_overload_reject();
+    test_overload_reset();
+    test_inflight_pipeline();
+    return TEST_RESULT("test_admission");
+}
@@ -0,0 +1,166 @@
+#include "pico/affinity.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/mutex.h"
+#include "pico/worker.h"
+#include "test_check.h"
+
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Placement
+{
+    std::vector<int> cpus;
+    int mode = -1;
+    unsigned long nodes = 0;
+};
+
+static Placement current_placement() {
+    Placement p;
+    p.cpus = pico::getAllowedCpus();
+    unsigned long nodes[16] = {0};
+    if (syscall(SYS_get_mempolicy, &p.mode, nodes, sizeof(nodes) * 8, nullptr, 0) == 0) {
+        p.nodes = nodes[0];
+    }
+    return p;
+}
+
+/**
+ * 在IOManager的每个调度线程上读取其亲和性和内存策略
+ */
+static std::map<int, Placement> thread_placements(pico::IOManager::Ptr iom) {
+    std::map<int, Placement> result;
+    pico::Mutex mutex;
+    std::atomic<size_t> done = {0};
+    for (int tid : iom->getThreadIds()) {
+        iom->schedule(
+            [&, tid]() {
+                Placement p = current_placement();
+                pico::Mutex::Lock lock(mutex);
+                result[tid] = p;
+                ++done;
+            },
+            tid);
+    }
+    while (done < iom->getThreadIds().size()) { usleep(1000); }
+    return result;
+}
+
+static bool numa_supported() {
+    int mode = 0;
+    unsigned long nodes[16] = {0};
+    return syscall(SYS_get_mempolicy, &mode, nodes, sizeof(nodes) * 8, nullptr, 0) == 0 &&
+           !pico::getNumaNodeCpus(0).empty();
+}
+
+/**
+ * CPU和节点列表的解析
+ */
+void test_parse() {
+    CHECK(pico::parseCpuList("0-3,8,x,2,10-9,5-5") == std::vector<int>({0, 1, 2, 3, 5, 8}));
+    CHECK(pico::parseCpuList("").empty());
+    CHECK(pico::parseCpuList("3,1,1") == std::vector<int>({1, 3}));
+    CHECK(pico::parseCpuList("-1,2x,4") == std::vector<int>({4}));
+    CHECK(pico::getNumaNodeCpus(-1).empty());
+    CHECK(pico::getNumaNodeCpus(100000).empty());
+}
+
+/**
+ * 作用域内创建的线程继承亲和性和内存策略, 离开作用域后创建线程恢复原状
+ */
+void test_guard() {
+    Placement before = current_placement();
+    std::vector<int> one(1, before.cpus.front());
+    bool numa = numa_supported();
+    Placement inherited;
+    {
+        pico::ThreadPlacementGuard guard(one, numa ? 0 : -1);
+        std::thread t([&]() { inherited = current_placement(); });
+        t.join();
+    }
+    CHECK(inherited.cpus == one);
+    if (numa) {
+        CHECK(inherited.mode == MPOL_PREFERRED);
+        CHECK(inherited.nodes == 1);
+    }
+    Placement after = current_placement();
+    CHECK(after.cpus == before.cpus);
+    CHECK(after.mode == before.mode);
+}
+
+/**
+ * 工作组的cpus, numa_node, pin和isolate应用到调度线程上
+ */
+void test_worker_groups() {
+    Placement before = current_placement();
+    const std::vector<int>& allowed = before.cpus;
+    const int first = allowed.front();
+    bool numa = numa_supported();
+
+    std::map<std::string, std::map<std::string, std::string>> conf;
+    conf["acceptor"] = {{"thread_num", "1"}, {"cpus", std::to_string(first)}, {"isolate", "true"}};
+    conf["pinned"] = {{"thread_num", "2"}, {"worker_num", "2"}, {"pin", "true"}};
+    conf["plain"] = {{"thread_num", "2"}};
+    if (numa) { conf["pinned"]["numa_node"] = "0"; }
+
+    pico::WorkerManager wm;
+    CHECK(wm.init(conf));
+
+    // 创建线程的亲和性和内存策略已恢复
+    Placement after = current_placement();
+    CHECK(after.cpus == before.cpus);
+    CHECK(after.mode == before.mode);
+
+    for (auto& it : thread_placements(wm.get("acceptor"))) {
+        CHECK(it.second.cpus == std::vector<int>(1, first));
+    }
+
+    // 有剩余CPU时其他工作组避开isolate的CPU, 否则仍使用全部CPU
+    bool spare = allowed.size() > 1;
+    for (auto& it : thread_placements(wm.get("plain"))) {
+        const std::vector<int>& cpus = it.second.cpus;
+        CHECK(!cpus.empty());
+        CHECK(spare ? std::find(cpus.begin(), cpus.end(), first) == cpus.end() : cpus == allowed);
+        if (numa) { CHECK(it.second.mode == before.mode); }
+    }
+
+    // 每个线程绑定单个CPU, CPU足够时互不相同
+    std::vector<int> node_cpus = numa ? pico::getNumaNodeCpus(0) : allowed;
+    std::vector<int> pinned;
+    for (auto& iom : wm.getGroup("pinned")->getWorkers()) {
+        for (auto& it : thread_placements(iom)) {
+            const std::vector<int>& cpus = it.second.cpus;
+            CHECK(cpus.size() == 1);
+            if (cpus.empty()) { continue; }
+            pinned.push_back(cpus[0]);
+            CHECK(std::find(allowed.begin(), allowed.end(), cpus[0]) != allowed.end());
+            if (node_cpus.size() > 1) { CHECK(cpus[0] != first); }
+            if (numa) {
+                CHECK(it.second.mode == MPOL_PREFERRED);
+                CHECK(it.second.nodes == 1);
+            }
+        }
+    }
+    CHECK(pinned.size() == 4);
+    std::sort(pinned.begin(), pinned.end());
+    if (node_cpus.size() > 4) {
+        CHECK(std::unique(pinned.begin(), pinned.end()) == pinned.end());
+    }
+    wm.stop();
+}
+
+int main(int argc, char const* argv[]) {
+    test_parse();
+    test_guard();
+    test_worker_groups();
+    return TEST_RESULT("test_affinity");
+}
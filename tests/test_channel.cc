@@ -0,0 +1,313 @@
+#include "pico/channel.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+/**
+ * 在普通线程中等待条件成立, 超时返回false
+ */
+static bool wait_until(std::function<bool()> pred, uint64_t timeout_ms = 3000) {
+    uint64_t deadline = pico::getCurrentTime() + timeout_ms;
+    while (!pred()) {
+        if (pico::getCurrentTime() >= deadline) { return false; }
+        usleep(5 * 1000);
+    }
+    return true;
+}
+
+static pico::Channel<int> s_jobs(4);
+static pico::Channel<std::string> s_results;
+static pico::Channel<int> s_quit;
+static std::atomic<int> s_collected = {0};
+
+void producer() {
+    for (int i = 0; i < 20; ++i) { CHECK(s_jobs.send(i)); }
+    s_jobs.close();
+}
+
+void worker() {
+    int job = 0;
+    while (s_jobs.recv(job)) { CHECK(s_results.send("job " + std::to_string(job))); }
+}
+
+void collector() {
+    int count = 0;
+    while (count < 20) {
+        std::string result;
+        int quit = 0;
+        pico::ChannelSelector sel;
+        int recv_result = sel.recv(s_results, result);
+        sel.recv(s_quit, quit);
+        int rt = sel.select(1000);
+        if (rt < 0) {
+            LOG_ERROR("select timeout");
+            break;
+        }
+        CHECK(rt == recv_result);
+        CHECK(result.compare(0, 4, "job ") == 0);
+        ++count;
+    }
+    s_collected = count;
+}
+
+/**
+ * 生产者, 多个消费者与select收集结果组成的流水线
+ */
+void test_pipeline(pico::IOManager& iom) {
+    iom.schedule(&producer);
+    iom.schedule(&worker);
+    iom.schedule(&worker);
+    iom.schedule(&collector);
+    CHECK(wait_until([]() { return s_collected != 0; }));
+    CHECK(s_collected == 20);
+}
+
+/**
+ * 无缓冲通道的发送方挂起, 直到接收方取走数据
+ */
+void test_unbuffered(pico::IOManager& iom) {
+    static pico::Channel<int> s_ch;
+    static std::atomic<bool> s_sent = {false};
+    static std::atomic<int> s_value = {0};
+
+    iom.schedule([]() {
+        CHECK(s_ch.send(42));
+        s_sent = true;
+    });
+    usleep(50 * 1000);
+    CHECK(!s_sent);
+    CHECK(s_ch.size() == 0);
+    iom.schedule([]() {
+        int value = 0;
+        CHECK(s_ch.recv(value));
+        s_value = value;
+    });
+    CHECK(wait_until([]() { return s_sent && s_value != 0; }));
+    CHECK(s_value == 42);
+
+    // 接收方先到达时同样直接交接
+    s_value = 0;
+    iom.schedule([]() {
+        int value = 0;
+        CHECK(s_ch.recv(value));
+        s_value = value;
+    });
+    usleep(20 * 1000);
+    iom.schedule([]() { CHECK(s_ch.send(7)); });
+    CHECK(wait_until([]() { return s_value != 0; }));
+    CHECK(s_value == 7);
+}
+
+/**
+ * 有界通道满时发送方挂起, 腾出位置后按发送顺序写入
+ */
+void test_bounded(pico::IOManager& iom) {
+    static pico::Channel<int> s_ch(2);
+    static std::atomic<int> s_sent = {0};
+    static std::atomic<int> s_sum = {0};
+
+    iom.schedule([]() {
+        for (int i = 1; i <= 3; ++i) {
+            CHECK(s_ch.send(i));
+            ++s_sent;
+        }
+    });
+    CHECK(wait_until([]() { return s_sent == 2; }));
+    usleep(50 * 1000);
+    CHECK(s_sent == 2);
+    CHECK(s_ch.size() == 2);
+    CHECK(!s_ch.trySend(9));
+
+    iom.schedule([]() {
+        int expected = 1;
+        for (int i = 0; i < 3; ++i) {
+            int value = 0;
+            CHECK(s_ch.recv(value));
+            CHECK(value == expected++);
+            s_sum += value;
+        }
+    });
+    CHECK(wait_until([]() { return s_sent == 3 && s_sum == 6; }));
+    CHECK(s_ch.size() == 0);
+}
+
+/**
+ * close唤醒阻塞的发送方与接收方, 缓冲区中的数据在关闭后仍可以接收
+ */
+void test_close(pico::IOManager& iom) {
+    static pico::Channel<int> s_empty;
+    static pico::Channel<int> s_full(1);
+    static pico::Channel<int> s_buffered(2);
+    static std::atomic<int> s_recv_rt = {-1};
+    static std::atomic<int> s_send_rt = {-1};
+
+    CHECK(s_full.send(1));
+    iom.schedule([]() {
+        int value = 0;
+        s_recv_rt = s_empty.recv(value);
+    });
+    iom.schedule([]() { s_send_rt = s_full.send(2); });
+    usleep(50 * 1000);
+    CHECK(s_recv_rt == -1 && s_send_rt == -1);
+    s_empty.close();
+    s_full.close();
+    CHECK(wait_until([]() { return s_recv_rt != -1 && s_send_rt != -1; }));
+    CHECK(s_recv_rt == 0);
+    CHECK(s_send_rt == 0);
+    CHECK(s_empty.isClosed());
+    CHECK(!s_full.send(3));
+
+    CHECK(s_buffered.send(1));
+    CHECK(s_buffered.send(2));
+    s_buffered.close();
+    int value = 0;
+    CHECK(s_buffered.recv(value) && value == 1);
+    CHECK(s_buffered.recv(value) && value == 2);
+    CHECK(!s_buffered.recv(value));
+    // 阻塞在满通道上的发送方未写入的值被丢弃, 缓冲区中原有的值仍在
+    CHECK(s_full.recv(value) && value == 1);
+    CHECK(!s_full.recv(value));
+}
+
+/**
+ * sendFor与recvFor超时返回false, 超时的值不会留在通道中
+ */
+void test_timeout(pico::IOManager& iom) {
+    static pico::Channel<int> s_ch;
+    static std::atomic<int> s_recv_rt = {-1};
+    static std::atomic<int> s_send_rt = {-1};
+    static std::atomic<uint64_t> s_elapsed = {0};
+
+    iom.schedule([]() {
+        uint64_t start = pico::getCurrentTime();
+        int value = 0;
+        s_recv_rt = s_ch.recvFor(value, 100);
+        s_elapsed = pico::getCurrentTime() - start;
+    });
+    CHECK(wait_until([]() { return s_recv_rt != -1; }));
+    CHECK(s_recv_rt == 0);
+    CHECK(s_elapsed >= 100 && s_elapsed < 1000);
+
+    iom.schedule([]() {
+        uint64_t start = pico::getCurrentTime();
+        s_send_rt = s_ch.sendFor(1, 100);
+        s_elapsed = pico::getCurrentTime() - start;
+    });
+    CHECK(wait_until([]() { return s_send_rt != -1; }));
+    CHECK(s_send_rt == 0);
+    CHECK(s_elapsed >= 100 && s_elapsed < 1000);
+    int value = 0;
+    CHECK(!s_ch.tryRecv(value));
+}
+
+/**
+ * select的发送分支: 只有能完成的分支被选中, 没有就绪分支时挂起到接收方出现
+ */
+void test_select_send(pico::IOManager& iom) {
+    static pico::Channel<int> s_full(1);
+    static pico::Channel<int> s_space(1);
+    static pico::Channel<int> s_unbuffered;
+    static std::atomic<int> s_selected = {-2};
+
+    CHECK(s_full.send(0));
+    {
+        pico::ChannelSelector sel;
+        sel.send(s_full, 1);
+        int space = sel.send(s_space, 2);
+        CHECK(sel.trySelect() == space);
+    }
+    int value = 0;
+    CHECK(s_space.recv(value) && value == 2);
+    CHECK(s_full.size() == 1);
+
+    iom.schedule([]() {
+        bool ok = false;
+        pico::ChannelSelector sel;
+        sel.send(s_full, 1);
+        int unbuffered = sel.send(s_unbuffered, 3, &ok);
+        int rt = sel.select(3000);
+        CHECK(ok);
+        s_selected = rt == unbuffered ? 1 : rt;
+    });
+    usleep(50 * 1000);
+    CHECK(s_selected == -2);
+    iom.schedule([]() {
+        int value = 0;
+        CHECK(s_unbuffered.recv(value) && value == 3);
+    });
+    CHECK(wait_until([]() { return s_selected != -2; }));
+    CHECK(s_selected == 1);
+    // 没有被选中的发送分支不会写入
+    CHECK(s_full.recv(value) && value == 0);
+    CHECK(!s_full.tryRecv(value));
+
+    pico::ChannelSelector sel;
+    sel.send(s_unbuffered, 4);
+    CHECK(sel.select(50) == -1);
+}
+
+/**
+ * 两组协程以相反的顺序在同一对通道上select, 按地址顺序加锁不会死锁
+ */
+void test_select_order(pico::IOManager& iom) {
+    static pico::Channel<int> s_a;
+    static pico::Channel<int> s_b;
+    static std::atomic<int> s_received = {0};
+    static std::atomic<int> s_sent = {0};
+    const int kRounds = 500;
+
+    for (int i = 0; i < 2; ++i) {
+        iom.schedule([i]() {
+            for (int j = 0; j < kRounds; ++j) {
+                int value = 0;
+                pico::ChannelSelector sel;
+                if (i == 0) {
+                    sel.recv(s_a, value);
+                    sel.recv(s_b, value);
+                }
+                else {
+                    sel.recv(s_b, value);
+                    sel.recv(s_a, value);
+                }
+                if (sel.select(3000) < 0) { return; }
+                ++s_received;
+            }
+        });
+        iom.schedule([i]() {
+            for (int j = 0; j < kRounds; ++j) {
+                pico::ChannelSelector sel;
+                if (i == 0) {
+                    sel.send(s_a, j);
+                    sel.send(s_b, j);
+                }
+                else {
+                    sel.send(s_b, j);
+                    sel.send(s_a, j);
+                }
+                if (sel.select(3000) < 0) { return; }
+                ++s_sent;
+            }
+        });
+    }
+    CHECK(wait_until([]() { return s_received == 2 * kRounds && s_sent == 2 * kRounds; }, 10000));
+}
+
+int main(int argc, char const* argv[]) {
+    pico::IOManager iom(3, false, "channel");
+    test_pipeline(iom);
+    test_unbuffered(iom);
+    test_bounded(iom);
+    test_close(iom);
+    test_timeout(iom);
+    test_select_send(iom);
+    test_select_order(iom);
+    iom.stop();
+    return TEST_RESULT("test_channel");
+}
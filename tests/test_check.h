@@ -0,0 +1,35 @@
+#ifndef __PICO_TEST_CHECK_H__
+#define __PICO_TEST_CHECK_H__
+
+#include <atomic>
+
+#include "pico/logging.h"
+
+/**
+ * @brief 自检测试的公共部分
+ * @details CHECK失败时记录日志并计数, 可以在任意线程和协程中使用;
+ *          main最后返回TEST_RESULT(name), 有失败的检查时进程退出码为1
+ */
+
+namespace pico_test {
+
+static std::atomic<int> s_failed = {0};
+
+static inline int result(const char* name) {
+    LOG_INFO("%s %s", name, s_failed ? "failed" : "passed");
+    return s_failed ? 1 : 0;
+}
+
+}   // namespace pico_test
+
+#define CHECK(cond)                               \
+    do {                                          \
+        if (!(cond)) {                            \
+            LOG_ERROR("check failed: %s", #cond); \
+            ++pico_test::s_failed;                \
+        }                                         \
+    } while (0)
+
+#define TEST_RESULT(name) pico_test::result(name)
+
+#endif
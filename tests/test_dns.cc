@@ -0,0 +1,220 @@
+#include "pico/config.h"
+#include "pico/dns.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/mutex.h"
+#include "test_check.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * 只应答A记录的nameserver, 记录每个名称收到的查询次数
+ */
+class FakeNameserver
+{
+public:
+    FakeNameserver() {
+        m_records["redis.svc.local"] = "10.0.0.1";
+        m_records["db.example"] = "10.0.0.2";
+        m_records["burst.svc.local"] = "10.0.0.3";
+        m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(m_fd, (sockaddr*)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(m_fd, (sockaddr*)&addr, &len);
+        m_port = ntohs(addr.sin_port);
+        struct timeval tv = {0, 100 * 1000};
+        setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        m_thread = std::thread([this]() { run(); });
+    }
+
+    ~FakeNameserver() {
+        m_stop = true;
+        m_thread.join();
+        close(m_fd);
+    }
+
+    uint16_t getPort() const { return m_port; }
+
+    int count(const std::string& name) {
+        pico::Mutex::Lock lock(m_mutex);
+        return m_counts[name];
+    }
+
+    int total() {
+        pico::Mutex::Lock lock(m_mutex);
+        int n = 0;
+        for (auto& i : m_counts) { n += i.second; }
+        return n;
+    }
+
+private:
+    void run() {
+        uint8_t buf[512];
+        while (!m_stop) {
+            sockaddr_in peer;
+            socklen_t len = sizeof(peer);
+            ssize_t n = recvfrom(m_fd, buf, sizeof(buf), 0, (sockaddr*)&peer, &len);
+            if (n < 12) { continue; }
+            std::string name;
+            size_t pos = 12;
+            while (pos < (size_t)n && buf[pos]) {
+                if (!name.empty()) { name += '.'; }
+                name.append((const char*)buf + pos + 1, buf[pos]);
+                pos += buf[pos] + 1;
+            }
+            size_t question_end = pos + 5;
+            uint16_t qtype = buf[pos + 1] << 8 | buf[pos + 2];
+            {
+                pico::Mutex::Lock lock(m_mutex);
+                ++m_counts[name];
+            }
+            // 让并发的查询有机会合并
+            if (name.compare(0, 5, "burst") == 0) { usleep(50 * 1000); }
+
+            auto it = m_records.find(name);
+            bool answer = it != m_records.end() && qtype == 1;
+            std::string reply((const char*)buf, 2);
+            uint8_t rcode = it == m_records.end() ? 3 : 0;
+            reply += (char)0x81;
+            reply += (char)(0x80 | rcode);
+            const char counts[] = {0, 1, 0, (char)answer, 0, (char)!answer, 0, 0};
+            reply.append(counts, sizeof(counts));
+            reply.append((const char*)buf + 12, question_end - 12);
+            if (answer) {
+                const char rr[] = {(char)0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 5, 0, 4};
+                reply.append(rr, sizeof(rr));
+                in_addr ip;
+                inet_pton(AF_INET, it->second.c_str(), &ip);
+                reply.append((const char*)&ip, 4);
+            }
+            else {
+                // SOA: 两个根域名和五个32位字段, MINIMUM为30秒
+                const char rr[] = {(char)0xc0, 12, 0, 6, 0, 1, 0, 0, 0, 60, 0, 22, 0, 0,
+                                   0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 30};
+                reply.append(rr, sizeof(rr));
+            }
+            sendto(m_fd, reply.data(), reply.size(), 0, (sockaddr*)&peer, len);
+        }
+    }
+
+private:
+    int m_fd = -1;
+    uint16_t m_port = 0;
+    std::atomic<bool> m_stop = {false};
+    std::map<std::string, std::string> m_records;
+    pico::Mutex m_mutex;
+    std::map<std::string, int> m_counts;
+    std::thread m_thread;
+};
+
+static std::string resolve_one(const std::string& host, int* rt) {
+    std::vector<pico::IPAddress::Ptr> addrs;
+    *rt = pico::DnsResolver::getInstance()->resolve(host, AF_INET, addrs);
+    if (addrs.empty()) { return ""; }
+    char ip[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &((const sockaddr_in*)addrs[0]->getAddr())->sin_addr, ip, sizeof(ip));
+    return ip;
+}
+
+void test_search(FakeNameserver& server) {
+    int rt = 0;
+    // 没有点的名称先加search域
+    CHECK(resolve_one("redis", &rt) == "10.0.0.1" && rt == 0);
+    CHECK(server.count("redis.svc.local") == 1);
+    CHECK(server.count("redis") == 0);
+
+    // 点数达到ndots时先按绝对域名查询
+    CHECK(resolve_one("db.example", &rt) == "10.0.0.2" && rt == 0);
+    CHECK(server.count("db.example") == 1);
+    CHECK(server.count("db.example.svc.local") == 0);
+
+    // 以'.'结尾的名称不使用search
+    CHECK(resolve_one("redis.", &rt) == "" && rt == EAI_NONAME);
+    CHECK(server.count("redis") == 1);
+    CHECK(server.count("redis.svc.local") == 1);
+}
+
+void test_cache(FakeNameserver& server) {
+    int rt = 0;
+    int total = server.total();
+    CHECK(resolve_one("redis", &rt) == "10.0.0.1");
+    CHECK(server.total() == total);
+
+    // 否定缓存
+    CHECK(resolve_one("missing.example", &rt) == "" && rt == EAI_NONAME);
+    total = server.total();
+    CHECK(resolve_one("missing.example", &rt) == "" && rt == EAI_NONAME);
+    CHECK(server.total() == total);
+
+    pico::DnsResolver::getInstance()->clear();
+    CHECK(resolve_one("redis", &rt) == "10.0.0.1");
+    CHECK(server.total() == total + 1);
+}
+
+void test_inflight(FakeNameserver& server) {
+    std::atomic<int> ok = {0};
+    pico::FiberSemaphore done;
+    const int n = 8;
+    for (int i = 0; i < n; ++i) {
+        pico::IOManager::GetThis()->schedule([&ok, &done]() {
+            int rt = 0;
+            if (resolve_one("burst", &rt) == "10.0.0.3") { ++ok; }
+            done.notify();
+        });
+    }
+    for (int i = 0; i < n; ++i) { done.wait(); }
+    CHECK(ok == n);
+    CHECK(server.count("burst.svc.local") == 1);
+}
+
+void test_getaddrinfo() {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    int rt = pico::DnsResolver::getInstance()->getaddrinfo("redis", "6379", &hints, &res);
+    CHECK(rt == 0 && res);
+    if (res) {
+        const sockaddr_in* sin = (const sockaddr_in*)res->ai_addr;
+        CHECK(ntohs(sin->sin_port) == 6379);
+        CHECK(sin->sin_addr.s_addr == inet_addr("10.0.0.1"));
+        CHECK(res->ai_next == nullptr);
+        freeaddrinfo(res);
+    }
+}
+
+int main(int argc, char const* argv[]) {
+    FakeNameserver server;
+    pico::Config::Lookup("dns.nameservers", std::vector<std::string>())
+        ->setValue(std::vector<std::string>(1, "127.0.0.1:" + std::to_string(server.getPort())));
+    pico::Config::Lookup("dns.search", std::vector<std::string>())
+        ->setValue(std::vector<std::string>(1, "svc.local"));
+    pico::Config::Lookup<int32_t>("dns.ndots", -1)->setValue(1);
+    pico::Config::Lookup<uint32_t>("dns.timeout", 2000)->setValue(500);
+    {
+        pico::IOManager iom(2, false, "dns");
+        iom.schedule([&server]() {
+            test_search(server);
+            test_cache(server);
+            test_inflight(server);
+            test_getaddrinfo();
+        });
+        iom.stop();
+    }
+    return TEST_RESULT("test_dns");
+}
@@ -0,0 +1,103 @@
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * 多个线程同时在尚未分配的段上注册事件, 每段只保留一份, 所有事件都能触发
+ */
+void test_concurrent_growth() {
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    const int max_fd = rl.rlim_max == RLIM_INFINITY ? 16384 : std::min<int>(rl.rlim_max, 16384);
+
+    // 每段取若干个fd, 散布在不同的段上
+    const int per_segment = 32;
+    std::vector<int> fds;
+    for (int base = 1024; base + 1024 <= max_fd; base += 1024) {
+        for (int i = 0; i < per_segment; ++i) {
+            int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            int fd = base + i * 31;
+            if (efd < 0 || dup2(efd, fd) != fd) {
+                CHECK(false);
+                return;
+            }
+            close(efd);
+            fds.push_back(fd);
+        }
+    }
+    CHECK(fds.size() >= 4 * per_segment);
+    LOG_INFO("%zu fds up to %d", fds.size(), fds.back());
+
+    const int threads = 8;
+    std::unique_ptr<std::atomic<int>[]> fired(new std::atomic<int>[fds.size()]());
+    std::atomic<int> failed = {0};
+    std::atomic<int> ready = {0};
+    std::atomic<bool> go = {false};
+    std::atomic<int> added = {0};
+    {
+        pico::IOManager iom(threads, false, "fdtable");
+        usleep(100 * 1000);
+        const std::vector<int>& ids = iom.getThreadIds();
+        for (int t = 0; t < threads; ++t) {
+            iom.schedule(
+                [&, t]() {
+                    // 所有线程就绪后同时开始, 按相同的顺序逐段注册
+                    ++ready;
+                    while (!go) {}
+                    for (size_t i = t; i < fds.size(); i += threads) {
+                        int rt = pico::IOManager::GetThis()->addEvent(
+                            fds[i], pico::IOManager::READ, [&, i]() { ++fired[i]; });
+                        if (rt) { ++failed; }
+                        ++added;
+                    }
+                },
+                ids[t]);
+        }
+        while (ready < threads) { usleep(100); }
+        go = true;
+        while (added < (int)fds.size()) { usleep(1000); }
+        CHECK(failed == 0);
+
+        uint64_t one = 1;
+        for (int fd : fds) { CHECK(write(fd, &one, sizeof(one)) == sizeof(one)); }
+        uint64_t start = pico::getCurrentTime();
+        size_t done = 0;
+        while (pico::getCurrentTime() - start < 5000) {
+            done = 0;
+            for (size_t i = 0; i < fds.size(); ++i) { done += fired[i] != 0; }
+            if (done == fds.size()) { break; }
+            usleep(1000);
+        }
+        CHECK(done == fds.size());
+
+        // fd表按RLIMIT_NOFILE的硬限制预留, 超出的fd无法注册
+        std::atomic<int> beyond = {0};
+        iom.schedule([&]() {
+            int fd = rl.rlim_max == RLIM_INFINITY ? (1 << 25) : (int)rl.rlim_max + 2048;
+            beyond = pico::IOManager::GetThis()->addEvent(fd, pico::IOManager::READ, []() {});
+        });
+        iom.stop();
+        CHECK(beyond == -1);
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+        CHECK(fired[i] == 1);
+        close(fds[i]);
+    }
+}
+
+int main(int argc, char const* argv[]) {
+    test_concurrent_growth();
+    return TEST_RESULT("test_fd_table");
+}
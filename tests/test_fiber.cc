@@ -1,6 +1,17 @@
+#include "pico/fdmanager.h"
 #include "pico/fiber.h"
+#include "pico/iomanager.h"
 #include "pico/logging.h"
 #include "pico/thread.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
 
 int count = 0;
 pico::Mutex mutex;
@@ -26,6 +37,87 @@ void test_fiber() {
     LOG_INFO("test_fiber end");
 }
 
+void run_in_shared_fiber(int id) {
+    char buf[1024];
+    memset(buf, id, sizeof(buf));
+    pico::Fiber::yieldToHold();
+    // 其他共享栈协程使用过共享栈后, 栈上的内容应当被恢复
+    bool intact = true;
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        if (buf[i] != (char)id) { intact = false; }
+    }
+    CHECK(intact);
+}
+
+void test_shared_stack() {
+    pico::Fiber::GetThis();
+    pico::Fiber::Ptr f1(new pico::Fiber(std::bind(run_in_shared_fiber, 1), 0, false, true));
+    pico::Fiber::Ptr f2(new pico::Fiber(std::bind(run_in_shared_fiber, 2), 0, false, true));
+    f1->call();
+    f2->call();
+    f1->call();
+    f2->call();
+    CHECK(f1->getState() == pico::Fiber::TERM);
+    CHECK(f2->getState() == pico::Fiber::TERM);
+}
+
+static std::atomic<int> s_parked_done = {0};
+
+/**
+ * 在hook的recv和poll上挂起, 恢复后栈上的内容不变, 并且仍在绑定的线程上执行
+ */
+void run_parked_shared_fiber(int id, int fd) {
+    char buf[2048];
+    memset(buf, id, sizeof(buf));
+    int thread = pico::getThreadId();
+    CHECK(pico::Fiber::GetThis()->isSharedStack());
+    CHECK(pico::Fiber::GetThis()->getBoundThread() == thread);
+
+    char c = 0;
+    CHECK(recv(fd, &c, 1, 0) == 1 && c == 'a');
+    CHECK(pico::getThreadId() == thread);
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    CHECK(poll(&pfd, 1, 3000) == 1 && (pfd.revents & POLLIN));
+    CHECK(recv(fd, &c, 1, 0) == 1 && c == 'b');
+    CHECK(pico::getThreadId() == thread);
+
+    bool intact = true;
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        if (buf[i] != (char)id) { intact = false; }
+    }
+    CHECK(intact);
+    ++s_parked_done;
+}
+
+void test_shared_stack_park() {
+    const int kFibers = 8;
+    int sv[kFibers][2];
+    pico::IOManager iom(2, false, "shared");
+    for (int i = 0; i < kFibers; ++i) {
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) == 0);
+        // socketpair没有被hook, 登记后hook的recv才会挂起协程
+        pico::FdMgr::getInstance()->getFdCtx(sv[i][0], true);
+        pico::Fiber::Ptr fiber(new pico::Fiber(
+            std::bind(run_parked_shared_fiber, i + 1, sv[i][0]), 0, false, true));
+        iom.schedule(fiber);
+    }
+    // 等待所有协程挂起, 同一线程上的共享栈协程轮流换出
+    usleep(100 * 1000);
+    for (int i = 0; i < kFibers; ++i) { write(sv[i][1], "a", 1); }
+    usleep(100 * 1000);
+    for (int i = 0; i < kFibers; ++i) { write(sv[i][1], "b", 1); }
+
+    uint64_t deadline = pico::getCurrentTime() + 3000;
+    while (s_parked_done < kFibers && pico::getCurrentTime() < deadline) { usleep(10 * 1000); }
+    CHECK(s_parked_done == kFibers);
+    iom.stop();
+    for (int i = 0; i < kFibers; ++i) {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+}
+
 int main(int argc, char const* argv[]) {
     LOG_INFO("main begin");
     pico::Thread::SetName("main");
@@ -38,9 +130,12 @@ int main(int argc, char const* argv[]) {
 
     for (auto& thr : thrs) { thr->join(); }
 
+    test_shared_stack();
+    test_shared_stack_park();
+
     LOG_INFO("main end");
 
     LOG_INFO("count: %d", count);
 
-    return 0;
+    return TEST_RESULT("test_fiber");
 }
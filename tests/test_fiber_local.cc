@@ -0,0 +1,68 @@
+#include "pico/fiber.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <unistd.h>
+
+#include <atomic>
+
+static std::atomic<int> g_destroyed = {0};
+
+struct Context
+{
+    int id = 0;
+    ~Context() {
+        if (id) { ++g_destroyed; }
+    }
+};
+
+static pico::FiberLocal<Context> s_context;
+static pico::FiberLocal<int> s_value;
+
+/**
+ * 每个协程持有独立的值, 挂起和迁移后不变, 协程结束时析构, 复用的协程不会带有上一个任务的值
+ */
+void test_isolation() {
+    const int n = 2000;
+    {
+        pico::IOManager iom(4, false, "local");
+        for (int i = 1; i <= n; ++i) {
+            iom.schedule([i]() {
+                CHECK(!s_context.get() && !s_value.get());
+                s_context->id = i;
+                s_value.set(i * 2);
+                for (int k = 0; k < 5; ++k) {
+                    usleep(1000);
+                    pico::Fiber::yieldToReady();
+                }
+                CHECK(s_context->id == i && *s_value == i * 2);
+            });
+        }
+        iom.stop();
+    }
+    CHECK(g_destroyed == n);
+}
+
+/**
+ * reset立即释放当前协程上的值
+ */
+void test_reset() {
+    g_destroyed = 0;
+    pico::IOManager iom(1, false, "reset");
+    iom.schedule([]() {
+        s_context->id = 1;
+        s_context.reset();
+        CHECK(g_destroyed == 1);
+        CHECK(!s_context.get());
+        CHECK(s_context->id == 0);
+    });
+    iom.stop();
+}
+
+int main(int argc, char const* argv[]) {
+    test_isolation();
+    test_reset();
+    return TEST_RESULT("test_fiber_local");
+}
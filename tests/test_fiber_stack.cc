@@ -0,0 +1,153 @@
+#include "pico/config.h"
+#include "pico/fiber.h"
+#include "pico/logging.h"
+#include "test_check.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <functional>
+#include <set>
+#include <thread>
+#include <vector>
+
+static int count_maps() {
+    FILE* fp = fopen("/proc/self/maps", "r");
+    if (!fp) { return -1; }
+    int lines = 0;
+    char buf[512];
+    while (fgets(buf, sizeof(buf), fp)) { ++lines; }
+    fclose(fp);
+    return lines;
+}
+
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+static bool guard_install_supported() {
+    long page_size = sysconf(_SC_PAGESIZE);
+    void* page =
+        mmap(nullptr, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) { return false; }
+    bool rt = madvise(page, page_size, MADV_GUARD_INSTALL) == 0;
+    munmap(page, page_size);
+    return rt;
+}
+
+static void park() {
+    char buf[256];
+    memset(buf, 1, sizeof(buf));
+    pico::Fiber::yieldToHold();
+}
+
+/**
+ * 大量挂起的协程不会按栈的数量占用内存映射
+ */
+void test_many_parked() {
+    // 6.13之前的内核每个保护页拆分一次映射, 协程数量受vm.max_map_count限制
+    if (!guard_install_supported()) {
+        LOG_INFO("MADV_GUARD_INSTALL unsupported, skip test_many_parked");
+        return;
+    }
+    const int n = 100000;
+    pico::Fiber::GetThis();
+    int before = count_maps();
+    std::vector<pico::Fiber::Ptr> fibers;
+    fibers.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        fibers.emplace_back(new pico::Fiber(park));
+        fibers.back()->call();
+    }
+    int after = count_maps();
+    LOG_INFO("%d parked fibers, memory maps %d -> %d", n, before, after);
+    CHECK(after - before < n / 10);
+
+    for (auto& fiber : fibers) {
+        fiber->call();
+        CHECK(fiber->getState() == pico::Fiber::TERM);
+    }
+    fibers.clear();
+
+    // 释放的栈被复用, 不再增加映射
+    for (int i = 0; i < n; ++i) {
+        fibers.emplace_back(new pico::Fiber(park));
+        fibers.back()->call();
+    }
+    CHECK(count_maps() <= after + 8);
+    for (auto& fiber : fibers) { fiber->call(); }
+}
+
+static int overflow(int depth) {
+    volatile char buf[1024];
+    buf[0] = (char)depth;
+    if (depth < 0) { return 0; }
+    return overflow(depth + 1) + buf[0];
+}
+
+/**
+ * 栈溢出时触碰保护页, 立即收到SIGSEGV
+ */
+void test_guard_page() {
+    pid_t pid = fork();
+    if (pid == 0) {
+        pico::Fiber::GetThis();
+        pico::Fiber::Ptr fiber(new pico::Fiber(std::bind(overflow, 0)));
+        fiber->call();
+        _exit(0);
+    }
+    int status = 0;
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+}
+
+/**
+ * malloc分配器同样先在线程内缓存释放的栈, 新协程复用这些栈
+ */
+void test_malloc_pool() {
+    pico::Config::Lookup<std::string>("fiber.stack_allocator", "auto")->setValue("malloc");
+    // 分配器在线程第一次创建协程时确定
+    std::thread thread([]() {
+        const int n = 8;
+        pico::Fiber::GetThis();
+        std::set<void*> first;
+        std::set<void*> second;
+        std::set<void*>* seen = &first;
+        auto record = [&]() {
+            char local;
+            seen->insert(&local);
+            pico::Fiber::yieldToHold();
+        };
+        std::vector<pico::Fiber::Ptr> fibers;
+        for (int i = 0; i < n; ++i) {
+            fibers.emplace_back(new pico::Fiber(record));
+            fibers.back()->call();
+        }
+        for (auto& fiber : fibers) { fiber->call(); }
+        fibers.clear();
+
+        seen = &second;
+        for (int i = 0; i < n; ++i) {
+            fibers.emplace_back(new pico::Fiber(record));
+            fibers.back()->call();
+        }
+        for (auto& fiber : fibers) { fiber->call(); }
+        CHECK(first.size() == (size_t)n);
+        CHECK(second == first);
+    });
+    thread.join();
+    pico::Config::Lookup<std::string>("fiber.stack_allocator", "auto")->setValue("mmap");
+}
+
+int main(int argc, char const* argv[]) {
+    // 内核不支持MADV_GUARD_INSTALL时默认的auto会选择malloc, 这里测试mmap分配器本身
+    pico::Config::Lookup<std::string>("fiber.stack_allocator", "auto")->setValue("mmap");
+    test_many_parked();
+    test_guard_page();
+    test_malloc_pool();
+    return TEST_RESULT("test_fiber_stack");
+}
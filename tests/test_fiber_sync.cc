@@ -0,0 +1,238 @@
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/mutex.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+
+/**
+ * 在普通线程中等待条件成立, 超时返回false
+ */
+static bool wait_until(std::function<bool()> pred, uint64_t timeout_ms = 3000) {
+    uint64_t deadline = pico::getCurrentTime() + timeout_ms;
+    while (!pred()) {
+        if (pico::getCurrentTime() >= deadline) { return false; }
+        usleep(5 * 1000);
+    }
+    return true;
+}
+
+/**
+ * 固定在不同线程上的协程竞争同一把锁, 持锁期间挂起, 临界区内同时只有一个协程
+ */
+void test_mutex() {
+    static pico::FiberMutex s_mutex;
+    static int s_count = 0;
+    static std::atomic<int> s_inside = {0};
+    static std::atomic<int> s_done = {0};
+    static std::mutex s_threads_mutex;
+    static std::set<int> s_threads;
+
+    pico::IOManager iom(3, false, "mutex");
+    const std::vector<int>& threads = iom.getThreadIds();
+    const int kFibers = 12;
+    for (int i = 0; i < kFibers; ++i) {
+        iom.schedule(
+            []() {
+                {
+                    std::lock_guard<std::mutex> guard(s_threads_mutex);
+                    s_threads.insert(pico::getThreadId());
+                }
+                for (int j = 0; j < 100; ++j) {
+                    pico::FiberMutex::Lock lock(s_mutex);
+                    CHECK(++s_inside == 1);
+                    int v = s_count;
+                    // 持锁期间让出协程, 其他协程只能挂起等待
+                    if (j % 10 == 0) { usleep(100); }
+                    s_count = v + 1;
+                    --s_inside;
+                }
+                ++s_done;
+            },
+            threads[i % threads.size()]);
+    }
+    CHECK(wait_until([]() { return s_done == kFibers; }));
+    iom.stop();
+    CHECK(s_count == kFibers * 100);
+    CHECK(s_threads.size() == threads.size());
+
+    pico::FiberMutex mutex;
+    CHECK(mutex.tryLock());
+    CHECK(!mutex.tryLock());
+    mutex.unlock();
+    CHECK(mutex.tryLock());
+    mutex.unlock();
+}
+
+/**
+ * notifyOne只唤醒一个等待者, notifyAll唤醒其余全部; 带条件的waitFor在条件满足时返回true
+ */
+void test_condition() {
+    static pico::FiberMutex s_mutex;
+    static pico::FiberCondition s_cond;
+    static std::atomic<int> s_waiting = {0};
+    static std::atomic<int> s_woken = {0};
+    static int s_ready = 0;
+    static std::atomic<int> s_pred_rt = {-1};
+
+    pico::IOManager iom(2, false, "cond");
+    const int kWaiters = 3;
+    for (int i = 0; i < kWaiters; ++i) {
+        iom.schedule([]() {
+            pico::FiberMutex::Lock lock(s_mutex);
+            ++s_waiting;
+            CHECK(s_cond.waitFor(lock, 3000));
+            ++s_woken;
+        });
+    }
+    CHECK(wait_until([]() { return s_waiting == kWaiters; }));
+    // 等待者在释放FiberMutex之前已经入队
+    iom.schedule([]() {
+        pico::FiberMutex::Lock lock(s_mutex);
+        s_cond.notifyOne();
+    });
+    CHECK(wait_until([]() { return s_woken >= 1; }));
+    usleep(100 * 1000);
+    CHECK(s_woken == 1);
+
+    iom.schedule([]() {
+        pico::FiberMutex::Lock lock(s_mutex);
+        s_cond.notifyAll();
+    });
+    CHECK(wait_until([]() { return s_woken == kWaiters; }));
+
+    iom.schedule([]() {
+        pico::FiberMutex::Lock lock(s_mutex);
+        s_pred_rt = s_cond.waitFor(lock, 1000, []() { return s_ready > 0; });
+    });
+    iom.schedule([]() {
+        usleep(50 * 1000);
+        pico::FiberMutex::Lock lock(s_mutex);
+        ++s_ready;
+        s_cond.notifyAll();
+    });
+    CHECK(wait_until([]() { return s_pred_rt != -1; }));
+    CHECK(s_pred_rt == 1);
+
+    // 没有人通知时在超时后返回false
+    s_pred_rt = -1;
+    uint64_t start = pico::getCurrentTime();
+    iom.schedule([]() {
+        pico::FiberMutex::Lock lock(s_mutex);
+        s_pred_rt = s_cond.waitFor(lock, 100, []() { return s_ready > 1; });
+    });
+    CHECK(wait_until([]() { return s_pred_rt != -1; }));
+    CHECK(s_pred_rt == 0);
+    CHECK(pico::getCurrentTime() - start >= 100);
+    iom.stop();
+}
+
+/**
+ * 计数限制同时持有的协程数, 计数为0时wait挂起直到notify
+ */
+void test_semaphore() {
+    static pico::FiberSemaphore s_limit(2);
+    static pico::FiberSemaphore s_signal;
+    static std::atomic<int> s_holders = {0};
+    static std::atomic<int> s_max_holders = {0};
+    static std::atomic<int> s_done = {0};
+    static std::atomic<bool> s_signaled = {false};
+    static std::atomic<int> s_timeout_rt = {-1};
+
+    pico::IOManager iom(3, false, "sem");
+    const int kFibers = 6;
+    for (int i = 0; i < kFibers; ++i) {
+        iom.schedule([]() {
+            s_limit.wait();
+            int holders = ++s_holders;
+            int max = s_max_holders;
+            while (holders > max && !s_max_holders.compare_exchange_weak(max, holders)) {}
+            usleep(10 * 1000);
+            --s_holders;
+            s_limit.notify();
+            ++s_done;
+        });
+    }
+    CHECK(wait_until([]() { return s_done == kFibers; }));
+    CHECK(s_max_holders == 2);
+
+    iom.schedule([]() {
+        s_signal.wait();
+        s_signaled = true;
+    });
+    usleep(50 * 1000);
+    CHECK(!s_signaled);
+    iom.schedule([]() { s_signal.notify(); });
+    CHECK(wait_until([]() { return s_signaled.load(); }));
+
+    iom.schedule([]() {
+        pico::FiberSemaphore sem;
+        s_timeout_rt = sem.waitFor(100);
+    });
+    CHECK(wait_until([]() { return s_timeout_rt != -1; }));
+    CHECK(s_timeout_rt == 0);
+    CHECK(!s_signal.tryWait());
+    iom.stop();
+}
+
+/**
+ * 不在任务协程中时退化为阻塞线程
+ */
+void test_blocking_fallback() {
+    pico::FiberSemaphore sem;
+    std::thread notifier([&sem]() {
+        usleep(50 * 1000);
+        sem.notify();
+    });
+    uint64_t start = pico::getCurrentTime();
+    CHECK(sem.waitFor(1000));
+    CHECK(pico::getCurrentTime() - start >= 40);
+    notifier.join();
+    CHECK(!sem.waitFor(50));
+
+    pico::FiberMutex mutex;
+    pico::FiberCondition cond;
+    int count = 0;
+    bool ready = false;
+    std::vector<std::thread> thrs;
+    for (int i = 0; i < 4; ++i) {
+        thrs.emplace_back([&]() {
+            for (int j = 0; j < 1000; ++j) {
+                pico::FiberMutex::Lock lock(mutex);
+                ++count;
+            }
+        });
+    }
+    for (auto& thr : thrs) { thr.join(); }
+    CHECK(count == 4000);
+
+    std::thread waiter([&]() {
+        pico::FiberMutex::Lock lock(mutex);
+        CHECK(cond.waitFor(lock, 1000, [&ready]() { return ready; }));
+    });
+    usleep(50 * 1000);
+    {
+        pico::FiberMutex::Lock lock(mutex);
+        ready = true;
+        cond.notifyOne();
+    }
+    waiter.join();
+
+    pico::FiberMutex::Lock lock(mutex);
+    CHECK(!cond.waitFor(lock, 50));
+}
+
+int main(int argc, char const* argv[]) {
+    test_mutex();
+    test_condition();
+    test_semaphore();
+    test_blocking_fallback();
+    return TEST_RESULT("test_fiber_sync");
+}
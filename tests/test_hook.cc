@@ -1,14 +1,64 @@
+#include "pico/config.h"
+#include "pico/fdmanager.h"
 #include "pico/hook.h"
 #include "pico/iomanager.h"
 #include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
 #include <arpa/inet.h>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <poll.h>
 #include <string.h>
 #include <string>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <thread>
+#include <time.h>
 #include <unistd.h>
 
+/**
+ * 在同一线程上每10ms计数一次的协程, 另一个协程挂起而不是阻塞线程时计数才会增加
+ */
+class Ticker
+{
+public:
+    Ticker()
+        : m_ticks(new std::atomic<int>(0))
+        , m_running(new std::atomic<bool>(true)) {
+        std::shared_ptr<std::atomic<int>> ticks = m_ticks;
+        std::shared_ptr<std::atomic<bool>> running = m_running;
+        pico::IOManager::GetThis()->schedule([ticks, running]() {
+            while (*running) {
+                ++*ticks;
+                usleep(10 * 1000);
+            }
+        });
+    }
+
+    ~Ticker() { *m_running = false; }
+
+    int stop() {
+        *m_running = false;
+        return *m_ticks;
+    }
+
+private:
+    std::shared_ptr<std::atomic<int>> m_ticks;
+    std::shared_ptr<std::atomic<bool>> m_running;
+};
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 void test_sleep() {
     pico::IOManager iom(1);
     iom.schedule([]() {
@@ -24,6 +74,375 @@ void test_sleep() {
     LOG_INFO("test sleep");
 }
 
+void test_poll() {
+    int fds[2];
+    if (pipe(fds)) {
+        LOG_ERROR("pipe errno=%d, %s", errno, strerror(errno));
+        return;
+    }
+    pico::IOManager::GetThis()->schedule([fds]() {
+        usleep(100 * 1000);
+        write(fds[1], "x", 1);
+    });
+
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    int rt = poll(&pfd, 1, 1000);
+    LOG_INFO("poll rt=%d, revents=%d", rt, pfd.revents);
+    CHECK(rt == 1 && (pfd.revents & POLLIN));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * 一个协程阻塞在recv上时另一个协程poll同一fd, 读方向的等待位已被占用,
+ * poll定时挂起协程重新检查, 不阻塞线程, 同一线程上的其他协程照常执行
+ */
+void test_poll_shared_fd() {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+        LOG_ERROR("socketpair errno=%d, %s", errno, strerror(errno));
+        return;
+    }
+    // socketpair没有被hook, 登记后hook的recv才会挂起协程
+    pico::FdMgr::getInstance()->getFdCtx(sv[0], true);
+    pico::FdMgr::getInstance()->getFdCtx(sv[1], true);
+    pico::IOManager::GetThis()->schedule([sv]() {
+        char c = 0;
+        int rt = recv(sv[0], &c, 1, 0);
+        LOG_INFO("recv rt=%d, c=%c", rt, c);
+        CHECK(rt == 1);
+    });
+    // 等待recv协程挂起
+    usleep(50 * 1000);
+
+    std::shared_ptr<std::atomic<int>> ticks(new std::atomic<int>(0));
+    std::shared_ptr<std::atomic<bool>> polling(new std::atomic<bool>(true));
+    pico::IOManager::GetThis()->schedule([ticks, polling]() {
+        while (*polling) {
+            ++*ticks;
+            usleep(10 * 1000);
+        }
+    });
+
+    // 写入两个字节, recv取走一个后poll仍然可读
+    std::thread writer([sv]() {
+        usleep_f(100 * 1000);
+        write_f(sv[1], "xy", 2);
+    });
+    struct pollfd pfd = {sv[0], POLLIN, 0};
+    int rt = poll(&pfd, 1, 1000);
+    *polling = false;
+    LOG_INFO("shared fd poll rt=%d, revents=%d, ticks=%d", rt, pfd.revents, ticks->load());
+    CHECK(rt == 1 && (pfd.revents & POLLIN));
+    CHECK(*ticks >= 3);
+    writer.join();
+
+    // 一直没有数据时在超时后返回
+    char c = 0;
+    CHECK(recv(sv[0], &c, 1, 0) == 1 && c == 'y');
+    pico::IOManager::GetThis()->schedule([sv]() {
+        char c = 0;
+        recv(sv[0], &c, 1, 0);
+    });
+    usleep(10 * 1000);
+    uint64_t start = pico::getCurrentTime();
+    rt = poll(&pfd, 1, 200);
+    uint64_t elapsed = pico::getCurrentTime() - start;
+    CHECK(rt == 0);
+    CHECK(elapsed >= 200 && elapsed < 400);
+    shutdown(sv[0], SHUT_RDWR);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/**
+ * select按就绪情况改写fd_set并写回剩余时间, 无效fd返回EBADF, 没有fd时只睡眠
+ */
+void test_select() {
+    int fds[2];
+    int idle[2];
+    if (pipe(fds) || pipe(idle)) {
+        LOG_ERROR("pipe errno=%d, %s", errno, strerror(errno));
+        return;
+    }
+    pico::IOManager::GetThis()->schedule([fds]() {
+        usleep(100 * 1000);
+        write(fds[1], "x", 1);
+    });
+    Ticker ticker;
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(fds[0], &rfds);
+    FD_SET(idle[0], &rfds);
+    struct timeval tv = {1, 0};
+    int rt = select(std::max(fds[0], idle[0]) + 1, &rfds, nullptr, nullptr, &tv);
+    CHECK(ticker.stop() >= 5);
+    CHECK(rt == 1);
+    CHECK(FD_ISSET(fds[0], &rfds));
+    CHECK(!FD_ISSET(idle[0], &rfds));
+    uint64_t left = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    CHECK(left > 500 && left < 1000);
+
+    // 超时后返回0, 集合被清空
+    FD_ZERO(&rfds);
+    FD_SET(idle[0], &rfds);
+    tv.tv_sec = 0;
+    tv.tv_usec = 50 * 1000;
+    CHECK(select(idle[0] + 1, &rfds, nullptr, nullptr, &tv) == 0);
+    CHECK(!FD_ISSET(idle[0], &rfds));
+    CHECK(tv.tv_sec == 0 && tv.tv_usec == 0);
+
+    int closed = idle[1];
+    close(idle[1]);
+    FD_ZERO(&rfds);
+    FD_SET(closed, &rfds);
+    tv.tv_sec = 0;
+    tv.tv_usec = 100 * 1000;
+    CHECK(select(closed + 1, &rfds, nullptr, nullptr, &tv) == -1 && errno == EBADF);
+
+    Ticker sleep_ticker;
+    tv.tv_sec = 0;
+    tv.tv_usec = 100 * 1000;
+    uint64_t start = pico::getCurrentTime();
+    CHECK(select(0, nullptr, nullptr, nullptr, &tv) == 0);
+    CHECK(pico::getCurrentTime() - start >= 100);
+    CHECK(sleep_ticker.stop() >= 5);
+
+    close(fds[0]);
+    close(fds[1]);
+    close(idle[0]);
+}
+
+/**
+ * epoll_wait通过等待epoll fd可读挂起协程
+ */
+void test_epoll_wait() {
+    int fds[2];
+    if (pipe(fds)) {
+        LOG_ERROR("pipe errno=%d, %s", errno, strerror(errno));
+        return;
+    }
+    int epfd = epoll_create1(0);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fds[0];
+    CHECK(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev) == 0);
+
+    pico::IOManager::GetThis()->schedule([fds]() {
+        usleep(100 * 1000);
+        write(fds[1], "x", 1);
+    });
+    Ticker ticker;
+    struct epoll_event events[4];
+    int rt = epoll_wait(epfd, events, 4, 1000);
+    CHECK(ticker.stop() >= 5);
+    CHECK(rt == 1 && events[0].data.fd == fds[0] && (events[0].events & EPOLLIN));
+
+    char c = 0;
+    CHECK(read(fds[0], &c, 1) == 1);
+    uint64_t start = pico::getCurrentTime();
+    CHECK(epoll_wait(epfd, events, 4, 100) == 0);
+    uint64_t elapsed = pico::getCurrentTime() - start;
+    CHECK(elapsed >= 100 && elapsed < 400);
+
+    close(epfd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * usleep/nanosleep挂起协程, 不足1毫秒的部分向上取整, 非法的timespec返回EINVAL
+ */
+void test_sleep_hooks() {
+    Ticker ticker;
+    uint64_t start = now_us();
+    CHECK(usleep(100 * 1000) == 0);
+    // 到期时间从截断到毫秒的当前时间算起, 最多提前1ms
+    CHECK(now_us() - start >= 99 * 1000);
+    CHECK(ticker.stop() >= 5);
+
+    // 定时器精度为毫秒, 向下取整时1.5ms的睡眠最多持续1ms
+    for (int i = 0; i < 5; ++i) {
+        start = now_us();
+        usleep(1500);
+        CHECK(now_us() - start > 1000);
+
+        struct timespec req = {0, 1500 * 1000};
+        struct timespec rem = {1, 1};
+        start = now_us();
+        CHECK(nanosleep(&req, &rem) == 0);
+        CHECK(now_us() - start > 1000);
+        CHECK(rem.tv_sec == 0 && rem.tv_nsec == 0);
+    }
+
+    Ticker nano_ticker;
+    struct timespec req = {0, 100 * 1000 * 1000};
+    CHECK(nanosleep(&req, nullptr) == 0);
+    CHECK(nano_ticker.stop() >= 5);
+
+    struct timespec bad = {0, 1000 * 1000 * 1000};
+    CHECK(nanosleep(&bad, nullptr) == -1 && errno == EINVAL);
+    bad.tv_sec = -1;
+    bad.tv_nsec = 0;
+    CHECK(nanosleep(&bad, nullptr) == -1 && errno == EINVAL);
+}
+
+/**
+ * recvmmsg在没有数据时挂起, sendmmsg在对端缓冲区满时挂起
+ */
+void test_mmsg() {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv)) {
+        LOG_ERROR("socketpair errno=%d, %s", errno, strerror(errno));
+        return;
+    }
+    pico::FdMgr::getInstance()->getFdCtx(sv[0], true);
+    pico::FdMgr::getInstance()->getFdCtx(sv[1], true);
+
+    pico::IOManager::GetThis()->schedule([sv]() {
+        usleep(100 * 1000);
+        char a[] = "one";
+        char b[] = "two";
+        struct iovec iov[2] = {{a, 3}, {b, 3}};
+        struct mmsghdr msgs[2];
+        memset(msgs, 0, sizeof(msgs));
+        msgs[0].msg_hdr.msg_iov = &iov[0];
+        msgs[0].msg_hdr.msg_iovlen = 1;
+        msgs[1].msg_hdr.msg_iov = &iov[1];
+        msgs[1].msg_hdr.msg_iovlen = 1;
+        CHECK(sendmmsg(sv[1], msgs, 2, 0) == 2);
+    });
+    Ticker ticker;
+    char bufs[2][8];
+    memset(bufs, 0, sizeof(bufs));
+    struct iovec iov[2] = {{bufs[0], sizeof(bufs[0])}, {bufs[1], sizeof(bufs[1])}};
+    struct mmsghdr msgs[2];
+    memset(msgs, 0, sizeof(msgs));
+    msgs[0].msg_hdr.msg_iov = &iov[0];
+    msgs[0].msg_hdr.msg_iovlen = 1;
+    msgs[1].msg_hdr.msg_iov = &iov[1];
+    msgs[1].msg_hdr.msg_iovlen = 1;
+    int rt = recvmmsg(sv[0], msgs, 2, 0, nullptr);
+    CHECK(ticker.stop() >= 5);
+    CHECK(rt >= 1 && msgs[0].msg_len == 3 && memcmp(bufs[0], "one", 3) == 0);
+    if (rt == 1) { CHECK(recv(sv[0], bufs[1], sizeof(bufs[1]), 0) == 3); }
+    CHECK(memcmp(bufs[1], "two", 3) == 0);
+
+    // 绕过hook填满对端的接收队列, sendmmsg挂起到对端读走数据
+    char payload[1024];
+    memset(payload, 'p', sizeof(payload));
+    while (send_f(sv[1], payload, sizeof(payload), MSG_DONTWAIT) > 0) {}
+    CHECK(errno == EAGAIN);
+    std::shared_ptr<std::atomic<int>> drained(new std::atomic<int>(0));
+    pico::IOManager::GetThis()->schedule([sv, drained]() {
+        usleep(100 * 1000);
+        char buf[1024];
+        while (recv_f(sv[0], buf, sizeof(buf), MSG_DONTWAIT) > 0) { ++*drained; }
+    });
+    Ticker send_ticker;
+    struct iovec piov = {payload, sizeof(payload)};
+    struct mmsghdr pmsg;
+    memset(&pmsg, 0, sizeof(pmsg));
+    pmsg.msg_hdr.msg_iov = &piov;
+    pmsg.msg_hdr.msg_iovlen = 1;
+    CHECK(sendmmsg(sv[1], &pmsg, 1, 0) == 1);
+    CHECK(send_ticker.stop() >= 5);
+    CHECK(*drained > 0);
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/**
+ * pread/pwrite按偏移读写; io_uring后端下挂起协程, 同一线程上的其他协程在请求完成前执行
+ */
+void test_file_io() {
+    char path[] = "/tmp/pico_test_hook_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        LOG_ERROR("mkstemp errno=%d, %s", errno, strerror(errno));
+        return;
+    }
+    unlink(path);
+    std::shared_ptr<std::atomic<bool>> other_ran(new std::atomic<bool>(false));
+    pico::IOManager::GetThis()->schedule([other_ran]() { *other_ran = true; });
+    CHECK(pwrite(fd, "hello", 5, 0) == 5);
+    bool parked = *other_ran;
+    CHECK(pwrite(fd, "world", 5, 4096) == 5);
+    char buf[5] = {0};
+    CHECK(pread(fd, buf, 5, 4096) == 5 && memcmp(buf, "world", 5) == 0);
+    CHECK(pread(fd, buf, 5, 0) == 5 && memcmp(buf, "hello", 5) == 0);
+    CHECK(pread(fd, buf, 5, 8192) == 0);
+    if (pico::IOManager::GetThis()->isUring()) { CHECK(parked); }
+    close(fd);
+}
+
+/**
+ * 常驻注册模式下fd绕过hook的close关闭后被复用, 新socket上的等待仍能被唤醒
+ */
+void test_register_once_reuse() {
+    for (int i = 0; i < 2; ++i) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) {
+            LOG_ERROR("socketpair errno=%d, %s", errno, strerror(errno));
+            return;
+        }
+        // 与hook的socket相同, 重建fd的记录
+        pico::FdMgr::getInstance()->addSocket(sv[0], false);
+        pico::FdMgr::getInstance()->addSocket(sv[1], false);
+        struct timeval tv = {1, 0};
+        setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        std::thread writer([sv]() {
+            usleep(50 * 1000);
+            write_f(sv[1], "x", 1);
+        });
+        char c = 0;
+        int rt = recv(sv[0], &c, 1, 0);
+        LOG_INFO("register_once round %d fd=%d recv rt=%d, c=%c", i, sv[0], rt, c);
+        CHECK(rt == 1 && c == 'x');
+        writer.join();
+        // 绕过hook关闭, 内核已把fd移出epoll, IOManager中仍记录为已注册
+        close_f(sv[0]);
+        close_f(sv[1]);
+    }
+}
+
+/**
+ * 未启用hook时accept4得到的fd沿用了之前绕过hook关闭的fd号, 不复用残留的FdCtx
+ */
+void test_accept4_unhooked_reuse() {
+    int listener = socket_f(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    CHECK(!bind(listener, (sockaddr*)&addr, sizeof(addr)));
+    CHECK(!listen(listener, 4));
+    CHECK(!getsockname(listener, (sockaddr*)&addr, &len));
+    int client = socket_f(AF_INET, SOCK_STREAM, 0);
+    CHECK(!connect_f(client, (sockaddr*)&addr, sizeof(addr)));
+
+    // 残留的记录带有超时和用户非阻塞标记
+    int stale = socket_f(AF_INET, SOCK_STREAM, 0);
+    pico::FdCtx::Ptr old_ctx = pico::FdMgr::getInstance()->getFdCtx(stale, true);
+    old_ctx->setTimeout(SO_RCVTIMEO, 1234);
+    old_ctx->setUserNonBlock(true);
+    close_f(stale);
+
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    CHECK(fd == stale);
+    pico::FdCtx::Ptr ctx = pico::FdMgr::getInstance()->getFdCtx(fd);
+    CHECK(ctx && ctx != old_ctx);
+    CHECK(ctx && ctx->getTimeout(SO_RCVTIMEO) == (uint64_t)-1);
+    CHECK(ctx && !ctx->isUserNonBlock() && ctx->isSocket());
+    close(fd);
+    close_f(client);
+    close_f(listener);
+}
+
 void test_socket() {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
@@ -71,7 +490,31 @@ void test_socket() {
 
 int main(int argc, char const* argv[]) {
     // test_sleep();
-    pico::IOManager iom(1, true, "iom");
-    iom.schedule(test_socket);
-    return 0;
+    test_accept4_unhooked_reuse();
+    {
+        pico::IOManager iom(1, true, "iom");
+        iom.schedule(test_poll);
+        iom.schedule(test_poll_shared_fd);
+        iom.schedule(test_select);
+        iom.schedule(test_epoll_wait);
+        iom.schedule(test_sleep_hooks);
+        iom.schedule(test_mmsg);
+        iom.schedule(test_file_io);
+        iom.schedule(test_socket);
+    }
+
+    // 单线程的io_uring后端, 内核不支持时退回epoll, 只检查读写结果
+    pico::Config::Lookup<std::string>("iomanager.backend", "epoll")->setValue("io_uring");
+    {
+        pico::IOManager iom(1, false, "file");
+        iom.schedule(test_file_io);
+        iom.stop();
+    }
+    pico::Config::Lookup<std::string>("iomanager.backend", "epoll")->setValue("epoll");
+
+    pico::Config::Lookup<bool>("iomanager.register_once", false)->setValue(true);
+    pico::IOManager iom(1, false, "once");
+    iom.schedule(test_register_once_reuse);
+    iom.stop();
+    return TEST_RESULT("test_hook");
 }
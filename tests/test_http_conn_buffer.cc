@@ -0,0 +1,159 @@
+#include "pico/http/http_connection.h"
+#include "pico/http/http_parser.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+static const int kPort = 18177;
+static const size_t kPad = 6000;
+static const size_t kBigPad = 100 * 1024;
+
+static std::atomic<int> s_step = {0};
+static std::atomic<bool> s_listening = {false};
+static std::atomic<bool> s_done = {false};
+
+/**
+ * 在普通线程中等待条件成立, 超时返回false
+ */
+static bool wait_until(std::function<bool()> pred, uint64_t timeout_ms = 5000) {
+    uint64_t deadline = pico::getCurrentTime() + timeout_ms;
+    while (!pred()) {
+        if (pico::getCurrentTime() >= deadline) { return false; }
+        usleep(5 * 1000);
+    }
+    return true;
+}
+
+static int connect_client() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (n <= 0) { return false; }
+        sent += n;
+    }
+    return true;
+}
+
+static std::string pad_request(const std::string& path, size_t pad) {
+    return "GET " + path + " HTTP/1.1\r\nX-Pad: " + std::string(pad, 'x') + "\r\n\r\n";
+}
+
+/**
+ * 服务端协程: 依次读取客户端的各个请求, 每完成一步推进s_step
+ */
+static void serve() {
+    pico::Socket::Ptr listener = pico::Socket::CreateTcpSocket();
+    CHECK(listener->bind(pico::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(kPort))));
+    CHECK(listener->listen());
+    s_listening = true;
+
+    {
+        pico::Socket::Ptr sock = listener->accept();
+        CHECK(sock != nullptr);
+        if (!sock) { return; }
+        pico::HttpConnection conn(sock);
+
+        // 请求头分两次到达, 缓冲区扩大到初始大小以上
+        pico::HttpRequest::Ptr a = conn.recvRequest();
+        CHECK(a && a->get_path() == "/a" && a->get_header("X-Pad").size() == kPad);
+        CHECK(conn.getBufferSize() > 4 * 1024);
+
+        // 同一连接上的下一个请求从重置后的解析器开始, 不带上一个请求的字段
+        pico::HttpRequest::Ptr b = conn.recvRequest();
+        CHECK(b && b->get_method() == pico::HttpMethod::POST && b->get_path() == "/b");
+        CHECK(b && b->get_body() == "hello" && b->get_header("X-Pad").empty());
+        CHECK(a && a->get_path() == "/a");
+        // 不超过空闲上限的缓冲区留给后续请求
+        size_t kept = conn.getBufferSize();
+        CHECK(kept > 4 * 1024 && kept <= 64 * 1024);
+        s_step = 1;
+
+        // 超过空闲上限的请求处理完后释放缓冲区, 之后按初始大小重新分配
+        pico::HttpRequest::Ptr big = conn.recvRequest();
+        CHECK(big && big->get_header("X-Pad").size() == kBigPad);
+        CHECK(conn.getBufferSize() == 0);
+        s_step = 2;
+        pico::HttpRequest::Ptr c = conn.recvRequest();
+        CHECK(c && c->get_path() == "/c");
+        CHECK(conn.getBufferSize() == 4 * 1024);
+        s_step = 3;
+
+        // 请求头达到上限仍未结束
+        CHECK(conn.recvRequest() == nullptr);
+        s_step = 4;
+    }
+
+    {
+        // 请求体没有读完连接就关闭
+        pico::Socket::Ptr sock = listener->accept();
+        CHECK(sock != nullptr);
+        if (!sock) { return; }
+        pico::HttpConnection conn(sock);
+        CHECK(conn.recvRequest() == nullptr);
+    }
+    s_done = true;
+}
+
+int main(int argc, char const* argv[]) {
+    pico::IOManager iom(1, false, "conn");
+    iom.schedule(&serve);
+    CHECK(wait_until([]() { return s_listening.load(); }));
+
+    int fd = connect_client();
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        std::string a = pad_request("/a", kPad);
+        CHECK(send_all(fd, a.substr(0, a.size() / 2)));
+        usleep(50 * 1000);
+        CHECK(send_all(fd, a.substr(a.size() / 2)));
+        CHECK(send_all(fd, "POST /b HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"));
+        CHECK(wait_until([]() { return s_step == 1; }));
+
+        CHECK(send_all(fd, pad_request("/big", kBigPad)));
+        CHECK(wait_until([]() { return s_step == 2; }));
+        CHECK(send_all(fd, "GET /c HTTP/1.1\r\n\r\n"));
+        CHECK(wait_until([]() { return s_step == 3; }));
+
+        std::string huge = "GET /huge HTTP/1.1\r\nX-Pad: ";
+        huge.resize(pico::HttpRequestParser::getHttpRequestBufferSize(), 'x');
+        CHECK(send_all(fd, huge));
+        CHECK(wait_until([]() { return s_step == 4; }));
+        close(fd);
+    }
+
+    fd = connect_client();
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        CHECK(send_all(fd, "POST /t HTTP/1.1\r\nContent-Length: 10\r\n\r\nabc"));
+        shutdown(fd, SHUT_WR);
+        CHECK(wait_until([]() { return s_done.load(); }));
+        close(fd);
+    }
+    iom.stop();
+    return TEST_RESULT("test_http_conn_buffer");
+}
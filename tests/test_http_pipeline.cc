@@ -0,0 +1,314 @@
+#include "pico/config.h"
+#include "pico/http/http_server.h"
+#include "pico/http/servlet.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const int kPort = 18172;
+static const int kSharedStackPort = 18175;
+
+static std::atomic<int> s_rst_started = {0};
+static std::atomic<int> s_after_rst = {0};
+
+class EchoServlet : public pico::Servlet
+{
+public:
+    void doGet(const pico::request& req, pico::response& res) override {
+        if (req->get_path() == "/slow") { usleep(100 * 1000); }
+        if (req->get_path() == "/rst") {
+            ++s_rst_started;
+            usleep(200 * 1000);
+        }
+        if (req->get_path() == "/after") { ++s_after_rst; }
+        if (req->get_path() == "/throw") { throw std::runtime_error("handler error"); }
+        res->set_body("get:" + req->get_path());
+    }
+    void doPost(const pico::request& req, pico::response& res) override {
+        res->set_body("post:" + req->get_body());
+    }
+};
+
+/**
+ * 在普通线程中按顺序写出各段数据, 每段之间间隔50ms, 然后读到连接关闭或超时
+ */
+static std::string exchange(const std::vector<std::string>& parts, int port = kPort) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    struct timeval tv = {3, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::string resp;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (i) { usleep(50 * 1000); }
+            send(fd, parts[i].data(), parts[i].size(), 0);
+        }
+        char buf[4096];
+        int n = 0;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) { resp.append(buf, n); }
+    }
+    close(fd);
+    return resp;
+}
+
+static size_t count(const std::string& str, const std::string& sub) {
+    size_t n = 0;
+    for (size_t pos = str.find(sub); pos != std::string::npos; pos = str.find(sub, pos + 1)) { ++n; }
+    return n;
+}
+
+/**
+ * 流水线请求的响应按请求顺序返回, 读多的请求体和后续请求留给下一个请求
+ */
+void test_pipeline(pico::HttpServer::Ptr server) {
+    std::vector<std::string> parts;
+    parts.push_back("GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n"
+                    "POST /p HTTP/1.1\r\nContent-Length: 10\r\n\r\nhel");
+    parts.push_back("loworldGET /c HTTP/1.1\r\nConnection: close\r\n\r\n");
+    std::string resp = exchange(parts);
+    CHECK(count(resp, "HTTP/1.1 200 OK") == 4);
+    size_t a = resp.find("get:/a");
+    size_t b = resp.find("get:/b");
+    size_t p = resp.find("post:helloworld");
+    size_t c = resp.find("get:/c");
+    CHECK(a != std::string::npos && b != std::string::npos && p != std::string::npos &&
+          c != std::string::npos);
+    CHECK(a < b && b < p && p < c);
+
+    // 一次写出大量请求, 超过缓冲区初始大小, 读取时最后一个请求可能只到达了一部分
+    const int n = 300;
+    std::string batch;
+    for (int i = 0; i < n; ++i) { batch += "GET /n" + std::to_string(i) + " HTTP/1.1\r\n\r\n"; }
+    batch += "GET /last HTTP/1.1\r\nConnection: close\r\n\r\n";
+    resp = exchange(std::vector<std::string>(1, batch));
+    CHECK(count(resp, "HTTP/1.1 200 OK") == n + 1);
+    size_t last = 0;
+    bool ordered = true;
+    for (int i = 0; i < n; ++i) {
+        // 前缀相同的路径排在后面, 从上一个位置向后查找总是先找到当前请求
+        size_t pos = resp.find("get:/n" + std::to_string(i), last);
+        if (pos == std::string::npos) {
+            ordered = false;
+            break;
+        }
+        last = pos;
+    }
+    CHECK(ordered && resp.find("get:/last", last) != std::string::npos);
+
+    // 请求头逐字节到达, 行尾只有\n
+    std::string req = "GET /lf HTTP/1.1\nConnection: close\n\n";
+    parts.clear();
+    for (char ch : req) { parts.push_back(std::string(1, ch)); }
+    resp = exchange(parts);
+    CHECK(resp.find("get:/lf") != std::string::npos);
+}
+
+/**
+ * 流水线中后面的请求格式错误时, 之前的请求仍然得到响应, 然后关闭连接
+ */
+void test_malformed(pico::HttpServer::Ptr server) {
+    std::vector<std::string> parts;
+    parts.push_back("GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\nBOGUS\r\n\r\n");
+    uint64_t start = pico::getCurrentTime();
+    std::string resp = exchange(parts);
+    CHECK(pico::getCurrentTime() - start < 2000);
+    CHECK(count(resp, "HTTP/1.1 200 OK") == 2);
+    size_t a = resp.find("get:/a");
+    size_t b = resp.find("get:/b");
+    CHECK(a != std::string::npos && b != std::string::npos && a < b);
+
+    // 第一个请求就出错时只返回400
+    parts.clear();
+    parts.push_back("BOGUS\r\n\r\nGET /a HTTP/1.1\r\n\r\n");
+    resp = exchange(parts);
+    CHECK(resp.compare(0, 12, "HTTP/1.1 400") == 0);
+    CHECK(resp.find("get:/a") == std::string::npos);
+}
+
+/**
+ * 请求体的边界不明确时返回错误并关闭连接, 请求体中的数据不会被当作流水线请求处理
+ */
+void test_ambiguous_body(pico::HttpServer::Ptr server) {
+    const std::string smuggled = "GET /smuggled HTTP/1.1\r\n\r\n";
+    struct Case
+    {
+        std::string request;
+        const char* status;
+    } cases[] = {
+        {"POST /p HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+         "1a\r\n" + smuggled + "\r\n0\r\n\r\n",
+         "HTTP/1.1 501"},
+        {"POST /p HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"
+         "0\r\n\r\n" + smuggled,
+         "HTTP/1.1 501"},
+        {"POST /p HTTP/1.1\r\nContent-Length: 3\r\ncontent-length: 30\r\n\r\nabc" + smuggled,
+         "HTTP/1.1 400"},
+        {"POST /p HTTP/1.1\r\nContent-Length: 3abc\r\n\r\nabc" + smuggled, "HTTP/1.1 400"},
+    };
+    for (auto& c : cases) {
+        std::vector<std::string> parts(1, "GET /a HTTP/1.1\r\n\r\n" + c.request);
+        std::string resp = exchange(parts);
+        CHECK(resp.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+        CHECK(resp.find(c.status) != std::string::npos);
+        CHECK(resp.find("get:/smuggled") == std::string::npos);
+    }
+
+    // 相同的Content-Length重复出现时仍然正常处理
+    std::vector<std::string> parts(
+        1, "POST /p HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n"
+           "Connection: close\r\n\r\nabc");
+    CHECK(exchange(parts).find("post:abc") != std::string::npos);
+
+    // 超过上限的请求体不分配内存, 直接返回413
+    auto max_body = pico::Config::Lookup<uint64_t>("http.request.max_body_size", 0);
+    uint64_t old_max = max_body->getValue();
+    max_body->setValue(16);
+    parts[0] = "POST /p HTTP/1.1\r\nContent-Length: 17\r\n\r\n01234567890123456";
+    CHECK(exchange(parts).compare(0, 12, "HTTP/1.1 413") == 0);
+    max_body->setValue(old_max);
+
+    // 超过数量上限的请求头不再保存, 其后的Content-Length不能被忽略后把请求体当作下一个请求
+    std::string many = "POST /p HTTP/1.1\r\n";
+    for (int i = 0; i < 200; ++i) { many += "X" + std::to_string(i) + ":y\r\n"; }
+    parts[0] = "GET /a HTTP/1.1\r\n\r\n" + many + "Content-Length: " +
+               std::to_string(smuggled.size()) + "\r\n\r\n" + smuggled;
+    std::string resp = exchange(parts);
+    CHECK(resp.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    CHECK(resp.find("HTTP/1.1 431") != std::string::npos);
+    CHECK(resp.find("get:/smuggled") == std::string::npos);
+}
+
+/**
+ * 响应写出失败后不再处理缓冲区中剩下的请求
+ */
+void test_write_failure(pico::HttpServer::Ptr server) {
+    // 每个请求单独成批, 第二个请求只会在第一个响应写出之后处理
+    auto depth = pico::Config::Lookup<uint32_t>("http.pipeline.depth", 16);
+    depth->setValue(1);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+    std::string data = "GET /rst HTTP/1.1\r\n\r\nGET /after HTTP/1.1\r\n\r\n";
+    send(fd, data.data(), data.size(), 0);
+    for (int i = 0; i < 200 && !s_rst_started; ++i) { usleep(10 * 1000); }
+    CHECK(s_rst_started == 1);
+    // 处理第一个请求时以RST关闭, 两个请求都已经读入服务器的缓冲区
+    struct linger lg = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close(fd);
+    usleep(500 * 1000);
+    CHECK(s_after_rst == 0);
+    depth->setValue(16);
+}
+
+/**
+ * 并发处理流水线请求时, 其中一个请求抛出异常, 连接应当关闭而不是一直等待
+ */
+void test_parallel_exception(pico::HttpServer::Ptr server) {
+    pico::Config::Lookup<bool>("http.pipeline.parallel", false)->setValue(true);
+    std::vector<std::string> parts;
+    parts.push_back("GET /slow HTTP/1.1\r\n\r\nGET /throw HTTP/1.1\r\n\r\nGET /c HTTP/1.1\r\n\r\n");
+    uint64_t start = pico::getCurrentTime();
+    std::string resp = exchange(parts);
+    uint64_t elapsed = pico::getCurrentTime() - start;
+    CHECK(elapsed < 2000);
+    usleep(100 * 1000);
+    CHECK(server->getInflightRequests() == 0);
+
+    // 没有异常时并发处理的响应仍然按请求顺序返回
+    parts.clear();
+    parts.push_back("GET /slow HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n"
+                    "GET /c HTTP/1.1\r\nConnection: close\r\n\r\n");
+    resp = exchange(parts);
+    size_t a = resp.find("get:/slow");
+    size_t b = resp.find("get:/b");
+    size_t c = resp.find("get:/c");
+    CHECK(a != std::string::npos && a < b && b < c && c != std::string::npos);
+    pico::Config::Lookup<bool>("http.pipeline.parallel", false)->setValue(false);
+}
+
+/**
+ * 连接协程运行在共享栈上, 在两个请求之间挂起后继续处理保持连接和流水线请求
+ */
+void test_shared_stack(pico::IOManager* iom) {
+    pico::HttpServer::Ptr server(new pico::HttpServer(true, iom, iom));
+    server->setSharedStack(true);
+    server->getRequestHandler()->addRoute("/*", std::make_shared<EchoServlet>());
+    iom->schedule([server]() {
+        pico::Address::Ptr addr =
+            pico::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(kSharedStackPort));
+        CHECK(server->bind(addr));
+        server->start();
+    });
+    usleep(100 * 1000);
+
+    std::vector<std::string> parts;
+    parts.push_back("GET /a HTTP/1.1\r\n\r\n");
+    parts.push_back("POST /p HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello");
+    parts.push_back("GET /b HTTP/1.1\r\nConnection: close\r\n\r\n");
+    std::string resp = exchange(parts, kSharedStackPort);
+    CHECK(count(resp, "HTTP/1.1 200 OK") == 3);
+    size_t a = resp.find("get:/a");
+    size_t p = resp.find("post:hello");
+    size_t b = resp.find("get:/b");
+    CHECK(a != std::string::npos && a < p && p < b && b != std::string::npos);
+
+    parts.clear();
+    parts.push_back("GET /a HTTP/1.1\r\n\r\nGET /slow HTTP/1.1\r\n\r\n"
+                    "GET /c HTTP/1.1\r\nConnection: close\r\n\r\n");
+    resp = exchange(parts, kSharedStackPort);
+    CHECK(count(resp, "HTTP/1.1 200 OK") == 3);
+    a = resp.find("get:/a");
+    size_t slow = resp.find("get:/slow");
+    size_t c = resp.find("get:/c");
+    CHECK(a != std::string::npos && a < slow && slow < c && c != std::string::npos);
+    server->stop();
+}
+
+int main(int argc, char const* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    pico::IOManager iom(2, false, "pipeline");
+    pico::HttpServer::Ptr server(new pico::HttpServer(true, &iom, &iom));
+    server->getRequestHandler()->addRoute("/*", std::make_shared<EchoServlet>());
+    iom.schedule([server]() {
+        pico::Address::Ptr addr = pico::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(kPort));
+        if (!server->bind(addr)) {
+            LOG_ERROR("bind error, errno=%d, %s", errno, strerror(errno));
+            return;
+        }
+        server->start();
+    });
+    usleep(100 * 1000);
+
+    test_pipeline(server);
+    test_malformed(server);
+    test_ambiguous_body(server);
+    test_write_failure(server);
+    test_parallel_exception(server);
+    test_shared_stack(&iom);
+
+    server->stop();
+    iom.stop();
+    return TEST_RESULT("test_http_pipeline");
+}
@@ -0,0 +1,167 @@
+#include "pico/http/http.h"
+#include "pico/http/http_server.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+static bool contains(const std::string& str, const std::string& sub) {
+    return str.find(sub) != std::string::npos;
+}
+
+static std::string head(pico::HttpStatus status, const std::string& body, bool close) {
+    pico::HttpResponse resp("HTTP/1.1", close);
+    resp.set_status(status);
+    resp.set_body(body);
+    std::string out;
+    resp.serialize_head(out);
+    return out;
+}
+
+/**
+ * 状态行和响应头的序列化
+ */
+void test_serialize() {
+    pico::HttpResponse resp;
+    resp.set_header("Content-Type", "text/plain");
+    resp.set_body("hello world");
+    std::string str = resp.to_string();
+    CHECK(str.compare(0, 17, "HTTP/1.1 200 OK\r\n") == 0);
+    CHECK(contains(str, "Content-Type: text/plain\r\n"));
+    CHECK(contains(str, "connection: keep-alive\r\n"));
+    CHECK(contains(str, "content-length: 11\r\n"));
+    CHECK(str.size() > 15 && str.compare(str.size() - 15, 15, "\r\n\r\nhello world") == 0);
+
+    // serialize_head追加到已有内容之后, 不包含响应体
+    std::string out = "prefix";
+    resp.serialize_head(out);
+    CHECK(out.compare(0, 6, "prefix") == 0);
+    CHECK(out.substr(6) + "hello world" == str);
+
+    // 非HTTP/1.1或自定义原因短语时逐段拼接状态行
+    pico::HttpResponse old("HTTP/1.0", true);
+    old.set_status(pico::HttpStatus::NOT_FOUND);
+    CHECK(old.to_string().compare(0, 24, "HTTP/1.0 404 Not Found\r\n") == 0);
+    old.set_reason("Gone Fishing");
+    CHECK(old.to_string().compare(0, 27, "HTTP/1.0 404 Gone Fishing\r\n") == 0);
+
+    // 显式设置的长度不重复输出
+    pico::HttpResponse explicit_length;
+    explicit_length.set_header("Content-Length", "11");
+    explicit_length.set_body("hello world");
+    str = explicit_length.to_string();
+    CHECK(contains(str, "Content-Length: 11\r\n"));
+    CHECK(!contains(str, "content-length"));
+}
+
+/**
+ * 保持连接时空响应体写出长度0, 1xx/204/304不带长度
+ */
+void test_content_length() {
+    CHECK(contains(head(pico::HttpStatus::OK, "", false), "content-length: 0\r\n"));
+    CHECK(!contains(head(pico::HttpStatus::OK, "", true), "content-length"));
+    CHECK(contains(head(pico::HttpStatus::OK, "abc", true), "content-length: 3\r\n"));
+    CHECK(!contains(head(pico::HttpStatus::NO_CONTENT, "", false), "content-length"));
+    CHECK(!contains(head(pico::HttpStatus::NOT_MODIFIED, "", false), "content-length"));
+    CHECK(!contains(head(pico::HttpStatus::CONTINUE, "", false), "content-length"));
+    CHECK(contains(head(pico::HttpStatus::NOT_FOUND, "", false), "content-length: 0\r\n"));
+}
+
+static std::string http_date(time_t t) {
+    char buf[64];
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+/**
+ * Date的格式, 以及由服务器定时器驱动时使用缓存的时间
+ */
+void test_date() {
+    time_t before = time(nullptr);
+    std::string now = pico::HttpDateClock::Now().to_string();
+    time_t after = time(nullptr);
+    CHECK(now.size() == 29);
+    CHECK(now == http_date(before) || now == http_date(after));
+
+    pico::HttpDateClock::Acquire();
+    before = time(nullptr);
+    now = pico::HttpDateClock::Now().to_string();
+    after = time(nullptr);
+    CHECK(now == http_date(before) || now == http_date(after));
+    pico::HttpDateClock::Release();
+}
+
+/**
+ * 固定响应头整段输出, 响应自己设置的同名头优先
+ */
+void test_header_block() {
+    pico::HttpHeaderBlock::HeaderList headers;
+    headers.push_back(std::make_pair("Server", "srv/1"));
+    headers.push_back(std::make_pair("X-Fixed", "1"));
+    pico::HttpHeaderBlock::Ptr block(new pico::HttpHeaderBlock(headers));
+
+    pico::HttpResponse resp;
+    resp.set_header_block(block);
+    std::string str = resp.to_string();
+    CHECK(contains(str, "\r\nServer: srv/1\r\nX-Fixed: 1\r\n"));
+    size_t date = str.find("\r\nDate: ");
+    CHECK(date != std::string::npos && str.compare(date + 33, 6, " GMT\r\n") == 0);
+
+    resp.set_header("server", "custom");
+    resp.set_header("Date", "Thu, 01 Jan 1970 00:00:00 GMT");
+    str = resp.to_string();
+    CHECK(contains(str, "server: custom\r\n"));
+    CHECK(!contains(str, "srv/1"));
+    CHECK(contains(str, "X-Fixed: 1\r\n"));
+    CHECK(str.find("Date: ") == str.rfind("Date: "));
+    CHECK(contains(str, "Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n"));
+
+    pico::HttpResponse no_date;
+    no_date.set_header_block(pico::HttpHeaderBlock::Ptr(new pico::HttpHeaderBlock(headers, false)));
+    str = no_date.to_string();
+    CHECK(contains(str, "Server: srv/1\r\n"));
+    CHECK(!contains(str, "Date: "));
+}
+
+/**
+ * 没有调用stop就销毁的服务器也会取消Date定时器, 否则IOManager无法退出
+ */
+void test_server_destroyed() {
+    std::atomic<bool> stopped = {false};
+    std::thread watchdog([&]() {
+        uint64_t start = pico::getCurrentTime();
+        while (!stopped && pico::getCurrentTime() - start < 5000) { usleep(10 * 1000); }
+        if (!stopped) {
+            LOG_ERROR("iomanager did not stop after the http server was destroyed");
+            fflush(stdout);
+            _exit(1);
+        }
+    });
+    pico::IOManager iom(1, false, "date");
+    {
+        pico::HttpServer::Ptr server(new pico::HttpServer(true, &iom, &iom));
+        CHECK(server->start());
+    }
+    iom.stop();
+    stopped = true;
+    watchdog.join();
+}
+
+int main(int argc, char const* argv[]) {
+    test_serialize();
+    test_content_length();
+    test_date();
+    test_header_block();
+    test_server_destroyed();
+    return TEST_RESULT("test_http_response");
+}
@@ -0,0 +1,171 @@
+#include "pico/http/http.h"
+#include "pico/http/http_parser.h"
+#include "pico/http/http_view.h"
+#include "pico/logging.h"
+#include "test_check.h"
+
+#include <string>
+
+typedef pico::HttpRequestView View;
+
+static std::string header(const View& view, View::KnownHeader id) {
+    pico::StringView value;
+    return view.getHeader(id, &value) ? value.to_string() : "<none>";
+}
+
+static std::string header(const View& view, const std::string& name) {
+    pico::StringView value;
+    return view.getHeader(name, &value) ? value.to_string() : "<none>";
+}
+
+/**
+ * 常用请求头按槽位定位, 名字大小写不敏感, 其余请求头按名字查找
+ */
+void test_known_slots() {
+    pico::HttpRequestParser::Ptr parser(new pico::HttpRequestParser);
+    std::string req = "POST /upload?x=1 HTTP/1.1\r\n"
+                      "host: example.com\r\n"
+                      "X-Trace: abc\r\n"
+                      "CONTENT-LENGTH: 4\r\n"
+                      "Cookie: a=1\r\n"
+                      "\r\n";
+    parser->parse(&req[0], req.size());
+    CHECK(parser->isFinished() && !parser->hasError());
+    const View& view = parser->getRequest()->view();
+
+    CHECK(view.path() == "/upload");
+    CHECK(view.query() == "x=1");
+    CHECK(view.headerCount() == 4);
+    CHECK(header(view, View::HOST) == "example.com");
+    CHECK(header(view, View::CONTENT_LENGTH) == "4");
+    CHECK(header(view, View::COOKIE) == "a=1");
+    CHECK(header(view, View::ORIGIN) == "<none>");
+    CHECK(header(view, "Content-Length") == "4");
+    CHECK(header(view, "x-trace") == "abc");
+    CHECK(header(view, "X-Missing") == "<none>");
+    CHECK(parser->getRequest()->get_header("Host") == "example.com");
+    CHECK(View::LookupKnown("sec-websocket-key", View::HashName("sec-websocket-key")) ==
+          View::SEC_WEBSOCKET_KEY);
+    CHECK(View::LookupKnown("X-Trace", View::HashName("X-Trace")) == View::UNKNOWN_HEADER);
+}
+
+/**
+ * 删除请求头后其后的请求头前移, 常用请求头的槽位随之更新
+ */
+void test_del_reindex() {
+    View view;
+    view.setHeader("Host", "a");
+    view.setHeader("X-One", "1");
+    view.setHeader("Content-Type", "text/plain");
+    view.setHeader("Accept", "*/*");
+
+    CHECK(view.delHeader("host"));
+    CHECK(!view.delHeader("Host"));
+    CHECK(view.headerCount() == 3);
+    CHECK(header(view, View::HOST) == "<none>");
+    CHECK(header(view, View::CONTENT_TYPE) == "text/plain");
+    CHECK(header(view, View::ACCEPT) == "*/*");
+    CHECK(view.headerName(0) == "X-One");
+
+    CHECK(view.delHeader("X-One"));
+    CHECK(header(view, View::CONTENT_TYPE) == "text/plain");
+    CHECK(header(view, View::ACCEPT) == "*/*");
+    CHECK(view.headerName(0) == "Content-Type");
+
+    // 删除后重新设置, 追加在末尾
+    view.setHeader("Host", "b");
+    CHECK(view.headerCount() == 3);
+    CHECK(view.headerName(2) == "Host");
+    CHECK(header(view, View::HOST) == "b");
+}
+
+/**
+ * 名字或值位于请求自己的缓冲区中, 追加数据使缓冲区重新分配后仍然正确
+ */
+void test_set_realloc() {
+    View view;
+    const std::string raw = "X-Name: value\r\nAccept: text/html\r\n";
+    char* p = view.load(raw.data(), raw.size());
+    view.setHeader(pico::StringView(p, 6), pico::StringView(p + 8, 5));
+    view.setHeader(pico::StringView(p + 15, 6), pico::StringView(p + 23, 9));
+    CHECK(header(view, "X-Name") == "value");
+    CHECK(header(view, View::ACCEPT) == "text/html");
+
+    // 名字在缓冲区中, 值需要追加, 追加会使缓冲区重新分配, 之前取得的视图随之失效
+    std::string big(64 * 1024, 'v');
+    view.setHeader(pico::StringView(p + 15, 6), big);
+    CHECK(header(view, View::ACCEPT) == big);
+    CHECK(header(view, "X-Name") == "value");
+
+    // 新的请求头, 名字是已有名字的一部分
+    pico::StringView x_name = view.headerName(0);
+    view.setHeader(pico::StringView(x_name.data() + 2, 4), big + "w");
+    CHECK(view.headerCount() == 3);
+    CHECK(view.headerName(2) == "Name");
+    CHECK(header(view, "name") == big + "w");
+
+    // 值是已有请求头的视图, 不会再复制一次
+    pico::StringView accept;
+    view.getHeader(View::ACCEPT, &accept);
+    view.setHeader("X-Copy", accept);
+    CHECK(header(view, "X-Copy") == big);
+    CHECK(header(view, "X-Name") == "value");
+}
+
+/**
+ * 替换已有字段时尽量复用原来的空间, 其他字段引用的数据不会被覆盖
+ */
+void test_reuse() {
+    View view;
+    view.setPath("/first/path");
+    view.setHeader("X-One", "value-one");
+    view.setHeader("X-Two", "value-two");
+
+    // 不长于旧值时原地覆盖
+    const char* one = view.headerValue(0).data();
+    view.setHeader("X-One", "short");
+    CHECK(view.headerValue(0).data() == one);
+    CHECK(header(view, "X-One") == "short");
+    view.setPath("/p");
+    CHECK(view.path() == "/p");
+    CHECK(header(view, "X-Two") == "value-two");
+
+    // 末尾的值变长时截掉旧值再追加, 反复设置不会增长
+    ptrdiff_t two = view.headerValue(1).data() - view.headerName(0).data();
+    for (int i = 0; i < 100; ++i) {
+        view.setHeader("X-Two", std::string(10 + i, 'x'));
+        CHECK(view.headerValue(1).data() - view.headerName(0).data() == two);
+    }
+    CHECK(header(view, "X-Two") == std::string(109, 'x'));
+
+    // 共享的值不能原地覆盖
+    pico::StringView one_value = view.headerValue(0);
+    view.setHeader("X-Copy", one_value);
+    CHECK(view.headerValue(2).data() == view.headerValue(0).data());
+    view.setHeader("X-Copy", "c");
+    CHECK(header(view, "X-Copy") == "c");
+    CHECK(header(view, "X-One") == "short");
+
+    // 解析得到的请求, 替换后其他字段不受影响
+    pico::HttpRequestParser::Ptr parser(new pico::HttpRequestParser);
+    std::string req = "GET /index HTTP/1.1\r\nHost: example.com\r\nX-Trace: abcdef\r\n\r\n";
+    parser->parse(&req[0], req.size());
+    View& parsed = parser->getRequest()->view();
+    const char* trace = parsed.headerValue(1).data();
+    parsed.setHeader("X-Trace", "xyz");
+    parsed.setHeader("Host", "a.com");
+    parsed.setPath("/i");
+    CHECK(parsed.headerValue(1).data() == trace);
+    CHECK(header(parsed, "X-Trace") == "xyz");
+    CHECK(header(parsed, View::HOST) == "a.com");
+    CHECK(parsed.path() == "/i");
+    CHECK(parsed.version() == "HTTP/1.1");
+}
+
+int main(int argc, char const* argv[]) {
+    test_known_slots();
+    test_del_reindex();
+    test_set_realloc();
+    test_reuse();
+    return TEST_RESULT("test_http_view");
+}
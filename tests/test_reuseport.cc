@@ -0,0 +1,112 @@
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/tcp_server.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int kPort = 18173;
+
+/**
+ * 记录连接是否在accept所在的线程上开始处理
+ */
+class ThreadServer : public pico::TcpServer
+{
+public:
+    typedef std::shared_ptr<ThreadServer> Ptr;
+    ThreadServer(pico::IOManager* worker, pico::IOManager* acceptor)
+        : TcpServer(worker, acceptor) {}
+
+    std::atomic<int> moved = {0};
+
+protected:
+    void startAccept(pico::Socket::Ptr& sock) override {
+        m_acceptThread = pico::getThreadId();
+        TcpServer::startAccept(sock);
+    }
+
+    void handleClient(pico::Socket::Ptr& client) override {
+        if (pico::getThreadId() != m_acceptThread) { ++moved; }
+        // 处理时不让出, 连接在accept线程的队列中堆积, 空闲线程有机会窃取
+        uint64_t start = pico::getCurrentTime();
+        while (pico::getCurrentTime() - start < 2) {}
+        client->send("ok", 2);
+        client->close();
+    }
+
+private:
+    std::atomic<int> m_acceptThread = {-1};
+};
+
+static bool start_server(pico::IOManager& iom, ThreadServer::Ptr server) {
+    std::atomic<int> state = {0};
+    iom.schedule([server, &state]() {
+        pico::Address::Ptr addr =
+            pico::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(kPort));
+        state = server->bind(addr) && server->start() ? 1 : 2;
+    });
+    while (!state) { usleep(1000); }
+    return state == 1;
+}
+
+/**
+ * 在普通线程中并发建立连接, 返回收到响应的连接数
+ */
+static int run_clients(int threads, int per_thread) {
+    std::atomic<int> ok = {0};
+    std::vector<std::thread> clients;
+    for (int i = 0; i < threads; ++i) {
+        clients.push_back(std::thread([per_thread, &ok]() {
+            for (int j = 0; j < per_thread; ++j) {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(kPort);
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                struct timeval tv = {2, 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                char buf[4];
+                if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0 && recv(fd, buf, 4, 0) == 2) {
+                    ++ok;
+                }
+                close(fd);
+            }
+        }));
+    }
+    for (auto& t : clients) { t.join(); }
+    return ok;
+}
+
+int main(int argc, char const* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    pico::IOManager iom(3, false, "reuseport");
+    ThreadServer::Ptr server(new ThreadServer(&iom, &iom));
+    server->setReuseportListeners(1);
+
+    CHECK(start_server(iom, server));
+    CHECK(run_clients(4, 50) == 200);
+    CHECK(server->moved == 0);
+
+    // stop之后可以重新绑定并启动, 已关闭的监听socket不会留在服务器中
+    server->stop();
+    usleep(100 * 1000);
+    CHECK(start_server(iom, server));
+    CHECK(run_clients(2, 10) == 20);
+
+    server->stop();
+    usleep(100 * 1000);
+    iom.stop();
+    return TEST_RESULT("test_reuseport");
+}
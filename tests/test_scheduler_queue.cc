@@ -0,0 +1,195 @@
+#include "pico/config.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+static void busy_wait(uint64_t ms) {
+    uint64_t start = pico::getCurrentTime();
+    while (pico::getCurrentTime() - start < ms) {}
+}
+
+/**
+ * 线程忙于执行任务时, 其本地队列中的任务被空闲线程窃取
+ */
+void test_steal() {
+    const int n = 8;
+    pico::IOManager iom(4, false, "steal");
+    usleep(100 * 1000);
+
+    std::atomic<int> owner = {-1};
+    std::atomic<int> done = {0};
+    std::atomic<int> on_owner = {0};
+    std::atomic<int> done_before_owner = {-1};
+    iom.schedule([&]() {
+        owner = pico::getThreadId();
+        for (int i = 0; i < n; ++i) {
+            // 在调度线程上投递, 进入本线程的本地队列
+            pico::IOManager::GetThis()->schedule([&]() {
+                if (pico::getThreadId() == owner) { ++on_owner; }
+                busy_wait(20);
+                ++done;
+            });
+        }
+        // 不让出, 本地队列中的任务只能被其他线程窃取
+        busy_wait(1000);
+        done_before_owner = done.load();
+    });
+    iom.stop();
+
+    CHECK(done == n);
+    CHECK(done_before_owner == n);
+    CHECK(on_owner == 0);
+}
+
+/**
+ * 本地队列一直不空时, 仍然每隔若干个任务检查一次全局队列
+ */
+void test_global_interval() {
+    const int limit = 1000000;
+    pico::IOManager iom(1, false, "global");
+
+    std::atomic<int> count = {0};
+    std::atomic<int> ran_at = {-1};
+    std::function<void()> chain;
+    chain = [&]() {
+        // 每个任务在本线程上投递下一个任务, 本地队列始终不空
+        if (++count < limit && ran_at == -1) { pico::IOManager::GetThis()->schedule(chain); }
+    };
+    iom.schedule(chain);
+    while (count < 1000) { usleep(100); }
+
+    // 外部线程投递的任务进入全局队列
+    int scheduled_at = count;
+    iom.schedule([&]() { ran_at = count.load(); });
+    iom.stop();
+
+    CHECK(ran_at != -1);
+    CHECK(ran_at - scheduled_at < limit / 10);
+    CHECK(count < limit);
+}
+
+/**
+ * 指定线程的任务只在该线程上执行, 该线程忙碌时其他空闲线程不会取走
+ */
+void test_pinned_busy() {
+    pico::IOManager iom(4, false, "pinned");
+    usleep(100 * 1000);
+    const std::vector<int>& ids = iom.getThreadIds();
+    const int target = ids[0];
+
+    std::atomic<uint64_t> busy_end = {0};
+    std::atomic<int> started = {0};
+    iom.schedule(
+        [&]() {
+            ++started;
+            busy_wait(300);
+            busy_end = pico::getCurrentTime();
+        },
+        target);
+    while (!started) { usleep(100); }
+
+    const int n = 20;
+    std::atomic<int> wrong = {0};
+    std::atomic<int> early = {0};
+    std::atomic<int> done = {0};
+    for (int i = 0; i < n; ++i) {
+        iom.schedule(
+            [&]() {
+                if (pico::getThreadId() != target) { ++wrong; }
+                if (busy_end == 0) { ++early; }
+                ++done;
+            },
+            target);
+    }
+    // 其余线程上的任务不受影响
+    std::atomic<int> others = {0};
+    for (size_t i = 1; i < ids.size(); ++i) {
+        iom.schedule([&]() { ++others; }, ids[i]);
+    }
+    usleep(100 * 1000);
+    CHECK(others == (int)ids.size() - 1);
+    CHECK(done == 0);
+    iom.stop();
+
+    CHECK(done == n);
+    CHECK(wrong == 0);
+    CHECK(early == 0);
+}
+
+/**
+ * 协程在线程之间反复迁移, 投递到目标线程时可能尚未在原线程上切出, 目标线程稍后重试
+ */
+void test_pinned_hop() {
+    const int fibers = 8;
+    const int rounds = 500;
+    pico::IOManager iom(4, false, "hop");
+    usleep(100 * 1000);
+    std::vector<int> ids = iom.getThreadIds();
+
+    std::atomic<int> hops = {0};
+    std::atomic<int> wrong = {0};
+    for (int i = 0; i < fibers; ++i) {
+        iom.schedule([&, i]() {
+            for (int r = 0; r < rounds; ++r) {
+                int target = ids[(i + r) % ids.size()];
+                iom.switchTo(target);
+                if (pico::getThreadId() != target) { ++wrong; }
+                ++hops;
+            }
+        });
+    }
+    iom.stop();
+
+    CHECK(hops == fibers * rounds);
+    CHECK(wrong == 0);
+}
+
+/**
+ * 定向唤醒使用配置的信号, 空闲线程及时执行投递给它的任务; 调度线程退出后恢复原来的信号掩码
+ */
+void test_wakeup_signal() {
+    const int signo = SIGRTMIN + 6;
+    sigset_t before;
+    pthread_sigmask(SIG_BLOCK, nullptr, &before);
+    CHECK(!sigismember(&before, signo));
+    {
+        pico::IOManager iom(2, true, "signal");
+        struct sigaction sa;
+        sigaction(signo, nullptr, &sa);
+        CHECK(sa.sa_handler != SIG_DFL);
+        sigaction(SIGRTMIN + 4, nullptr, &sa);
+        CHECK(sa.sa_handler == SIG_DFL);
+
+        // 等待工作线程进入idle
+        usleep(100 * 1000);
+        const int target = iom.getThreadIds().back();
+        std::atomic<uint64_t> ran = {0};
+        uint64_t start = pico::getCurrentTime();
+        iom.schedule([&]() { ran = pico::getCurrentTime(); }, target);
+        while (!ran && pico::getCurrentTime() - start < 2000) { usleep(1000); }
+        CHECK(ran && ran - start < 500);
+        iom.stop();
+    }
+    sigset_t after;
+    pthread_sigmask(SIG_BLOCK, nullptr, &after);
+    CHECK(!sigismember(&after, signo));
+}
+
+int main(int argc, char const* argv[]) {
+    // 唤醒信号在第一个IOManager创建时确定
+    pico::Config::Lookup<int32_t>("iomanager.wakeup_signal", 4)->setValue(6);
+    test_wakeup_signal();
+    test_steal();
+    test_global_interval();
+    test_pinned_busy();
+    test_pinned_hop();
+    return TEST_RESULT("test_scheduler_queue");
+}
@@ -0,0 +1,212 @@
+#include "pico/hook.h"
+#include "pico/iomanager.h"
+#include "pico/log/LogAppender.h"
+#include "pico/logging.h"
+#include "pico/tcp_server.h"
+#include "test_check.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int kPort = 18174;
+
+static int get_int_opt(int fd, int level, int name) {
+    int value = -1;
+    socklen_t len = sizeof(value);
+    getsockopt(fd, level, name, &value, &len);
+    return value;
+}
+
+/**
+ * 检查监听socket和接受的连接上的选项, 然后回显
+ */
+class OptionServer : public pico::TcpServer
+{
+public:
+    typedef std::shared_ptr<OptionServer> Ptr;
+    OptionServer(pico::IOManager* worker, pico::IOManager* acceptor)
+        : TcpServer(worker, acceptor) {}
+
+    std::atomic<int> listenerChecked = {0};
+
+protected:
+    void startAccept(pico::Socket::Ptr& sock) override {
+        int fd = sock->getSocket();
+        CHECK(get_int_opt(fd, SOL_SOCKET, SO_RCVBUF) >= 65536);
+        CHECK(get_int_opt(fd, IPPROTO_TCP, TCP_KEEPIDLE) == 33);
+        CHECK(get_int_opt(fd, IPPROTO_TCP, TCP_KEEPCNT) == 4);
+        CHECK(get_int_opt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT) > 0);
+        ++listenerChecked;
+        TcpServer::startAccept(sock);
+    }
+
+    void handleClient(pico::Socket::Ptr& client) override {
+        int fd = client->getSocket();
+        // 接受的连接继承监听socket的选项
+        CHECK(get_int_opt(fd, IPPROTO_TCP, TCP_NODELAY) == 1);
+        CHECK(get_int_opt(fd, IPPROTO_TCP, TCP_KEEPIDLE) == 33);
+        CHECK(fcntl_f(fd, F_GETFD) & FD_CLOEXEC);
+        // 内核中是非阻塞的, 用户看到的仍是阻塞的
+        CHECK(fcntl_f(fd, F_GETFL) & O_NONBLOCK);
+        CHECK(!(fcntl(fd, F_GETFL) & O_NONBLOCK));
+        char buf[16];
+        int n = client->recv(buf, sizeof(buf));
+        if (n > 0) { client->send(buf, n); }
+        client->close();
+    }
+};
+
+/**
+ * 配置的解析和序列化
+ */
+void test_lexical_cast() {
+    std::string yml = "addresses: [\"127.0.0.1:18174\"]\n"
+                      "tcp:\n"
+                      "  backlog: 77\n"
+                      "  rcvbuf: 65536\n"
+                      "  keepalive_idle: 33\n"
+                      "  keepalive_count: 4\n"
+                      "  defer_accept: 2\n"
+                      "  quickack: true\n"
+                      "  accept_batch: 4\n";
+    pico::TcpServerOptions opts = pico::LexicalCast<std::string, pico::TcpServerOptions>()(yml);
+    CHECK(opts.tcp.backlog == 77);
+    CHECK(opts.tcp.rcvbuf == 65536);
+    CHECK(opts.tcp.nodelay);
+    CHECK(opts.tcp.accept_batch == 4);
+    CHECK(opts.tcp.sndbuf == 0);
+
+    std::string str = pico::LexicalCast<pico::TcpServerOptions, std::string>()(opts);
+    pico::TcpServerOptions round = pico::LexicalCast<std::string, pico::TcpServerOptions>()(str);
+    CHECK(round.tcp.backlog == 77);
+    CHECK(round.tcp.keepalive_idle == 33);
+    CHECK(round.tcp.keepalive_count == 4);
+    CHECK(round.tcp.defer_accept == 2);
+    CHECK(round.tcp.quickack);
+    CHECK(round.tcp.accept_batch == 4);
+}
+
+static int run_clients(int threads, int per_thread) {
+    std::atomic<int> ok = {0};
+    std::vector<std::thread> clients;
+    for (int i = 0; i < threads; ++i) {
+        clients.push_back(std::thread([per_thread, &ok]() {
+            for (int j = 0; j < per_thread; ++j) {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(kPort);
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                struct timeval tv = {3, 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                char buf[4];
+                if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0 && send(fd, "hi", 2, 0) == 2 &&
+                    recv(fd, buf, 4, 0) == 2) {
+                    ++ok;
+                }
+                close(fd);
+            }
+        }));
+    }
+    for (auto& t : clients) { t.join(); }
+    return ok;
+}
+
+/**
+ * 选项设置到监听socket上, 批量accept时所有连接都得到处理
+ */
+void test_server_options() {
+    pico::TcpSocketOptions opts;
+    opts.backlog = 77;
+    opts.rcvbuf = 65536;
+    opts.keepalive_idle = 33;
+    opts.keepalive_count = 4;
+    opts.defer_accept = 2;
+    opts.quickack = true;
+    opts.accept_batch = 4;
+
+    pico::IOManager iom(2, false, "options");
+    OptionServer::Ptr server(new OptionServer(&iom, &iom));
+    server->setSocketOptions(opts);
+    std::atomic<int> state = {0};
+    iom.schedule([server, &state]() {
+        pico::Address::Ptr addr =
+            pico::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(kPort));
+        state = server->bind(addr) && server->start() ? 1 : 2;
+    });
+    while (!state) { usleep(1000); }
+    CHECK(state == 1);
+
+    CHECK(run_clients(4, 25) == 100);
+    CHECK(server->listenerChecked == 1);
+
+    server->stop();
+    usleep(100 * 1000);
+    iom.stop();
+}
+
+/**
+ * 记录WARN级别的日志内容
+ */
+class CaptureAppender : public pico::LogAppender
+{
+public:
+    void log(std::shared_ptr<pico::Logger> logger, pico::LogEvent::Ptr event) override {
+        if (event->getLevel() != pico::LogLevel::WARN) { return; }
+        MutexType::Lock lock(m_mutex);
+        messages += event->getMessage() + "\n";
+    }
+
+    std::string messages;
+};
+
+/**
+ * 内核拒绝的选项记录警告, 不影响其他选项和监听
+ */
+void test_option_failures() {
+    pico::TcpSocketOptions opts;
+    opts.keepalive_idle = 33;
+    opts.keepalive_interval = 40000;   // 超过32767
+    opts.keepalive_count = 1000;       // 超过127
+
+    std::shared_ptr<CaptureAppender> appender(new CaptureAppender);
+    ROOT_LOGGER()->addAppender(appender);
+    pico::IOManager iom(1, false, "failures");
+    pico::TcpServer::Ptr server(new pico::TcpServer(&iom, &iom));
+    server->setSocketOptions(opts);
+    std::atomic<int> state = {0};
+    iom.schedule([server, &state]() {
+        pico::Address::Ptr addr =
+            pico::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(kPort));
+        state = server->bind(addr) ? 1 : 2;
+    });
+    while (!state) { usleep(1000); }
+    server->stop();
+    iom.stop();
+    ROOT_LOGGER()->removeAppender(appender);
+
+    CHECK(state == 1);
+    CHECK(appender->messages.find("set TCP_KEEPINTVL failed") != std::string::npos);
+    CHECK(appender->messages.find("set TCP_KEEPCNT failed") != std::string::npos);
+    CHECK(appender->messages.find("set TCP_KEEPIDLE failed") == std::string::npos);
+}
+
+int main(int argc, char const* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+    test_lexical_cast();
+    test_server_options();
+    test_option_failures();
+    return TEST_RESULT("test_tcp_options");
+}
@@ -0,0 +1,163 @@
+#include "pico/logging.h"
+#include "pico/timer.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/// 不为0时作为当前时间, 让时间轮在测试中瞬间推进到上层的槽位
+static std::atomic<uint64_t> s_fake_now = {0};
+
+/**
+ * 覆盖libstdc++中的实现, 定时器通过getCurrentTime从这里读取当前时间
+ */
+std::chrono::system_clock::time_point std::chrono::system_clock::now() noexcept {
+    uint64_t ms = s_fake_now;
+    if (!ms) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return time_point(duration(std::chrono::seconds(ts.tv_sec) +
+                                   std::chrono::nanoseconds(ts.tv_nsec)));
+    }
+    return time_point(std::chrono::milliseconds(ms));
+}
+
+class Manager : public pico::TimerManager
+{
+public:
+    /**
+     * @brief 推进到now并执行到期的回调
+     */
+    void advance(uint64_t now) {
+        s_fake_now = now;
+        std::vector<Callback> cbs;
+        listExpiredCb(cbs);
+        for (auto& cb : cbs) { cb(); }
+    }
+
+protected:
+    void onTimerInsertAtFront() override {}
+};
+
+/**
+ * 各层的定时器逐层下放, 恰好在到期时刻触发, 不会提前
+ */
+void test_cascade() {
+    const uint64_t start = 1000000000000ull;
+    s_fake_now = start;
+    Manager mgr;
+
+    // 分别落在第0层, 第1层, 第2层, 第3层, 第4层以及层的边界上
+    const uint64_t delays[] = {1,         255,        256,        300,       16383,
+                               16384,     20000,      1ull << 20, 1ull << 21, (1ull << 26) + 7,
+                               1ull << 27, (1ull << 31) + 5};
+    const size_t n = sizeof(delays) / sizeof(delays[0]);
+    std::vector<int> fired(n, 0);
+    std::vector<uint64_t> fired_at(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        mgr.addTimer(delays[i], [&, i]() {
+            ++fired[i];
+            fired_at[i] = s_fake_now;
+        });
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        mgr.advance(start + delays[i] - 1);
+        CHECK(fired[i] == 0);
+        mgr.advance(start + delays[i]);
+        CHECK(fired[i] == 1);
+        CHECK(fired_at[i] == start + delays[i]);
+    }
+    CHECK(!mgr.hasTimer());
+
+    // 随机的到期时间和推进步长
+    srand(7);
+    const int m = 2000;
+    uint64_t now = start + (1ull << 32);
+    mgr.advance(now);
+    std::vector<uint64_t> deadline(m);
+    std::vector<int> count(m, 0);
+    std::vector<int> early(m, 0);
+    for (int i = 0; i < m; ++i) {
+        uint64_t delay = 1 + (uint64_t)rand() % (1ull << (rand() % 23));
+        deadline[i] = now + delay;
+        mgr.addTimer(delay, [&, i]() {
+            ++count[i];
+            if (s_fake_now < deadline[i]) { ++early[i]; }
+        });
+    }
+    const uint64_t end = now + (1ull << 23);
+    while (mgr.hasTimer() && now < end) {
+        now += 1 + rand() % 5000;
+        mgr.advance(now);
+        for (int i = 0; i < m; ++i) {
+            if (deadline[i] <= now && count[i] != 1) {
+                CHECK(count[i] == 1);
+                count[i] = 1;
+            }
+        }
+    }
+    int total = 0;
+    int total_early = 0;
+    for (int i = 0; i < m; ++i) {
+        total += count[i];
+        total_early += early[i];
+    }
+    CHECK(total == m);
+    CHECK(total_early == 0);
+    s_fake_now = 0;
+}
+
+/**
+ * 到期前取消的定时器不会触发, 包括已经从上层下放到下层的定时器
+ */
+void test_cancel() {
+    const uint64_t start = 2000000000000ull;
+    s_fake_now = start;
+    Manager mgr;
+
+    std::atomic<int> fired = {0};
+    pico::Timer::Ptr near = mgr.addTimer(10, [&]() { ++fired; });
+    pico::Timer::Ptr level1 = mgr.addTimer(1000, [&]() { ++fired; });
+    pico::Timer::Ptr level2 = mgr.addTimer(100000, [&]() { ++fired; });
+    pico::Timer::Ptr moved = mgr.addTimer(600, [&]() { ++fired; });
+    pico::Timer::Ptr kept = mgr.addTimer(700, [&]() { ++fired; });
+
+    CHECK(near->cancel());
+    CHECK(!near->cancel());
+    CHECK(level1->cancel());
+    CHECK(level2->cancel());
+
+    // start按256ms对齐, 推进到599时moved已经从第1层下放到第0层
+    mgr.advance(start + 599);
+    CHECK(fired == 0);
+    CHECK(moved->cancel());
+
+    mgr.advance(start + 200000);
+    CHECK(fired == 1);
+    CHECK(!kept->cancel());
+    CHECK(!mgr.hasTimer());
+
+    // 重复定时器取消后不再重新加入
+    int repeats = 0;
+    pico::Timer::Ptr repeat = mgr.addTimer(300, [&]() { ++repeats; }, true);
+    mgr.advance(start + 200300);
+    mgr.advance(start + 200600);
+    CHECK(repeats == 2);
+    CHECK(repeat->cancel());
+    mgr.advance(start + 300000);
+    CHECK(repeats == 2);
+    CHECK(!mgr.hasTimer());
+    s_fake_now = 0;
+}
+
+int main(int argc, char const* argv[]) {
+    test_cascade();
+    test_cancel();
+    return TEST_RESULT("test_timer");
+}
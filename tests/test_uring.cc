@@ -0,0 +1,267 @@
+#include "pico/config.h"
+#include "pico/fdmanager.h"
+#include "pico/hook.h"
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+static const int kPort = 18176;
+static const size_t kBulk = 4 << 20;
+
+/**
+ * 在普通线程中等待条件成立, 超时返回false
+ */
+static bool wait_until(std::function<bool()> pred, uint64_t timeout_ms = 5000) {
+    uint64_t deadline = pico::getCurrentTime() + timeout_ms;
+    while (!pred()) {
+        if (pico::getCurrentTime() >= deadline) { return false; }
+        usleep(5 * 1000);
+    }
+    return true;
+}
+
+/**
+ * @return 内核没有io_uring, 或被seccomp、kernel.io_uring_disabled禁用时返回false
+ */
+static bool uring_supported() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, 4, &params);
+    if (fd < 0) { return errno != ENOSYS && errno != EPERM; }
+    close(fd);
+    return true;
+}
+
+/**
+ * hook的socket创建的socketpair, 登记后的recv/send走io_uring路径
+ */
+static bool make_pair(int sv[2]) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) { return false; }
+    pico::FdMgr::getInstance()->getFdCtx(sv[0], true);
+    pico::FdMgr::getInstance()->getFdCtx(sv[1], true);
+    return true;
+}
+
+/**
+ * accept/connect/recv/send都在返回EAGAIN后提交到ring, 大块发送在对端读取前挂起
+ */
+void test_socket(pico::IOManager& iom) {
+    static std::atomic<int> s_done = {0};
+    iom.schedule([]() {
+        int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(kPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CHECK(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+        CHECK(listen(listen_fd, 16) == 0);
+
+        pico::IOManager::GetThis()->schedule([]() {
+            // 等待服务端挂起在accept上
+            usleep(50 * 1000);
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(kPort);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            CHECK(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+            usleep(50 * 1000);
+            CHECK(send(fd, "ping", 4, 0) == 4);
+            char buf[4] = {0};
+            CHECK(recv(fd, buf, sizeof(buf), MSG_WAITALL) == 4 && memcmp(buf, "pong", 4) == 0);
+
+            std::string bulk(kBulk, 'x');
+            size_t sent = 0;
+            while (sent < bulk.size()) {
+                ssize_t n = send(fd, bulk.data() + sent, bulk.size() - sent, 0);
+                if (n <= 0) { break; }
+                sent += n;
+            }
+            CHECK(sent == kBulk);
+            close(fd);
+            ++s_done;
+        });
+
+        int fd = accept(listen_fd, nullptr, nullptr);
+        CHECK(fd >= 0);
+        char buf[4] = {0};
+        CHECK(recv(fd, buf, sizeof(buf), 0) == 4 && memcmp(buf, "ping", 4) == 0);
+        CHECK(send(fd, "pong", 4, 0) == 4);
+
+        // 对端的发送缓冲区先被填满, 稍后再读
+        usleep(100 * 1000);
+        size_t received = 0;
+        bool intact = true;
+        char chunk[64 * 1024];
+        ssize_t n = 0;
+        while ((n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+            for (ssize_t i = 0; i < n; ++i) {
+                if (chunk[i] != 'x') { intact = false; }
+            }
+            received += n;
+        }
+        CHECK(received == kBulk);
+        CHECK(intact);
+        close(fd);
+        close(listen_fd);
+        ++s_done;
+    });
+    CHECK(wait_until([]() { return s_done == 2; }));
+}
+
+/**
+ * SO_RCVTIMEO超时通过ASYNC_CANCEL取消请求, 之后同一fd上的请求不受影响
+ */
+void test_recv_timeout(pico::IOManager& iom) {
+    static std::atomic<bool> s_done = {false};
+    iom.schedule([]() {
+        int sv[2];
+        CHECK(make_pair(sv));
+        struct timeval tv = {0, 100 * 1000};
+        setsockopt(sv[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        char c = 0;
+        uint64_t start = pico::getCurrentTime();
+        CHECK(recv(sv[0], &c, 1, 0) == -1 && errno == ETIMEDOUT);
+        uint64_t elapsed = pico::getCurrentTime() - start;
+        CHECK(elapsed >= 100 && elapsed < 1000);
+
+        pico::IOManager::GetThis()->schedule([sv]() {
+            usleep(20 * 1000);
+            send(sv[1], "y", 1, 0);
+        });
+        CHECK(recv(sv[0], &c, 1, 0) == 1 && c == 'y');
+        close(sv[0]);
+        close(sv[1]);
+        s_done = true;
+    });
+    CHECK(wait_until([]() { return s_done.load(); }));
+}
+
+/**
+ * hook的close取消另一个协程挂起中的recv, 该recv返回EBADF
+ */
+void test_close_cancel(pico::IOManager& iom) {
+    static int s_sv[2];
+    static std::atomic<int> s_rt = {0};
+    static std::atomic<int> s_errno = {0};
+    static std::atomic<bool> s_done = {false};
+    CHECK(make_pair(s_sv));
+    iom.schedule([]() {
+        char c = 0;
+        s_rt = recv(s_sv[0], &c, 1, 0);
+        s_errno = errno;
+        s_done = true;
+    });
+    usleep(50 * 1000);
+    CHECK(!s_done);
+    iom.schedule([]() { close(s_sv[0]); });
+    CHECK(wait_until([]() { return s_done.load(); }, 1000));
+    CHECK(s_rt == -1 && s_errno == EBADF);
+    close(s_sv[1]);
+}
+
+/**
+ * 普通文件的pread/pwrite提交到ring, 按偏移读写
+ */
+void test_file_io(pico::IOManager& iom) {
+    static std::atomic<bool> s_done = {false};
+    iom.schedule([]() {
+        char path[] = "/tmp/pico_test_uring_XXXXXX";
+        int fd = mkstemp(path);
+        CHECK(fd >= 0);
+        unlink(path);
+        CHECK(pwrite(fd, "hello", 5, 0) == 5);
+        CHECK(pwrite(fd, "world", 5, 100) == 5);
+        char buf[5] = {0};
+        CHECK(pread(fd, buf, 5, 100) == 5 && memcmp(buf, "world", 5) == 0);
+        CHECK(pread(fd, buf, 5, 0) == 5 && memcmp(buf, "hello", 5) == 0);
+        CHECK(pread(fd, buf, 5, 200) == 0);
+        close(fd);
+        CHECK(pread(fd, buf, 5, 0) == -1 && errno == EBADF);
+        s_done = true;
+    });
+    CHECK(wait_until([]() { return s_done.load(); }));
+}
+
+/**
+ * 共享栈协程挂起后栈内容会被换出, 不能交给内核, 退回到等待就绪再重试
+ */
+void test_shared_stack(pico::IOManager& iom) {
+    static int s_sv[2];
+    static std::atomic<bool> s_done = {false};
+    CHECK(make_pair(s_sv));
+    pico::Fiber::Ptr fiber(new pico::Fiber(
+        []() {
+            char buf[1024];
+            memset(buf, 7, sizeof(buf));
+            char c = 0;
+            CHECK(recv(s_sv[0], &c, 1, 0) == 1 && c == 's');
+            bool intact = true;
+            for (size_t i = 0; i < sizeof(buf); ++i) {
+                if (buf[i] != 7) { intact = false; }
+            }
+            CHECK(intact);
+            s_done = true;
+        },
+        0,
+        false,
+        true));
+    iom.schedule(fiber);
+    // 其他共享栈协程在此期间使用共享栈
+    for (int i = 0; i < 4; ++i) {
+        iom.schedule(pico::Fiber::Ptr(new pico::Fiber(
+            []() {
+                char buf[2048];
+                memset(buf, 9, sizeof(buf));
+                usleep(10 * 1000);
+            },
+            0,
+            false,
+            true)));
+    }
+    usleep(50 * 1000);
+    CHECK(!s_done);
+    CHECK(write(s_sv[1], "s", 1) == 1);
+    CHECK(wait_until([]() { return s_done.load(); }));
+    close(s_sv[0]);
+    close(s_sv[1]);
+}
+
+int main(int argc, char const* argv[]) {
+    if (!uring_supported()) {
+        LOG_INFO("io_uring_setup failed, errno=%d, skip test_uring", errno);
+        return 0;
+    }
+    pico::Config::Lookup<std::string>("iomanager.backend", "epoll")->setValue("io_uring");
+    pico::IOManager iom(2, false, "uring");
+    CHECK(iom.isUring());
+    if (iom.isUring()) {
+        test_socket(iom);
+        test_recv_timeout(iom);
+        test_close_cancel(iom);
+        test_file_io(iom);
+        test_shared_stack(iom);
+    }
+    iom.stop();
+    return TEST_RESULT("test_uring");
+}
@@ -0,0 +1,118 @@
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/util.h"
+#include "test_check.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+static void busy_wait(uint64_t ms) {
+    uint64_t start = pico::getCurrentTime();
+    while (pico::getCurrentTime() - start < ms) {}
+}
+
+/**
+ * 等待任务执行, 返回从投递到执行的毫秒数, 超时返回~0ull
+ */
+static uint64_t schedule_and_wait(pico::IOManager& iom, int thread = -1) {
+    std::shared_ptr<std::atomic<uint64_t>> ran(new std::atomic<uint64_t>(0));
+    uint64_t start = pico::getCurrentTime();
+    iom.schedule([ran]() { *ran = pico::getCurrentTime(); }, thread);
+    while (!*ran && pico::getCurrentTime() - start < 5000) { usleep(100); }
+    return *ran ? *ran - start : ~0ull;
+}
+
+/**
+ * 合并在途的唤醒不会丢失唤醒, 线程在任意时刻入睡时外部投递的任务都能及时执行
+ */
+void test_no_lost_wakeup() {
+    pico::IOManager iom(4, false, "wake");
+    srand(11);
+    uint64_t worst = 0;
+    for (int i = 0; i < 300 && worst < 1000; ++i) {
+        usleep(rand() % 3000);
+        worst = std::max(worst, schedule_and_wait(iom));
+    }
+    const std::vector<int>& ids = iom.getThreadIds();
+    for (int i = 0; i < 100 && worst < 1000; ++i) {
+        usleep(rand() % 3000);
+        worst = std::max(worst, schedule_and_wait(iom, ids[i % ids.size()]));
+    }
+    iom.stop();
+    LOG_INFO("worst wakeup latency %lu ms", (unsigned long)worst);
+    // 丢失唤醒时要等到idle超时(3s)才执行
+    CHECK(worst < 1000);
+}
+
+/**
+ * 同一时间只有一次唤醒在途, 被唤醒的线程发现还有任务时依次唤醒其他线程
+ */
+void test_fanout() {
+    const int threads = 4;
+    pico::IOManager iom(threads, false, "fanout");
+    usleep(100 * 1000);
+
+    std::mutex mutex;
+    std::set<int> used;
+    std::atomic<int> done = {0};
+    uint64_t start = pico::getCurrentTime();
+    for (int i = 0; i < threads; ++i) {
+        iom.schedule([&]() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                used.insert(pico::getThreadId());
+            }
+            busy_wait(300);
+            ++done;
+        });
+    }
+    while (done < threads && pico::getCurrentTime() - start < 5000) { usleep(1000); }
+    uint64_t elapsed = pico::getCurrentTime() - start;
+    iom.stop();
+
+    CHECK(done == threads);
+    CHECK((int)used.size() == threads);
+    // 逐个执行需要1200ms
+    CHECK(elapsed < 900);
+}
+
+/**
+ * 多个外部线程同时大量投递, 所有任务都被执行
+ */
+void test_burst() {
+    const int producers = 4;
+    const int per_producer = 20000;
+    pico::IOManager iom(4, false, "burst");
+    std::atomic<int> done = {0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; ++i) {
+        threads.push_back(std::thread([&]() {
+            for (int j = 0; j < per_producer; ++j) {
+                iom.schedule([&]() { ++done; });
+                if (j % 1000 == 0) { usleep(rand() % 1000); }
+            }
+        }));
+    }
+    for (auto& t : threads) { t.join(); }
+    uint64_t start = pico::getCurrentTime();
+    while (done < producers * per_producer && pico::getCurrentTime() - start < 5000) {
+        usleep(1000);
+    }
+    CHECK(done == producers * per_producer);
+    iom.stop();
+}
+
+int main(int argc, char const* argv[]) {
+    test_no_lost_wakeup();
+    test_fanout();
+    test_burst();
+    return TEST_RESULT("test_wakeup");
+}
@@ -0,0 +1,164 @@
+#include "pico/iomanager.h"
+#include "pico/logging.h"
+#include "pico/worker.h"
+#include "test_check.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::vector<pico::IOManager::Ptr> Workers;
+
+/**
+ * 在worker上挂起count个等待管道可读的协程, 使其负载增加count
+ */
+class Load
+{
+public:
+    Load(pico::IOManager::Ptr worker, int count) {
+        for (int i = 0; i < count; ++i) {
+            int fds[2];
+            if (pipe(fds)) { continue; }
+            m_pipes.push_back(std::make_pair(fds[0], fds[1]));
+            worker->schedule([fds]() {
+                struct pollfd pfd = {fds[0], POLLIN, 0};
+                poll(&pfd, 1, 5000);
+            });
+        }
+        while (worker->getLoad() < (size_t)count) { usleep(1000); }
+        usleep(10 * 1000);
+    }
+
+    ~Load() {
+        for (auto& p : m_pipes) { write(p.second, "x", 1); }
+        usleep(50 * 1000);
+        for (auto& p : m_pipes) {
+            close(p.first);
+            close(p.second);
+        }
+    }
+
+private:
+    std::vector<std::pair<int, int>> m_pipes;
+};
+
+static std::vector<int> histogram(pico::WorkerSelector& selector, const Workers& workers,
+                                  int rounds) {
+    std::vector<int> hits(workers.size(), 0);
+    for (int i = 0; i < rounds; ++i) {
+        pico::IOManager::Ptr w = selector.select(workers);
+        for (size_t j = 0; j < workers.size(); ++j) {
+            if (workers[j] == w) { ++hits[j]; }
+        }
+    }
+    return hits;
+}
+
+/**
+ * 轮流选择严格按顺序, 多线程同时选择时仍然均匀
+ */
+void test_round_robin(const Workers& workers) {
+    pico::RoundRobinSelector selector;
+    for (int i = 0; i < 8; ++i) { CHECK(selector.select(workers) == workers[i % workers.size()]); }
+
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int>> hits(4);
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(
+            std::thread([&, t]() { hits[t] = histogram(selector, workers, 10000); }));
+    }
+    for (auto& t : threads) { t.join(); }
+    for (size_t j = 0; j < workers.size(); ++j) {
+        int total = 0;
+        for (auto& h : hits) { total += h[j]; }
+        CHECK(total == 40000 / (int)workers.size());
+    }
+}
+
+/**
+ * 随机选择大致均匀, 不受负载影响
+ */
+void test_random(const Workers& workers) {
+    pico::RandomSelector selector;
+    Load load(workers[0], 10);
+    const int rounds = 8000;
+    std::vector<int> hits = histogram(selector, workers, rounds);
+    int expected = rounds / workers.size();
+    for (int h : hits) { CHECK(h > expected * 3 / 4 && h < expected * 5 / 4); }
+}
+
+/**
+ * 总是选择负载最低的成员, 负载相同的成员之间轮流
+ */
+void test_least_loaded(const Workers& workers) {
+    pico::LeastLoadedSelector selector;
+    std::vector<int> hits = histogram(selector, workers, 400);
+    for (int h : hits) { CHECK(h == 100); }
+
+    Load load0(workers[0], 10);
+    Load load1(workers[1], 3);
+    hits = histogram(selector, workers, 400);
+    CHECK(hits[0] == 0);
+    CHECK(hits[1] == 0);
+    CHECK(hits[2] == 200 && hits[3] == 200);
+}
+
+/**
+ * 随机取两个不同的成员选负载低的, 负载最高的成员不会被选中,
+ * 次高的成员只在与最高的成员配对时被选中
+ */
+void test_power_of_two(const Workers& workers) {
+    pico::PowerOfTwoSelector selector;
+    Load load0(workers[0], 10);
+    Load load1(workers[1], 3);
+    const int rounds = 12000;
+    std::vector<int> hits = histogram(selector, workers, rounds);
+    CHECK(hits[0] == 0);
+    // 4个成员共6种配对, {0, 1}配对时选中1
+    CHECK(hits[1] > rounds / 6 * 3 / 4 && hits[1] < rounds / 6 * 5 / 4);
+    CHECK(hits[2] > rounds * 5 / 12 * 3 / 4 && hits[3] > rounds * 5 / 12 * 3 / 4);
+}
+
+/**
+ * 配置中按类名指定策略, 无效的类名退化为轮流选择
+ */
+void test_config() {
+    std::map<std::string, std::map<std::string, std::string>> conf;
+    conf["least"] = {{"worker_num", "3"}, {"selector", "LeastLoadedSelector"}};
+    conf["bogus"] = {{"worker_num", "3"}, {"selector", "NoSuchSelector"}};
+    conf["single"] = {{"worker_num", "1"}};
+    pico::WorkerManager wm;
+    wm.init(conf);
+
+    pico::WorkerGroup::Ptr least = wm.getGroup("least");
+    {
+        Load load(least->getWorkers()[0], 5);
+        for (int i = 0; i < 20; ++i) { CHECK(least->select() != least->getWorkers()[0]); }
+    }
+
+    pico::WorkerGroup::Ptr bogus = wm.getGroup("bogus");
+    for (int i = 0; i < 6; ++i) { CHECK(bogus->select() == bogus->getWorkers()[i % 3]); }
+
+    pico::WorkerGroup::Ptr single = wm.getGroup("single");
+    CHECK(single->select() == single->getWorkers()[0]);
+    CHECK(!wm.getGroup("missing"));
+    wm.stop();
+}
+
+int main(int argc, char const* argv[]) {
+    Workers workers;
+    for (int i = 0; i < 4; ++i) {
+        workers.push_back(pico::IOManager::Ptr(new pico::IOManager(1, false, "w" + std::to_string(i))));
+    }
+    test_round_robin(workers);
+    test_random(workers);
+    test_least_loaded(workers);
+    test_power_of_two(workers);
+    for (auto& w : workers) { w->stop(); }
+    test_config();
+    return TEST_RESULT("test_worker_selector");
+}